@@ -1331,6 +1331,7 @@ void RecordBootComplete() {
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.first_stage");
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.selinux");
   RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.cold_boot_wait");
+  RecordInitBootTimeProp(&boot_event_store, "ro.boottime.init.readahead");
 
   const BootloaderTimingMap bootloader_timings = GetBootLoaderTimings();
   int32_t bootloader_boot_duration = GetBootloaderTime(bootloader_timings);
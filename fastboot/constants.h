@@ -19,6 +19,7 @@
 #define FB_CMD_DOWNLOAD "download"
 #define FB_CMD_UPLOAD "upload"
 #define FB_CMD_FLASH "flash"
+#define FB_CMD_FLASH_STREAM "flash-stream"
 #define FB_CMD_ERASE "erase"
 #define FB_CMD_BOOT "boot"
 #define FB_CMD_SET_ACTIVE "set_active"
@@ -79,3 +80,4 @@
 #define FB_VAR_SECURITY_PATCH_LEVEL "security-patch-level"
 #define FB_VAR_TREBLE_ENABLED "treble-enabled"
 #define FB_VAR_MAX_FETCH_SIZE "max-fetch-size"
+#define FB_VAR_FLASH_STREAM "flash-stream"
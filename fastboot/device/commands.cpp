@@ -148,6 +148,7 @@ bool GetVarHandler(FastbootDevice* device, const std::vector<std::string>& args)
             {FB_VAR_SECURITY_PATCH_LEVEL, {GetSecurityPatchLevel, nullptr}},
             {FB_VAR_TREBLE_ENABLED, {GetTrebleEnabled, nullptr}},
             {FB_VAR_MAX_FETCH_SIZE, {GetMaxFetchSize, nullptr}},
+            {FB_VAR_FLASH_STREAM, {GetFlashStream, nullptr}},
     };
 
     if (args.size() < 2) {
@@ -596,6 +597,39 @@ bool FlashHandler(FastbootDevice* device, const std::vector<std::string>& args)
     return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
 }
 
+bool FlashStreamHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Flashing is not allowed on locked devices");
+    }
+
+    // arg[1] is the partition, arg[2] the size of the image that follows.
+    const auto& partition_name = args[1];
+    unsigned int size;
+    if (!android::base::ParseUint("0x" + args[2], &size)) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size");
+    }
+
+    if (IsProtectedPartitionDuringMerge(device, partition_name)) {
+        auto message = "Cannot flash " + partition_name + " while a snapshot update is in progress";
+        return device->WriteFail(message);
+    }
+
+    if (LogicalPartitionExists(device, partition_name)) {
+        CancelPartitionSnapshot(device, partition_name);
+    }
+
+    int ret = FlashStream(device, partition_name, size);
+    if (ret < 0) {
+        return device->WriteStatus(FastbootResult::FAIL, strerror(-ret));
+    }
+    return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
+}
+
 bool UpdateSuperHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteFail("Invalid arguments");
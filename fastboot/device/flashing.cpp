@@ -20,14 +20,19 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <ext4_utils/ext4_utils.h>
 #include <fs_mgr_overlayfs.h>
@@ -39,6 +44,7 @@
 #include <sparse/sparse.h>
 
 #include "fastboot_device.h"
+#include "streaming_image_writer.h"
 #include "utility.h"
 
 using namespace android::fs_mgr;
@@ -46,7 +52,13 @@ using namespace std::literals;
 
 namespace {
 
-constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
+// Size of each of the two buffers used to overlap transport reads with
+// block device writes in FlashStream().
+constexpr size_t kStreamBufferSize = 8 * 1024 * 1024;
+
+bool IsBootPartition(const std::string& partition_name) {
+    return partition_name == "boot" || partition_name == "boot_a" || partition_name == "boot_b";
+}
 
 void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partition_name) {
     // May be called, in the case of sparse data, multiple times so cache/skip.
@@ -145,6 +157,119 @@ static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_s
     }
 }
 
+// Same as CopyAVBFooter(), for an image that has already been written: pads
+// the partition with zeroes and places the footer at its very end.
+static int WriteAVBFooter(int fd, const std::vector<char>& tail, uint64_t data_size,
+                          uint64_t block_device_size) {
+    if (tail.size() < AVB_FOOTER_SIZE ||
+        memcmp(tail.data(), AVB_FOOTER_MAGIC, AVB_FOOTER_MAGIC_LEN) != 0) {
+        return 0;
+    }
+    uint64_t footer_offset = block_device_size - AVB_FOOTER_SIZE;
+    if (footer_offset <= data_size) {
+        if (lseek64(fd, footer_offset, SEEK_SET) < 0) return -errno;
+    } else {
+        uint64_t to_zero = footer_offset - data_size;
+        std::vector<char> zeroes(std::min<uint64_t>(to_zero, 1024 * 1024));
+        while (to_zero > 0) {
+            size_t n = std::min<uint64_t>(to_zero, zeroes.size());
+            if (FlashRawDataChunk(fd, zeroes.data(), n) < 0) return -errno;
+            to_zero -= n;
+        }
+    }
+    if (FlashRawDataChunk(fd, tail.data(), tail.size()) < 0) return -errno;
+    return 0;
+}
+
+int FlashStream(FastbootDevice* device, const std::string& partition_name, uint32_t size) {
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle)) {
+        return -ENOENT;
+    }
+    if (size == 0) {
+        return -EINVAL;
+    }
+    uint64_t block_device_size = get_block_device_size(handle.fd());
+    if (size > block_device_size) {
+        return -EOVERFLOW;
+    }
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+    lseek64(handle.fd(), 0, SEEK_SET);
+
+    if (!device->WriteStatus(FastbootResult::DATA, android::base::StringPrintf("%08x", size))) {
+        return -EIO;
+    }
+
+    // The transport is read into one buffer while the other is being written
+    // to the block device. A write error does not stop the receive loop: the
+    // host still sends the whole payload, and it must be drained to keep the
+    // protocol in sync.
+    StreamingImageWriter writer(handle.fd(), block_device_size);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<char>> free_buffers(2);
+    std::deque<std::vector<char>> full_buffers;
+    bool receive_done = false;
+
+    std::thread write_thread([&] {
+        for (;;) {
+            std::vector<char> buffer;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !full_buffers.empty() || receive_done; });
+                if (full_buffers.empty()) return;
+                buffer = std::move(full_buffers.front());
+                full_buffers.pop_front();
+            }
+            writer.Write(buffer.data(), buffer.size());
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                free_buffers.emplace_back(std::move(buffer));
+            }
+            cv.notify_all();
+        }
+    });
+
+    bool received = true;
+    for (uint64_t offset = 0; offset < size && received;) {
+        std::vector<char> buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return !free_buffers.empty(); });
+            buffer = std::move(free_buffers.front());
+            free_buffers.pop_front();
+        }
+        buffer.resize(std::min<uint64_t>(size - offset, kStreamBufferSize));
+        received = device->HandleData(true, &buffer);
+        offset += buffer.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full_buffers.emplace_back(std::move(buffer));
+        }
+        cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        receive_done = true;
+    }
+    cv.notify_all();
+    write_thread.join();
+
+    if (!received) {
+        PLOG(ERROR) << "Couldn't download data";
+        return -EIO;
+    }
+    int result = writer.Finish();
+    if (result == 0 && writer.is_raw() && size < block_device_size &&
+        IsBootPartition(partition_name)) {
+        result = WriteAVBFooter(handle.fd(), writer.tail(), size, block_device_size);
+    }
+    sync();
+    return result;
+}
+
 int Flash(FastbootDevice* device, const std::string& partition_name) {
     PartitionHandle handle;
     if (!OpenPartition(device, partition_name, &handle)) {
@@ -158,9 +283,7 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
     uint64_t block_device_size = get_block_device_size(handle.fd());
     if (data.size() > block_device_size) {
         return -EOVERFLOW;
-    } else if (data.size() < block_device_size &&
-               (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b")) {
+    } else if (data.size() < block_device_size && IsBootPartition(partition_name)) {
         CopyAVBFooter(&data, block_device_size);
     }
     if (android::base::GetProperty("ro.system.build.type", "") != "user") {
@@ -22,4 +22,7 @@
 class FastbootDevice;
 
 int Flash(FastbootDevice* device, const std::string& partition_name);
+// Receives |size| bytes from the host and writes them to the partition as they
+// arrive, instead of staging them in download_data() first.
+int FlashStream(FastbootDevice* device, const std::string& partition_name, uint32_t size);
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe);
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "streaming_image_writer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <libavb/libavb.h>
+
+StreamingImageWriter::StreamingImageWriter(int fd, uint64_t block_device_size)
+    : fd_(fd), block_device_size_(block_device_size) {
+    Expect(State::kMagic, sizeof(SPARSE_HEADER_MAGIC));
+}
+
+int StreamingImageWriter::Write(const char* data, size_t len) {
+    while (len > 0 && error_ == 0) {
+        size_t n;
+        switch (state_) {
+            case State::kRaw:
+                n = len;
+                WriteData(data, n);
+                KeepTail(data, n);
+                break;
+            case State::kRawChunk:
+                n = std::min<uint64_t>(len, remaining_);
+                WriteData(data, n);
+                if ((remaining_ -= n) == 0) NextChunk();
+                break;
+            case State::kSkip:
+                n = std::min<uint64_t>(len, remaining_);
+                if ((remaining_ -= n) == 0) NextChunk();
+                break;
+            case State::kSkipHeader:
+                n = std::min<uint64_t>(len, remaining_);
+                if ((remaining_ -= n) == 0) ExpectChunk();
+                break;
+            case State::kDone:
+                // Trailing bytes after the last chunk are ignored, as
+                // sparse_file_import_buf() would.
+                n = len;
+                break;
+            default:
+                n = std::min(len, wanted_ - pending_.size());
+                pending_.insert(pending_.end(), data, data + n);
+                if (pending_.size() == wanted_) Parse();
+                break;
+        }
+        data += n;
+        len -= n;
+    }
+    return error_;
+}
+
+int StreamingImageWriter::Finish() {
+    if (error_ == 0 && state_ == State::kMagic) {
+        // Images shorter than the sparse magic are written as is.
+        std::vector<char> data = std::move(pending_);
+        state_ = State::kRaw;
+        Write(data.data(), data.size());
+    }
+    if (error_ == 0 && state_ != State::kRaw && state_ != State::kDone) {
+        LOG(ERROR) << "Sparse image ended after " << chunks_done_ << " of "
+                   << header_.total_chunks << " chunks";
+        error_ = -EINVAL;
+    }
+    return error_;
+}
+
+void StreamingImageWriter::Expect(State state, size_t size) {
+    state_ = state;
+    wanted_ = size;
+}
+
+void StreamingImageWriter::Parse() {
+    switch (state_) {
+        case State::kMagic:
+            if (*reinterpret_cast<uint32_t*>(pending_.data()) != SPARSE_HEADER_MAGIC) {
+                std::vector<char> data = std::move(pending_);
+                pending_.clear();
+                state_ = State::kRaw;
+                Write(data.data(), data.size());
+                return;
+            }
+            Expect(State::kFileHeader, sizeof(SparseHeader));
+            return;
+        case State::kFileHeader:
+            memcpy(&header_, pending_.data(), sizeof(header_));
+            pending_.clear();
+            if (header_.major_version != 1 || header_.file_hdr_sz < sizeof(SparseHeader) ||
+                header_.chunk_hdr_sz < sizeof(ChunkHeader) || header_.blk_sz == 0 ||
+                header_.blk_sz % 4 != 0) {
+                LOG(ERROR) << "Invalid sparse image header";
+                error_ = -EINVAL;
+                return;
+            }
+            if (static_cast<uint64_t>(header_.total_blks) * header_.blk_sz > block_device_size_) {
+                error_ = -EOVERFLOW;
+                return;
+            }
+            remaining_ = header_.file_hdr_sz - sizeof(SparseHeader);
+            if (remaining_ > 0) {
+                state_ = State::kSkipHeader;
+            } else {
+                ExpectChunk();
+            }
+            return;
+        case State::kChunkHeader:
+            ParseChunkHeader();
+            return;
+        case State::kFillData: {
+            uint32_t fill;
+            memcpy(&fill, pending_.data(), sizeof(fill));
+            pending_.clear();
+            WriteFill(fill, static_cast<uint64_t>(chunk_.chunk_sz) * header_.blk_sz);
+            NextChunk();
+            return;
+        }
+        default:
+            LOG(FATAL) << "Unexpected state";
+    }
+}
+
+void StreamingImageWriter::ParseChunkHeader() {
+    memcpy(&chunk_, pending_.data(), sizeof(chunk_));
+    pending_.clear();
+    uint64_t out_size = static_cast<uint64_t>(chunk_.chunk_sz) * header_.blk_sz;
+    if (chunk_.total_sz < header_.chunk_hdr_sz ||
+        written_ + out_size > static_cast<uint64_t>(header_.total_blks) * header_.blk_sz) {
+        LOG(ERROR) << "Invalid sparse chunk " << chunks_done_;
+        error_ = -EINVAL;
+        return;
+    }
+    // Any chunk header bytes beyond the ones we understand were read into
+    // |pending_| along with the header and are dropped here.
+    uint64_t payload = chunk_.total_sz - header_.chunk_hdr_sz;
+
+    switch (chunk_.chunk_type) {
+        case CHUNK_TYPE_RAW:
+            if (payload != out_size) break;
+            remaining_ = payload;
+            state_ = State::kRawChunk;
+            if (remaining_ == 0) NextChunk();
+            return;
+        case CHUNK_TYPE_FILL:
+            if (payload != sizeof(uint32_t)) break;
+            Expect(State::kFillData, sizeof(uint32_t));
+            return;
+        case CHUNK_TYPE_DONT_CARE:
+            if (payload != 0) break;
+            SkipData(out_size);
+            NextChunk();
+            return;
+        case CHUNK_TYPE_CRC32:
+            remaining_ = payload;
+            state_ = State::kSkip;
+            if (remaining_ == 0) NextChunk();
+            return;
+        default:
+            break;
+    }
+    LOG(ERROR) << "Invalid sparse chunk " << chunks_done_ << " of type " << std::hex
+               << chunk_.chunk_type;
+    error_ = -EINVAL;
+}
+
+void StreamingImageWriter::ExpectChunk() {
+    if (chunks_done_ == header_.total_chunks) {
+        state_ = State::kDone;
+        return;
+    }
+    Expect(State::kChunkHeader, header_.chunk_hdr_sz);
+}
+
+void StreamingImageWriter::NextChunk() {
+    if (error_) return;
+    chunks_done_++;
+    ExpectChunk();
+}
+
+void StreamingImageWriter::WriteData(const char* data, size_t len) {
+    if (!android::base::WriteFully(fd_, data, len)) {
+        PLOG(ERROR) << "Failed to flash data of len " << len;
+        error_ = -errno;
+        return;
+    }
+    written_ += len;
+}
+
+void StreamingImageWriter::SkipData(uint64_t len) {
+    // A DONT_CARE chunk can span more than 4GiB, which does not fit the
+    // size_t length of a sparse_file_callback() write on 32-bit builds, so
+    // seek with a 64-bit offset directly.
+    if (len > static_cast<uint64_t>(std::numeric_limits<off64_t>::max())) {
+        error_ = -EOVERFLOW;
+        return;
+    }
+    if (lseek64(fd_, static_cast<off64_t>(len), SEEK_CUR) < 0) {
+        PLOG(ERROR) << "Failed to skip " << len << " bytes";
+        error_ = -errno;
+        return;
+    }
+    written_ += len;
+}
+
+void StreamingImageWriter::WriteFill(uint32_t fill, uint64_t len) {
+    size_t buffer_size = std::min<uint64_t>(len, 1024 * 1024) / sizeof(fill);
+    if (fill_buffer_.size() < buffer_size || fill_value_ != fill) {
+        fill_buffer_.resize(std::max(fill_buffer_.size(), buffer_size));
+        std::fill(fill_buffer_.begin(), fill_buffer_.end(), fill);
+        fill_value_ = fill;
+    }
+    while (len > 0 && error_ == 0) {
+        size_t n = std::min<uint64_t>(len, fill_buffer_.size() * sizeof(fill));
+        WriteData(reinterpret_cast<const char*>(fill_buffer_.data()), n);
+        len -= n;
+    }
+}
+
+void StreamingImageWriter::KeepTail(const char* data, size_t len) {
+    if (len >= AVB_FOOTER_SIZE) {
+        tail_.assign(data + len - AVB_FOOTER_SIZE, data + len);
+        return;
+    }
+    tail_.insert(tail_.end(), data, data + len);
+    if (tail_.size() > AVB_FOOTER_SIZE) {
+        tail_.erase(tail_.begin(), tail_.end() - AVB_FOOTER_SIZE);
+    }
+}
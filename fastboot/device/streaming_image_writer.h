@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// On-disk sparse format, as defined by libsparse's private sparse_format.h.
+constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
+constexpr uint16_t CHUNK_TYPE_RAW = 0xCAC1;
+constexpr uint16_t CHUNK_TYPE_FILL = 0xCAC2;
+constexpr uint16_t CHUNK_TYPE_DONT_CARE = 0xCAC3;
+constexpr uint16_t CHUNK_TYPE_CRC32 = 0xCAC4;
+
+struct SparseHeader {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+} __attribute__((packed));
+
+struct ChunkHeader {
+    uint16_t chunk_type;
+    uint16_t reserved1;
+    uint32_t chunk_sz;
+    uint32_t total_sz;
+} __attribute__((packed));
+
+// Writes a raw or sparse image to a block device as it arrives, so that the
+// whole image never has to be held in memory. Sparse images are expanded chunk
+// by chunk; DONT_CARE chunks become seeks, exactly like FlashSparseData().
+class StreamingImageWriter {
+  public:
+    StreamingImageWriter(int fd, uint64_t block_device_size);
+
+    // Returns 0 on success, or a negative errno. Once an error is returned,
+    // further calls are ignored and return the same error.
+    int Write(const char* data, size_t len);
+    // Returns an error if the image ended in the middle of a sparse image.
+    int Finish();
+
+    bool is_raw() const { return state_ == State::kRaw; }
+    // The last AVB_FOOTER_SIZE bytes of a raw image.
+    const std::vector<char>& tail() const { return tail_; }
+
+  private:
+    enum class State {
+        kMagic,
+        kFileHeader,
+        kSkipHeader,
+        kChunkHeader,
+        kFillData,
+        kRawChunk,
+        kSkip,
+        kRaw,
+        kDone,
+    };
+
+    void Expect(State state, size_t size);
+    void Parse();
+    void ParseChunkHeader();
+    void ExpectChunk();
+    void NextChunk();
+    void WriteData(const char* data, size_t len);
+    void SkipData(uint64_t len);
+    void WriteFill(uint32_t fill, uint64_t len);
+    void KeepTail(const char* data, size_t len);
+
+    int fd_;
+    uint64_t block_device_size_;
+    State state_ = State::kMagic;
+    size_t wanted_ = 0;
+    std::vector<char> pending_;
+    SparseHeader header_ = {};
+    ChunkHeader chunk_ = {};
+    uint32_t chunks_done_ = 0;
+    uint64_t remaining_ = 0;
+    uint64_t written_ = 0;
+    std::vector<uint32_t> fill_buffer_;
+    uint32_t fill_value_ = 0;
+    std::vector<char> tail_;
+    int error_ = 0;
+};
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "streaming_image_writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <libavb/libavb.h>
+
+static constexpr uint32_t kBlockSize = 16;
+// What the block device holds before flashing, and so where DONT_CARE chunks are.
+static constexpr char kOldContents = '\xee';
+
+// Builds a sparse image chunk by chunk, and the raw image it expands to.
+class SparseImageBuilder {
+  public:
+    explicit SparseImageBuilder(uint32_t total_blks) : total_blks_(total_blks) {}
+
+    void AddRaw(const std::string& data) {
+        AddChunk(CHUNK_TYPE_RAW, data.size() / kBlockSize, data);
+        expanded_ += data;
+    }
+    void AddFill(uint32_t value, uint32_t blocks) {
+        AddChunk(CHUNK_TYPE_FILL, blocks,
+                 std::string(reinterpret_cast<const char*>(&value), sizeof(value)));
+        for (size_t i = 0; i < blocks * kBlockSize / sizeof(value); i++) {
+            expanded_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    }
+    void AddDontCare(uint32_t blocks) {
+        AddChunk(CHUNK_TYPE_DONT_CARE, blocks, "");
+        expanded_.append(blocks * kBlockSize, kOldContents);
+    }
+    void AddCrc32(uint32_t crc) {
+        AddChunk(CHUNK_TYPE_CRC32, 0, std::string(reinterpret_cast<const char*>(&crc), sizeof(crc)));
+    }
+
+    std::string image() const {
+        SparseHeader header = {
+                .magic = SPARSE_HEADER_MAGIC,
+                .major_version = 1,
+                .minor_version = 0,
+                .file_hdr_sz = sizeof(SparseHeader),
+                .chunk_hdr_sz = sizeof(ChunkHeader),
+                .blk_sz = kBlockSize,
+                .total_blks = total_blks_,
+                .total_chunks = chunks_,
+                .image_checksum = 0,
+        };
+        return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + body_;
+    }
+    const std::string& expanded() const { return expanded_; }
+
+  private:
+    void AddChunk(uint16_t type, uint32_t blocks, const std::string& payload) {
+        ChunkHeader chunk = {
+                .chunk_type = type,
+                .reserved1 = 0,
+                .chunk_sz = blocks,
+                .total_sz = static_cast<uint32_t>(sizeof(ChunkHeader) + payload.size()),
+        };
+        body_.append(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+        body_ += payload;
+        chunks_++;
+    }
+
+    uint32_t total_blks_;
+    uint32_t chunks_ = 0;
+    std::string body_;
+    std::string expanded_;
+};
+
+static std::string Pattern(size_t size, char seed) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>(seed + i * 7);
+    }
+    return data;
+}
+
+static std::string ReadAll(int fd) {
+    std::string data;
+    EXPECT_EQ(0, lseek(fd, 0, SEEK_SET));
+    EXPECT_TRUE(android::base::ReadFdToString(fd, &data));
+    return data;
+}
+
+// Feeds |image| to a writer in pieces of at most |piece| bytes.
+static int WriteInPieces(StreamingImageWriter* writer, const std::string& image, size_t piece) {
+    for (size_t offset = 0; offset < image.size(); offset += piece) {
+        size_t n = std::min(piece, image.size() - offset);
+        if (int rv = writer->Write(image.data() + offset, n); rv != 0) {
+            return rv;
+        }
+    }
+    return writer->Finish();
+}
+
+TEST(StreamingImageWriter, RawImage) {
+    std::string image = Pattern(AVB_FOOTER_SIZE * 3 + 5, 1);
+    for (size_t piece : {1, 3, 4, 5, AVB_FOOTER_SIZE - 1, AVB_FOOTER_SIZE + 1}) {
+        TemporaryFile tf;
+        StreamingImageWriter writer(tf.fd, image.size());
+        ASSERT_EQ(0, WriteInPieces(&writer, image, piece)) << "piece " << piece;
+        EXPECT_TRUE(writer.is_raw());
+        EXPECT_EQ(image, ReadAll(tf.fd)) << "piece " << piece;
+        EXPECT_EQ(image.substr(image.size() - AVB_FOOTER_SIZE),
+                  std::string(writer.tail().begin(), writer.tail().end()));
+    }
+}
+
+TEST(StreamingImageWriter, RawImageShorterThanMagic) {
+    TemporaryFile tf;
+    StreamingImageWriter writer(tf.fd, 1024);
+    ASSERT_EQ(0, writer.Write("ab", 2));
+    ASSERT_EQ(0, writer.Finish());
+    EXPECT_TRUE(writer.is_raw());
+    EXPECT_EQ("ab", ReadAll(tf.fd));
+}
+
+TEST(StreamingImageWriter, SparseChunkBoundaries) {
+    SparseImageBuilder builder(12);
+    builder.AddRaw(Pattern(2 * kBlockSize, 3));
+    builder.AddFill(0x12345678, 3);
+    builder.AddDontCare(2);
+    builder.AddCrc32(0xdeadbeef);
+    builder.AddRaw(Pattern(kBlockSize, 9));
+    builder.AddFill(0, 4);
+    std::string image = builder.image();
+
+    // Every piece size puts the chunk boundaries at a different place in the
+    // Write() calls, including in the middle of the headers and fill values.
+    for (size_t piece = 1; piece <= image.size(); piece++) {
+        TemporaryFile tf;
+        std::string old_contents(builder.expanded().size(), kOldContents);
+        ASSERT_TRUE(android::base::WriteFully(tf.fd, old_contents.data(), old_contents.size()));
+        ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+        StreamingImageWriter writer(tf.fd, builder.expanded().size());
+        ASSERT_EQ(0, WriteInPieces(&writer, image, piece)) << "piece " << piece;
+        EXPECT_FALSE(writer.is_raw());
+        ASSERT_EQ(builder.expanded(), ReadAll(tf.fd)) << "piece " << piece;
+    }
+}
+
+TEST(StreamingImageWriter, TruncatedSparseImage) {
+    SparseImageBuilder builder(4);
+    builder.AddRaw(Pattern(2 * kBlockSize, 3));
+    builder.AddFill(1, 2);
+    std::string image = builder.image();
+
+    // Any strict prefix longer than the magic is a sparse image that ended early.
+    for (size_t size = sizeof(SPARSE_HEADER_MAGIC); size < image.size(); size++) {
+        TemporaryFile tf;
+        StreamingImageWriter writer(tf.fd, 4 * kBlockSize);
+        ASSERT_EQ(0, writer.Write(image.data(), size)) << "size " << size;
+        EXPECT_EQ(-EINVAL, writer.Finish()) << "size " << size;
+    }
+}
+
+TEST(StreamingImageWriter, OversizeSparseImage) {
+    SparseImageBuilder builder(4);
+    builder.AddFill(1, 4);
+    std::string image = builder.image();
+
+    TemporaryFile tf;
+    StreamingImageWriter writer(tf.fd, 4 * kBlockSize - 1);
+    EXPECT_EQ(-EOVERFLOW, writer.Write(image.data(), image.size()));
+    // The error sticks.
+    EXPECT_EQ(-EOVERFLOW, writer.Finish());
+}
+
+TEST(StreamingImageWriter, ChunkPastTotalBlocks) {
+    SparseImageBuilder builder(2);
+    builder.AddRaw(Pattern(2 * kBlockSize, 3));
+    builder.AddFill(1, 1);
+    std::string image = builder.image();
+
+    TemporaryFile tf;
+    StreamingImageWriter writer(tf.fd, 1024);
+    EXPECT_EQ(-EINVAL, writer.Write(image.data(), image.size()));
+}
+
+TEST(StreamingImageWriter, DontCareOver4GiB) {
+    // A DONT_CARE chunk whose length does not fit in 32 bits, followed by data
+    // that has to land past it. The chunks are built by hand, since the
+    // expanded image would not fit in memory.
+    static constexpr uint32_t kSkipBlocks = (5ULL << 30) / kBlockSize;
+    std::string data = Pattern(kBlockSize, 5);
+    SparseHeader header = {
+            .magic = SPARSE_HEADER_MAGIC,
+            .major_version = 1,
+            .minor_version = 0,
+            .file_hdr_sz = sizeof(SparseHeader),
+            .chunk_hdr_sz = sizeof(ChunkHeader),
+            .blk_sz = kBlockSize,
+            .total_blks = kSkipBlocks + 1,
+            .total_chunks = 2,
+            .image_checksum = 0,
+    };
+    ChunkHeader skip = {
+            .chunk_type = CHUNK_TYPE_DONT_CARE,
+            .reserved1 = 0,
+            .chunk_sz = kSkipBlocks,
+            .total_sz = sizeof(ChunkHeader),
+    };
+    ChunkHeader raw = {
+            .chunk_type = CHUNK_TYPE_RAW,
+            .reserved1 = 0,
+            .chunk_sz = 1,
+            .total_sz = sizeof(ChunkHeader) + kBlockSize,
+    };
+    std::string image(reinterpret_cast<const char*>(&header), sizeof(header));
+    image.append(reinterpret_cast<const char*>(&skip), sizeof(skip));
+    image.append(reinterpret_cast<const char*>(&raw), sizeof(raw));
+    image += data;
+
+    TemporaryFile tf;
+    StreamingImageWriter writer(tf.fd, (kSkipBlocks + 1ULL) * kBlockSize);
+    ASSERT_EQ(0, WriteInPieces(&writer, image, 7));
+
+    std::string read(data.size(), '\0');
+    ASSERT_TRUE(android::base::ReadFullyAtOffset(tf.fd, read.data(), read.size(),
+                                                 uint64_t{kSkipBlocks} * kBlockSize));
+    EXPECT_EQ(data, read);
+}
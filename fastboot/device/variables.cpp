@@ -528,3 +528,9 @@ bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string
     *message = android::base::StringPrintf("0x%X", kMaxFetchSizeDefault);
     return true;
 }
+
+bool GetFlashStream(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message) {
+    *message = "yes";
+    return true;
+}
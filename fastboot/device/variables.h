@@ -82,6 +82,8 @@ bool GetTrebleEnabled(FastbootDevice* device, const std::vector<std::string>& ar
                       std::string* message);
 bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
                      std::string* message);
+bool GetFlashStream(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message);
 
 // Helpers for getvar all.
 std::vector<std::vector<std::string>> GetAllPartitionArgsWithSlot(FastbootDevice* device);
@@ -44,7 +44,10 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <thread>
@@ -95,6 +98,9 @@ static bool g_long_listing = false;
 static constexpr int64_t RESPARSE_LIMIT = 1 * 1024 * 1024 * 1024;
 static uint64_t sparse_limit = 0;
 static int64_t target_sparse_limit = -1;
+// Upper bound on host memory used to hold serialized sparse pieces while the
+// previous piece is being sent and written. Zero disables the pipeline.
+static uint64_t sparse_buffer_limit = RESPARSE_LIMIT;
 
 static unsigned g_base_addr = 0x10000000;
 static boot_img_hdr_v2 g_boot_img_hdr = {};
@@ -463,6 +469,9 @@ static int show_help() {
             " -s SERIAL                  Specify a USB device.\n"
             " -s tcp|udp:HOST[:PORT]     Specify a network device.\n"
             " -S SIZE[K|M|G]             Break into sparse files no larger than SIZE.\n"
+            " --sparse-buffer SIZE[K|M|G]\n"
+            "                            Prepare sparse files ahead of the device using at\n"
+            "                            most SIZE of memory; 0 to disable (default: 1G).\n"
             " --force                    Force a flash operation that may be unsafe.\n"
             " --slot SLOT                Use SLOT; 'all' for both slots, 'other' for\n"
             "                            non-current slot (default: current active slot).\n"
@@ -895,6 +904,19 @@ static uint64_t get_uint_var(const char* var_name) {
     return value;
 }
 
+// Whether the device can write images as they are received (fastbootd only).
+static int supports_flash_stream = -1;
+
+static bool use_flash_stream() {
+    if (supports_flash_stream == -1) {
+        std::string value;
+        supports_flash_stream =
+                fb->GetVar(FB_VAR_FLASH_STREAM, &value) == fastboot::SUCCESS && value == "yes";
+        if (supports_flash_stream) verbose("target supports streaming flash");
+    }
+    return supports_flash_stream;
+}
+
 static int64_t get_sparse_limit(int64_t size) {
     int64_t limit = sparse_limit;
     if (limit == 0) {
@@ -1097,6 +1119,131 @@ static void copy_boot_avb_footer(const std::string& partition, struct fastboot_b
     lseek(buf->fd.get(), 0, SEEK_SET);
 }
 
+// Serializes the pieces of a resparsed image on a worker thread so that reading
+// piece N+1 from disk overlaps with sending and writing piece N. Pieces are
+// handed over in order; the worker stalls once |sparse_buffer_limit| bytes are
+// queued or in flight, but a single piece larger than the limit is still let
+// through so that progress is always possible.
+class SparsePipeline {
+  public:
+    explicit SparsePipeline(const std::vector<std::pair<sparse_file*, int64_t>>& pieces)
+        : pieces_(pieces) {}
+
+    ~SparsePipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancelled_ = true;
+        }
+        cv_.notify_all();
+        if (worker_.joinable()) worker_.join();
+    }
+
+    void Start() { worker_ = std::thread(&SparsePipeline::Produce, this); }
+
+    // Blocks until the next piece is ready. Returns false if serialization failed.
+    bool Next(std::vector<char>* out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !ready_.empty() || failed_; });
+        if (ready_.empty()) return false;
+        *out = std::move(ready_.front());
+        ready_.pop_front();
+        return true;
+    }
+
+    // Returns true if the next piece is already serialized.
+    bool Ready() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !ready_.empty();
+    }
+
+    // Releases the budget held by a piece once it has been flashed.
+    void Release(size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ -= size;
+        }
+        cv_.notify_all();
+    }
+
+  private:
+    void Produce() {
+        for (size_t i = 0; i < pieces_.size(); ++i) {
+            size_t size = static_cast<size_t>(pieces_[i].second);
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this, size] {
+                    return cancelled_ || used_ == 0 || used_ + size <= sparse_buffer_limit;
+                });
+                if (cancelled_) return;
+                used_ += size;
+            }
+
+            double start = now();
+            std::vector<char> data;
+            data.reserve(size);
+            auto cb = [](void* priv, const void* buf, size_t len) -> int {
+                auto out = static_cast<std::vector<char>*>(priv);
+                auto cbuf = static_cast<const char*>(buf);
+                out->insert(out->end(), cbuf, cbuf + len);
+                return 0;
+            };
+            bool ok = sparse_file_callback(pieces_[i].first, true, false, cb, &data) == 0;
+            verbose("prepared sparse %zu/%zu (%zu KB) in %.3fs", i + 1, pieces_.size(),
+                    data.size() / 1024, now() - start);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!ok) {
+                    failed_ = true;
+                } else {
+                    ready_.emplace_back(std::move(data));
+                }
+            }
+            cv_.notify_all();
+            if (!ok) return;
+        }
+    }
+
+    const std::vector<std::pair<sparse_file*, int64_t>>& pieces_;
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<char>> ready_;
+    uint64_t used_ = 0;
+    bool failed_ = false;
+    bool cancelled_ = false;
+};
+
+static void flash_sparse_pipelined(const std::string& partition,
+                                   const std::vector<std::pair<sparse_file*, int64_t>>& pieces) {
+    SparsePipeline pipeline(pieces);
+    pipeline.Start();
+
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        std::vector<char> data;
+        if (pipeline.Ready()) {
+            pipeline.Next(&data);
+        } else {
+            // Only shows up when the host, not the device, is the bottleneck.
+            Status(android::base::StringPrintf("Reading sparse '%s' %zu/%zu", partition.c_str(),
+                                               i + 1, pieces.size()));
+            if (!pipeline.Next(&data)) {
+                fprintf(stderr, "FAILED\n");
+                die("Error reading sparse file");
+            }
+            Epilog(0);
+        }
+        size_t size = static_cast<size_t>(pieces[i].second);
+        if (use_flash_stream()) {
+            fb->FlashStream(partition, data, i + 1, pieces.size());
+        } else {
+            fb->FlashPartition(partition, data, i + 1, pieces.size());
+        }
+        data = std::vector<char>();
+        pipeline.Release(size);
+    }
+}
+
 static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
 {
     sparse_file** s;
@@ -1125,6 +1272,10 @@ static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
                 ++s;
             }
 
+            if (sparse_files.size() > 1 && sparse_buffer_limit > 0) {
+                flash_sparse_pipelined(partition, sparse_files);
+                break;
+            }
             for (size_t i = 0; i < sparse_files.size(); ++i) {
                 const auto& pair = sparse_files[i];
                 fb->FlashPartition(partition, pair.first, pair.second, i + 1, sparse_files.size());
@@ -1132,7 +1283,11 @@ static void flash_buf(const std::string& partition, struct fastboot_buffer *buf)
             break;
         }
         case FB_BUFFER_FD:
-            fb->FlashPartition(partition, buf->fd, buf->sz);
+            if (use_flash_stream()) {
+                fb->FlashStream(partition, buf->fd, buf->sz);
+            } else {
+                fb->FlashPartition(partition, buf->fd, buf->sz);
+            }
             break;
         default:
             die("unknown buffer type: %d", buf->type);
@@ -1405,6 +1560,7 @@ static void reboot_to_userspace_fastboot() {
     // Reset target_sparse_limit after reboot to userspace fastboot. Max
     // download sizes may differ in bootloader and fastbootd.
     target_sparse_limit = -1;
+    supports_flash_stream = -1;
 }
 
 static void CancelSnapshotIfNeeded() {
@@ -1927,6 +2083,7 @@ int FastBootTool::Main(int argc, char* argv[]) {
         {"skip-reboot", no_argument, 0, 0},
         {"skip-secondary", no_argument, 0, 0},
         {"slot", required_argument, 0, 0},
+        {"sparse-buffer", required_argument, 0, 0},
         {"tags-offset", required_argument, 0, 0},
         {"dtb", required_argument, 0, 0},
         {"dtb-offset", required_argument, 0, 0},
@@ -1978,6 +2135,10 @@ int FastBootTool::Main(int argc, char* argv[]) {
                 skip_secondary = true;
             } else if (name == "slot") {
                 slot_override = optarg;
+            } else if (name == "sparse-buffer") {
+                if (!android::base::ParseByteCount(optarg, &sparse_buffer_limit)) {
+                    die("invalid sparse buffer size %s", optarg);
+                }
             } else if (name == "dtb-offset") {
                 g_boot_img_hdr.dtb_addr = strtoul(optarg, 0, 16);
             } else if (name == "tags-offset") {
@@ -162,6 +162,38 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file
     return Flash(partition);
 }
 
+RetCode FastBootDriver::FlashPartition(const std::string& partition, const std::vector<char>& data,
+                                       size_t current, size_t total) {
+    RetCode ret;
+    if ((ret = Download(partition, data, current, total))) {
+        return ret;
+    }
+    return Flash(partition);
+}
+
+RetCode FastBootDriver::FlashStream(const std::string& partition, android::base::borrowed_fd fd,
+                                    uint32_t size) {
+    prolog_(StringPrintf("Streaming '%s' (%u KB)", partition.c_str(), size / 1024));
+    RetCode ret;
+    if (!(ret = FlashStreamCommand(partition, size)) && !(ret = SendBuffer(fd, size))) {
+        ret = HandleResponse();
+    }
+    epilog_(ret);
+    return ret;
+}
+
+RetCode FastBootDriver::FlashStream(const std::string& partition, const std::vector<char>& data,
+                                    size_t current, size_t total) {
+    prolog_(StringPrintf("Streaming sparse '%s' %zu/%zu (%zu KB)", partition.c_str(), current,
+                         total, data.size() / 1024));
+    RetCode ret;
+    if (!(ret = FlashStreamCommand(partition, data.size())) && !(ret = SendBuffer(data))) {
+        ret = HandleResponse();
+    }
+    epilog_(ret);
+    return ret;
+}
+
 RetCode FastBootDriver::Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions) {
     std::vector<std::string> all;
     RetCode ret;
@@ -255,6 +287,16 @@ RetCode FastBootDriver::Download(const std::string& partition, struct sparse_fil
     return result;
 }
 
+RetCode FastBootDriver::Download(const std::string& partition, const std::vector<char>& buf,
+                                 size_t current, size_t total, std::string* response,
+                                 std::vector<std::string>* info) {
+    prolog_(StringPrintf("Sending sparse '%s' %zu/%zu (%zu KB)", partition.c_str(), current, total,
+                         buf.size() / 1024));
+    auto result = Download(buf, response, info);
+    epilog_(result);
+    return result;
+}
+
 RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* response,
                                  std::vector<std::string>* info) {
     error_ = "";
@@ -459,6 +501,14 @@ RetCode FastBootDriver::DownloadCommand(uint32_t size, std::string* response,
     return SUCCESS;
 }
 
+RetCode FastBootDriver::FlashStreamCommand(const std::string& partition, uint32_t size,
+                                           std::string* response,
+                                           std::vector<std::string>* info) {
+    std::string cmd(android::base::StringPrintf("%s:%s:%08" PRIx32, FB_CMD_FLASH_STREAM,
+                                                partition.c_str(), size));
+    return RawCommand(cmd, response, info);
+}
+
 RetCode FastBootDriver::HandleResponse(std::string* response, std::vector<std::string>* info,
                                        int* dsize) {
     char status[FB_RESPONSE_SZ + 1];
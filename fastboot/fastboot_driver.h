@@ -90,6 +90,10 @@ class FastBootDriver {
                      std::vector<std::string>* info = nullptr);
     RetCode Download(sparse_file* s, bool use_crc = false, std::string* response = nullptr,
                      std::vector<std::string>* info = nullptr);
+    // Sends one piece of a resparsed image that was already serialized into |buf|.
+    RetCode Download(const std::string& partition, const std::vector<char>& buf, size_t current,
+                     size_t total, std::string* response = nullptr,
+                     std::vector<std::string>* info = nullptr);
     RetCode Erase(const std::string& partition, std::string* response = nullptr,
                   std::vector<std::string>* info = nullptr);
     RetCode Flash(const std::string& partition, std::string* response = nullptr,
@@ -117,6 +121,13 @@ class FastBootDriver {
                            uint32_t sz);
     RetCode FlashPartition(const std::string& partition, sparse_file* s, uint32_t sz,
                            size_t current, size_t total);
+    RetCode FlashPartition(const std::string& partition, const std::vector<char>& data,
+                           size_t current, size_t total);
+    // Like FlashPartition(), but the device writes the image as it arrives
+    // instead of staging it in RAM. Requires getvar:flash-stream to be "yes".
+    RetCode FlashStream(const std::string& partition, android::base::borrowed_fd fd, uint32_t sz);
+    RetCode FlashStream(const std::string& partition, const std::vector<char>& data,
+                        size_t current, size_t total);
 
     RetCode Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions);
     RetCode Require(const std::string& var, const std::vector<std::string>& allowed, bool* reqmet,
@@ -142,6 +153,9 @@ class FastBootDriver {
   protected:
     RetCode DownloadCommand(uint32_t size, std::string* response = nullptr,
                             std::vector<std::string>* info = nullptr);
+    RetCode FlashStreamCommand(const std::string& partition, uint32_t size,
+                               std::string* response = nullptr,
+                               std::vector<std::string>* info = nullptr);
     RetCode HandleResponse(std::string* response = nullptr,
                            std::vector<std::string>* info = nullptr, int* dsize = nullptr);
 
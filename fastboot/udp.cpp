@@ -33,6 +33,8 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <deque>
 #include <list>
 #include <memory>
 #include <vector>
@@ -131,9 +133,16 @@ class UdpTransport : public Transport {
                                    uint8_t* rx_data, size_t rx_length, int attempts,
                                    std::string* error);
 
+    // Version 2 alternative to SendData() for multi-packet writes: keeps up to |window_size_|
+    // packets in flight and only re-transmits the ones that haven't been acknowledged. Returns
+    // the number of response data bytes received, which should be 0, or -1 on failure.
+    ssize_t SendDataWindowed(Id id, const uint8_t* tx_data, size_t tx_length, int attempts,
+                             std::string* error);
+
     std::unique_ptr<Socket> socket_;
     int sequence_ = -1;
     size_t max_data_length_ = kMinPacketSize - kHeaderSize;
+    size_t window_size_ = 1;
     std::vector<uint8_t> rx_packet_;
 
     DISALLOW_COPY_AND_ASSIGN(UdpTransport);
@@ -151,9 +160,10 @@ std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket>
 }
 
 bool UdpTransport::InitializeProtocol(std::string* error) {
-    uint8_t rx_data[4];
+    uint8_t rx_data[6];
 
     sequence_ = 0;
+    window_size_ = 1;
     rx_packet_.resize(kMinPacketSize);
 
     // First send the query packet to sync with the target. Only attempt this a small number of
@@ -169,7 +179,8 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     // The first two bytes contain the next expected sequence number.
     sequence_ = ExtractUint16(rx_data);
 
-    // Now send the initialization packet with our version and maximum packet size.
+    // Now send the initialization packet with our version and maximum packet size. This is always
+    // the version 1 payload, since version 1 devices may not accept a longer one.
     uint8_t init_data[] = {kProtocolVersion >> 8, kProtocolVersion & 0xFF,
                            kHostMaxPacketSize >> 8, kHostMaxPacketSize & 0xFF};
     rx_bytes = SendData(kIdInitialization, init_data, sizeof(init_data), rx_data, sizeof(rx_data),
@@ -199,6 +210,25 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     max_data_length_ = packet_size - kHeaderSize;
     rx_packet_.resize(packet_size);
 
+    // A device that reports version 2 is sent a second initialization packet with our window size,
+    // and follows its response with its own. Anything else, including a window size of 1, keeps
+    // the version 1 stop-and-wait behavior.
+    if (version >= kProtocolVersionWindowed) {
+        uint8_t windowed_init_data[] = {
+                kProtocolVersionWindowed >> 8, kProtocolVersionWindowed & 0xFF,
+                kHostMaxPacketSize >> 8,       kHostMaxPacketSize & 0xFF,
+                kHostMaxWindowSize >> 8,       kHostMaxWindowSize & 0xFF};
+        rx_bytes = SendData(kIdInitialization, windowed_init_data, sizeof(windowed_init_data),
+                            rx_data, sizeof(rx_data), kMaxTransmissionAttempts, error);
+        if (rx_bytes == -1) {
+            return false;
+        }
+        if (rx_bytes >= 6 && ExtractUint16(rx_data) >= kProtocolVersionWindowed) {
+            uint16_t window_size = ExtractUint16(rx_data + 4);
+            window_size_ = std::max<size_t>(1, std::min(kHostMaxWindowSize, window_size));
+        }
+    }
+
     return true;
 }
 
@@ -211,6 +241,12 @@ ssize_t UdpTransport::SendData(Id id, const uint8_t* tx_data, size_t tx_length,
         return -1;
     }
 
+    // Multi-packet writes can be pipelined if the device negotiated a window. Reads and the
+    // protocol setup packets always use stop-and-wait.
+    if (window_size_ > 1 && id == kIdFastboot && rx_length == 0 && tx_length > max_data_length_) {
+        return SendDataWindowed(id, tx_data, tx_length, attempts, error);
+    }
+
     Header header;
     size_t packet_data_length;
     ssize_t ret = 0;
@@ -325,6 +361,95 @@ ssize_t UdpTransport::SendSinglePacketHelper(
     return total_data_bytes;
 }
 
+ssize_t UdpTransport::SendDataWindowed(Id id, const uint8_t* tx_data, size_t tx_length,
+                                       const int attempts, std::string* error) {
+    struct Packet {
+        Header header;
+        const uint8_t* data;
+        size_t length;
+        bool acked;
+    };
+
+    error->clear();
+    std::deque<Packet> window;
+    ssize_t total_data_bytes = 0;
+    int attempts_left = attempts;
+
+    while (tx_length > 0 || !window.empty()) {
+        // Fill the window.
+        while (tx_length > 0 && window.size() < window_size_) {
+            Packet packet;
+            packet.data = tx_data;
+            packet.acked = false;
+            if (tx_length > max_data_length_) {
+                packet.length = max_data_length_;
+                packet.header.Set(id, sequence_, kFlagContinuation);
+            } else {
+                packet.length = tx_length;
+                packet.header.Set(id, sequence_, kFlagNone);
+            }
+            if (!socket_->Send({{packet.header.bytes(), kHeaderSize},
+                                {packet.data, packet.length}})) {
+                *error = Socket::GetErrorMessage();
+                return -1;
+            }
+            ++sequence_;
+            tx_data += packet.length;
+            tx_length -= packet.length;
+            window.push_back(packet);
+        }
+
+        ssize_t bytes = socket_->Receive(rx_packet_.data(), rx_packet_.size(), kResponseTimeoutMs);
+        if (bytes == -1) {
+            if (!socket_->ReceiveTimedOut()) {
+                *error = Socket::GetErrorMessage();
+                return -1;
+            }
+            if (--attempts_left <= 0) {
+                *error = "no response from target";
+                return -1;
+            }
+            // Selective re-transmission: only resend what hasn't been acknowledged yet.
+            for (const Packet& packet : window) {
+                if (packet.acked) continue;
+                if (!socket_->Send({{packet.header.bytes(), kHeaderSize},
+                                    {packet.data, packet.length}})) {
+                    *error = Socket::GetErrorMessage();
+                    return -1;
+                }
+            }
+            continue;
+        } else if (bytes < static_cast<ssize_t>(kHeaderSize)) {
+            *error = "protocol error: incomplete header";
+            return -1;
+        }
+
+        // Find the in-flight packet this responds to; anything else is a stale duplicate.
+        auto it = std::find_if(window.begin(), window.end(), [this](Packet& packet) {
+            return packet.header.Matches(rx_packet_.data());
+        });
+        if (it == window.end() || it->acked) {
+            continue;
+        }
+        if (rx_packet_[kIndexId] == kIdError) {
+            error->assign(rx_packet_.data() + kHeaderSize, rx_packet_.data() + bytes);
+            *error = "target reported error: " + *error;
+            return -1;
+        }
+        total_data_bytes += bytes - kHeaderSize;
+        it->acked = true;
+        // We got a valid response so reset our attempt counter.
+        attempts_left = attempts;
+
+        // Slide the window past everything acknowledged in order.
+        while (!window.empty() && window.front().acked) {
+            window.pop_front();
+        }
+    }
+
+    return total_data_bytes;
+}
+
 ssize_t UdpTransport::Read(void* data, size_t length) {
     // Read from the target by sending an empty packet.
     std::string error;
@@ -45,7 +45,15 @@ std::unique_ptr<Transport> Connect(const std::string& hostname, int port, std::s
 // Internal namespace for test use only.
 namespace internal {
 
+// Lowest protocol version the host accepts.
 constexpr uint16_t kProtocolVersion = 1;
+// Version 2 adds a window size to the Init packet, allowing multiple fastboot write packets to be
+// in flight at once. The host falls back to version 1 behavior if the device doesn't support it.
+constexpr uint16_t kProtocolVersionWindowed = 2;
+
+// Maximum number of unacknowledged write packets. This will be negotiated with the device so may
+// end up being smaller.
+constexpr uint16_t kHostMaxWindowSize = 32;
 
 // This will be negotiated with the device so may end up being smaller.
 constexpr uint16_t kHostMaxPacketSize = 8192;
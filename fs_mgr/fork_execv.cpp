@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fork_execv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace fs_mgr {
+
+int ForkExecvAndWait(const std::vector<const char*>& argv, int* status, std::string* output) {
+    // Everything the child needs is set up before forking, since only async-signal-safe calls
+    // may be made between fork() and execv() in a process with other threads.
+    std::vector<const char*> args(argv);
+    args.emplace_back(nullptr);
+
+    // Both ends are close-on-exec, so that children forked by other threads meanwhile can't
+    // keep the pipe open after we're done with it; this is what logwrap's lock is for.
+    unique_fd null_fd(TEMP_FAILURE_RETRY(open("/dev/null", O_RDONLY | O_CLOEXEC)));
+    if (null_fd == -1) {
+        return -errno;
+    }
+    unique_fd read_fd, write_fd;
+    if (!android::base::Pipe(&read_fd, &write_fd)) {
+        return -errno;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        return -errno;
+    }
+    if (pid == 0) {
+        if (dup2(null_fd, STDIN_FILENO) == -1 || dup2(write_fd, STDOUT_FILENO) == -1 ||
+            dup2(write_fd, STDERR_FILENO) == -1) {
+            _exit(127);
+        }
+        execv(args[0], const_cast<char* const*>(args.data()));
+        _exit(127);
+    }
+
+    write_fd.reset();
+    output->clear();
+    android::base::ReadFdToString(read_fd, output);
+    if (TEMP_FAILURE_RETRY(waitpid(pid, status, 0)) != pid) {
+        return -errno;
+    }
+    return 0;
+}
+
+}  // namespace fs_mgr
+}  // namespace android
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace fs_mgr {
+
+// Runs argv[0], which must be an absolute path, with its stdout and stderr collected in
+// |output|, and waits for it to exit. Unlike logwrap_fork_execvp(), which holds a process-wide
+// lock until the child exits, this can run in several threads at once, so that fs_mgr_mount_all()
+// can check several filesystems at the same time.
+//
+// Returns 0 and sets |status| to the wait status of the child, or -errno if it couldn't be run.
+int ForkExecvAndWait(const std::vector<const char*>& argv, int* status, std::string* output);
+
+}  // namespace fs_mgr
+}  // namespace android
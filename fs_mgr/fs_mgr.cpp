@@ -38,6 +38,9 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
 #include <thread>
 #include <utility>
@@ -71,7 +74,9 @@
 #include <logwrap/logwrap.h>
 
 #include "blockdev.h"
+#include "fork_execv.h"
 #include "fs_mgr_priv.h"
+#include "parallel_fs_preparer.h"
 
 #define KEY_LOC_PROP   "ro.crypto.keyfile.userdata"
 #define KEY_IN_FOOTER  "footer"
@@ -135,17 +140,52 @@ enum FsStatFlags {
     FS_STAT_ENABLE_METADATA_CSUM_FAILED = 0x200000,
 };
 
+// fs_mgr_mount_all() may check several filesystems at once.
+static std::mutex fsck_log_lock;
+
+static bool append_to_fsck_log(const std::string& msg) {
+    std::lock_guard<std::mutex> lock(fsck_log_lock);
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(FSCK_LOG_FILE, O_WRONLY | O_CLOEXEC |
+                                                        O_APPEND | O_CREAT, 0664)));
+    return fd != -1 && android::base::WriteStringToFd(msg, fd);
+}
+
 static void log_fs_stat(const std::string& blk_device, int fs_stat) {
     if ((fs_stat & FS_STAT_IS_EXT4) == 0) return; // only log ext4
     std::string msg =
             android::base::StringPrintf("\nfs_stat,%s,0x%x\n", blk_device.c_str(), fs_stat);
-    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(FSCK_LOG_FILE, O_WRONLY | O_CLOEXEC |
-                                                        O_APPEND | O_CREAT, 0664)));
-    if (fd == -1 || !android::base::WriteStringToFd(msg, fd)) {
+    if (!append_to_fsck_log(msg)) {
         LWARNING << __FUNCTION__ << "() cannot log " << msg;
     }
 }
 
+// Runs a filesystem tool with its output logged to the kernel log, and also to FSCK_LOG_FILE
+// with |fsck_log|. This goes through ForkExecvAndWait() rather than logwrap_fork_execvp(), which
+// would check one filesystem at a time. The output of a run is logged in one piece once the tool
+// exits, so that the output of checks running at the same time doesn't interleave.
+// Returns like logwrap_fork_execvp(): with |status|, 0 and the wait status of the tool, else its
+// exit status or -ECHILD if it didn't exit. Returns -errno if the tool couldn't be run.
+static int run_fs_tool(int argc, const char* argv[], int* status, bool fsck_log) {
+    int wait_status;
+    std::string output;
+    int ret = ForkExecvAndWait(std::vector<const char*>(argv, argv + argc), &wait_status, &output);
+    if (ret < 0) {
+        return ret;
+    }
+    std::string tag = Basename(argv[0]);
+    for (const auto& line : android::base::Split(output, "\n")) {
+        if (!line.empty()) LINFO << tag << ": " << line;
+    }
+    if (fsck_log && !append_to_fsck_log(output)) {
+        LWARNING << "Cannot append the output of " << tag << " to " << FSCK_LOG_FILE;
+    }
+    if (status) {
+        *status = wait_status;
+        return 0;
+    }
+    return WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -ECHILD;
+}
+
 static bool is_extfs(const std::string& fs_type) {
     return fs_type == "ext4" || fs_type == "ext3" || fs_type == "ext2";
 }
@@ -244,12 +284,10 @@ static void check_fs(const std::string& blk_device, const std::string& fs_type,
         } else {
             LINFO << "Running " << E2FSCK_BIN << " on " << realpath(blk_device);
             if (should_force_check(*fs_stat)) {
-                ret = logwrap_fork_execvp(ARRAY_SIZE(e2fsck_forced_argv), e2fsck_forced_argv,
-                                          &status, false, LOG_KLOG | LOG_FILE, false,
-                                          FSCK_LOG_FILE);
+                ret = run_fs_tool(ARRAY_SIZE(e2fsck_forced_argv), e2fsck_forced_argv, &status,
+                                  true);
             } else {
-                ret = logwrap_fork_execvp(ARRAY_SIZE(e2fsck_argv), e2fsck_argv, &status, false,
-                                          LOG_KLOG | LOG_FILE, false, FSCK_LOG_FILE);
+                ret = run_fs_tool(ARRAY_SIZE(e2fsck_argv), e2fsck_argv, &status, true);
             }
 
             if (ret < 0) {
@@ -270,13 +308,12 @@ static void check_fs(const std::string& blk_device, const std::string& fs_type,
         if (should_force_check(*fs_stat)) {
             LINFO << "Running " << F2FS_FSCK_BIN << " -f -c 10000 --debug-cache "
                   << realpath(blk_device);
-            ret = logwrap_fork_execvp(ARRAY_SIZE(f2fs_fsck_forced_argv), f2fs_fsck_forced_argv,
-                                      &status, false, LOG_KLOG | LOG_FILE, false, nullptr);
+            ret = run_fs_tool(ARRAY_SIZE(f2fs_fsck_forced_argv), f2fs_fsck_forced_argv, &status,
+                              false);
         } else {
             LINFO << "Running " << F2FS_FSCK_BIN << " -a -c 10000 --debug-cache "
                   << realpath(blk_device);
-            ret = logwrap_fork_execvp(ARRAY_SIZE(f2fs_fsck_argv), f2fs_fsck_argv, &status, false,
-                                      LOG_KLOG | LOG_FILE, false, nullptr);
+            ret = run_fs_tool(ARRAY_SIZE(f2fs_fsck_argv), f2fs_fsck_argv, &status, false);
         }
         if (ret < 0) {
             /* No need to check for error in fork, we can't really handle it now */
@@ -355,7 +392,7 @@ static bool tune2fs_available(void) {
 static bool run_command(const char* argv[], int argc) {
     int ret;
 
-    ret = logwrap_fork_execvp(argc, argv, nullptr, false, LOG_KLOG, false, nullptr);
+    ret = run_fs_tool(argc, argv, nullptr, false);
     return ret == 0;
 }
 
@@ -876,9 +913,12 @@ static bool fs_match(const std::string& in1, const std::string& in2) {
 // end_idx: On return, will be the last entry that was looked at.
 // attempted_idx: On return, will indicate which fstab entry
 //     succeeded. In case of failure, it will be the start_idx.
+// prepared_fs_stat: If set, the result of prepare_fs_for_mount() for
+//     fstab[start_idx], which then isn't prepared again.
 // Sets errno to match the 1st mount failure on failure.
 static bool mount_with_alternatives(const Fstab& fstab, int start_idx, int* end_idx,
-                                    int* attempted_idx) {
+                                    int* attempted_idx,
+                                    std::optional<int> prepared_fs_stat = std::nullopt) {
     unsigned long i;
     int mount_errno = 0;
     bool mounted = false;
@@ -897,7 +937,9 @@ static bool mount_with_alternatives(const Fstab& fstab, int start_idx, int* end_
             continue;
         }
 
-        int fs_stat = prepare_fs_for_mount(fstab[i].blk_device, fstab[i]);
+        int fs_stat = (i == start_idx && prepared_fs_stat)
+                              ? *prepared_fs_stat
+                              : prepare_fs_for_mount(fstab[i].blk_device, fstab[i]);
         if (fs_stat & FS_STAT_INVALID_MAGIC) {
             LERROR << __FUNCTION__
                    << "(): skipping mount due to invalid magic, mountpoint=" << fstab[i].mount_point
@@ -1366,6 +1408,46 @@ static bool IsMountPointMounted(const std::string& mount_point) {
     return GetEntryForMountPoint(&fstab, mount_point) != nullptr;
 }
 
+// Whether fs_mgr_mount_all() leaves |entry| alone.
+static bool SkipMountAllEntry(const FstabEntry& entry, int mount_mode) {
+    // If a filesystem should have been mounted in the first stage, we
+    // ignore it here. With one exception, if the filesystem is
+    // formattable, then it can only be formatted in the second stage,
+    // so we allow it to mount here.
+    if (entry.fs_mgr_flags.first_stage_mount &&
+        (!entry.fs_mgr_flags.formattable || IsMountPointMounted(entry.mount_point))) {
+        return true;
+    }
+
+    // Don't mount entries that are managed by vold or not for the mount mode.
+    if (entry.fs_mgr_flags.vold_managed || entry.fs_mgr_flags.recovery_only ||
+        ((mount_mode == MOUNT_MODE_LATE) && !entry.fs_mgr_flags.late_mount) ||
+        ((mount_mode == MOUNT_MODE_EARLY) && entry.fs_mgr_flags.late_mount)) {
+        return true;
+    }
+
+    // Skip swap and raw partition entries such as boot, recovery, etc.
+    if (entry.fs_type == "swap" || entry.fs_type == "emmc" || entry.fs_type == "mtd") {
+        return true;
+    }
+
+    // Skip mounting the root partition, as it will already have been mounted.
+    if (entry.mount_point == "/" || entry.mount_point == "/system") {
+        if ((entry.flags & MS_RDONLY) != 0) {
+            fs_mgr_set_blk_ro(entry.blk_device);
+        }
+        return true;
+    }
+
+    // Terrible hack to make it possible to remount /data.
+    // TODO: refactor fs_mgr_mount_all and get rid of this.
+    if (mount_mode == MOUNT_MODE_ONLY_USERDATA && entry.mount_point != "/data") {
+        return true;
+    }
+
+    return false;
+}
+
 // When multiple fstab records share the same mount_point, it will try to mount each
 // one in turn, and ignore any duplicates after a first successful mount.
 // Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
@@ -1381,103 +1463,144 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         return {FS_MGR_MNTALL_FAIL, userdata_mounted};
     }
 
-    // Keep i int to prevent unsigned integer overflow from (i = top_idx - 1),
-    // where top_idx is 0. It will give SIGABRT
-    for (int i = 0; i < static_cast<int>(fstab->size()); i++) {
-        auto& current_entry = (*fstab)[i];
-
-        // If a filesystem should have been mounted in the first stage, we
-        // ignore it here. With one exception, if the filesystem is
-        // formattable, then it can only be formatted in the second stage,
-        // so we allow it to mount here.
-        if (current_entry.fs_mgr_flags.first_stage_mount &&
-            (!current_entry.fs_mgr_flags.formattable ||
-             IsMountPointMounted(current_entry.mount_point))) {
-            continue;
-        }
-
-        // Don't mount entries that are managed by vold or not for the mount mode.
-        if (current_entry.fs_mgr_flags.vold_managed || current_entry.fs_mgr_flags.recovery_only ||
-            ((mount_mode == MOUNT_MODE_LATE) && !current_entry.fs_mgr_flags.late_mount) ||
-            ((mount_mode == MOUNT_MODE_EARLY) && current_entry.fs_mgr_flags.late_mount)) {
-            continue;
-        }
-
-        // Skip swap and raw partition entries such as boot, recovery, etc.
-        if (current_entry.fs_type == "swap" || current_entry.fs_type == "emmc" ||
-            current_entry.fs_type == "mtd") {
-            continue;
-        }
-
-        // Skip mounting the root partition, as it will already have been mounted.
-        if (current_entry.mount_point == "/" || current_entry.mount_point == "/system") {
-            if ((current_entry.flags & MS_RDONLY) != 0) {
-                fs_mgr_set_blk_ro(current_entry.blk_device);
-            }
-            continue;
-        }
-
-        // Terrible hack to make it possible to remount /data.
-        // TODO: refactor fs_mgr_mount_all and get rid of this.
-        if (mount_mode == MOUNT_MODE_ONLY_USERDATA && current_entry.mount_point != "/data") {
-            continue;
-        }
-
+    // Sets up the block device of an entry to be mounted. Returns false if the entry should
+    // be skipped, and sets |fatal| if fs_mgr_mount_all() can't continue either.
+    auto set_up_entry = [&](FstabEntry* entry, bool* fatal) -> bool {
         // Translate LABEL= file system labels into block devices.
-        if (is_extfs(current_entry.fs_type)) {
-            if (!TranslateExtLabels(&current_entry)) {
+        if (is_extfs(entry->fs_type)) {
+            if (!TranslateExtLabels(entry)) {
                 LERROR << "Could not translate label to block device";
-                continue;
+                return false;
             }
         }
 
-        if (current_entry.fs_mgr_flags.logical) {
-            if (!fs_mgr_update_logical_partition(&current_entry)) {
+        if (entry->fs_mgr_flags.logical) {
+            if (!fs_mgr_update_logical_partition(entry)) {
                 LERROR << "Could not set up logical partition, skipping!";
-                continue;
+                return false;
             }
         }
 
-        WrapUserdataIfNeeded(&current_entry);
+        WrapUserdataIfNeeded(entry);
 
-        if (!checkpoint_manager.Update(&current_entry)) {
-            continue;
+        if (!checkpoint_manager.Update(entry)) {
+            return false;
         }
 
-        if (current_entry.fs_mgr_flags.wait && !WaitForFile(current_entry.blk_device, 20s)) {
-            LERROR << "Skipping '" << current_entry.blk_device << "' during mount_all";
-            continue;
+        if (entry->fs_mgr_flags.wait && !WaitForFile(entry->blk_device, 20s)) {
+            LERROR << "Skipping '" << entry->blk_device << "' during mount_all";
+            return false;
         }
 
-        if (current_entry.fs_mgr_flags.avb) {
+        if (entry->fs_mgr_flags.avb) {
             if (!avb_handle) {
                 avb_handle = AvbHandle::Open();
                 if (!avb_handle) {
                     LERROR << "Failed to open AvbHandle";
-                    set_type_property(encryptable);
-                    return {FS_MGR_MNTALL_FAIL, userdata_mounted};
+                    *fatal = true;
+                    return false;
                 }
             }
-            if (avb_handle->SetUpAvbHashtree(&current_entry, true /* wait_for_verity_dev */) ==
+            if (avb_handle->SetUpAvbHashtree(entry, true /* wait_for_verity_dev */) ==
                 AvbHashtreeResult::kFail) {
-                LERROR << "Failed to set up AVB on partition: " << current_entry.mount_point
+                LERROR << "Failed to set up AVB on partition: " << entry->mount_point
                        << ", skipping!";
                 // Skips mounting the device.
-                continue;
+                return false;
             }
-        } else if (!current_entry.avb_keys.empty()) {
-            if (AvbHandle::SetUpStandaloneAvbHashtree(&current_entry) == AvbHashtreeResult::kFail) {
+        } else if (!entry->avb_keys.empty()) {
+            if (AvbHandle::SetUpStandaloneAvbHashtree(entry) == AvbHashtreeResult::kFail) {
                 LERROR << "Failed to set up AVB on standalone partition: "
-                       << current_entry.mount_point << ", skipping!";
+                       << entry->mount_point << ", skipping!";
                 // Skips mounting the device.
-                continue;
+                return false;
             }
-        } else if ((current_entry.fs_mgr_flags.verify)) {
-            int rc = fs_mgr_setup_verity(&current_entry, true);
+        } else if ((entry->fs_mgr_flags.verify)) {
+            int rc = fs_mgr_setup_verity(entry, true);
             if (rc == FS_MGR_SETUP_VERITY_DISABLED || rc == FS_MGR_SETUP_VERITY_SKIPPED) {
                 LINFO << "Verity disabled";
             } else if (rc != FS_MGR_SETUP_VERITY_SUCCESS) {
                 LERROR << "Could not set up verified partition, skipping!";
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    // With ro.fs_mgr.mount_all.parallel, entries are set up in batches ahead of the loop below,
+    // and their filesystems are checked concurrently while it mounts them in fstab order.
+    // A batch ends before an entry whose setup may depend on the entries before it being
+    // mounted: checkpointing asks vold, and failing to open the AVB handle ends mount_all.
+    std::unique_ptr<ParallelFsPreparer> preparer;
+    if (GetBoolProperty("ro.fs_mgr.mount_all.parallel", false)) {
+        preparer = std::make_unique<ParallelFsPreparer>([](const FstabEntry& entry) {
+            LINFO << "Preparing " << entry.blk_device << " for " << entry.mount_point;
+            Timer t;
+            int fs_stat = prepare_fs_for_mount(entry.blk_device, entry);
+            LINFO << "Prepared " << entry.blk_device << " for " << entry.mount_point << " in "
+                  << t;
+            return fs_stat;
+        });
+    }
+    std::set<int> skipped_in_batch;
+    int batch_end = 0;
+    auto set_up_batch = [&](int start) -> bool {
+        int i = start;
+        while (i < static_cast<int>(fstab->size())) {
+            auto& entry = (*fstab)[i];
+            if (i > start && (entry.fs_mgr_flags.checkpoint_blk ||
+                              entry.fs_mgr_flags.checkpoint_fs ||
+                              (entry.fs_mgr_flags.avb && !avb_handle))) {
+                break;
+            }
+            bool fatal = false;
+            if (SkipMountAllEntry(entry, mount_mode) || !set_up_entry(&entry, &fatal)) {
+                if (fatal) return false;
+                skipped_in_batch.emplace(i++);
+                continue;
+            }
+            preparer->Start(entry, i);
+            // Alternatives for the same mount point are only prepared if this one fails.
+            while (++i < static_cast<int>(fstab->size()) &&
+                   (*fstab)[i].mount_point == entry.mount_point) {
+            }
+        }
+        batch_end = i;
+        return true;
+    };
+
+    // Keep i int to prevent unsigned integer overflow from (i = top_idx - 1),
+    // where top_idx is 0. It will give SIGABRT
+    for (int i = 0; i < static_cast<int>(fstab->size()); i++) {
+        auto& current_entry = (*fstab)[i];
+
+        std::optional<int> prepared_fs_stat;
+        if (preparer) {
+            preparer->ReleaseBefore(i);
+            if (i >= batch_end && !set_up_batch(i)) {
+                set_type_property(encryptable);
+                return {FS_MGR_MNTALL_FAIL, userdata_mounted};
+            }
+            if (skipped_in_batch.count(i)) {
+                continue;
+            }
+            if (preparer->IsPreparing(i)) {
+                prepared_fs_stat = preparer->Wait(i);
+            }
+        }
+
+        // Entries of a batch were already set up. The ones replayed after formatting aren't.
+        if (!prepared_fs_stat) {
+            if (SkipMountAllEntry(current_entry, mount_mode)) {
+                continue;
+            }
+            bool fatal = false;
+            if (!set_up_entry(&current_entry, &fatal)) {
+                if (fatal) {
+                    set_type_property(encryptable);
+                    return {FS_MGR_MNTALL_FAIL, userdata_mounted};
+                }
                 continue;
             }
         }
@@ -1486,7 +1609,8 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         int top_idx = i;
         int attempted_idx = -1;
 
-        bool mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx);
+        bool mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx,
+                                            prepared_fs_stat);
         auto& attempted_entry = (*fstab)[attempted_idx];
         i = last_idx_inspected;
         int mount_errno = errno;
@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <deque>
 #include <sstream>
 
 #include <android-base/file.h>
@@ -152,10 +153,16 @@ std::unique_ptr<LpMetadata> ReadCurrentMetadata(const std::string& block_device)
 }
 
 bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& super_device) {
+    CreateLogicalPartitionParams::OwnedData owned_data;
     CreateLogicalPartitionParams params = {
             .block_device = super_device,
             .metadata = &metadata,
     };
+
+    // Build every table first, so that all of the devices can be created in
+    // one batch.
+    std::deque<DmTable> tables;
+    std::vector<DeviceMapper::DeviceSpec> devices;
     for (const auto& partition : metadata.partitions) {
         if (!partition.num_extents) {
             LINFO << "Skipping zero-length logical partition: " << GetPartitionName(partition);
@@ -166,13 +173,26 @@ bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& supe
             continue;
         }
 
-        params.partition = &partition;
-
-        std::string ignore_path;
-        if (!CreateLogicalPartition(params, &ignore_path)) {
+        CreateLogicalPartitionParams partition_params = params;
+        partition_params.partition = &partition;
+        if (!partition_params.InitDefaults(&owned_data) ||
+            !CreateDmTableInternal(partition_params, &tables.emplace_back())) {
             LERROR << "Could not create logical partition: " << GetPartitionName(partition);
             return false;
         }
+        devices.push_back({partition_params.device_name, &tables.back()});
+    }
+    if (devices.empty()) {
+        return true;
+    }
+
+    std::vector<std::string> paths;
+    if (!DeviceMapper::Instance().CreateDevices(devices, &paths, params.timeout_ms)) {
+        LERROR << "Could not create logical partitions on " << super_device;
+        return false;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        LINFO << "Created logical partition " << devices[i].name << " on device " << paths[i];
     }
     return true;
 }
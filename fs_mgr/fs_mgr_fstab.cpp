@@ -22,10 +22,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -528,6 +532,35 @@ err:
     return false;
 }
 
+bool ParseFstabFromString(const std::string& fstab_buf, Fstab* fstab) {
+    std::unique_ptr<FILE, decltype(&fclose)> fstab_file(
+        fmemopen(static_cast<void*>(const_cast<char*>(fstab_buf.c_str())),
+                 fstab_buf.length(), "r"), fclose);
+    if (!fstab_file) {
+        PERROR << __FUNCTION__ << "(): failed to create a file stream for fstab";
+        return false;
+    }
+    return ReadFstabFile(fstab_file.get(), false, fstab);
+}
+
+// Like ReadFstabFromDt(), without skipping any partitions.
+bool ParseFstabFromDt(Fstab* fstab, bool verbose) {
+    std::string fstab_buf = ReadFstabFromDt();
+    if (fstab_buf.empty()) {
+        if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
+        return false;
+    }
+
+    if (!ParseFstabFromString(fstab_buf, fstab)) {
+        if (verbose) {
+            LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
+                   << fstab_buf;
+        }
+        return false;
+    }
+    return true;
+}
+
 /* Extracts <device>s from the by-name symlinks specified in a fstab:
  *   /dev/block/<type>/<device>/by-name/<partition>
  *
@@ -698,21 +731,12 @@ void EnableMandatoryFlags(Fstab* fstab) {
     }
 }
 
-bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
-    auto fstab_file = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (!fstab_file) {
-        PERROR << __FUNCTION__ << "(): cannot open file: '" << path << "'";
-        return false;
-    }
-
-    bool is_proc_mounts = path == "/proc/mounts";
+namespace {
 
-    Fstab fstab;
-    if (!ReadFstabFile(fstab_file.get(), is_proc_mounts, &fstab)) {
-        LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
-        return false;
-    }
-    if (!is_proc_mounts) {
+// Everything ReadFstabFromFile() does on top of parsing the file, which depends on the state of the
+// device rather than on the contents of the file.
+bool FinishFstabFromFile(Fstab* fstab, bool proc_mounts) {
+    if (!proc_mounts) {
         if (!access(android::gsi::kGsiBootedIndicatorFile, F_OK)) {
             // This is expected to fail if host is android Q, since Q doesn't
             // support DSU slotting. The DSU "active" indicator file would be
@@ -733,41 +757,330 @@ bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
                 PERROR << __FUNCTION__ << "(): failed to read DSU LP names";
                 return false;
             }
-            TransformFstabForDsu(&fstab, dsu_slot, Split(lp_names, ","));
+            TransformFstabForDsu(fstab, dsu_slot, Split(lp_names, ","));
         } else if (errno != ENOENT) {
             PERROR << __FUNCTION__ << "(): failed to access() DSU booted indicator";
             return false;
         }
     }
 
-    SkipMountingPartitions(&fstab, false /* verbose */);
-    EnableMandatoryFlags(&fstab);
+    SkipMountingPartitions(fstab, false /* verbose */);
+    EnableMandatoryFlags(fstab);
+    return true;
+}
 
-    *fstab_out = std::move(fstab);
+// The cache that WriteFstabCache() writes is only read back by the same boot, but possibly by the
+// vendor variant of this library from another build. Bump the version whenever FstabEntry or the
+// layout below changes. The static_asserts below catch a member of FstabEntry or of its
+// FsMgrFlags that the cache would miss.
+constexpr uint64_t kFstabCacheMagic = 0x4653544142434143;
+constexpr uint64_t kFstabCacheVersion = 2;
+
+// Converts to anything, to count the members of an aggregate by how many it can initialize.
+struct AnyMember {
+    template <typename T>
+    operator T() const;
+};
+
+template <typename T, typename... Members>
+decltype(void(T{std::declval<Members>()...}), std::true_type{}) IsBraceInitializable(int);
+template <typename T, typename... Members>
+std::false_type IsBraceInitializable(...);
+
+template <typename T, typename... Members>
+constexpr size_t CountMembers() {
+    if constexpr (decltype(IsBraceInitializable<T, Members..., AnyMember>(0))::value) {
+        return CountMembers<T, Members..., AnyMember>();
+    } else {
+        return sizeof...(Members);
+    }
+}
+
+// The cache stores the flags that are set by name, rather than the bit-fields as the compiler of
+// the writer laid them out.
+struct FsMgrFlagField {
+    const char* name;
+    bool (*get)(const FstabEntry::FsMgrFlags& flags);
+    void (*set)(FstabEntry::FsMgrFlags* flags);
+};
+
+#define FsMgrFlag(flag)                                                         \
+    {                                                                           \
+        #flag,                                                                  \
+        [](const FstabEntry::FsMgrFlags& flags) -> bool { return flags.flag; }, \
+        [](FstabEntry::FsMgrFlags* flags) { flags->flag = true; },              \
+    }
+constexpr FsMgrFlagField kFsMgrFlagFields[] = {
+        FsMgrFlag(wait),
+        FsMgrFlag(check),
+        FsMgrFlag(crypt),
+        FsMgrFlag(nonremovable),
+        FsMgrFlag(vold_managed),
+        FsMgrFlag(recovery_only),
+        FsMgrFlag(verify),
+        FsMgrFlag(force_crypt),
+        FsMgrFlag(no_emulated_sd),
+        FsMgrFlag(no_trim),
+        FsMgrFlag(file_encryption),
+        FsMgrFlag(formattable),
+        FsMgrFlag(slot_select),
+        FsMgrFlag(force_fde_or_fbe),
+        FsMgrFlag(late_mount),
+        FsMgrFlag(no_fail),
+        FsMgrFlag(verify_at_boot),
+        FsMgrFlag(quota),
+        FsMgrFlag(avb),
+        FsMgrFlag(logical),
+        FsMgrFlag(checkpoint_blk),
+        FsMgrFlag(checkpoint_fs),
+        FsMgrFlag(first_stage_mount),
+        FsMgrFlag(slot_select_other),
+        FsMgrFlag(fs_verity),
+        FsMgrFlag(ext_meta_csum),
+        FsMgrFlag(fs_compress),
+        FsMgrFlag(wrapped_key),
+};
+#undef FsMgrFlag
+static_assert(std::size(kFsMgrFlagFields) == CountMembers<FstabEntry::FsMgrFlags>(),
+              "kFsMgrFlagFields misses a member of FstabEntry::FsMgrFlags");
+
+struct FstabCache {
+    uint64_t magic = kFstabCacheMagic;
+    uint64_t version = kFstabCacheVersion;
+    // The default fstab file, as it was when it was parsed. Empty if there is none.
+    std::string fstab_path;
+    int64_t fstab_size = 0;
+    int64_t fstab_mtime_ns = 0;
+    uint64_t fstab_hash = 0;
+    // Both as ReadFstabFile() left them, before anything that depends on more than their source.
+    Fstab dt_fstab;
+    Fstab fstab;
+};
+
+class FstabCacheWriter {
+  public:
+    template <typename T>
+    std::enable_if_t<std::is_integral_v<T>, bool> Field(const T* value) {
+        int64_t v = static_cast<int64_t>(*value);
+        data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        return true;
+    }
+    bool Field(const std::string* value) {
+        uint64_t size = value->size();
+        Field(&size);
+        data_ += *value;
+        return true;
+    }
+    bool Field(const FstabEntry::FsMgrFlags* flags) {
+        uint64_t count = std::count_if(std::begin(kFsMgrFlagFields), std::end(kFsMgrFlagFields),
+                                       [flags](const auto& field) { return field.get(*flags); });
+        Field(&count);
+        for (const auto& field : kFsMgrFlagFields) {
+            if (field.get(*flags)) {
+                std::string name = field.name;
+                Field(&name);
+            }
+        }
+        return true;
+    }
+    bool Field(const Fstab* fstab);
+
+    const std::string& data() const { return data_; }
+
+  private:
+    std::string data_;
+};
+
+class FstabCacheReader {
+  public:
+    explicit FstabCacheReader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+    std::enable_if_t<std::is_integral_v<T>, bool> Field(T* value) {
+        int64_t v;
+        if (!Read(&v, sizeof(v))) return false;
+        *value = static_cast<T>(v);
+        return true;
+    }
+    bool Field(std::string* value) {
+        uint64_t size;
+        if (!Field(&size) || size > data_.size()) return false;
+        value->assign(data_.substr(0, size));
+        data_.remove_prefix(size);
+        return true;
+    }
+    bool Field(FstabEntry::FsMgrFlags* flags) {
+        uint64_t count;
+        if (!Field(&count) || count > std::size(kFsMgrFlagFields)) return false;
+        *flags = {};
+        for (; count > 0; --count) {
+            std::string name;
+            if (!Field(&name)) return false;
+            auto field = std::find_if(std::begin(kFsMgrFlagFields), std::end(kFsMgrFlagFields),
+                                      [&name](const auto& field) { return name == field.name; });
+            if (field == std::end(kFsMgrFlagFields)) return false;
+            field->set(flags);
+        }
+        return true;
+    }
+    bool Field(Fstab* fstab);
+
+    bool empty() const { return data_.empty(); }
+
+  private:
+    bool Read(void* out, size_t size) {
+        if (data_.size() < size) return false;
+        memcpy(out, data_.data(), size);
+        data_.remove_prefix(size);
+        return true;
+    }
+
+    std::string_view data_;
+};
+
+template <typename Archive, typename... Fields>
+bool VisitFstabEntryFields(Archive* ar, Fields*... fields) {
+    static_assert(sizeof...(Fields) == CountMembers<FstabEntry>(),
+                  "VisitFstabEntry() misses a member of FstabEntry");
+    return (ar->Field(fields) && ...);
+}
+
+// Visits every field of an FstabEntry, for FstabCacheWriter or FstabCacheReader.
+template <typename Archive, typename Entry>
+bool VisitFstabEntry(Archive* ar, Entry* entry) {
+    // clang-format off
+    return VisitFstabEntryFields(ar,
+                                 &entry->blk_device,
+                                 &entry->logical_partition_name,
+                                 &entry->mount_point,
+                                 &entry->fs_type,
+                                 &entry->flags,
+                                 &entry->fs_options,
+                                 &entry->fs_checkpoint_opts,
+                                 &entry->key_loc,
+                                 &entry->metadata_key_dir,
+                                 &entry->metadata_encryption,
+                                 &entry->length,
+                                 &entry->label,
+                                 &entry->partnum,
+                                 &entry->swap_prio,
+                                 &entry->max_comp_streams,
+                                 &entry->zram_size,
+                                 &entry->reserved_size,
+                                 &entry->readahead_size_kb,
+                                 &entry->encryption_options,
+                                 &entry->erase_blk_size,
+                                 &entry->logical_blk_size,
+                                 &entry->sysfs_path,
+                                 &entry->vbmeta_partition,
+                                 &entry->zram_backingdev_size,
+                                 &entry->avb_keys,
+                                 &entry->lowerdir,
+                                 &entry->fs_mgr_flags);
+    // clang-format on
+}
+
+bool FstabCacheWriter::Field(const Fstab* fstab) {
+    uint64_t size = fstab->size();
+    Field(&size);
+    for (const auto& entry : *fstab) {
+        VisitFstabEntry(this, &entry);
+    }
     return true;
 }
 
-// Returns fstab entries parsed from the device tree if they exist
-bool ReadFstabFromDt(Fstab* fstab, bool verbose) {
-    std::string fstab_buf = ReadFstabFromDt();
-    if (fstab_buf.empty()) {
-        if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
+bool FstabCacheReader::Field(Fstab* fstab) {
+    uint64_t size;
+    // Every entry takes well over a byte, which bounds what a corrupt size can allocate.
+    if (!Field(&size) || size > data_.size()) return false;
+    fstab->resize(size);
+    for (auto& entry : *fstab) {
+        if (!VisitFstabEntry(this, &entry)) return false;
+    }
+    return true;
+}
+
+template <typename Archive, typename Cache>
+bool VisitFstabCache(Archive* ar, Cache* cache) {
+    // clang-format off
+    return ar->Field(&cache->magic) &&
+           ar->Field(&cache->version) &&
+           ar->Field(&cache->fstab_path) &&
+           ar->Field(&cache->fstab_size) &&
+           ar->Field(&cache->fstab_mtime_ns) &&
+           ar->Field(&cache->fstab_hash) &&
+           ar->Field(&cache->dt_fstab) &&
+           ar->Field(&cache->fstab);
+    // clang-format on
+}
+
+// 64-bit FNV-1a, which is enough to tell whether a file changed.
+uint64_t HashFstabContents(std::string_view contents) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : contents) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return hash;
+}
+
+int64_t MtimeNs(const struct stat& sb) {
+    return static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+}
+
+// The device tree does not change during a boot, and the cache does not outlive one, so only the
+// fstab file needs checking. Its size and mtime are enough when it is at the same path. Otherwise,
+// or if they changed, its contents are: first stage init may have parsed another copy of it.
+bool IsFstabCacheCurrent(const FstabCache& cache, const std::string& fstab_path) {
+    if (fstab_path.empty() || cache.fstab_path.empty()) {
+        return fstab_path == cache.fstab_path;
+    }
+    struct stat sb;
+    if (stat(fstab_path.c_str(), &sb) != 0 || sb.st_size != cache.fstab_size) {
         return false;
     }
+    if (fstab_path == cache.fstab_path && MtimeNs(sb) == cache.fstab_mtime_ns) {
+        return true;
+    }
+    std::string contents;
+    return ReadFileToString(fstab_path, &contents) &&
+           HashFstabContents(contents) == cache.fstab_hash;
+}
 
-    std::unique_ptr<FILE, decltype(&fclose)> fstab_file(
-        fmemopen(static_cast<void*>(const_cast<char*>(fstab_buf.c_str())),
-                 fstab_buf.length(), "r"), fclose);
+// Use different fstab paths for normal boot and recovery boot, respectively
+std::string GetDefaultFstabPath() {
+    if (access("/system/bin/recovery", F_OK) == 0) {
+        return "/etc/recovery.fstab";
+    }
+    return GetFstabPath();
+}
+
+}  // namespace
+
+bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
+    auto fstab_file = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
     if (!fstab_file) {
-        if (verbose) PERROR << __FUNCTION__ << "(): failed to create a file stream for fstab dt";
+        PERROR << __FUNCTION__ << "(): cannot open file: '" << path << "'";
         return false;
     }
 
-    if (!ReadFstabFile(fstab_file.get(), false, fstab)) {
-        if (verbose) {
-            LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
-                   << fstab_buf;
-        }
+    bool is_proc_mounts = path == "/proc/mounts";
+
+    Fstab fstab;
+    if (!ReadFstabFile(fstab_file.get(), is_proc_mounts, &fstab)) {
+        LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
+        return false;
+    }
+    if (!FinishFstabFromFile(&fstab, is_proc_mounts)) {
+        return false;
+    }
+
+    *fstab_out = std::move(fstab);
+    return true;
+}
+
+// Returns fstab entries parsed from the device tree if they exist
+bool ReadFstabFromDt(Fstab* fstab, bool verbose) {
+    if (!ParseFstabFromDt(fstab, verbose)) {
         return false;
     }
 
@@ -826,19 +1139,94 @@ bool SkipMountingPartitions(Fstab* fstab, bool verbose) {
 }
 #endif
 
+bool WriteFstabCache(const std::string& cache_path, const std::string& fstab_path) {
+    FstabCache cache;
+    ParseFstabFromDt(&cache.dt_fstab, false /* verbose */);
+
+    if (!fstab_path.empty()) {
+        std::string contents;
+        struct stat sb;
+        if (stat(fstab_path.c_str(), &sb) != 0 || !ReadFileToString(fstab_path, &contents)) {
+            PERROR << __FUNCTION__ << "(): cannot read file: '" << fstab_path << "'";
+            return false;
+        }
+        // Parse exactly what is hashed.
+        if (!ParseFstabFromString(contents, &cache.fstab)) {
+            LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << fstab_path << "'";
+            return false;
+        }
+        cache.fstab_path = fstab_path;
+        cache.fstab_size = static_cast<int64_t>(contents.size());
+        cache.fstab_mtime_ns = MtimeNs(sb);
+        cache.fstab_hash = HashFstabContents(contents);
+    }
+
+    FstabCacheWriter writer;
+    VisitFstabCache(&writer, &cache);
+
+    // Readers never see a partially written cache.
+    const std::string temp_path = cache_path + ".tmp";
+    if (!android::base::WriteStringToFile(writer.data(), temp_path, 0644, getuid(), getgid())) {
+        PERROR << __FUNCTION__ << "(): cannot write file: '" << temp_path << "'";
+        return false;
+    }
+    if (rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+        PERROR << __FUNCTION__ << "(): cannot rename '" << temp_path << "' to '" << cache_path
+               << "'";
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ReadFstabCache(const std::string& cache_path, const std::string& fstab_path, Fstab* fstab) {
+    std::string data;
+    auto save_errno = errno;
+    if (!ReadFileToString(cache_path, &data)) {
+        errno = save_errno;  // a missing cache is expected
+        return false;
+    }
+
+    FstabCache cache;
+    FstabCacheReader reader(data);
+    if (!VisitFstabCache(&reader, &cache) || !reader.empty() || cache.magic != kFstabCacheMagic ||
+        cache.version != kFstabCacheVersion) {
+        LWARNING << __FUNCTION__ << "(): ignoring malformed fstab cache: '" << cache_path << "'";
+        return false;
+    }
+    if (!IsFstabCacheCurrent(cache, fstab_path)) {
+        LINFO << __FUNCTION__ << "(): fstab cache is stale: '" << fstab_path << "'";
+        return false;
+    }
+
+    // What ReadDefaultFstab() does with the parsed device tree and default fstab.
+    SkipMountingPartitions(&cache.dt_fstab, false /* verbose */);
+    if (!cache.fstab_path.empty() && FinishFstabFromFile(&cache.fstab, false)) {
+        for (auto&& entry : cache.fstab) {
+            cache.dt_fstab.emplace_back(std::move(entry));
+        }
+    } else {
+        LINFO << __FUNCTION__ << "(): failed to find device default fstab";
+    }
+    *fstab = std::move(cache.dt_fstab);
+    return true;
+}
+
+bool WriteDefaultFstabCache() {
+    return WriteFstabCache(kDefaultFstabCachePath, GetDefaultFstabPath());
+}
+
 // Loads the fstab file and combines with fstab entries passed in from device tree.
 bool ReadDefaultFstab(Fstab* fstab) {
     fstab->clear();
-    ReadFstabFromDt(fstab, false /* verbose */);
 
-    std::string default_fstab_path;
-    // Use different fstab paths for normal boot and recovery boot, respectively
-    if (access("/system/bin/recovery", F_OK) == 0) {
-        default_fstab_path = "/etc/recovery.fstab";
-    } else {  // normal boot
-        default_fstab_path = GetFstabPath();
+    std::string default_fstab_path = GetDefaultFstabPath();
+    if (ReadFstabCache(kDefaultFstabCachePath, default_fstab_path, fstab)) {
+        return !fstab->empty();
     }
 
+    ReadFstabFromDt(fstab, false /* verbose */);
+
     Fstab default_fstab;
     if (!default_fstab_path.empty() && ReadFstabFromFile(default_fstab_path, &default_fstab)) {
         for (auto&& entry : default_fstab) {
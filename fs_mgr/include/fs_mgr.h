@@ -73,6 +73,8 @@ struct MountAllResult {
 // defined above, and the second element tells whether this call to fs_mgr_mount_all was responsible
 // for mounting userdata. Later is required for init to correctly enqueue fs-related events as part
 // of userdata remount during userspace reboot.
+// If ro.fs_mgr.mount_all.parallel is true, filesystems are checked concurrently, but still
+// mounted in fstab order.
 MountAllResult fs_mgr_mount_all(android::fs_mgr::Fstab* fstab, int mount_mode);
 
 #define FS_MGR_DOMNT_FAILED (-1)
@@ -43,7 +43,8 @@ namespace fs_mgr {
 std::unique_ptr<LpMetadata> ReadCurrentMetadata(const std::string& block_device);
 
 // Create block devices for all logical partitions in the given metadata. The
-// metadata must have been read from the current slot.
+// metadata must have been read from the current slot. The devices are created
+// as one batch, and if any of them fails, none are left behind.
 bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& block_device);
 
 // Create block devices for all logical partitions. This is a convenience
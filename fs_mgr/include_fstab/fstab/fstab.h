@@ -104,6 +104,19 @@ bool ReadFstabFromDt(Fstab* fstab, bool verbose = true);
 bool ReadDefaultFstab(Fstab* fstab);
 bool SkipMountingPartitions(Fstab* fstab, bool verbose = false);
 
+// ReadDefaultFstab() reads the fstab from the device tree and parses the default fstab file in
+// every process that calls it. First stage init calls WriteDefaultFstabCache() once its partitions
+// are mounted, and ReadDefaultFstab() loads what it parsed from kDefaultFstabCachePath instead,
+// for as long as the default fstab file is unchanged.
+static constexpr char kDefaultFstabCachePath[] = "/dev/fstab.cache";
+bool WriteDefaultFstabCache();
+
+// Exposed for testing: WriteDefaultFstabCache() and the cached path of ReadDefaultFstab(), with
+// the given cache and default fstab file. ReadFstabCache() returns false if the cache is missing,
+// or was written for another fstab file.
+bool WriteFstabCache(const std::string& cache_path, const std::string& fstab_path);
+bool ReadFstabCache(const std::string& cache_path, const std::string& fstab_path, Fstab* fstab);
+
 FstabEntry* GetEntryForMountPoint(Fstab* fstab, const std::string& path);
 // The Fstab can contain multiple entries for the same mount point with different configurations.
 std::vector<FstabEntry*> GetEntriesForMountPoint(Fstab* fstab, const std::string& path);
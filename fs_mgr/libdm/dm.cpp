@@ -170,6 +170,21 @@ static bool IsRecovery() {
     return access("/system/bin/recovery", F_OK) == 0;
 }
 
+// Older recovery images run a ueventd that doesn't create the unique paths, so
+// wait for the dm-N path there instead.
+static bool UseLegacyWaitPath() {
+    if (!IsRecovery()) {
+        return false;
+    }
+    bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
+    int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
+    if (non_ab_device && sdk && sdk <= 29) {
+        LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
+        return true;
+    }
+    return false;
+}
+
 bool DeviceMapper::CreateEmptyDevice(const std::string& name) {
     std::string uuid = GenerateUuid();
     return CreateDevice(name, uuid);
@@ -190,13 +205,8 @@ bool DeviceMapper::WaitForDevice(const std::string& name,
         return true;
     }
 
-    if (IsRecovery()) {
-        bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
-        int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
-        if (non_ab_device && sdk && sdk <= 29) {
-            LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
-            unique_path = *path;
-        }
+    if (UseLegacyWaitPath()) {
+        unique_path = *path;
     }
 
     if (!WaitForFile(unique_path, timeout_ms)) {
@@ -226,6 +236,51 @@ bool DeviceMapper::CreateDevice(const std::string& name, const DmTable& table, s
     return true;
 }
 
+bool DeviceMapper::CreateDevices(const std::vector<DeviceSpec>& devices,
+                                 std::vector<std::string>* paths,
+                                 const std::chrono::milliseconds& timeout_ms) {
+    paths->clear();
+    auto delete_devices = [&, this](size_t count) -> bool {
+        for (size_t i = 0; i < count; i++) {
+            DeleteDevice(devices[i].name);
+        }
+        paths->clear();
+        return false;
+    };
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!CreateEmptyDevice(devices[i].name)) {
+            return delete_devices(i);
+        }
+        if (!LoadTableAndActivate(devices[i].name, *devices[i].table)) {
+            return delete_devices(i + 1);
+        }
+    }
+
+    // See WaitForDevice() for why the unique path is used.
+    const bool legacy_wait_path =
+            timeout_ms > std::chrono::milliseconds::zero() && UseLegacyWaitPath();
+    std::vector<std::string> wait_paths;
+    for (const auto& device : devices) {
+        std::string unique_path, path;
+        if (!GetDeviceUniquePath(device.name, &unique_path) ||
+            !GetDmDevicePathByName(device.name, &path)) {
+            return delete_devices(devices.size());
+        }
+        wait_paths.emplace_back(legacy_wait_path ? path : unique_path);
+        paths->emplace_back(path);
+    }
+
+    if (timeout_ms <= std::chrono::milliseconds::zero()) {
+        return true;
+    }
+    if (!WaitForFiles(wait_paths, timeout_ms)) {
+        LOG(ERROR) << "Failed waiting for device paths of " << devices.size() << " devices";
+        return delete_devices(devices.size());
+    }
+    return true;
+}
+
 bool DeviceMapper::GetDeviceUniquePath(const std::string& name, std::string* path) {
     struct dm_ioctl io;
     InitIo(&io, name);
@@ -690,3 +690,52 @@ TEST(libdm, CreateEmptyDevice) {
     // Empty device should be in suspended state.
     ASSERT_EQ(DmDeviceState::SUSPENDED, dm.GetState("empty-device"));
 }
+
+TEST(libdm, CreateDevices) {
+    unique_fd tmp(CreateTempFile("file_1", 4096));
+    ASSERT_GE(tmp, 0);
+    LoopDevice loop(tmp, 10s);
+    ASSERT_TRUE(loop.valid());
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    const std::vector<std::string> names = {"libdm-test-batch-a", "libdm-test-batch-b",
+                                            "libdm-test-batch-c"};
+    auto guard = android::base::make_scope_guard([&]() {
+        for (const auto& name : names) dm.DeleteDeviceIfExists(name, 5s);
+    });
+
+    std::vector<DmTable> tables(names.size());
+    std::vector<DeviceMapper::DeviceSpec> devices;
+    for (size_t i = 0; i < names.size(); i++) {
+        ASSERT_TRUE(tables[i].Emplace<DmTargetLinear>(0, 1, loop.device(), i));
+        devices.push_back({names[i], &tables[i]});
+    }
+
+    std::vector<std::string> paths;
+    ASSERT_TRUE(dm.CreateDevices(devices, &paths, 5s));
+    ASSERT_EQ(names.size(), paths.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        EXPECT_EQ(DmDeviceState::ACTIVE, dm.GetState(names[i]));
+        std::string path;
+        ASSERT_TRUE(dm.GetDmDevicePathByName(names[i], &path));
+        EXPECT_EQ(path, paths[i]);
+        EXPECT_EQ(0, access(paths[i].c_str(), F_OK));
+    }
+}
+
+TEST(libdm, CreateDevicesCleansUpOnFailure) {
+    DeviceMapper& dm = DeviceMapper::Instance();
+    auto guard = android::base::make_scope_guard(
+            [&]() { dm.DeleteDeviceIfExists("libdm-test-batch-fail", 5s); });
+
+    DmTable table;
+    ASSERT_TRUE(table.Emplace<DmTargetZero>(0, 1));
+
+    // The second device has the same name as the first, so it can't be created.
+    std::vector<DeviceMapper::DeviceSpec> devices = {{"libdm-test-batch-fail", &table},
+                                                     {"libdm-test-batch-fail", &table}};
+    std::vector<std::string> paths;
+    ASSERT_FALSE(dm.CreateDevices(devices, &paths, 5s));
+    EXPECT_TRUE(paths.empty());
+    EXPECT_EQ(DmDeviceState::INVALID, dm.GetState("libdm-test-batch-fail"));
+}
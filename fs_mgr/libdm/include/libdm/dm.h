@@ -158,6 +158,23 @@ class DeviceMapper final {
     bool CreateDevice(const std::string& name, const DmTable& table, std::string* path,
                       const std::chrono::milliseconds& timeout_ms);
 
+    // A device for CreateDevices(). |table| must remain valid for the call.
+    struct DeviceSpec {
+        std::string name;
+        const DmTable* table;
+    };
+
+    // Creates several devices, as CreateDevice() above would. The create,
+    // load and resume ioctls are issued for all of them first, and then their
+    // paths are waited for together, so ueventd can work through the whole
+    // batch instead of one device at a time. |paths| receives the path of
+    // each device, in the same order.
+    //
+    // If any device can't be created or doesn't appear within |timeout_ms|,
+    // every device created by this call is deleted and false is returned.
+    bool CreateDevices(const std::vector<DeviceSpec>& devices, std::vector<std::string>* paths,
+                       const std::chrono::milliseconds& timeout_ms);
+
     // Create a device and activate the given table, without waiting to acquire
     // a valid path. If the caller will use GetDmDevicePathByName(), it should
     // use the timeout variant above.
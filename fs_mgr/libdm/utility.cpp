@@ -15,11 +15,18 @@
 #include "utility.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <set>
 #include <thread>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
 using namespace std::literals;
 
@@ -58,6 +65,71 @@ bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeo
     return WaitForCondition(condition, timeout_ms);
 }
 
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms) {
+    android::base::unique_fd inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    if (inotify_fd < 0) {
+        PLOG(WARNING) << "inotify_init1 failed, polling instead";
+    }
+
+    std::set<std::string> unwatched_dirs;
+    for (const auto& path : paths) {
+        unwatched_dirs.emplace(android::base::Dirname(path));
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::string> pending = paths;
+    while (true) {
+        // Watch directories as they appear. Check the files after adding the
+        // watches, so that a file created in between isn't missed.
+        if (inotify_fd >= 0) {
+            for (auto iter = unwatched_dirs.begin(); iter != unwatched_dirs.end();) {
+                if (inotify_add_watch(inotify_fd, iter->c_str(), IN_CREATE | IN_MOVED_TO) >= 0) {
+                    iter = unwatched_dirs.erase(iter);
+                } else {
+                    iter++;
+                }
+            }
+        }
+
+        bool failed = false;
+        auto exists = [&](const std::string& path) -> bool {
+            // If the file exists but returns EPERM or something, we consider
+            // it present, as WaitForFile() does.
+            if (access(path.c_str(), F_OK) == 0) return true;
+            if (errno == ENOENT) return false;
+            PLOG(ERROR) << "access failed: " << path;
+            failed = true;
+            return true;
+        };
+        pending.erase(std::remove_if(pending.begin(), pending.end(), exists), pending.end());
+        if (failed) return false;
+        if (pending.empty()) return true;
+
+        auto now = std::chrono::steady_clock::now();
+        auto time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
+        if (time_elapsed > timeout_ms) {
+            LOG(ERROR) << "Timed out waiting for: " << android::base::Join(pending, ", ");
+            return false;
+        }
+
+        // Without a watch on every directory, fall back to checking every
+        // 20ms like WaitForCondition().
+        auto wait = timeout_ms - time_elapsed;
+        if (inotify_fd < 0 || !unwatched_dirs.empty()) {
+            wait = std::min<std::chrono::milliseconds>(wait, 20ms);
+        }
+        struct pollfd pfd = {.fd = inotify_fd.get(), .events = POLLIN};
+        if (inotify_fd < 0) {
+            std::this_thread::sleep_for(wait);
+        } else if (TEMP_FAILURE_RETRY(poll(&pfd, 1, wait.count() + 1)) > 0) {
+            char buffer[4096];
+            while (read(inotify_fd, buffer, sizeof(buffer)) > 0) {
+            }
+        }
+    }
+}
+
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
     auto condition = [&]() -> WaitResult {
         if (access(path.c_str(), F_OK) == 0) {
@@ -156,18 +156,24 @@ class CowSnapuserdTest final {
 
 class CowSnapuserdMetadataTest final {
   public:
+    ~CowSnapuserdMetadataTest();
     void Setup();
     void SetupPartialArea();
+    void SetupAdoptedMetadata();
+    void SetupStaleMetadata();
     void ValidateMetadata();
     void ValidatePartialFilledArea();
 
   private:
     void InitMetadata();
+    void InitPersistedMetadata(const std::string& misc_name);
     void CreateCowDevice();
     void CreateCowPartialFilledArea();
 
     std::unique_ptr<Snapuserd> snapuserd_;
     std::unique_ptr<TemporaryFile> cow_system_;
+    TemporaryDir metadata_dir_;
+    std::string metadata_path_;
     size_t size_ = 1_MiB;
 };
 
@@ -856,8 +862,11 @@ void CowSnapuserdTest::MergeInterrupt() {
 }
 
 void CowSnapuserdMetadataTest::CreateCowPartialFilledArea() {
-    std::string path = android::base::GetExecutableDirectory();
-    cow_system_ = std::make_unique<TemporaryFile>(path);
+    // Rewrite the COW in place if there is one, as an update would.
+    if (!cow_system_) {
+        std::string path = android::base::GetExecutableDirectory();
+        cow_system_ = std::make_unique<TemporaryFile>(path);
+    }
 
     CowOptions options;
     options.compression = "gz";
@@ -978,11 +987,57 @@ void CowSnapuserdMetadataTest::InitMetadata() {
     ASSERT_TRUE(snapuserd_->InitCowDevice());
 }
 
+void CowSnapuserdMetadataTest::InitPersistedMetadata(const std::string& misc_name) {
+    snapuserd_ = std::make_unique<Snapuserd>(misc_name, cow_system_->path, "");
+    snapuserd_->SetMetadataDir(metadata_dir_.path);
+    ASSERT_TRUE(snapuserd_->InitCowDevice());
+    metadata_path_ = snapuserd_->GetMetadataPath();
+}
+
+CowSnapuserdMetadataTest::~CowSnapuserdMetadataTest() {
+    snapuserd_ = nullptr;
+    if (!metadata_path_.empty()) {
+        unlink(metadata_path_.c_str());
+    }
+}
+
 void CowSnapuserdMetadataTest::Setup() {
     CreateCowDevice();
     InitMetadata();
 }
 
+void CowSnapuserdMetadataTest::SetupAdoptedMetadata() {
+    CreateCowDevice();
+    InitPersistedMetadata("system-user-cow-init");
+    ASSERT_FALSE(snapuserd_->IsMetadataAdopted());
+    auto computed = std::move(snapuserd_);
+
+    // The second stage daemon takes over the device under another name.
+    InitPersistedMetadata("system-user-cow");
+    ASSERT_TRUE(snapuserd_->IsMetadataAdopted());
+    ASSERT_EQ(snapuserd_->GetNumSectors(), computed->GetNumSectors());
+
+    const auto& chunk_vec = snapuserd_->GetChunkVec();
+    const auto& computed_chunk_vec = computed->GetChunkVec();
+    ASSERT_EQ(chunk_vec.size(), computed_chunk_vec.size());
+    for (size_t i = 0; i < chunk_vec.size(); i++) {
+        ASSERT_EQ(chunk_vec[i].first, computed_chunk_vec[i].first);
+        ASSERT_EQ(memcmp(chunk_vec[i].second, computed_chunk_vec[i].second, sizeof(CowOperation)),
+                  0);
+    }
+    ASSERT_EQ(snapuserd_->GetReadAheadOpsVec().size(), computed->GetReadAheadOpsVec().size());
+}
+
+void CowSnapuserdMetadataTest::SetupStaleMetadata() {
+    CreateCowDevice();
+    InitPersistedMetadata("system-user-cow");
+
+    // A different COW for the same device must not adopt the metadata of the previous one.
+    CreateCowPartialFilledArea();
+    InitPersistedMetadata("system-user-cow");
+    ASSERT_FALSE(snapuserd_->IsMetadataAdopted());
+}
+
 void CowSnapuserdMetadataTest::ValidateMetadata() {
     int area_sz = snapuserd_->GetMetadataAreaSize();
     ASSERT_EQ(area_sz, 3);
@@ -1119,6 +1174,18 @@ TEST(Snapuserd_Test, Snapshot_Metadata_Overlap) {
     harness.ValidatePartialFilledArea();
 }
 
+TEST(Snapuserd_Test, Snapshot_Metadata_Adopted) {
+    CowSnapuserdMetadataTest harness;
+    harness.SetupAdoptedMetadata();
+    harness.ValidateMetadata();
+}
+
+TEST(Snapuserd_Test, Snapshot_Metadata_Stale) {
+    CowSnapuserdMetadataTest harness;
+    harness.SetupStaleMetadata();
+    harness.ValidatePartialFilledArea();
+}
+
 TEST(Snapuserd_Test, Snapshot_Merge_Resume) {
     CowSnapuserdTest harness;
     ASSERT_TRUE(harness.Setup());
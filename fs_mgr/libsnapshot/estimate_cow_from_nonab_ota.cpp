@@ -18,14 +18,25 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/scopeguard.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gflags/gflags.h>
@@ -34,9 +45,12 @@
 #include <sparse/sparse.h>
 #include <ziparchive/zip_archive.h>
 
+#include "worker_pool.h"
+
 DEFINE_string(source_tf, "", "Source target files (dir or zip file)");
 DEFINE_string(ota_tf, "", "Target files of the build for an OTA");
 DEFINE_string(compression, "gz", "Compression (options: none, gz, brotli)");
+DEFINE_uint32(threads, 0, "Number of block batches to analyze at once (0 for one per CPU)");
 
 namespace android {
 namespace snapshot {
@@ -45,6 +59,7 @@ using android::base::borrowed_fd;
 using android::base::unique_fd;
 
 static constexpr size_t kBlockSize = 4096;
+static constexpr uint64_t kBlocksPerBatch = 256;
 
 void MyLogger(android::base::LogId, android::base::LogSeverity severity, const char*, const char*,
               unsigned int, const char* message) {
@@ -69,6 +84,8 @@ class TargetFilesPackage final {
     std::string path_;
     unique_fd fd_;
     std::unique_ptr<ZipArchive, decltype(&CloseArchive)> zip_;
+    // Serializes lookups and extraction from zip_, as partitions are analyzed in parallel.
+    std::mutex zip_lock_;
 };
 
 TargetFilesPackage::TargetFilesPackage(const std::string& path)
@@ -102,6 +119,7 @@ bool TargetFilesPackage::Open() {
 
 bool TargetFilesPackage::HasFile(const std::string& path) {
     if (zip_) {
+        std::lock_guard<std::mutex> lock(zip_lock_);
         ZipEntry64 entry;
         return !FindEntry(zip_.get(), path, &entry);
     }
@@ -121,6 +139,7 @@ unique_fd TargetFilesPackage::OpenFile(const std::string& path) {
         return fd;
     }
 
+    std::lock_guard<std::mutex> lock(zip_lock_);
     ZipEntry64 entry;
     if (FindEntry(zip_.get(), path, &entry)) {
         LOG(ERROR) << path << " not found in archive: " << path_;
@@ -206,23 +225,45 @@ std::unordered_set<std::string> TargetFilesPackage::GetDynamicPartitionNames() {
     return set;
 }
 
+// How a block of the target image ends up in the COW.
+struct BlockOp {
+    enum Type { kZero, kUnchanged, kCopy, kRaw } type;
+    uint64_t source_block;
+};
+
+// Consecutive blocks of the target image, starting at first_block.
+struct BlockBatch {
+    uint64_t first_block;
+    std::string data;
+    std::vector<BlockOp> ops;
+};
+
 class NonAbEstimator final {
   public:
     NonAbEstimator(const std::string& ota_tf_path, const std::string& source_tf_path)
-        : ota_tf_path_(ota_tf_path), source_tf_path_(source_tf_path) {}
+        : ota_tf_path_(ota_tf_path),
+          source_tf_path_(source_tf_path),
+          threads_(FLAGS_threads ?: std::max(std::thread::hardware_concurrency(), 1u)),
+          pool_(threads_) {}
 
     bool Run();
 
   private:
     bool OpenPackages();
     bool AnalyzePartition(const std::string& partition_name);
-    std::unordered_map<std::string, uint64_t> GetBlockMap(borrowed_fd fd);
+    std::optional<BlockBatch> AnalyzeBlocks(
+            borrowed_fd fd, uint64_t first_block, uint64_t num_blocks, borrowed_fd source_fd,
+            uint64_t source_size, const std::unordered_map<std::string, uint64_t>& source_blocks);
+    std::unordered_map<std::string, uint64_t> GetBlockMap(borrowed_fd fd, uint64_t size);
 
     std::string ota_tf_path_;
     std::string source_tf_path_;
     std::unique_ptr<TargetFilesPackage> ota_tf_;
     std::unique_ptr<TargetFilesPackage> source_tf_;
-    uint64_t size_ = 0;
+    std::atomic<uint64_t> size_ = 0;
+    unsigned int threads_;
+    // Analyzes the blocks of all partitions, which bounds how many are analyzed at once.
+    WorkerPool pool_;
 };
 
 bool NonAbEstimator::Run() {
@@ -235,10 +276,25 @@ bool NonAbEstimator::Run() {
         LOG(ERROR) << "No dynamic partitions found in META/misc_info.txt";
         return false;
     }
-    for (const auto& partition : partitions) {
-        if (!AnalyzePartition(partition)) {
-            return false;
-        }
+
+    // Partitions have their own COW, so up to threads_ of them are analyzed at once.
+    std::vector<std::string> names(partitions.begin(), partitions.end());
+    // Partitions wait for blocks in pool_, so they can't run there themselves.
+    WorkerPool workers(std::min<size_t>(threads_, names.size()));
+    std::atomic<bool> failed = false;
+    std::vector<std::future<void>> results;
+    for (const auto& name : names) {
+        results.emplace_back(workers.Submit([this, &failed, &name] {
+            if (!failed && !AnalyzePartition(name)) {
+                failed = true;
+            }
+        }));
+    }
+    for (auto& result : results) {
+        result.wait();
+    }
+    if (failed) {
+        return false;
     }
 
     int64_t size_in_mb = int64_t(double(size_) / 1024.0 / 1024.0);
@@ -292,8 +348,8 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
             }
             source_size = s.st_size;
 
-            std::cout << "Hashing blocks for " << partition_name << "...\n";
-            source_blocks = GetBlockMap(source_fd);
+            std::cout << "Hashing blocks for " + partition_name + "...\n";
+            source_blocks = GetBlockMap(source_fd, source_size);
             if (source_blocks.empty()) {
                 LOG(ERROR) << "Could not build a block map for source partition: "
                            << partition_name;
@@ -324,53 +380,73 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
         return false;
     }
 
-    LOG(INFO) << "Analyzing " << partition_name << " ...";
+    struct stat target;
+    if (fstat(fd.get(), &target) < 0) {
+        PLOG(ERROR) << "fstat failed";
+        return false;
+    }
+    // A partial block at the end of the image is not part of the partition.
+    uint64_t num_blocks = target.st_size / kBlockSize;
 
-    std::string zeroes(kBlockSize, '\0');
-    std::string chunk(kBlockSize, '\0');
-    std::string src_chunk(kBlockSize, '\0');
-    uint64_t next_block_number = 0;
-    while (true) {
-        if (!android::base::ReadFully(fd, chunk.data(), chunk.size())) {
-            if (errno) {
-                PLOG(ERROR) << "read failed";
-                return false;
-            }
-            break;
+    LOG(INFO) << "Analyzing " << partition_name << " ...";
+    auto start = std::chrono::steady_clock::now();
+
+    // Blocks are analyzed independently of each other, so batches of them are analyzed in
+    // parallel. They are added to the COW in block order, which keeps its size the same as when
+    // analyzed one block at a time, and bounds how many analyzed batches wait in memory.
+    auto analyze = [&](uint64_t first_block, uint64_t count) -> std::optional<BlockBatch> {
+        return AnalyzeBlocks(fd, first_block, count, source_fd, source_size, source_blocks);
+    };
+    std::deque<std::future<std::optional<BlockBatch>>> pending;
+    // Batches still in the pool use the images opened above, so let them finish before returning.
+    auto wait_pending = android::base::make_scope_guard([&] {
+        for (auto& batch : pending) {
+            batch.wait();
         }
-
-        uint64_t block_number = next_block_number++;
-        if (chunk == zeroes) {
-            if (!writer->AddZeroBlocks(block_number, 1)) {
-                LOG(ERROR) << "Could not add zero block";
-                return false;
-            }
-            continue;
+    });
+    auto write_next = [&]() -> bool {
+        auto batch = pending.front().get();
+        pending.pop_front();
+        if (!batch) {
+            return false;
         }
-
-        uint64_t source_offset = block_number * kBlockSize;
-        if (source_fd >= 0 && source_offset <= source_size) {
-            off64_t offset = block_number * kBlockSize;
-            if (android::base::ReadFullyAtOffset(source_fd, src_chunk.data(), src_chunk.size(),
-                                                 offset)) {
-                if (chunk == src_chunk) {
-                    continue;
-                }
-            } else if (errno) {
-                PLOG(ERROR) << "pread failed";
-                return false;
+        for (size_t i = 0; i < batch->ops.size(); i++) {
+            uint64_t block_number = batch->first_block + i;
+            const auto& op = batch->ops[i];
+            switch (op.type) {
+                case BlockOp::kZero:
+                    if (!writer->AddZeroBlocks(block_number, 1)) {
+                        LOG(ERROR) << "Could not add zero block";
+                        return false;
+                    }
+                    break;
+                case BlockOp::kUnchanged:
+                    break;
+                case BlockOp::kCopy:
+                    if (!writer->AddCopy(block_number, op.source_block)) {
+                        return false;
+                    }
+                    break;
+                case BlockOp::kRaw:
+                    if (!writer->AddRawBlocks(block_number, &batch->data[i * kBlockSize],
+                                              kBlockSize)) {
+                        return false;
+                    }
+                    break;
             }
         }
-
-        auto hash = SHA256(chunk);
-        if (auto iter = source_blocks.find(hash); iter != source_blocks.end()) {
-            if (!writer->AddCopy(block_number, iter->second)) {
-                return false;
-            }
-            continue;
+        return true;
+    };
+    for (uint64_t first_block = 0; first_block < num_blocks; first_block += kBlocksPerBatch) {
+        if (pending.size() >= threads_ && !write_next()) {
+            return false;
         }
-
-        if (!writer->AddRawBlocks(block_number, chunk.data(), chunk.size())) {
+        uint64_t count = std::min(kBlocksPerBatch, num_blocks - first_block);
+        pending.emplace_back(pool_.Submit(
+                [analyze, first_block, count] { return analyze(first_block, count); }));
+    }
+    while (!pending.empty()) {
+        if (!write_next()) {
             return false;
         }
     }
@@ -386,25 +462,101 @@ bool NonAbEstimator::AnalyzePartition(const std::string& partition_name) {
     }
 
     size_ += s.st_size;
+
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    double mib = num_blocks * kBlockSize / 1024.0 / 1024.0;
+    LOG(INFO) << partition_name << ": analyzed " << mib << " MiB in " << seconds.count() << " s ("
+              << mib / seconds.count() << " MiB/s)";
     return true;
 }
 
-std::unordered_map<std::string, uint64_t> NonAbEstimator::GetBlockMap(borrowed_fd fd) {
-    std::string chunk(kBlockSize, '\0');
+std::optional<BlockBatch> NonAbEstimator::AnalyzeBlocks(
+        borrowed_fd fd, uint64_t first_block, uint64_t num_blocks, borrowed_fd source_fd,
+        uint64_t source_size, const std::unordered_map<std::string, uint64_t>& source_blocks) {
+    BlockBatch batch;
+    batch.first_block = first_block;
+    batch.data.resize(num_blocks * kBlockSize);
+    if (!android::base::ReadFullyAtOffset(fd, batch.data.data(), batch.data.size(),
+                                          first_block * kBlockSize)) {
+        PLOG(ERROR) << "read failed";
+        return {};
+    }
 
-    std::unordered_map<std::string, uint64_t> block_map;
-    uint64_t block_number = 0;
-    while (true) {
-        if (!android::base::ReadFully(fd, chunk.data(), chunk.size())) {
-            if (errno) {
+    std::string zeroes(kBlockSize, '\0');
+    std::string src_chunk(kBlockSize, '\0');
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        uint64_t block_number = first_block + i;
+        auto chunk = std::string_view(batch.data).substr(i * kBlockSize, kBlockSize);
+        if (chunk == zeroes) {
+            batch.ops.push_back({BlockOp::kZero, 0});
+            continue;
+        }
+
+        uint64_t source_offset = block_number * kBlockSize;
+        if (source_fd.get() >= 0 && source_offset + kBlockSize <= source_size) {
+            if (!android::base::ReadFullyAtOffset(source_fd, src_chunk.data(), src_chunk.size(),
+                                                  source_offset)) {
+                PLOG(ERROR) << "pread failed";
+                return {};
+            }
+            if (chunk == src_chunk) {
+                batch.ops.push_back({BlockOp::kUnchanged, 0});
+                continue;
+            }
+        }
+
+        auto hash = SHA256(std::string(chunk));
+        if (auto iter = source_blocks.find(hash); iter != source_blocks.end()) {
+            batch.ops.push_back({BlockOp::kCopy, iter->second});
+            continue;
+        }
+        batch.ops.push_back({BlockOp::kRaw, 0});
+    }
+    return batch;
+}
+
+std::unordered_map<std::string, uint64_t> NonAbEstimator::GetBlockMap(borrowed_fd fd,
+                                                                      uint64_t size) {
+    // Hash ranges of blocks in parallel, then map them in block order, so that a block that
+    // appears more than once maps to its last copy, as when hashed one block at a time.
+    uint64_t num_blocks = size / kBlockSize;
+    uint64_t blocks_per_thread = (num_blocks + threads_ - 1) / threads_;
+    using Hashes = std::vector<std::string>;
+    auto hash_blocks = [&](uint64_t first, uint64_t last) -> std::optional<Hashes> {
+        Hashes hashes;
+        std::string chunk(kBlockSize, '\0');
+        for (uint64_t block = first; block < last; block++) {
+            if (!android::base::ReadFullyAtOffset(fd, chunk.data(), chunk.size(),
+                                                  block * kBlockSize)) {
                 PLOG(ERROR) << "read failed";
                 return {};
             }
-            break;
+            hashes.emplace_back(SHA256(chunk));
         }
-        auto hash = SHA256(chunk);
-        block_map[hash] = block_number;
-        block_number++;
+        return hashes;
+    };
+    std::vector<std::future<std::optional<Hashes>>> ranges;
+    for (uint64_t first = 0; first < num_blocks; first += blocks_per_thread) {
+        uint64_t last = std::min(first + blocks_per_thread, num_blocks);
+        ranges.emplace_back(
+                pool_.Submit([hash_blocks, first, last] { return hash_blocks(first, last); }));
+    }
+
+    std::unordered_map<std::string, uint64_t> block_map;
+    uint64_t block_number = 0;
+    bool ok = true;
+    for (auto& range : ranges) {
+        auto hashes = range.get();
+        if (!hashes) {
+            ok = false;
+            continue;
+        }
+        for (auto& hash : *hashes) {
+            block_map[std::move(hash)] = block_number++;
+        }
+    }
+    if (!ok) {
+        return {};
     }
     return block_map;
 }
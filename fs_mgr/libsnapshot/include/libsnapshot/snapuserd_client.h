@@ -32,6 +32,10 @@ static constexpr uint32_t PACKET_SIZE = 512;
 
 static constexpr char kSnapuserdSocket[] = "snapuserd";
 
+// Each daemon persists the metadata it computes from a COW device here, in tmpfs, so that the
+// daemons started after it for the same device can adopt it instead of reading the COW again.
+static constexpr char kSnapuserdMetadataDir[] = "/dev/snapuserd_metadata";
+
 // Ensure that the second-stage daemon for snapuserd is running.
 bool EnsureSnapuserdStarted();
 
@@ -21,13 +21,21 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/scopeguard.h>
 #include <android-base/unique_fd.h>
 #include <bsdiff/bspatch.h>
 #include <bzlib.h>
@@ -39,6 +47,9 @@
 #include <xz.h>
 #include <ziparchive/zip_archive.h>
 
+#include "make_cow_from_ab_ota.h"
+#include "worker_pool.h"
+
 namespace android {
 namespace snapshot {
 
@@ -54,15 +65,7 @@ static constexpr uint64_t kBlockSize = 4096;
 DEFINE_string(source_tf, "", "Source target files (dir or zip file) for incremental payloads");
 DEFINE_string(compression, "gz", "Compression type to use (none or gz)");
 DEFINE_uint32(cluster_ops, 0, "Number of Cow Ops per cluster (0 or >1)");
-
-void MyLogger(android::base::LogId, android::base::LogSeverity severity, const char*, const char*,
-              unsigned int, const char* message) {
-    if (severity == android::base::ERROR) {
-        fprintf(stderr, "%s\n", message);
-    } else {
-        fprintf(stdout, "%s\n", message);
-    }
-}
+DEFINE_uint32(threads, 0, "Number of operations to convert at once (0 for one per CPU)");
 
 uint64_t ToLittleEndian(uint64_t value) {
     union {
@@ -77,23 +80,91 @@ uint64_t ToLittleEndian(uint64_t value) {
     return packed.u64;
 }
 
+template <typename T>
+static uint64_t SizeOfAllExtents(const T& extents) {
+    uint64_t total = 0;
+    for (const auto& extent : extents) {
+        total += extent.num_blocks() * kBlockSize;
+    }
+    return total;
+}
+
+// Records what an InstallOperation adds to the COW, so that operations can be converted in
+// parallel and still be added to the COW in payload order.
+class CowOpRecorder final {
+  public:
+    bool AddCopy(uint64_t new_block, uint64_t old_block) {
+        ops_.push_back({kCowCopyOp, new_block, old_block, 0});
+        return true;
+    }
+    bool AddRawBlocks(uint64_t new_block_start, const void* data, size_t size) {
+        ops_.push_back({kCowReplaceOp, new_block_start, data_.size(), size});
+        data_.insert(data_.end(), static_cast<const uint8_t*>(data),
+                     static_cast<const uint8_t*>(data) + size);
+        return true;
+    }
+    bool AddZeroBlocks(uint64_t new_block_start, uint64_t num_blocks) {
+        ops_.push_back({kCowZeroOp, new_block_start, 0, num_blocks});
+        return true;
+    }
+
+    bool Replay(ICowWriter* writer) const {
+        for (const auto& op : ops_) {
+            switch (op.type) {
+                case kCowCopyOp:
+                    if (!writer->AddCopy(op.new_block, op.source)) {
+                        LOG(ERROR) << "Could not add copy operation";
+                        return false;
+                    }
+                    break;
+                case kCowReplaceOp:
+                    if (!writer->AddRawBlocks(op.new_block, &data_[op.source], op.length)) {
+                        LOG(ERROR) << "Could not add raw blocks";
+                        return false;
+                    }
+                    break;
+                case kCowZeroOp:
+                    if (!writer->AddZeroBlocks(op.new_block, op.length)) {
+                        LOG(ERROR) << "Could not add zero operation";
+                        return false;
+                    }
+                    break;
+            }
+        }
+        return true;
+    }
+
+  private:
+    struct Op {
+        uint8_t type;
+        uint64_t new_block;
+        // The source block of copy operations, and the offset in data_ of replace operations.
+        uint64_t source;
+        // The size of replace operations, and the number of blocks of zero operations.
+        uint64_t length;
+    };
+    std::vector<Op> ops_;
+    std::vector<uint8_t> data_;
+};
+
+class PartitionConverter;
+
 class PayloadConverter final {
   public:
     PayloadConverter(const std::string& in_file, const std::string& out_dir)
-        : in_file_(in_file), out_dir_(out_dir), source_tf_zip_(nullptr, &CloseArchive) {}
+        : in_file_(in_file),
+          out_dir_(out_dir),
+          source_tf_zip_(nullptr, &CloseArchive),
+          threads_(FLAGS_threads ?: std::max(std::thread::hardware_concurrency(), 1u)),
+          pool_(threads_) {}
 
     bool Run();
 
   private:
+    friend class PartitionConverter;
+
     bool OpenPayload();
     bool OpenSourceTargetFiles();
-    bool ProcessPartition(const PartitionUpdate& update);
-    bool ProcessOperation(const InstallOperation& op);
-    bool ProcessZero(const InstallOperation& op);
-    bool ProcessCopy(const InstallOperation& op);
-    bool ProcessReplace(const InstallOperation& op);
-    bool ProcessDiff(const InstallOperation& op);
-    borrowed_fd OpenSourceImage();
 
     std::string in_file_;
     std::string out_dir_;
@@ -103,8 +174,32 @@ class PayloadConverter final {
     std::unordered_set<std::string> dap_;
     unique_fd source_tf_fd_;
     std::unique_ptr<ZipArchive, decltype(&CloseArchive)> source_tf_zip_;
+    // Serializes extracting source images from source_tf_zip_.
+    std::mutex source_tf_lock_;
+
+    unsigned int threads_;
+    // Converts the operations of all partitions, which bounds how many are converted at once.
+    WorkerPool pool_;
+};
+
+// Converts the operations of one partition and writes its COW.
+class PartitionConverter final {
+  public:
+    PartitionConverter(PayloadConverter* payload, const PartitionUpdate& update)
+        : payload_(payload), update_(update), partition_name_(update.partition_name()) {}
+
+    bool Run();
+
+  private:
+    bool ProcessOperation(const InstallOperation& op, CowOpRecorder* out);
+    bool ProcessZero(const InstallOperation& op, CowOpRecorder* out);
+    bool ProcessCopy(const InstallOperation& op, CowOpRecorder* out);
+    bool ProcessReplace(const InstallOperation& op, CowOpRecorder* out);
+    bool ProcessDiff(const InstallOperation& op, CowOpRecorder* out);
+    borrowed_fd OpenSourceImage();
 
-    // Updated during ProcessPartition().
+    PayloadConverter* payload_;
+    const PartitionUpdate& update_;
     std::string partition_name_;
     std::unique_ptr<CowWriter> writer_;
     unique_fd source_image_;
@@ -133,14 +228,33 @@ bool PayloadConverter::Run() {
         return false;
     }
 
+    // Partitions have their own COW and only read the payload and their source image, so up to
+    // threads_ of them are converted at once. Their operations all go to pool_, so with one
+    // thread, this converts the payload one operation at a time, as update_engine would.
+    std::vector<std::unique_ptr<PartitionConverter>> converters;
     for (const auto& update : manifest_.partitions()) {
-        if (!ProcessPartition(update)) {
-            return false;
+        if (dap_.find(update.partition_name()) == dap_.end()) {
+            // Skip non-DAP partitions.
+            continue;
         }
-        writer_ = nullptr;
-        source_image_.reset();
+        converters.emplace_back(std::make_unique<PartitionConverter>(this, update));
     }
-    return true;
+
+    // Partitions wait for operations in pool_, so they can't run there themselves.
+    WorkerPool partitions(std::min<size_t>(threads_, converters.size()));
+    std::atomic<bool> failed = false;
+    std::vector<std::future<void>> results;
+    for (auto& converter : converters) {
+        results.emplace_back(partitions.Submit([&failed, &converter] {
+            if (!failed && !converter->Run()) {
+                failed = true;
+            }
+        }));
+    }
+    for (auto& result : results) {
+        result.wait();
+    }
+    return !failed;
 }
 
 bool PayloadConverter::OpenSourceTargetFiles() {
@@ -173,14 +287,8 @@ bool PayloadConverter::OpenSourceTargetFiles() {
     return true;
 }
 
-bool PayloadConverter::ProcessPartition(const PartitionUpdate& update) {
-    auto partition_name = update.partition_name();
-    if (dap_.find(partition_name) == dap_.end()) {
-        // Skip non-DAP partitions.
-        return true;
-    }
-
-    auto path = out_dir_ + "/" + partition_name + ".cow";
+bool PartitionConverter::Run() {
+    auto path = payload_->out_dir_ + "/" + partition_name_ + ".cow";
     unique_fd fd(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
     if (fd < 0) {
         PLOG(ERROR) << "open failed: " << path;
@@ -198,34 +306,76 @@ bool PayloadConverter::ProcessPartition(const PartitionUpdate& update) {
         return false;
     }
 
-    partition_name_ = partition_name;
+    // Diff operations all read the source image, so open it before converting any of them.
+    const auto& operations = update_.operations();
+    bool has_diff = std::any_of(operations.begin(), operations.end(), [](const auto& op) {
+        return op.type() == InstallOperation::BROTLI_BSDIFF ||
+               op.type() == InstallOperation::PUFFDIFF;
+    });
+    if (has_diff && OpenSourceImage() < 0) {
+        return false;
+    }
 
-    for (const auto& op : update.operations()) {
-        if (!ProcessOperation(op)) {
+    // Operations write disjoint blocks from the payload and the source image, neither of which
+    // changes, so they are converted in parallel. They are added to the COW in payload order,
+    // which keeps it the same as when converted one at a time, and bounds how many converted
+    // operations wait in memory.
+    auto start = std::chrono::steady_clock::now();
+    auto convert = [this](const InstallOperation* op) -> std::unique_ptr<CowOpRecorder> {
+        auto out = std::make_unique<CowOpRecorder>();
+        return ProcessOperation(*op, out.get()) ? std::move(out) : nullptr;
+    };
+    std::deque<std::future<std::unique_ptr<CowOpRecorder>>> pending;
+    // Operations still in the pool use this converter, so let them finish before returning.
+    auto wait_pending = android::base::make_scope_guard([&] {
+        for (auto& out : pending) {
+            out.wait();
+        }
+    });
+    auto write_next = [&]() -> bool {
+        auto out = pending.front().get();
+        pending.pop_front();
+        return out && out->Replay(writer_.get());
+    };
+    uint64_t bytes = 0;
+    for (const auto& op : operations) {
+        if (pending.size() >= payload_->threads_ && !write_next()) {
+            return false;
+        }
+        pending.emplace_back(payload_->pool_.Submit([convert, &op] { return convert(&op); }));
+        bytes += SizeOfAllExtents(op.dst_extents());
+    }
+    while (!pending.empty()) {
+        if (!write_next()) {
             return false;
         }
     }
 
     if (!writer_->Finalize()) {
-        LOG(ERROR) << "Unable to finalize COW for " << partition_name;
+        LOG(ERROR) << "Unable to finalize COW for " << partition_name_;
         return false;
     }
+
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    double mib = bytes / 1024.0 / 1024.0;
+    LOG(INFO) << partition_name_ << ": converted " << operations.size() << " operations, " << mib
+              << " MiB in " << seconds.count() << " s (" << mib / seconds.count() << " MiB/s)";
     return true;
 }
 
-bool PayloadConverter::ProcessOperation(const InstallOperation& op) {
+bool PartitionConverter::ProcessOperation(const InstallOperation& op, CowOpRecorder* out) {
     switch (op.type()) {
         case InstallOperation::SOURCE_COPY:
-            return ProcessCopy(op);
+            return ProcessCopy(op, out);
         case InstallOperation::BROTLI_BSDIFF:
         case InstallOperation::PUFFDIFF:
-            return ProcessDiff(op);
+            return ProcessDiff(op, out);
         case InstallOperation::REPLACE:
         case InstallOperation::REPLACE_XZ:
         case InstallOperation::REPLACE_BZ:
-            return ProcessReplace(op);
+            return ProcessReplace(op, out);
         case InstallOperation::ZERO:
-            return ProcessZero(op);
+            return ProcessZero(op, out);
         default:
             LOG(ERROR) << "Unsupported op: " << (int)op.type();
             return false;
@@ -233,9 +383,9 @@ bool PayloadConverter::ProcessOperation(const InstallOperation& op) {
     return true;
 }
 
-bool PayloadConverter::ProcessZero(const InstallOperation& op) {
+bool PartitionConverter::ProcessZero(const InstallOperation& op, CowOpRecorder* out) {
     for (const auto& extent : op.dst_extents()) {
-        if (!writer_->AddZeroBlocks(extent.start_block(), extent.num_blocks())) {
+        if (!out->AddZeroBlocks(extent.start_block(), extent.num_blocks())) {
             LOG(ERROR) << "Could not add zero operation";
             return false;
         }
@@ -243,15 +393,6 @@ bool PayloadConverter::ProcessZero(const InstallOperation& op) {
     return true;
 }
 
-template <typename T>
-static uint64_t SizeOfAllExtents(const T& extents) {
-    uint64_t total = 0;
-    for (const auto& extent : extents) {
-        total += extent.num_blocks() * kBlockSize;
-    }
-    return total;
-}
-
 class PuffInputStream final : public puffin::StreamInterface {
   public:
     PuffInputStream(uint8_t* buffer, size_t length) : buffer_(buffer), length_(length), pos_(0) {}
@@ -327,7 +468,7 @@ class PuffOutputStream final : public puffin::StreamInterface {
     size_t pos_;
 };
 
-bool PayloadConverter::ProcessDiff(const InstallOperation& op) {
+bool PartitionConverter::ProcessDiff(const InstallOperation& op, CowOpRecorder* out) {
     auto source_image = OpenSourceImage();
     if (source_image < 0) {
         return false;
@@ -340,14 +481,9 @@ bool PayloadConverter::ProcessDiff(const InstallOperation& op) {
     // Read source bytes.
     for (const auto& extent : op.src_extents()) {
         uint64_t offset = extent.start_block() * kBlockSize;
-        if (lseek(source_image.get(), offset, SEEK_SET) < 0) {
-            PLOG(ERROR) << "lseek source image failed";
-            return false;
-        }
-
         uint64_t size = extent.num_blocks() * kBlockSize;
         CHECK(src_length - src_pos >= size);
-        if (!android::base::ReadFully(source_image, src.get() + src_pos, size)) {
+        if (!android::base::ReadFullyAtOffset(source_image, src.get() + src_pos, size, offset)) {
             PLOG(ERROR) << "read source image failed";
             return false;
         }
@@ -357,11 +493,8 @@ bool PayloadConverter::ProcessDiff(const InstallOperation& op) {
 
     // Read patch bytes.
     auto patch = std::make_unique<uint8_t[]>(op.data_length());
-    if (lseek(in_fd_.get(), payload_offset_ + op.data_offset(), SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek payload failed";
-        return false;
-    }
-    if (!android::base::ReadFully(in_fd_, patch.get(), op.data_length())) {
+    if (!android::base::ReadFullyAtOffset(payload_->in_fd_, patch.get(), op.data_length(),
+                                          payload_->payload_offset_ + op.data_offset())) {
         PLOG(ERROR) << "read payload failed";
         return false;
     }
@@ -401,7 +534,7 @@ bool PayloadConverter::ProcessDiff(const InstallOperation& op) {
         uint64_t size = extent.num_blocks() * kBlockSize;
         CHECK(dest.size() - dest_pos >= size);
 
-        if (!writer_->AddRawBlocks(extent.start_block(), &dest[dest_pos], size)) {
+        if (!out->AddRawBlocks(extent.start_block(), &dest[dest_pos], size)) {
             return false;
         }
         dest_pos += size;
@@ -409,7 +542,7 @@ bool PayloadConverter::ProcessDiff(const InstallOperation& op) {
     return true;
 }
 
-borrowed_fd PayloadConverter::OpenSourceImage() {
+borrowed_fd PartitionConverter::OpenSourceImage() {
     if (source_image_ >= 0) {
         return source_image_;
     }
@@ -417,7 +550,8 @@ borrowed_fd PayloadConverter::OpenSourceImage() {
     unique_fd unzip_fd;
 
     auto local_path = "IMAGES/" + partition_name_ + ".img";
-    if (source_tf_zip_) {
+    if (payload_->source_tf_zip_) {
+        std::lock_guard<std::mutex> lock(payload_->source_tf_lock_);
         {
             TemporaryFile tmp;
             if (tmp.fd < 0) {
@@ -428,11 +562,11 @@ borrowed_fd PayloadConverter::OpenSourceImage() {
         }
 
         ZipEntry64 entry;
-        if (FindEntry(source_tf_zip_.get(), local_path, &entry)) {
+        if (FindEntry(payload_->source_tf_zip_.get(), local_path, &entry)) {
             LOG(ERROR) << "not found in archive: " << local_path;
             return -1;
         }
-        if (ExtractEntryToFile(source_tf_zip_.get(), &entry, unzip_fd.get())) {
+        if (ExtractEntryToFile(payload_->source_tf_zip_.get(), &entry, unzip_fd.get())) {
             LOG(ERROR) << "could not extract " << local_path;
             return -1;
         }
@@ -440,8 +574,8 @@ borrowed_fd PayloadConverter::OpenSourceImage() {
             PLOG(ERROR) << "lseek failed";
             return -1;
         }
-    } else if (source_tf_fd_ >= 0) {
-        unzip_fd.reset(openat(source_tf_fd_.get(), local_path.c_str(), O_RDONLY));
+    } else if (payload_->source_tf_fd_ >= 0) {
+        unzip_fd.reset(openat(payload_->source_tf_fd_.get(), local_path.c_str(), O_RDONLY));
         if (unzip_fd < 0) {
             PLOG(ERROR) << "open failed: " << FLAGS_source_tf << "/" << local_path;
             return -1;
@@ -498,7 +632,7 @@ class ExtentIter final {
     uint64_t dst_index_;
 };
 
-bool PayloadConverter::ProcessCopy(const InstallOperation& op) {
+bool PartitionConverter::ProcessCopy(const InstallOperation& op, CowOpRecorder* out) {
     ExtentIter dst_blocks(op.dst_extents());
 
     for (const auto& extent : op.src_extents()) {
@@ -510,7 +644,7 @@ bool PayloadConverter::ProcessCopy(const InstallOperation& op) {
                 return false;
             }
             if (src_block == dst_block) continue;
-            if (!writer_->AddCopy(dst_block, src_block)) {
+            if (!out->AddCopy(dst_block, src_block)) {
                 LOG(ERROR) << "Could not add copy operation";
                 return false;
             }
@@ -519,15 +653,11 @@ bool PayloadConverter::ProcessCopy(const InstallOperation& op) {
     return true;
 }
 
-bool PayloadConverter::ProcessReplace(const InstallOperation& op) {
+bool PartitionConverter::ProcessReplace(const InstallOperation& op, CowOpRecorder* out) {
     auto buffer_size = op.data_length();
     auto buffer = std::make_unique<char[]>(buffer_size);
-    uint64_t offs = payload_offset_ + op.data_offset();
-    if (lseek(in_fd_.get(), offs, SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek " << offs << " failed";
-        return false;
-    }
-    if (!android::base::ReadFully(in_fd_, buffer.get(), buffer_size)) {
+    uint64_t offs = payload_->payload_offset_ + op.data_offset();
+    if (!android::base::ReadFullyAtOffset(payload_->in_fd_, buffer.get(), buffer_size, offs)) {
         PLOG(ERROR) << "read " << buffer_size << " bytes from offset " << offs << "failed";
         return false;
     }
@@ -600,7 +730,7 @@ bool PayloadConverter::ProcessReplace(const InstallOperation& op) {
             LOG(ERROR) << "replace op ran out of input buffer";
             return false;
         }
-        if (!writer_->AddRawBlocks(extent.start_block(), buffer.get() + buffer_pos, extent_size)) {
+        if (!out->AddRawBlocks(extent.start_block(), buffer.get() + buffer_pos, extent_size)) {
             LOG(ERROR) << "failed to add raw blocks from replace op";
             return false;
         }
@@ -672,21 +802,12 @@ bool PayloadConverter::OpenPayload() {
     return true;
 }
 
-}  // namespace snapshot
-}  // namespace android
-
-int main(int argc, char** argv) {
-    android::base::InitLogging(argv, android::snapshot::MyLogger);
-    gflags::SetUsageMessage("Convert OTA payload to a Virtual A/B COW");
-    int arg_start = gflags::ParseCommandLineFlags(&argc, &argv, false);
-
+bool ConvertPayloadToCow(const std::string& payload_path, const std::string& out_dir) {
     xz_crc32_init();
 
-    if (argc - arg_start != 2) {
-        std::cerr << "Usage: [options] <payload.bin> <out-dir>\n";
-        return 1;
-    }
-
-    android::snapshot::PayloadConverter pc(argv[arg_start], argv[arg_start + 1]);
-    return pc.Run() ? 0 : 1;
+    PayloadConverter pc(payload_path, out_dir);
+    return pc.Run();
 }
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,30 @@
+//
+// Copyright (C) 2020 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <string>
+
+namespace android {
+namespace snapshot {
+
+// Writes a COW to |out_dir| for each dynamic partition updated by the payload at |payload_path|,
+// as update_engine would write them. Uses the source_tf, compression, cluster_ops and threads
+// flags.
+bool ConvertPayloadToCow(const std::string& payload_path, const std::string& out_dir);
+
+}  // namespace snapshot
+}  // namespace android
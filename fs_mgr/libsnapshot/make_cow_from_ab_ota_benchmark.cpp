@@ -0,0 +1,55 @@
+//
+// Copyright (C) 2020 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+
+#include "make_cow_from_ab_ota.h"
+#include "synthetic_payload.h"
+
+namespace android {
+namespace snapshot {
+
+DECLARE_uint32(threads);
+
+static void BM_ConvertPayload(benchmark::State& state) {
+    android::base::SetMinimumLogSeverity(android::base::WARNING);
+    FLAGS_threads = state.range(0);
+
+    SyntheticPayload payload;
+    TemporaryDir out_dir;
+    for (auto _ : state) {
+        if (!ConvertPayloadToCow(payload.path(), out_dir.path)) {
+            state.SkipWithError("conversion failed");
+            return;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * payload.partition_bytes());
+}
+BENCHMARK(BM_ConvertPayload)
+        ->Arg(1)
+        ->Arg(2)
+        ->Arg(4)
+        ->Arg(8)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+}  // namespace snapshot
+}  // namespace android
+
+BENCHMARK_MAIN();
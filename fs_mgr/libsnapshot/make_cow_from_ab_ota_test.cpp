@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "make_cow_from_ab_ota.h"
+#include "synthetic_payload.h"
+
+namespace android {
+namespace snapshot {
+
+DECLARE_uint32(threads);
+
+class MakeCowFromAbOtaTest : public ::testing::Test {
+  protected:
+    void TearDown() override { FLAGS_threads = 0; }
+
+    SyntheticPayload payload_;
+};
+
+TEST_F(MakeCowFromAbOtaTest, ThreadsDoNotChangeCows) {
+    TemporaryDir serial;
+    FLAGS_threads = 1;
+    ASSERT_TRUE(ConvertPayloadToCow(payload_.path(), serial.path));
+
+    TemporaryDir parallel;
+    FLAGS_threads = 8;
+    ASSERT_TRUE(ConvertPayloadToCow(payload_.path(), parallel.path));
+
+    for (const auto& name : payload_.partition_names()) {
+        std::string expected, actual;
+        ASSERT_TRUE(android::base::ReadFileToString(
+                std::string(serial.path) + "/" + name + ".cow", &expected));
+        ASSERT_TRUE(android::base::ReadFileToString(
+                std::string(parallel.path) + "/" + name + ".cow", &actual));
+        EXPECT_FALSE(expected.empty()) << name;
+        // Compare sizes first, so that a mismatch doesn't print both COWs.
+        ASSERT_EQ(expected.size(), actual.size()) << name;
+        EXPECT_TRUE(expected == actual) << name << ".cow differs";
+    }
+}
+
+TEST_F(MakeCowFromAbOtaTest, TruncatedPayload) {
+    // Operations past the end of the payload fail while earlier ones are still being converted.
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(payload_.path(), &contents));
+    TemporaryFile truncated;
+    ASSERT_TRUE(android::base::WriteStringToFile(contents.substr(0, contents.size() / 2),
+                                                 truncated.path));
+
+    TemporaryDir out;
+    FLAGS_threads = 8;
+    EXPECT_FALSE(ConvertPayloadToCow(truncated.path, out.path));
+}
+
+}  // namespace snapshot
+}  // namespace android
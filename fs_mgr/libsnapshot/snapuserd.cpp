@@ -16,10 +16,18 @@
 
 #include "snapuserd.h"
 
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <algorithm>
 #include <csignal>
 #include <optional>
 #include <set>
 
+#include <android-base/chrono_utils.h>
+#include <android-base/scopeguard.h>
+#include <android-base/stringprintf.h>
 #include <libsnapshot/snapuserd_client.h>
 
 namespace android {
@@ -32,6 +40,146 @@ using android::base::unique_fd;
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
 #define SNAP_PLOG(level) PLOG(level) << misc_name_ << ": "
 
+static constexpr uint32_t kPersistedMetadataMagic = 0x534e4d44;  // "SNMD"
+static constexpr uint32_t kPersistedMetadataVersion = 2;
+
+// What metadata was computed from: the COW header, which also records merge progress, the size
+// of the COW device and the COW footer, which has the number of operations and their checksum.
+struct CowFingerprint {
+    CowHeader header;
+    uint64_t size;
+    CowFooter footer;
+} __attribute__((packed));
+
+// Persisted metadata starts with this header, in its own block. It is followed by the
+// exception areas, chunk_vec_ and read_ahead_ops_ as indices into the COW operations, and the
+// COW operations themselves, as left by CowReader::InitializeMerge().
+struct PersistedMetadata {
+    uint32_t magic;
+    uint32_t version;
+    CowFingerprint cow;
+    uint64_t num_sectors;
+    uint64_t total_data_ops;
+    uint64_t total_copy_ops;
+    uint64_t num_areas;
+    uint64_t num_chunks;
+    uint64_t num_read_ahead_ops;
+    uint64_t num_ops;
+};
+static_assert(sizeof(PersistedMetadata) <= BLOCK_SZ);
+
+struct PersistedChunk {
+    uint64_t sector;
+    uint64_t op;
+};
+
+static constexpr size_t kExceptionAreaSize = CHUNK_SIZE << SECTOR_SHIFT;
+
+// Finds the footer the way CowReader::ParseOps() does, but without reading every operation: a
+// full cluster ends with the cluster op that leads to the next one, so only that op is read.
+// CowWriter::Finalize() writes the footer either first in a new cluster, or in a cluster whose
+// unused slots it cleared; the footer data then spans the three slots after the footer op. So a
+// cluster is only skipped if it doesn't start with a footer op and none of the slots before its
+// cluster op holds one. Otherwise it is read in full.
+static bool ReadCowFooter(android::base::borrowed_fd fd, const CowHeader& header, uint64_t size,
+                          CowFooter* footer) {
+    // Without clusters, the operations are interleaved with their data and can only be read one
+    // by one.
+    if (header.cluster_ops < 2) {
+        return false;
+    }
+    constexpr uint64_t kTailOps = 4;
+    const uint64_t cluster_ops = header.cluster_ops;
+    const uint64_t cluster_size = cluster_ops * sizeof(CowOperation);
+    std::vector<CowOperation> ops(cluster_ops);
+    CowOperation first;
+
+    uint64_t pos = header.header_size;
+    if (header.major_version >= 2) {
+        pos += header.buffer_size;
+    }
+    while (pos < size) {
+        const uint64_t tail_ops = std::min(kTailOps, cluster_ops);
+        if (cluster_size <= size - pos) {
+            const uint64_t tail = pos + cluster_size - tail_ops * sizeof(CowOperation);
+            if (!android::base::ReadFullyAtOffset(fd, &first, sizeof(first), pos) ||
+                !android::base::ReadFullyAtOffset(fd, ops.data(), tail_ops * sizeof(CowOperation),
+                                                  tail)) {
+                return false;
+            }
+            const auto& last = ops[tail_ops - 1];
+            if (first.type != kCowFooterOp && last.type == kCowClusterOp &&
+                std::none_of(ops.begin(), ops.begin() + tail_ops - 1,
+                             [](const CowOperation& op) { return op.type == kCowFooterOp; })) {
+                if (last.source > size - pos - cluster_size) {
+                    return false;
+                }
+                pos += cluster_size + last.source;
+                continue;
+            }
+        }
+
+        const uint64_t num_ops = std::min(cluster_ops, (size - pos) / sizeof(CowOperation));
+        if (!android::base::ReadFullyAtOffset(fd, ops.data(), num_ops * sizeof(CowOperation),
+                                              pos)) {
+            return false;
+        }
+        uint64_t i = 0;
+        for (; i < num_ops; i++) {
+            const uint64_t next = pos + (i + 1) * sizeof(CowOperation);
+            if (ops[i].type == kCowFooterOp) {
+                memcpy(&footer->op, &ops[i], sizeof(footer->op));
+                return android::base::ReadFullyAtOffset(fd, &footer->data, sizeof(footer->data),
+                                                        next);
+            }
+            if (ops[i].type == kCowClusterOp) {
+                if (ops[i].source > size - next) {
+                    return false;
+                }
+                pos = next + ops[i].source;
+                break;
+            }
+        }
+        if (i == num_ops) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool GetCowFingerprint(android::base::borrowed_fd fd, CowFingerprint* fingerprint) {
+    memset(fingerprint, 0, sizeof(*fingerprint));
+    if (!android::base::ReadFullyAtOffset(fd, &fingerprint->header, sizeof(fingerprint->header),
+                                          0)) {
+        return false;
+    }
+    off_t size = lseek(fd.get(), 0, SEEK_END);
+    if (size < 0) {
+        return false;
+    }
+    fingerprint->size = size;
+    return ReadCowFooter(fd, fingerprint->header, fingerprint->size, &fingerprint->footer);
+}
+
+// Persisted metadata is named after the COW device rather than after the dm-user device, which
+// is renamed when the second stage daemon takes over from the first stage one.
+static std::string GetMetadataName(const struct stat& cow) {
+    if (S_ISBLK(cow.st_mode)) {
+        return android::base::StringPrintf("%u:%u", major(cow.st_rdev), minor(cow.st_rdev));
+    }
+    // Tests back the COW with a file.
+    return android::base::StringPrintf("%" PRIu64 ":%" PRIu64 ".ino",
+                                       static_cast<uint64_t>(cow.st_dev),
+                                       static_cast<uint64_t>(cow.st_ino));
+}
+
+static uint64_t PersistedMetadataSize(const PersistedMetadata& metadata) {
+    return BLOCK_SZ + metadata.num_areas * kExceptionAreaSize +
+           metadata.num_chunks * sizeof(PersistedChunk) +
+           metadata.num_read_ahead_ops * sizeof(uint64_t) +
+           metadata.num_ops * sizeof(CowOperation);
+}
+
 Snapuserd::Snapuserd(const std::string& misc_name, const std::string& cow_device,
                      const std::string& backing_device) {
     misc_name_ = misc_name;
@@ -40,6 +188,12 @@ Snapuserd::Snapuserd(const std::string& misc_name, const std::string& cow_device
     control_device_ = "/dev/dm-user/" + misc_name;
 }
 
+Snapuserd::~Snapuserd() {
+    if (persisted_addr_ != MAP_FAILED) {
+        munmap(persisted_addr_, persisted_size_);
+    }
+}
+
 bool Snapuserd::InitializeWorkers() {
     for (int i = 0; i < NUM_THREADS_PER_PARTITION; i++) {
         std::unique_ptr<WorkerThread> wt = std::make_unique<WorkerThread>(
@@ -665,7 +819,240 @@ bool Snapuserd::InitCowDevice() {
         return false;
     }
 
-    return ReadMetadata();
+    if (!metadata_dir_.empty()) {
+        struct stat st;
+        if (fstat(cow_fd_.get(), &st) < 0) {
+            SNAP_PLOG(ERROR) << "fstat failed: " << cow_device_;
+            return false;
+        }
+        metadata_path_ = metadata_dir_ + "/" + GetMetadataName(st);
+    }
+
+    android::base::Timer t;
+    if (!metadata_path_.empty() && AdoptMetadata()) {
+        SNAP_LOG(INFO) << "Adopted metadata from " << metadata_path_ << " in " << t
+                       << ". Areas: " << vec_.size() << " Num Sector: " << num_sectors_
+                       << " Total-data-ops: " << reader_->total_data_ops();
+        return true;
+    }
+
+    if (!ReadMetadata()) {
+        return false;
+    }
+    SNAP_LOG(INFO) << "Read metadata from COW in " << t;
+
+    // The metadata is only an optimization for the daemons started after this one.
+    if (!metadata_path_.empty() && !PersistMetadata()) {
+        SNAP_LOG(WARNING) << "Failed to persist metadata at " << metadata_path_;
+    }
+    return true;
+}
+
+bool Snapuserd::AdoptMetadata() {
+    unique_fd fd(open(metadata_path_.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            SNAP_PLOG(ERROR) << "Open failed: " << metadata_path_;
+        }
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd.get(), &st) < 0) {
+        SNAP_PLOG(ERROR) << "fstat failed: " << metadata_path_;
+        return false;
+    }
+    const uint64_t size = st.st_size;
+    if (size < BLOCK_SZ) {
+        SNAP_LOG(ERROR) << "Persisted metadata truncated: " << size << " bytes";
+        return false;
+    }
+
+    // Persisted metadata is never modified in place, see PersistMetadata(), so it is safe
+    // to keep using the mapping for as long as this handler lives.
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+    if (addr == MAP_FAILED) {
+        SNAP_PLOG(ERROR) << "mmap persisted metadata failed";
+        return false;
+    }
+    auto unmap = android::base::make_scope_guard([&] { munmap(addr, size); });
+
+    const auto* metadata = reinterpret_cast<const PersistedMetadata*>(addr);
+    if (metadata->magic != kPersistedMetadataMagic ||
+        metadata->version != kPersistedMetadataVersion) {
+        SNAP_LOG(ERROR) << "Unknown persisted metadata format";
+        return false;
+    }
+    // Bound each count by the size first, so that the size computation cannot overflow.
+    if (metadata->num_areas > size || metadata->num_chunks > size ||
+        metadata->num_read_ahead_ops > size || metadata->num_ops > size ||
+        PersistedMetadataSize(*metadata) != size) {
+        SNAP_LOG(ERROR) << "Persisted metadata size mismatch: " << size << " bytes";
+        return false;
+    }
+    CowFingerprint cow;
+    if (!GetCowFingerprint(cow_fd_, &cow)) {
+        SNAP_LOG(ERROR) << "Failed to read the COW header and footer";
+        return false;
+    }
+    if (memcmp(&cow, &metadata->cow, sizeof(cow)) != 0) {
+        SNAP_LOG(INFO) << "Persisted metadata is stale, COW changed since";
+        return false;
+    }
+
+    auto areas = reinterpret_cast<const uint8_t*>(addr) + BLOCK_SZ;
+    auto chunks = reinterpret_cast<const PersistedChunk*>(areas +
+                                                          metadata->num_areas * kExceptionAreaSize);
+    auto ra_ops = reinterpret_cast<const uint64_t*>(chunks + metadata->num_chunks);
+    auto ops = reinterpret_cast<const CowOperation*>(ra_ops + metadata->num_read_ahead_ops);
+
+    std::vector<std::pair<sector_t, const CowOperation*>> chunk_vec;
+    chunk_vec.reserve(metadata->num_chunks);
+    for (uint64_t i = 0; i < metadata->num_chunks; i++) {
+        if (chunks[i].op >= metadata->num_ops) {
+            SNAP_LOG(ERROR) << "Persisted metadata has invalid op index: " << chunks[i].op;
+            return false;
+        }
+        chunk_vec.emplace_back(chunks[i].sector, &ops[chunks[i].op]);
+    }
+    std::vector<const CowOperation*> read_ahead_ops;
+    read_ahead_ops.reserve(metadata->num_read_ahead_ops);
+    for (uint64_t i = 0; i < metadata->num_read_ahead_ops; i++) {
+        if (ra_ops[i] >= metadata->num_ops) {
+            SNAP_LOG(ERROR) << "Persisted metadata has invalid op index: " << ra_ops[i];
+            return false;
+        }
+        read_ahead_ops.push_back(&ops[ra_ops[i]]);
+    }
+
+    // The worker threads only need the header from the reader; they read COW operations
+    // through chunk_vec_.
+    reader_ = std::make_unique<CowReader>();
+    if (!reader_->InitForMerge(unique_fd(dup(cow_fd_.get())))) {
+        SNAP_LOG(ERROR) << "Failed to read COW header";
+        return false;
+    }
+    reader_->set_total_data_ops(metadata->total_data_ops);
+    reader_->set_copy_ops(metadata->total_copy_ops);
+
+    if (!MmapMetadata()) {
+        SNAP_LOG(ERROR) << "mmap failed";
+        return false;
+    }
+
+    exceptions_per_area_ = kExceptionAreaSize / sizeof(struct disk_exception);
+    vec_.clear();
+    for (uint64_t i = 0; i < metadata->num_areas; i++) {
+        auto de_ptr = std::make_unique<uint8_t[]>(kExceptionAreaSize);
+        memcpy(de_ptr.get(), areas + i * kExceptionAreaSize, kExceptionAreaSize);
+        vec_.push_back(std::move(de_ptr));
+    }
+    chunk_vec_ = std::move(chunk_vec);
+    read_ahead_ops_ = std::move(read_ahead_ops);
+    num_sectors_ = metadata->num_sectors;
+
+    unmap.Disable();
+    persisted_addr_ = addr;
+    persisted_size_ = size;
+
+    merge_initiated_ = false;
+    PrepareReadAhead();
+    return true;
+}
+
+bool Snapuserd::PersistMetadata() {
+    PersistedMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.magic = kPersistedMetadataMagic;
+    metadata.version = kPersistedMetadataVersion;
+    // Unclustered COWs are not supported, since finding their footer means reading every op.
+    if (!GetCowFingerprint(cow_fd_, &metadata.cow)) {
+        SNAP_LOG(ERROR) << "Failed to read the COW header and footer";
+        return false;
+    }
+    metadata.num_sectors = num_sectors_;
+    metadata.total_data_ops = reader_->total_data_ops();
+    metadata.total_copy_ops = reader_->total_copy_ops();
+    metadata.num_areas = vec_.size();
+    metadata.num_chunks = chunk_vec_.size();
+    metadata.num_read_ahead_ops = read_ahead_ops_.size();
+
+    // The reader keeps the COW operations in a vector, which chunk_vec_ and read_ahead_ops_
+    // point into.
+    const CowOperation* ops = nullptr;
+    for (auto iter = reader_->GetOpIter(); !iter->Done(); iter->Next()) {
+        if (!ops) ops = &iter->Get();
+        metadata.num_ops++;
+    }
+    auto op_index = [&](const CowOperation* op) -> std::optional<uint64_t> {
+        if (op < ops || op >= ops + metadata.num_ops) return {};
+        return op - ops;
+    };
+
+    const std::string dir = android::base::Dirname(metadata_path_);
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+        SNAP_PLOG(ERROR) << "mkdir failed: " << dir;
+        return false;
+    }
+
+    // Write to a new file and rename it into place, so that a daemon which adopted the
+    // previous metadata keeps a consistent mapping of it.
+    const std::string temp_path = metadata_path_ + ".tmp";
+    unique_fd fd(open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                      0600));
+    if (fd < 0) {
+        SNAP_PLOG(ERROR) << "Open failed: " << temp_path;
+        return false;
+    }
+    auto remove_temp = android::base::make_scope_guard([&] { unlink(temp_path.c_str()); });
+
+    const uint64_t size = PersistedMetadataSize(metadata);
+    if (ftruncate(fd.get(), size) < 0) {
+        SNAP_PLOG(ERROR) << "ftruncate failed: " << temp_path;
+        return false;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    if (addr == MAP_FAILED) {
+        SNAP_PLOG(ERROR) << "mmap failed: " << temp_path;
+        return false;
+    }
+    auto unmap = android::base::make_scope_guard([&] { munmap(addr, size); });
+
+    memcpy(addr, &metadata, sizeof(metadata));
+    auto areas = reinterpret_cast<uint8_t*>(addr) + BLOCK_SZ;
+    for (size_t i = 0; i < vec_.size(); i++) {
+        memcpy(areas + i * kExceptionAreaSize, vec_[i].get(), kExceptionAreaSize);
+    }
+    auto chunks = reinterpret_cast<PersistedChunk*>(areas + vec_.size() * kExceptionAreaSize);
+    for (size_t i = 0; i < chunk_vec_.size(); i++) {
+        auto index = op_index(chunk_vec_[i].second);
+        if (!index) {
+            SNAP_LOG(ERROR) << "COW operation of sector " << chunk_vec_[i].first
+                            << " is not in the reader";
+            return false;
+        }
+        chunks[i] = {chunk_vec_[i].first, *index};
+    }
+    auto ra_ops = reinterpret_cast<uint64_t*>(chunks + chunk_vec_.size());
+    for (size_t i = 0; i < read_ahead_ops_.size(); i++) {
+        auto index = op_index(read_ahead_ops_[i]);
+        if (!index) {
+            SNAP_LOG(ERROR) << "Read-ahead COW operation is not in the reader";
+            return false;
+        }
+        ra_ops[i] = *index;
+    }
+    if (metadata.num_ops) {
+        memcpy(ra_ops + read_ahead_ops_.size(), ops, metadata.num_ops * sizeof(CowOperation));
+    }
+
+    unmap.Disable();
+    munmap(addr, size);
+    if (rename(temp_path.c_str(), metadata_path_.c_str()) < 0) {
+        SNAP_PLOG(ERROR) << "rename failed: " << metadata_path_;
+        return false;
+    }
+    remove_temp.Disable();
+    return true;
 }
 
 /*
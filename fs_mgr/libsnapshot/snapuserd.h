@@ -224,6 +224,7 @@ class Snapuserd : public std::enable_shared_from_this<Snapuserd> {
   public:
     Snapuserd(const std::string& misc_name, const std::string& cow_device,
               const std::string& backing_device);
+    ~Snapuserd();
     bool InitCowDevice();
     bool Start();
     const std::string& GetControlDevicePath() { return control_device_; }
@@ -232,6 +233,13 @@ class Snapuserd : public std::enable_shared_from_this<Snapuserd> {
     bool IsAttached() const { return attached_; }
     void AttachControlDevice() { attached_ = true; }
 
+    // Persist the metadata computed by InitCowDevice() in |dir|, and adopt it from there when it
+    // is still current, rather than reading the COW device again. The file is named after the
+    // COW device, so that every handler of the same COW device shares it.
+    void SetMetadataDir(const std::string& dir) { metadata_dir_ = dir; }
+    const std::string& GetMetadataPath() const { return metadata_path_; }
+    bool IsMetadataAdopted() const { return persisted_addr_ != MAP_FAILED; }
+
     void CheckMergeCompletionStatus();
     bool CommitMerge(int num_merge_ops);
 
@@ -291,6 +299,8 @@ class Snapuserd : public std::enable_shared_from_this<Snapuserd> {
 
     bool GetRABuffer(std::unique_lock<std::mutex>* lock, uint64_t block, void* buffer);
     bool ReadMetadata();
+    bool AdoptMetadata();
+    bool PersistMetadata();
     sector_t ChunkToSector(chunk_t chunk) { return chunk << CHUNK_SHIFT; }
     chunk_t SectorToChunk(sector_t sector) { return sector >> CHUNK_SHIFT; }
     bool IsBlockAligned(int read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
@@ -324,6 +334,13 @@ class Snapuserd : public std::enable_shared_from_this<Snapuserd> {
     void* mapped_addr_;
     size_t total_mapped_addr_length_;
 
+    // Persisted metadata adopted by AdoptMetadata(). chunk_vec_ and read_ahead_ops_ point
+    // at the COW operations in it.
+    std::string metadata_dir_;
+    std::string metadata_path_;
+    void* persisted_addr_ = MAP_FAILED;
+    size_t persisted_size_ = 0;
+
     std::vector<std::unique_ptr<WorkerThread>> worker_threads_;
     // Read-ahead related
     std::unordered_map<uint64_t, void*> read_ahead_buffer_map_;
@@ -25,7 +25,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
+#include <libsnapshot/snapuserd_client.h>
 
 #include "snapuserd.h"
 #include "snapuserd_server.h"
@@ -78,7 +81,9 @@ void SnapuserdServer::ShutdownThreads() {
 }
 
 DmUserHandler::DmUserHandler(std::shared_ptr<Snapuserd> snapuserd)
-    : snapuserd_(snapuserd), misc_name_(snapuserd_->GetMiscName()) {}
+    : snapuserd_(snapuserd),
+      misc_name_(snapuserd_->GetMiscName()),
+      metadata_path_(snapuserd_->GetMetadataPath()) {}
 
 bool SnapuserdServer::Sendmsg(android::base::borrowed_fd fd, const std::string& msg) {
     ssize_t ret = TEMP_FAILURE_RETRY(send(fd.get(), msg.data(), msg.size(), MSG_NOSIGNAL));
@@ -355,6 +360,7 @@ std::shared_ptr<DmUserHandler> SnapuserdServer::AddHandler(const std::string& mi
                                                            const std::string& cow_device_path,
                                                            const std::string& backing_device) {
     auto snapuserd = std::make_shared<Snapuserd>(misc_name, cow_device_path, backing_device);
+    snapuserd->SetMetadataDir(kSnapuserdMetadataDir);
     if (!snapuserd->InitCowDevice()) {
         LOG(ERROR) << "Failed to initialize Snapuserd";
         return nullptr;
@@ -419,6 +425,19 @@ bool SnapuserdServer::RemoveAndJoinHandler(const std::string& misc_name) {
     if (th.joinable()) {
         th.join();
     }
+
+    // Remove the persisted metadata once no device uses the COW anymore. When the second stage
+    // transition renames a device, the new one is added before the old one is deleted.
+    const auto& metadata_path = handler->metadata_path();
+    if (!metadata_path.empty()) {
+        std::lock_guard<std::mutex> lock(lock_);
+        bool in_use = std::any_of(dm_users_.begin(), dm_users_.end(), [&](const auto& other) {
+            return other->metadata_path() == metadata_path;
+        });
+        if (!in_use && unlink(metadata_path.c_str()) < 0 && errno != ENOENT) {
+            PLOG(ERROR) << "Failed to remove persisted metadata of " << misc_name;
+        }
+    }
     return true;
 }
 
@@ -62,11 +62,13 @@ class DmUserHandler {
     std::thread& thread() { return thread_; }
 
     const std::string& misc_name() const { return misc_name_; }
+    const std::string& metadata_path() const { return metadata_path_; }
 
   private:
     std::thread thread_;
     std::shared_ptr<Snapuserd> snapuserd_;
     std::string misc_name_;
+    std::string metadata_path_;
 };
 
 class Stoppable {
@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "synthetic_payload.h"
+
+#include <endian.h>
+
+#include <random>
+
+#include <android-base/logging.h>
+#include <bzlib.h>
+#include <update_engine/update_metadata.pb.h>
+
+namespace android {
+namespace snapshot {
+
+using chromeos_update_engine::DeltaArchiveManifest;
+using chromeos_update_engine::InstallOperation;
+
+static constexpr uint64_t kBlockSize = 4096;
+static constexpr int kPartitions = 4;
+static constexpr uint64_t kBlocksPerPartition = 4096;
+static constexpr uint64_t kBlocksPerOperation = 64;
+
+SyntheticPayload::SyntheticPayload() {
+    DeltaArchiveManifest manifest;
+    auto group = manifest.mutable_dynamic_partition_metadata()->add_groups();
+    group->set_name("group");
+
+    std::mt19937 rng(42);
+    std::string blobs;
+    for (int i = 0; i < kPartitions; i++) {
+        auto name = "partition" + std::to_string(i);
+        group->add_partition_names(name);
+        partition_names_.emplace_back(name);
+        auto partition = manifest.add_partitions();
+        partition->set_partition_name(name);
+
+        for (uint64_t block = 0; block < kBlocksPerPartition; block += kBlocksPerOperation) {
+            auto op = partition->add_operations();
+            auto dst = op->add_dst_extents();
+            dst->set_start_block(block);
+            dst->set_num_blocks(kBlocksPerOperation);
+
+            switch ((block / kBlocksPerOperation) % 8) {
+                case 0:
+                    op->set_type(InstallOperation::ZERO);
+                    break;
+                case 1: {
+                    op->set_type(InstallOperation::SOURCE_COPY);
+                    auto src = op->add_src_extents();
+                    src->set_start_block(kBlocksPerPartition - block - kBlocksPerOperation);
+                    src->set_num_blocks(kBlocksPerOperation);
+                    break;
+                }
+                default: {
+                    // Text-like data, which compresses about as well as a system image.
+                    std::string data(kBlocksPerOperation * kBlockSize, '\0');
+                    for (auto& c : data) {
+                        c = 'a' + rng() % 16;
+                    }
+                    std::string compressed(data.size() * 2, '\0');
+                    unsigned int size = compressed.size();
+                    CHECK_EQ(BZ_OK, BZ2_bzBuffToBuffCompress(compressed.data(), &size, data.data(),
+                                                             data.size(), 9, 0, 0));
+                    op->set_type(InstallOperation::REPLACE_BZ);
+                    op->set_data_offset(blobs.size());
+                    op->set_data_length(size);
+                    blobs.append(compressed.data(), size);
+                    break;
+                }
+            }
+        }
+    }
+
+    std::string serialized;
+    CHECK(manifest.SerializeToString(&serialized));
+    uint64_t version = htobe64(2);
+    uint64_t manifest_size = htobe64(serialized.size());
+    uint32_t signature_size = 0;
+    std::string payload = "CrAU";
+    payload.append(reinterpret_cast<const char*>(&version), sizeof(version));
+    payload.append(reinterpret_cast<const char*>(&manifest_size), sizeof(manifest_size));
+    payload.append(reinterpret_cast<const char*>(&signature_size), sizeof(signature_size));
+    payload += serialized;
+    payload += blobs;
+    CHECK(android::base::WriteStringToFile(payload, path()));
+}
+
+uint64_t SyntheticPayload::partition_bytes() const {
+    return kPartitions * kBlocksPerPartition * kBlockSize;
+}
+
+}  // namespace snapshot
+}  // namespace android
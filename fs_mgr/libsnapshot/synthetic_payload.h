@@ -0,0 +1,47 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+
+namespace android {
+namespace snapshot {
+
+// A full-looking payload for a few dynamic partitions, mostly REPLACE_BZ operations with some
+// ZERO and SOURCE_COPY ones, as make_cow_from_ab_ota sees from a real OTA. It is written to a
+// temporary directory, and is the same every time.
+class SyntheticPayload final {
+  public:
+    SyntheticPayload();
+
+    std::string path() const { return std::string(dir_.path) + "/payload.bin"; }
+    const std::vector<std::string>& partition_names() const { return partition_names_; }
+    // The number of bytes the payload writes to its partitions.
+    uint64_t partition_bytes() const;
+
+  private:
+    TemporaryDir dir_;
+    std::vector<std::string> partition_names_;
+};
+
+}  // namespace snapshot
+}  // namespace android
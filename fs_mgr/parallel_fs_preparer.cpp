@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_fs_preparer.h"
+
+#include <iterator>
+#include <vector>
+
+#include <android-base/strings.h>
+
+using android::base::StartsWith;
+
+namespace android {
+namespace fs_mgr {
+
+bool MountPointsNested(const std::string& a, const std::string& b) {
+    auto under = [](const std::string& child, const std::string& parent) {
+        return parent == "/" || StartsWith(child, parent + "/");
+    };
+    return a == b || under(a, b) || under(b, a);
+}
+
+ParallelFsPreparer::~ParallelFsPreparer() {
+    for (auto& [index, pending] : pending_) {
+        Release(&pending);
+    }
+    // Destroying the futures waits for any preparation that is still running.
+}
+
+void ParallelFsPreparer::Start(const FstabEntry& entry, int index) {
+    std::vector<std::shared_future<void>> earlier;
+    for (const auto& [earlier_index, pending] : pending_) {
+        if (!pending.released && MountPointsNested(entry.mount_point, pending.mount_point)) {
+            earlier.emplace_back(pending.released_future);
+        }
+    }
+
+    auto& pending = pending_[index];
+    pending.mount_point = entry.mount_point;
+    pending.released_future = pending.released_promise.get_future().share();
+    pending.fs_stat = std::async(std::launch::async, [this, entry, earlier]() {
+        for (const auto& future : earlier) {
+            future.wait();
+        }
+        return prepare_(entry);
+    });
+}
+
+bool ParallelFsPreparer::IsPreparing(int index) const {
+    auto it = pending_.find(index);
+    return it != pending_.end() && it->second.fs_stat.valid();
+}
+
+int ParallelFsPreparer::Wait(int index) {
+    return pending_.at(index).fs_stat.get();
+}
+
+void ParallelFsPreparer::ReleaseBefore(int index) {
+    for (auto it = pending_.begin(); it != pending_.end() && it->first < index;) {
+        Release(&it->second);
+        it = it->second.fs_stat.valid() ? std::next(it) : pending_.erase(it);
+    }
+}
+
+void ParallelFsPreparer::Release(Pending* pending) {
+    if (!pending->released) {
+        pending->released_promise.set_value();
+        pending->released = true;
+    }
+}
+
+}  // namespace fs_mgr
+}  // namespace android
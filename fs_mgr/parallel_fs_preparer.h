@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <map>
+#include <string>
+
+#include <fstab/fstab.h>
+
+namespace android {
+namespace fs_mgr {
+
+// Runs prepare_fs_for_mount(), which may fsck and tune2fs a filesystem, for several fstab
+// entries at once, while fs_mgr_mount_all() still mounts them one at a time and in fstab
+// order. check_fs() temporarily mounts a filesystem on its mount point, so an entry whose mount
+// point is nested with that of an earlier entry, in either direction, is only prepared once that
+// entry was released. For a child listed after its parent, the parent is mounted by then; for a
+// child listed first, the two are prepared in fstab order.
+class ParallelFsPreparer {
+  public:
+    using PrepareFunction = std::function<int(const FstabEntry&)>;
+
+    explicit ParallelFsPreparer(PrepareFunction prepare) : prepare_(std::move(prepare)) {}
+    ~ParallelFsPreparer();
+
+    // Starts preparing fstab[index], which must come after every entry started before.
+    void Start(const FstabEntry& entry, int index);
+
+    // Whether fstab[index] is being prepared and hasn't been waited for yet.
+    bool IsPreparing(int index) const;
+
+    // Waits for fstab[index] to be prepared and returns its fs_stat.
+    int Wait(int index);
+
+    // Called once fs_mgr_mount_all() is done with every entry before |index|, so that
+    // entries nested with their mount points can be prepared.
+    void ReleaseBefore(int index);
+
+  private:
+    struct Pending {
+        std::string mount_point;
+        bool released = false;
+        std::promise<void> released_promise;
+        std::shared_future<void> released_future;
+        std::future<int> fs_stat;
+    };
+
+    static void Release(Pending* pending);
+
+    PrepareFunction prepare_;
+    std::map<int, Pending> pending_;
+};
+
+// Whether a filesystem mounted on one of |a| and |b| is mounted over, or under, the other.
+bool MountPointsNested(const std::string& a, const std::string& b);
+
+}  // namespace fs_mgr
+}  // namespace android
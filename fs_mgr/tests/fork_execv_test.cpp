@@ -0,0 +1,79 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/wait.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../fork_execv.h"
+
+using namespace std::literals;
+using android::fs_mgr::ForkExecvAndWait;
+
+namespace {
+
+TEST(fork_execv, Output) {
+    int status;
+    std::string output;
+    ASSERT_EQ(ForkExecvAndWait({"/system/bin/sh", "-c", "echo out; echo err >&2; exit 3"},
+                               &status, &output),
+              0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 3);
+    EXPECT_EQ(output, "out\nerr\n");
+}
+
+TEST(fork_execv, NoStdin) {
+    int status;
+    std::string output;
+    ASSERT_EQ(ForkExecvAndWait({"/system/bin/cat"}, &status, &output), 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_EQ(output, "");
+}
+
+TEST(fork_execv, NotFound) {
+    int status;
+    std::string output;
+    ASSERT_EQ(ForkExecvAndWait({"/system/bin/does-not-exist"}, &status, &output), 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 127);
+}
+
+// fs_mgr_mount_all() checks filesystems on several threads, which only helps if the checkers
+// they run overlap: logwrap_fork_execvp() would run them one at a time.
+TEST(fork_execv, Concurrent) {
+    constexpr int kThreads = 4;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; i++) {
+        threads.emplace_back([] {
+            int status;
+            std::string output;
+            ASSERT_EQ(ForkExecvAndWait({"/system/bin/sleep", "1"}, &status, &output), 0);
+            EXPECT_EQ(status, 0);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 1s * kThreads / 2);
+}
+
+}  // namespace
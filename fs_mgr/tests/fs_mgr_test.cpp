@@ -1161,3 +1161,72 @@ source none6       swap   defaults      readahead_size_kb=0
     EXPECT_TRUE(CompareFlags(flags, entry->fs_mgr_flags));
     EXPECT_EQ(0, entry->readahead_size_kb);
 }
+
+TEST(fs_mgr, FstabCache) {
+    TemporaryDir td;
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    std::string fstab_contents = R"fs(
+source /            ext4    ro,barrier=1                    wait,avb
+source /metadata    ext4    noatime,nosuid,nodev,discard    wait,formattable
+source /data        f2fs    noatime,nosuid,nodev,discard,reserve_root=32768    latemount,wait,check,fileencryption=aes-256-xts:aes-256-cts,keydirectory=/metadata/vold/metadata_encryption,quota,reservedsize=128M
+source none         swap    defaults                        zramsize=75%,max_comp_streams=8,zram_backingdev_size=256M
+)fs";
+    ASSERT_TRUE(android::base::WriteStringToFile(fstab_contents, tf.path));
+    const std::string cache_path = std::string(td.path) + "/fstab.cache";
+
+    // What ReadDefaultFstab() would return without the cache.
+    Fstab expected;
+    ReadFstabFromDt(&expected, false);
+    Fstab file_fstab;
+    ASSERT_TRUE(ReadFstabFromFile(tf.path, &file_fstab));
+    expected.insert(expected.end(), file_fstab.begin(), file_fstab.end());
+
+    Fstab fstab;
+    EXPECT_FALSE(ReadFstabCache(cache_path, tf.path, &fstab));
+    ASSERT_TRUE(WriteFstabCache(cache_path, tf.path));
+    ASSERT_TRUE(ReadFstabCache(cache_path, tf.path, &fstab));
+    ASSERT_EQ(expected.size(), fstab.size());
+    for (size_t i = 0; i < fstab.size(); i++) {
+        EXPECT_EQ(expected[i].blk_device, fstab[i].blk_device);
+        EXPECT_EQ(expected[i].mount_point, fstab[i].mount_point);
+        EXPECT_EQ(expected[i].fs_type, fstab[i].fs_type);
+        EXPECT_EQ(expected[i].flags, fstab[i].flags);
+        EXPECT_EQ(expected[i].fs_options, fstab[i].fs_options);
+        EXPECT_EQ(expected[i].key_loc, fstab[i].key_loc);
+        EXPECT_EQ(expected[i].encryption_options, fstab[i].encryption_options);
+        EXPECT_EQ(expected[i].reserved_size, fstab[i].reserved_size);
+        EXPECT_EQ(expected[i].zram_size, fstab[i].zram_size);
+        EXPECT_EQ(expected[i].max_comp_streams, fstab[i].max_comp_streams);
+        EXPECT_EQ(expected[i].zram_backingdev_size, fstab[i].zram_backingdev_size);
+        EXPECT_EQ(expected[i].partnum, fstab[i].partnum);
+        EXPECT_TRUE(CompareFlags(expected[i].fs_mgr_flags, fstab[i].fs_mgr_flags));
+    }
+
+    // The same contents are still current, whatever their path or mtime.
+    TemporaryFile copy;
+    ASSERT_TRUE(android::base::WriteStringToFile(fstab_contents, copy.path));
+    EXPECT_TRUE(ReadFstabCache(cache_path, copy.path, &fstab));
+    EXPECT_FALSE(ReadFstabCache(cache_path, "", &fstab));
+
+    // Other contents are not, even of the same size.
+    std::string changed = fstab_contents;
+    changed.replace(changed.find("zramsize=75%"), 12, "zramsize=50%");
+    ASSERT_TRUE(android::base::WriteStringToFile(changed, tf.path));
+    EXPECT_FALSE(ReadFstabCache(cache_path, tf.path, &fstab));
+
+    std::string cache;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_path, &cache));
+
+    // Flags are stored by name, and one this build doesn't know makes the cache unusable.
+    std::string unknown_flag = cache;
+    size_t flag = unknown_flag.find("formattable");
+    ASSERT_NE(std::string::npos, flag);
+    unknown_flag[flag] = 'F';
+    ASSERT_TRUE(android::base::WriteStringToFile(unknown_flag, cache_path));
+    EXPECT_FALSE(ReadFstabCache(cache_path, copy.path, &fstab));
+
+    cache.resize(cache.size() / 2);
+    ASSERT_TRUE(android::base::WriteStringToFile(cache, cache_path));
+    EXPECT_FALSE(ReadFstabCache(cache_path, copy.path, &fstab));
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+#include <fstab/fstab.h>
+
+using namespace android::fs_mgr;
+
+// The size and the mix of options of a typical device fstab, without slotselect, as that fails
+// without a slot suffix.
+static const char kFstab[] = R"fs(
+# Android fstab file.
+system      /system     ext4    ro,barrier=1    wait,avb=vbmeta_system,logical,first_stage_mount,avb_keys=/avb/q-gsi.avbpubkey:/avb/r-gsi.avbpubkey:/avb/s-gsi.avbpubkey
+system_ext  /system_ext ext4    ro,barrier=1    wait,avb=vbmeta_system,logical,first_stage_mount
+product     /product    ext4    ro,barrier=1    wait,avb=vbmeta_system,logical,first_stage_mount
+vendor      /vendor     ext4    ro,barrier=1    wait,avb=vbmeta,logical,first_stage_mount
+vendor_dlkm /vendor_dlkm ext4   ro,barrier=1    wait,avb=vbmeta,logical,first_stage_mount
+odm         /odm        ext4    ro,barrier=1    wait,avb=vbmeta,logical,first_stage_mount
+/dev/block/by-name/metadata /metadata ext4 noatime,nosuid,nodev,discard,sync wait,check,formattable,first_stage_mount
+/dev/block/by-name/userdata /data f2fs noatime,nosuid,nodev,discard,reserve_root=32768,resgid=1065,fsync_mode=nobarrier,inlinecrypt latemount,wait,check,quota,formattable,sysfs_path=/sys/devices/platform/14700000.ufs,reservedsize=128M,fileencryption=aes-256-xts:aes-256-cts:v2+inlinecrypt_optimized,keydirectory=/metadata/vold/metadata_encryption,checkpoint=fs,readahead_size_kb=128
+/dev/block/by-name/misc /misc emmc defaults defaults
+/dev/block/by-name/boot /boot emmc defaults defaults,avb=boot,first_stage_mount
+/dev/block/by-name/init_boot /init_boot emmc defaults defaults,avb=init_boot
+/dev/block/by-name/vendor_boot /vendor_boot emmc defaults defaults,avb=vendor_boot
+/dev/block/by-name/dtbo /dtbo emmc defaults defaults,avb=dtbo
+/dev/block/by-name/vbmeta /vbmeta emmc defaults defaults,avb
+/dev/block/by-name/persist /mnt/vendor/persist ext4 noatime,nosuid,nodev,sync wait,check,formattable
+/dev/block/by-name/efs /mnt/vendor/efs ext4 noatime,nosuid,nodev,sync wait,check,formattable
+/dev/block/by-name/modem /vendor/firmware_mnt vfat ro,shortname=lower,uid=1000,gid=1000,dmask=227,fmask=337,context=u:object_r:firmware_file:s0 wait
+/devices/platform/11120000.usb/* auto auto defaults voldmanaged=usb:auto
+/devices/platform/11500000.sdhci/mmc_host* auto auto nosuid,nodev voldmanaged=sdcard1:auto,encryptable=userdata
+/dev/block/zram0 none swap defaults zramsize=50%,max_comp_streams=8,zram_backingdev_size=512M
+)fs";
+
+// What every ReadDefaultFstab() caller used to do.
+static void BM_ParseFstab(benchmark::State& state) {
+    TemporaryFile tf;
+    android::base::WriteStringToFile(kFstab, tf.path);
+    for (auto _ : state) {
+        Fstab fstab;
+        if (!ReadFstabFromFile(tf.path, &fstab)) {
+            state.SkipWithError("parse failed");
+            return;
+        }
+        benchmark::DoNotOptimize(fstab);
+    }
+}
+BENCHMARK(BM_ParseFstab);
+
+// What they do once first stage init has written the cache.
+static void BM_LoadFstabCache(benchmark::State& state) {
+    TemporaryDir td;
+    TemporaryFile tf;
+    android::base::WriteStringToFile(kFstab, tf.path);
+    const std::string cache_path = std::string(td.path) + "/fstab.cache";
+    if (!WriteFstabCache(cache_path, tf.path)) {
+        state.SkipWithError("write failed");
+        return;
+    }
+    for (auto _ : state) {
+        Fstab fstab;
+        if (!ReadFstabCache(cache_path, tf.path, &fstab)) {
+            state.SkipWithError("load failed");
+            return;
+        }
+        benchmark::DoNotOptimize(fstab);
+    }
+}
+BENCHMARK(BM_LoadFstabCache);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,161 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fstab/fstab.h>
+#include <gtest/gtest.h>
+
+#include "../parallel_fs_preparer.h"
+
+using namespace std::literals;
+using android::fs_mgr::FstabEntry;
+using android::fs_mgr::MountPointsNested;
+using android::fs_mgr::ParallelFsPreparer;
+
+namespace {
+
+FstabEntry Entry(const std::string& mount_point) {
+    FstabEntry entry;
+    entry.blk_device = "/dev/block/by-name" + mount_point;
+    entry.mount_point = mount_point;
+    return entry;
+}
+
+// Stands in for prepare_fs_for_mount(): records which mount points were prepared, in order.
+class FakePreparer {
+  public:
+    ParallelFsPreparer::PrepareFunction Function() {
+        return [this](const FstabEntry& entry) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            prepared_.emplace_back(entry.mount_point);
+            cv_.notify_all();
+            // Optionally hold the entry until another one started, to show they overlap.
+            auto it = hold_until_.find(entry.mount_point);
+            if (it != hold_until_.end() &&
+                !cv_.wait_for(lock, 5s, [&] { return Has(it->second); })) {
+                return -1;
+            }
+            return static_cast<int>(entry.mount_point.size());
+        };
+    }
+
+    void HoldUntilStarted(const std::string& held, const std::string& other) {
+        hold_until_[held] = other;
+    }
+
+    // Whether |mount_point| is prepared, or starts being prepared within |timeout|.
+    bool WaitFor(const std::string& mount_point, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, timeout, [&] { return Has(mount_point); });
+    }
+
+    std::vector<std::string> prepared() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return prepared_;
+    }
+
+  private:
+    bool Has(const std::string& mount_point) const {
+        return std::find(prepared_.begin(), prepared_.end(), mount_point) != prepared_.end();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::string> prepared_;
+    std::map<std::string, std::string> hold_until_;
+};
+
+}  // namespace
+
+TEST(ParallelFsPreparer, MountPointsNested) {
+    EXPECT_TRUE(MountPointsNested("/data", "/data"));
+    EXPECT_TRUE(MountPointsNested("/data", "/data/media"));
+    EXPECT_TRUE(MountPointsNested("/data/media", "/data"));
+    EXPECT_TRUE(MountPointsNested("/", "/data"));
+    EXPECT_FALSE(MountPointsNested("/data", "/database"));
+    EXPECT_FALSE(MountPointsNested("/vendor", "/odm"));
+}
+
+TEST(ParallelFsPreparer, UnrelatedEntriesOverlap) {
+    FakePreparer fake;
+    // Each of /vendor and /odm is only done once the other one started.
+    fake.HoldUntilStarted("/vendor", "/odm");
+    fake.HoldUntilStarted("/odm", "/vendor");
+    ParallelFsPreparer preparer(fake.Function());
+    preparer.Start(Entry("/vendor"), 0);
+    preparer.Start(Entry("/odm"), 1);
+
+    EXPECT_EQ(7, preparer.Wait(0));
+    preparer.ReleaseBefore(1);
+    EXPECT_EQ(4, preparer.Wait(1));
+}
+
+TEST(ParallelFsPreparer, ParentBeforeChild) {
+    FakePreparer fake;
+    ParallelFsPreparer preparer(fake.Function());
+    preparer.Start(Entry("/data"), 0);
+    preparer.Start(Entry("/data/media"), 1);
+    preparer.Start(Entry("/metadata"), 2);
+
+    ASSERT_TRUE(preparer.IsPreparing(0));
+    EXPECT_EQ(5, preparer.Wait(0));
+    EXPECT_FALSE(preparer.IsPreparing(0));
+    // /metadata isn't nested with /data and goes ahead, but /data/media waits until /data was
+    // mounted over it.
+    ASSERT_TRUE(fake.WaitFor("/metadata", 5s));
+    EXPECT_FALSE(fake.WaitFor("/data/media", 100ms));
+
+    preparer.ReleaseBefore(1);
+    EXPECT_EQ(11, preparer.Wait(1));
+    preparer.ReleaseBefore(2);
+    EXPECT_EQ(9, preparer.Wait(2));
+
+    auto prepared = fake.prepared();
+    EXPECT_EQ("/data", prepared.front());
+    EXPECT_EQ("/data/media", prepared.back());
+}
+
+TEST(ParallelFsPreparer, ChildListedFirstFallsBackToFstabOrder) {
+    FakePreparer fake;
+    ParallelFsPreparer preparer(fake.Function());
+    preparer.Start(Entry("/data/media"), 0);
+    preparer.Start(Entry("/data"), 1);
+
+    EXPECT_EQ(11, preparer.Wait(0));
+    // Checking /data would mount it over /data/media, so it waits for its turn.
+    EXPECT_FALSE(fake.WaitFor("/data", 100ms));
+
+    preparer.ReleaseBefore(1);
+    EXPECT_EQ(5, preparer.Wait(1));
+    EXPECT_EQ((std::vector<std::string>{"/data/media", "/data"}), fake.prepared());
+}
+
+TEST(ParallelFsPreparer, DestructorReleasesWaitingEntries) {
+    FakePreparer fake;
+    {
+        ParallelFsPreparer preparer(fake.Function());
+        preparer.Start(Entry("/data"), 0);
+        preparer.Start(Entry("/data/media"), 1);
+        // fs_mgr_mount_all() may give up before it gets to either entry.
+    }
+    EXPECT_EQ(2u, fake.prepared().size());
+}
@@ -19,21 +19,22 @@
 #include <healthd/healthd.h>
 #include <healthd/BatteryMonitor.h>
 
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <memory>
 #include <optional>
+#include <string_view>
 
-#include <android-base/file.h>
 #include <android-base/parseint.h>
-#include <android-base/strings.h>
 #include <android/hardware/health/2.1/types.h>
 #include <batteryservice/BatteryService.h>
 #include <cutils/klog.h>
@@ -44,6 +45,7 @@
 
 #define POWER_SUPPLY_SUBSYSTEM "power_supply"
 #define POWER_SUPPLY_SYSFS_PATH "/sys/class/" POWER_SUPPLY_SUBSYSTEM
+#define SIZE 128
 #define FAKE_BATTERY_CAPACITY 42
 #define FAKE_BATTERY_TEMPERATURE 424
 #define MILLION 1.0e6
@@ -87,8 +89,11 @@ static void initHealthInfo(HealthInfo_2_1* health_info_2_1) {
     props->batteryHealth = BatteryHealth::UNKNOWN;
 }
 
-BatteryMonitor::BatteryMonitor()
-    : mHealthdConfig(nullptr),
+BatteryMonitor::BatteryMonitor() : BatteryMonitor(POWER_SUPPLY_SYSFS_PATH) {}
+
+BatteryMonitor::BatteryMonitor(const std::string& powerSupplyPath)
+    : mPowerSupplyPath(powerSupplyPath),
+      mHealthdConfig(nullptr),
       mBatteryDevicePresent(false),
       mBatteryFixedCapacity(0),
       mBatteryFixedTemperature(0),
@@ -96,7 +101,9 @@ BatteryMonitor::BatteryMonitor()
     initHealthInfo(mHealthInfo.get());
 }
 
-BatteryMonitor::~BatteryMonitor() {}
+BatteryMonitor::~BatteryMonitor() {
+    for (const auto& [path, fd] : mSysfsFds) close(fd);
+}
 
 const HealthInfo_1_0& BatteryMonitor::getHealthInfo_1_0() const {
     return getHealthInfo_2_0().legacy;
@@ -174,11 +181,45 @@ BatteryHealth getBatteryHealth(const char* status) {
     return *ret;
 }
 
-int BatteryMonitor::readFromFile(const String8& path, std::string* buf) {
-    if (android::base::ReadFileToString(path.c_str(), buf)) {
-        *buf = android::base::Trim(*buf);
+// sysfs regenerates an attribute on every read from offset 0, so the file
+// descriptors are kept open and pread() again on the next update. One that
+// no longer reads, e.g. because its power supply went away, is reopened.
+int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
+    if (path.isEmpty()) return -1;
+
+    ssize_t len = -1;
+    {
+        std::lock_guard<std::mutex> lock(mSysfsFdsLock);
+        std::string_view key(path.string(), path.length());
+        auto it = mSysfsFds.find(key);
+        if (it != mSysfsFds.end()) {
+            len = TEMP_FAILURE_RETRY(pread(it->second, buf, size - 1, 0));
+            if (len < 0) {
+                close(it->second);
+                mSysfsFds.erase(it);
+            }
+        }
+        if (len < 0) {
+            int fd = TEMP_FAILURE_RETRY(open(path.string(), O_RDONLY | O_CLOEXEC));
+            if (fd == -1) return -1;
+            len = TEMP_FAILURE_RETRY(pread(fd, buf, size - 1, 0));
+            if (len < 0) {
+                close(fd);
+                return -1;
+            }
+            mSysfsFds.emplace(key, fd);
+        }
     }
-    return buf->length();
+
+    // Trim the value in place, as ReadFileToString() and Trim() used to.
+    char* start = buf;
+    char* end = buf + len;
+    while (start < end && isspace(*start)) start++;
+    while (end > start && isspace(end[-1])) end--;
+    len = end - start;
+    memmove(buf, start, len);
+    buf[len] = '\0';
+    return len;
 }
 
 BatteryMonitor::PowerSupplyType BatteryMonitor::readPowerSupplyType(const String8& path) {
@@ -201,12 +242,12 @@ BatteryMonitor::PowerSupplyType BatteryMonitor::readPowerSupplyType(const String
             {"DASH", ANDROID_POWER_SUPPLY_TYPE_AC},
             {NULL, 0},
     };
-    std::string buf;
+    char buf[SIZE];
 
-    if (readFromFile(path, &buf) <= 0)
+    if (readFromFile(path, buf, sizeof(buf)) <= 0)
         return ANDROID_POWER_SUPPLY_TYPE_UNKNOWN;
 
-    auto ret = mapSysfsString(buf.c_str(), supplyTypeMap);
+    auto ret = mapSysfsString(buf, supplyTypeMap);
     if (!ret)
         *ret = ANDROID_POWER_SUPPLY_TYPE_UNKNOWN;
 
@@ -214,10 +255,10 @@ BatteryMonitor::PowerSupplyType BatteryMonitor::readPowerSupplyType(const String
 }
 
 bool BatteryMonitor::getBooleanField(const String8& path) {
-    std::string buf;
+    char buf[SIZE];
     bool value = false;
 
-    if (readFromFile(path, &buf) > 0)
+    if (readFromFile(path, buf, sizeof(buf)) > 0)
         if (buf[0] != '0')
             value = true;
 
@@ -225,10 +266,10 @@ bool BatteryMonitor::getBooleanField(const String8& path) {
 }
 
 int BatteryMonitor::getIntField(const String8& path) {
-    std::string buf;
+    char buf[SIZE];
     int value = 0;
 
-    if (readFromFile(path, &buf) > 0)
+    if (readFromFile(path, buf, sizeof(buf)) > 0)
         android::base::ParseInt(buf, &value);
 
     return value;
@@ -238,9 +279,9 @@ bool BatteryMonitor::isScopedPowerSupply(const char* name) {
     constexpr char kScopeDevice[] = "Device";
 
     String8 path;
-    path.appendFormat("%s/%s/scope", POWER_SUPPLY_SYSFS_PATH, name);
-    std::string scope;
-    return (readFromFile(path, &scope) > 0 && scope == kScopeDevice);
+    path.appendFormat("%s/%s/scope", mPowerSupplyPath.c_str(), name);
+    char scope[SIZE];
+    return (readFromFile(path, scope, sizeof(scope)) > 0 && !strcmp(scope, kScopeDevice));
 }
 
 void BatteryMonitor::updateValues(void) {
@@ -286,26 +327,26 @@ void BatteryMonitor::updateValues(void) {
         mBatteryFixedTemperature :
         getIntField(mHealthdConfig->batteryTemperaturePath);
 
-    std::string buf;
+    char buf[SIZE];
 
-    if (readFromFile(mHealthdConfig->batteryCapacityLevelPath, &buf) > 0)
-        mHealthInfo->batteryCapacityLevel = getBatteryCapacityLevel(buf.c_str());
+    if (readFromFile(mHealthdConfig->batteryCapacityLevelPath, buf, sizeof(buf)) > 0)
+        mHealthInfo->batteryCapacityLevel = getBatteryCapacityLevel(buf);
 
-    if (readFromFile(mHealthdConfig->batteryStatusPath, &buf) > 0)
-        props.batteryStatus = getBatteryStatus(buf.c_str());
+    if (readFromFile(mHealthdConfig->batteryStatusPath, buf, sizeof(buf)) > 0)
+        props.batteryStatus = getBatteryStatus(buf);
 
-    if (readFromFile(mHealthdConfig->batteryHealthPath, &buf) > 0)
-        props.batteryHealth = getBatteryHealth(buf.c_str());
+    if (readFromFile(mHealthdConfig->batteryHealthPath, buf, sizeof(buf)) > 0)
+        props.batteryHealth = getBatteryHealth(buf);
 
-    if (readFromFile(mHealthdConfig->batteryTechnologyPath, &buf) > 0)
-        props.batteryTechnology = String8(buf.c_str());
+    if (readFromFile(mHealthdConfig->batteryTechnologyPath, buf, sizeof(buf)) > 0)
+        props.batteryTechnology = String8(buf);
 
     double MaxPower = 0;
 
     // Rescan for the available charger types
-    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(POWER_SUPPLY_SYSFS_PATH), closedir);
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(mPowerSupplyPath.c_str()), closedir);
     if (dir == NULL) {
-        KLOG_ERROR(LOG_TAG, "Could not open %s\n", POWER_SUPPLY_SYSFS_PATH);
+        KLOG_ERROR(LOG_TAG, "Could not open %s\n", mPowerSupplyPath.c_str());
     } else {
         struct dirent* entry;
         String8 path;
@@ -320,13 +361,13 @@ void BatteryMonitor::updateValues(void) {
 
             // Look for "type" file in each subdirectory
             path.clear();
-            path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH, name);
+            path.appendFormat("%s/%s/type", mPowerSupplyPath.c_str(), name);
             switch(BatteryMonitor::readPowerSupplyType(path)) {
             case ANDROID_POWER_SUPPLY_TYPE_AC:
             case ANDROID_POWER_SUPPLY_TYPE_USB:
             case ANDROID_POWER_SUPPLY_TYPE_WIRELESS:
                 path.clear();
-                path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
+                path.appendFormat("%s/%s/online", mPowerSupplyPath.c_str(), name);
                 if (access(path.string(), R_OK) == 0)
                     mChargerNames.add(String8(name));
                 break;
@@ -338,11 +379,11 @@ void BatteryMonitor::updateValues(void) {
 
     for (size_t i = 0; i < mChargerNames.size(); i++) {
         String8 path;
-        path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH,
+        path.appendFormat("%s/%s/online", mPowerSupplyPath.c_str(),
                           mChargerNames[i].string());
         if (getIntField(path)) {
             path.clear();
-            path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH,
+            path.appendFormat("%s/%s/type", mPowerSupplyPath.c_str(),
                               mChargerNames[i].string());
             switch(readPowerSupplyType(path)) {
             case ANDROID_POWER_SUPPLY_TYPE_AC:
@@ -359,18 +400,19 @@ void BatteryMonitor::updateValues(void) {
                              mChargerNames[i].string());
             }
             path.clear();
-            path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
+            path.appendFormat("%s/%s/current_max", mPowerSupplyPath.c_str(),
                               mChargerNames[i].string());
-            int ChargingCurrent =
-                    (access(path.string(), R_OK) == 0) ? getIntField(path) : 0;
+            int ChargingCurrent = getIntField(path);
 
             path.clear();
-            path.appendFormat("%s/%s/voltage_max", POWER_SUPPLY_SYSFS_PATH,
+            path.appendFormat("%s/%s/voltage_max", mPowerSupplyPath.c_str(),
                               mChargerNames[i].string());
 
-            int ChargingVoltage =
-                (access(path.string(), R_OK) == 0) ? getIntField(path) :
-                DEFAULT_VBUS_VOLTAGE;
+            int ChargingVoltage = DEFAULT_VBUS_VOLTAGE;
+            if (readFromFile(path, buf, sizeof(buf)) >= 0) {
+                ChargingVoltage = 0;
+                android::base::ParseInt(buf, &ChargingVoltage);
+            }
 
             double power = ((double)ChargingCurrent / MILLION) *
                            ((double)ChargingVoltage / MILLION);
@@ -433,16 +475,15 @@ bool BatteryMonitor::isChargerOnline() {
 int BatteryMonitor::getChargeStatus() {
     BatteryStatus result = BatteryStatus::UNKNOWN;
     if (!mHealthdConfig->batteryStatusPath.isEmpty()) {
-        std::string buf;
-        if (readFromFile(mHealthdConfig->batteryStatusPath, &buf) > 0)
-            result = getBatteryStatus(buf.c_str());
+        char buf[SIZE];
+        if (readFromFile(mHealthdConfig->batteryStatusPath, buf, sizeof(buf)) > 0)
+            result = getBatteryStatus(buf);
     }
     return static_cast<int>(result);
 }
 
 status_t BatteryMonitor::getProperty(int id, struct BatteryProperty *val) {
     status_t ret = BAD_VALUE;
-    std::string buf;
 
     val->valueInt64 = LONG_MIN;
 
@@ -564,9 +605,9 @@ void BatteryMonitor::init(struct healthd_config *hc) {
     char pval[PROPERTY_VALUE_MAX];
 
     mHealthdConfig = hc;
-    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(POWER_SUPPLY_SYSFS_PATH), closedir);
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(mPowerSupplyPath.c_str()), closedir);
     if (dir == NULL) {
-        KLOG_ERROR(LOG_TAG, "Could not open %s\n", POWER_SUPPLY_SYSFS_PATH);
+        KLOG_ERROR(LOG_TAG, "Could not open %s\n", mPowerSupplyPath.c_str());
     } else {
         struct dirent* entry;
 
@@ -584,13 +625,13 @@ void BatteryMonitor::init(struct healthd_config *hc) {
 
             // Look for "type" file in each subdirectory
             path.clear();
-            path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH, name);
+            path.appendFormat("%s/%s/type", mPowerSupplyPath.c_str(), name);
             switch(readPowerSupplyType(path)) {
             case ANDROID_POWER_SUPPLY_TYPE_AC:
             case ANDROID_POWER_SUPPLY_TYPE_USB:
             case ANDROID_POWER_SUPPLY_TYPE_WIRELESS:
                 path.clear();
-                path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
+                path.appendFormat("%s/%s/online", mPowerSupplyPath.c_str(), name);
                 if (access(path.string(), R_OK) == 0)
                     mChargerNames.add(String8(name));
                 break;
@@ -605,7 +646,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
 
                 if (mHealthdConfig->batteryStatusPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/status", POWER_SUPPLY_SYSFS_PATH,
+                    path.appendFormat("%s/%s/status", mPowerSupplyPath.c_str(),
                                       name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryStatusPath = path;
@@ -613,7 +654,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
 
                 if (mHealthdConfig->batteryHealthPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/health", POWER_SUPPLY_SYSFS_PATH,
+                    path.appendFormat("%s/%s/health", mPowerSupplyPath.c_str(),
                                       name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryHealthPath = path;
@@ -621,7 +662,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
 
                 if (mHealthdConfig->batteryPresentPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/present", POWER_SUPPLY_SYSFS_PATH,
+                    path.appendFormat("%s/%s/present", mPowerSupplyPath.c_str(),
                                       name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryPresentPath = path;
@@ -629,7 +670,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
 
                 if (mHealthdConfig->batteryCapacityPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/capacity", POWER_SUPPLY_SYSFS_PATH,
+                    path.appendFormat("%s/%s/capacity", mPowerSupplyPath.c_str(),
                                       name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryCapacityPath = path;
@@ -638,7 +679,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryVoltagePath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/voltage_now",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0) {
                         mHealthdConfig->batteryVoltagePath = path;
                     }
@@ -647,7 +688,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryFullChargePath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/charge_full",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryFullChargePath = path;
                 }
@@ -655,7 +696,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryCurrentNowPath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/current_now",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryCurrentNowPath = path;
                 }
@@ -663,27 +704,27 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryCycleCountPath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/cycle_count",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryCycleCountPath = path;
                 }
 
                 if (mHealthdConfig->batteryCapacityLevelPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/capacity_level", POWER_SUPPLY_SYSFS_PATH, name);
+                    path.appendFormat("%s/%s/capacity_level", mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0) mHealthdConfig->batteryCapacityLevelPath = path;
                 }
 
                 if (mHealthdConfig->batteryChargeTimeToFullNowPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/time_to_full_now", POWER_SUPPLY_SYSFS_PATH, name);
+                    path.appendFormat("%s/%s/time_to_full_now", mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryChargeTimeToFullNowPath = path;
                 }
 
                 if (mHealthdConfig->batteryFullChargeDesignCapacityUahPath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/charge_full_design", POWER_SUPPLY_SYSFS_PATH, name);
+                    path.appendFormat("%s/%s/charge_full_design", mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryFullChargeDesignCapacityUahPath = path;
                 }
@@ -691,7 +732,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryCurrentAvgPath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/current_avg",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryCurrentAvgPath = path;
                 }
@@ -699,14 +740,14 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryChargeCounterPath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/charge_counter",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryChargeCounterPath = path;
                 }
 
                 if (mHealthdConfig->batteryTemperaturePath.isEmpty()) {
                     path.clear();
-                    path.appendFormat("%s/%s/temp", POWER_SUPPLY_SYSFS_PATH,
+                    path.appendFormat("%s/%s/temp", mPowerSupplyPath.c_str(),
                                       name);
                     if (access(path, R_OK) == 0) {
                         mHealthdConfig->batteryTemperaturePath = path;
@@ -716,7 +757,7 @@ void BatteryMonitor::init(struct healthd_config *hc) {
                 if (mHealthdConfig->batteryTechnologyPath.isEmpty()) {
                     path.clear();
                     path.appendFormat("%s/%s/technology",
-                                      POWER_SUPPLY_SYSFS_PATH, name);
+                                      mPowerSupplyPath.c_str(), name);
                     if (access(path, R_OK) == 0)
                         mHealthdConfig->batteryTechnologyPath = path;
                 }
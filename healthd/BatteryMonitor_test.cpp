@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+
+#include <android-base/file.h>
+#include <android/hardware/health/2.1/types.h>
+#include <gtest/gtest.h>
+#include <healthd/BatteryMonitor.h>
+
+using HealthInfo_1_0 = android::hardware::health::V1_0::HealthInfo;
+using android::hardware::health::V1_0::BatteryHealth;
+using android::hardware::health::V1_0::BatteryStatus;
+
+namespace android {
+
+// A /sys/class/power_supply lookalike with a battery and two chargers.
+class BatteryMonitorTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        AddSupply("battery", {{"type", "Battery"},
+                              {"status", "Charging"},
+                              {"health", "Good"},
+                              {"present", "1"},
+                              {"capacity", "42"},
+                              {"voltage_now", "3900000"},
+                              {"current_now", "-1200"},
+                              {"temp", "250"},
+                              {"technology", "Li-ion"}});
+        AddSupply("usb", {{"type", "USB"},
+                          {"online", "1"},
+                          {"current_max", "500000"},
+                          {"voltage_max", "5000000"}});
+        AddSupply("ac", {{"type", "Mains"}, {"online", "0"}});
+
+        config_ = std::make_unique<healthd_config>();
+        config_->periodic_chores_interval_fast = 60;
+        config_->periodic_chores_interval_slow = 600;
+        monitor_ = std::make_unique<BatteryMonitor>(dir_.path);
+        monitor_->init(config_.get());
+    }
+
+    void AddSupply(const std::string& name, const std::map<std::string, std::string>& attrs) {
+        ASSERT_EQ(0, mkdir(Path(name).c_str(), 0755));
+        for (const auto& [attr, value] : attrs) SetAttr(name, attr, value);
+    }
+
+    // Like the kernel, rewrites the attribute in place, so the same file
+    // descriptor sees the new value.
+    void SetAttr(const std::string& name, const std::string& attr, const std::string& value) {
+        ASSERT_TRUE(base::WriteStringToFile(value + "\n", Path(name) + "/" + attr));
+    }
+
+    std::string Path(const std::string& name) { return std::string(dir_.path) + "/" + name; }
+
+    const HealthInfo_1_0& Update() {
+        monitor_->updateValues();
+        return monitor_->getHealthInfo_1_0();
+    }
+
+    TemporaryDir dir_;
+    std::unique_ptr<healthd_config> config_;
+    std::unique_ptr<BatteryMonitor> monitor_;
+};
+
+TEST_F(BatteryMonitorTest, FindsBatteryAttributes) {
+    EXPECT_EQ(Path("battery") + "/capacity", config_->batteryCapacityPath.string());
+    EXPECT_EQ(Path("battery") + "/status", config_->batteryStatusPath.string());
+    EXPECT_TRUE(config_->batteryFullChargePath.isEmpty());
+}
+
+TEST_F(BatteryMonitorTest, ReadsValues) {
+    const auto& props = Update();
+    EXPECT_TRUE(props.batteryPresent);
+    EXPECT_EQ(42, props.batteryLevel);
+    EXPECT_EQ(3900, props.batteryVoltage);
+    EXPECT_EQ(-1200, props.batteryCurrent);
+    EXPECT_EQ(250, props.batteryTemperature);
+    EXPECT_EQ(BatteryStatus::CHARGING, props.batteryStatus);
+    EXPECT_EQ(BatteryHealth::GOOD, props.batteryHealth);
+    EXPECT_EQ("Li-ion", std::string(props.batteryTechnology));
+    EXPECT_TRUE(props.chargerUsbOnline);
+    EXPECT_FALSE(props.chargerAcOnline);
+    EXPECT_EQ(500000, props.maxChargingCurrent);
+    EXPECT_EQ(5000000, props.maxChargingVoltage);
+}
+
+TEST_F(BatteryMonitorTest, RereadsChangedValues) {
+    Update();
+    SetAttr("battery", "capacity", "43");
+    SetAttr("battery", "status", "Full");
+    SetAttr("usb", "online", "0");
+    SetAttr("ac", "online", "1");
+    const auto& props = Update();
+    EXPECT_EQ(43, props.batteryLevel);
+    EXPECT_EQ(BatteryStatus::FULL, props.batteryStatus);
+    EXPECT_FALSE(props.chargerUsbOnline);
+    EXPECT_TRUE(props.chargerAcOnline);
+    EXPECT_EQ(0, props.maxChargingCurrent);
+}
+
+TEST_F(BatteryMonitorTest, ChargerTypeChanges) {
+    Update();
+    SetAttr("usb", "type", "USB_DCP");
+    const auto& props = Update();
+    EXPECT_FALSE(props.chargerUsbOnline);
+    EXPECT_TRUE(props.chargerAcOnline);
+}
+
+TEST_F(BatteryMonitorTest, ChargerWithoutVoltageMax) {
+    ASSERT_EQ(0, unlink((Path("usb") + "/voltage_max").c_str()));
+    const auto& props = Update();
+    EXPECT_EQ(500000, props.maxChargingCurrent);
+    EXPECT_EQ(5000000, props.maxChargingVoltage);
+}
+
+TEST_F(BatteryMonitorTest, ChargerAdded) {
+    EXPECT_FALSE(Update().chargerWirelessOnline);
+    AddSupply("wireless", {{"type", "Wireless"}, {"online", "1"}});
+    EXPECT_TRUE(Update().chargerWirelessOnline);
+}
+
+TEST_F(BatteryMonitorTest, GetProperty) {
+    BatteryProperty val;
+    ASSERT_EQ(OK, monitor_->getProperty(BATTERY_PROP_CAPACITY, &val));
+    EXPECT_EQ(42, val.valueInt64);
+    SetAttr("battery", "capacity", "7");
+    ASSERT_EQ(OK, monitor_->getProperty(BATTERY_PROP_CAPACITY, &val));
+    EXPECT_EQ(7, val.valueInt64);
+    EXPECT_EQ(NAME_NOT_FOUND, monitor_->getProperty(BATTERY_PROP_CHARGE_COUNTER, &val));
+    EXPECT_EQ(static_cast<int>(BatteryStatus::CHARGING), monitor_->getChargeStatus());
+}
+
+}  // namespace android
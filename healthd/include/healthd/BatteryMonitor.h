@@ -17,7 +17,10 @@
 #ifndef HEALTHD_BATTERYMONITOR_H
 #define HEALTHD_BATTERYMONITOR_H
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include <batteryservice/BatteryService.h>
 #include <utils/String8.h>
@@ -52,6 +55,9 @@ class BatteryMonitor {
     };
 
     BatteryMonitor();
+    // Reads power supplies from powerSupplyPath rather than from
+    // /sys/class/power_supply, e.g. from a fake sysfs tree in tests.
+    explicit BatteryMonitor(const std::string& powerSupplyPath);
     ~BatteryMonitor();
     void init(struct healthd_config *hc);
     int getChargeStatus();
@@ -70,14 +76,18 @@ class BatteryMonitor {
                           const struct healthd_config& healthd_config);
 
   private:
+    std::string mPowerSupplyPath;
     struct healthd_config *mHealthdConfig;
     Vector<String8> mChargerNames;
     bool mBatteryDevicePresent;
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
     std::unique_ptr<android::hardware::health::V2_1::HealthInfo> mHealthInfo;
+    // Open sysfs attributes by path, reread on every update.
+    std::mutex mSysfsFdsLock;
+    std::map<std::string, int, std::less<>> mSysfsFds;
 
-    int readFromFile(const String8& path, std::string* buf);
+    int readFromFile(const String8& path, char* buf, size_t size);
     PowerSupplyType readPowerSupplyType(const String8& path);
     bool getBooleanField(const String8& path);
     int getIntField(const String8& path);
@@ -75,6 +75,7 @@
 #include "mount_namespace.h"
 #include "parser.h"
 #include "property_service.h"
+#include "readahead_profile.h"
 #include "reboot.h"
 #include "rlimit_parser.h"
 #include "selabel.h"
@@ -1461,6 +1462,7 @@ const BuiltinFunctionMap& GetBuiltinFunctionMap() {
         {"umount_all",              {0,     1,    {false,  do_umount_all}}},
         {"update_linker_config",    {0,     0,    {false,  do_update_linker_config}}},
         {"readahead",               {1,     2,    {true,   do_readahead}}},
+        {"readahead_profile",       {1,     1,    {false,  do_readahead_profile}}},
         {"remount_userdata",        {0,     0,    {false,  do_remount_userdata}}},
         {"restart",                 {1,     1,    {false,  do_restart}}},
         {"restorecon",              {1,     kMax, {true,   do_restorecon}}},
@@ -161,10 +161,72 @@ bool Permissions::Match(const std::string& path) const {
     return path == name_;
 }
 
+void PermissionsMatcher::Add(const Permissions& rule, size_t index) {
+    const std::string& name = rule.name_;
+
+    // Only the text before the first fnmatch() special character is matched literally.
+    size_t literal_length = name.size();
+    if (rule.wildcard_) {
+        literal_length = std::min(name.find_first_of("*?[\\"), name.size());
+    }
+
+    size_t node = 0;
+    for (size_t i = 0; i < literal_length; ++i) {
+        node = FindOrAddChild(node, name[i]);
+    }
+
+    if (rule.prefix_) {
+        nodes_[node].prefix.emplace_back(index);
+    } else if (rule.wildcard_) {
+        nodes_[node].wildcard.push_back(
+                {name, rule.no_fnm_pathname_ ? 0 : FNM_PATHNAME, index});
+    } else {
+        nodes_[node].exact.emplace_back(index);
+    }
+}
+
+size_t PermissionsMatcher::FindOrAddChild(size_t node, char c) {
+    auto& children = nodes_[node].children;
+    auto it = std::lower_bound(children.begin(), children.end(), c,
+                               [](const auto& child, char value) { return child.first < value; });
+    if (it != children.end() && it->first == c) return it->second;
+
+    size_t child = nodes_.size();
+    children.emplace(it, c, child);
+    // This invalidates |children|, so it must come last.
+    nodes_.emplace_back();
+    return child;
+}
+
+const PermissionsMatcher::Node* PermissionsMatcher::FindChild(const Node& node, char c) const {
+    auto it = std::lower_bound(node.children.begin(), node.children.end(), c,
+                               [](const auto& child, char value) { return child.first < value; });
+    if (it == node.children.end() || it->first != c) return nullptr;
+    return &nodes_[it->second];
+}
+
+void PermissionsMatcher::FindMatches(const std::string& path, std::vector<size_t>* matches) const {
+    const Node* node = &nodes_[0];
+    for (size_t depth = 0; node != nullptr; ++depth) {
+        matches->insert(matches->end(), node->prefix.begin(), node->prefix.end());
+        for (const auto& rule : node->wildcard) {
+            if (fnmatch(rule.pattern.c_str(), path.c_str(), rule.flags) == 0) {
+                matches->emplace_back(rule.index);
+            }
+        }
+
+        if (depth == path.size()) {
+            matches->insert(matches->end(), node->exact.begin(), node->exact.end());
+            break;
+        }
+        node = FindChild(*node, path[depth]);
+    }
+}
+
 bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
                                           const std::string& subsystem) const {
     std::string path_basename = Basename(path);
-    if (name().find(subsystem) != std::string::npos) {
+    if (AppliesToSubsystemLinks(subsystem)) {
         if (Match("/sys/class/" + subsystem + "/" + path_basename)) return true;
         if (Match("/sys/bus/" + subsystem + "/devices/" + path_basename)) return true;
     }
@@ -224,30 +286,55 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
     // upaths omit the "/sys" that paths in this list
     // contain, so we prepend it...
     std::string path = "/sys" + upath;
+    // ... but the attributes themselves live under the sysfs mount point.
+    std::string sysfs_path = sysfs_mount_point_ + upath;
+
+    // This is the compiled equivalent of calling MatchWithSubsystem() for every rule.
+    std::vector<size_t> matches;
+    sysfs_permissions_matcher_.FindMatches(path, &matches);
 
-    for (const auto& s : sysfs_permissions_) {
-        if (s.MatchWithSubsystem(path, subsystem)) s.SetPermissions(path);
+    std::vector<size_t> subsystem_matches;
+    std::string path_basename = Basename(path);
+    sysfs_permissions_matcher_.FindMatches("/sys/class/" + subsystem + "/" + path_basename,
+                                           &subsystem_matches);
+    sysfs_permissions_matcher_.FindMatches("/sys/bus/" + subsystem + "/devices/" + path_basename,
+                                           &subsystem_matches);
+    for (auto index : subsystem_matches) {
+        if (sysfs_permissions_[index].AppliesToSubsystemLinks(subsystem)) {
+            matches.emplace_back(index);
+        }
+    }
+
+    // Rules are applied in the order in which they were parsed, each at most once.
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    for (auto index : matches) {
+        sysfs_permissions_[index].SetPermissions(sysfs_path);
     }
 
-    if (!skip_restorecon_ && access(path.c_str(), F_OK) == 0) {
-        LOG(VERBOSE) << "restorecon_recursive: " << path;
-        if (selinux_android_restorecon(path.c_str(), SELINUX_ANDROID_RESTORECON_RECURSE) != 0) {
-            PLOG(ERROR) << "selinux_android_restorecon(" << path << ") failed";
+    if (!skip_restorecon_ && access(sysfs_path.c_str(), F_OK) == 0) {
+        LOG(VERBOSE) << "restorecon_recursive: " << sysfs_path;
+        if (selinux_android_restorecon(sysfs_path.c_str(), SELINUX_ANDROID_RESTORECON_RECURSE) !=
+            0) {
+            PLOG(ERROR) << "selinux_android_restorecon(" << sysfs_path << ") failed";
         }
     }
 }
 
 std::tuple<mode_t, uid_t, gid_t> DeviceHandler::GetDevicePermissions(
     const std::string& path, const std::vector<std::string>& links) const {
-    // Search the perms list in reverse so that ueventd.$hardware can override ueventd.rc.
-    for (auto it = dev_permissions_.crbegin(); it != dev_permissions_.crend(); ++it) {
-        if (it->Match(path) || std::any_of(links.cbegin(), links.cend(),
-                                           [it](const auto& link) { return it->Match(link); })) {
-            return {it->perm(), it->uid(), it->gid()};
-        }
+    std::vector<size_t> matches;
+    dev_permissions_matcher_.FindMatches(path, &matches);
+    for (const auto& link : links) {
+        dev_permissions_matcher_.FindMatches(link, &matches);
     }
+
     /* Default if nothing found. */
-    return {0600, 0, 0};
+    if (matches.empty()) return {0600, 0, 0};
+
+    // The last matching rule wins, so that ueventd.$hardware can override ueventd.rc.
+    const auto& permissions = dev_permissions_[*std::max_element(matches.begin(), matches.end())];
+    return {permissions.perm(), permissions.uid(), permissions.gid()};
 }
 
 void DeviceHandler::MakeDevice(const std::string& path, bool block, int major, int minor,
@@ -530,6 +617,8 @@ DeviceHandler::DeviceHandler(std::vector<Permissions> dev_permissions,
                              bool skip_restorecon)
     : dev_permissions_(std::move(dev_permissions)),
       sysfs_permissions_(std::move(sysfs_permissions)),
+      dev_permissions_matcher_(dev_permissions_),
+      sysfs_permissions_matcher_(sysfs_permissions_),
       subsystems_(std::move(subsystems)),
       boot_devices_(std::move(boot_devices)),
       skip_restorecon_(skip_restorecon),
@@ -36,6 +36,7 @@ namespace init {
 
 class Permissions {
   public:
+    friend class PermissionsMatcher;
     friend void TestPermissions(const Permissions& expected, const Permissions& test);
 
     Permissions(const std::string& name, mode_t perm, uid_t uid, gid_t gid, bool no_fnm_pathname);
@@ -68,12 +69,58 @@ class SysfsPermissions : public Permissions {
         : Permissions(name, perm, uid, gid, no_fnm_pathname), attribute_(attribute) {}
 
     bool MatchWithSubsystem(const std::string& path, const std::string& subsystem) const;
+    // Rules whose name mentions the subsystem are also matched against the /sys/class and /sys/bus
+    // paths of the device.
+    bool AppliesToSubsystemLinks(const std::string& subsystem) const {
+        return name().find(subsystem) != std::string::npos;
+    }
     void SetPermissions(const std::string& path) const;
 
+    const std::string& attribute() const { return attribute_; }
+
   private:
     const std::string attribute_;
 };
 
+// Compiled form of a list of Permissions rules, built once after ueventd.rc has been parsed.
+// Exact and prefix rules are stored in a trie keyed on their names.  Wildcard rules hang off the
+// trie node for the literal text that precedes their first fnmatch() special character, so fnmatch()
+// is only run for the rules whose literal prefix already matched the path.  Matches are reported
+// as indices into the original list, so callers keep the 'later rules override earlier ones'
+// semantics of the list.
+class PermissionsMatcher {
+  public:
+    PermissionsMatcher() = default;
+    template <typename T>
+    explicit PermissionsMatcher(const std::vector<T>& rules) {
+        for (size_t i = 0; i < rules.size(); ++i) {
+            Add(rules[i], i);
+        }
+    }
+
+    // Appends the index of every rule that matches |path| to |matches|, in no particular order.
+    void FindMatches(const std::string& path, std::vector<size_t>* matches) const;
+
+  private:
+    struct WildcardRule {
+        std::string pattern;
+        int flags;
+        size_t index;
+    };
+    struct Node {
+        std::vector<std::pair<char, size_t>> children;  // Sorted by character.
+        std::vector<size_t> exact;
+        std::vector<size_t> prefix;
+        std::vector<WildcardRule> wildcard;
+    };
+
+    void Add(const Permissions& rule, size_t index);
+    size_t FindOrAddChild(size_t node, char c);
+    const Node* FindChild(const Node& node, char c) const;
+
+    std::vector<Node> nodes_ = std::vector<Node>(1);
+};
+
 class Subsystem {
   public:
     friend class SubsystemParser;
@@ -135,6 +182,8 @@ class DeviceHandler : public UeventHandler {
 
     std::vector<Permissions> dev_permissions_;
     std::vector<SysfsPermissions> sysfs_permissions_;
+    PermissionsMatcher dev_permissions_matcher_;
+    PermissionsMatcher sysfs_permissions_matcher_;
     std::vector<Subsystem> subsystems_;
     std::set<std::string> boot_devices_;
     bool skip_restorecon_;
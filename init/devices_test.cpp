@@ -16,6 +16,10 @@
 
 #include "devices.h"
 
+#include <sys/stat.h>
+
+#include <set>
+
 #include <android-base/file.h>
 #include <android-base/scopeguard.h>
 #include <gtest/gtest.h>
@@ -56,6 +60,13 @@ class DeviceHandlerTester {
         }
     }
 
+    static void FixupSysPermissions(DeviceHandler* device_handler,
+                                    const std::string& sysfs_mount_point, const std::string& upath,
+                                    const std::string& subsystem) {
+        device_handler->sysfs_mount_point_ = sysfs_mount_point;
+        device_handler->FixupSysPermissions(upath, subsystem);
+    }
+
   private:
     DeviceHandler device_handler_;
 };
@@ -328,5 +339,141 @@ TEST(device_handler, SysfsPermissionsMatchWithSubsystemBus) {
     EXPECT_EQ(1001U, permissions.gid());
 }
 
+// Uevents recorded during cold boot, as (devpath, subsystem, device node) tuples.
+struct RecordedUevent {
+    const char* path;
+    const char* subsystem;
+    const char* device;
+};
+
+static const RecordedUevent kRecordedUevents[] = {
+        {"/devices/virtual/mem/null", "mem", "/dev/null"},
+        {"/devices/virtual/mem/zero", "mem", "/dev/zero"},
+        {"/devices/virtual/tty/ptmx", "tty", "/dev/ptmx"},
+        {"/devices/virtual/tty/tty0", "tty", "/dev/tty0"},
+        {"/devices/virtual/tty/tty12", "tty", "/dev/tty12"},
+        {"/devices/virtual/misc/ashmem", "misc", "/dev/ashmem"},
+        {"/devices/virtual/misc/binder", "misc", "/dev/binder"},
+        {"/devices/virtual/misc/uhid", "misc", "/dev/uhid"},
+        {"/devices/virtual/misc/uhid/0005:045E:0B13.0001/leds/input5:white:player-1", "leds",
+         nullptr},
+        {"/devices/virtual/input/input3", "input", nullptr},
+        {"/devices/virtual/input/input3/event3", "input", "/dev/input/event3"},
+        {"/devices/virtual/usb_composite/mtp", "usb_composite", nullptr},
+        {"/devices/virtual/dma_heap/system", "dma_heap", "/dev/dma_heap/system"},
+        {"/devices/virtual/dma_heap/system-uncached", "dma_heap", "/dev/dma_heap/system-uncached"},
+        {"/devices/platform/trusty.0", "platform", nullptr},
+        {"/devices/platform/trusty.0/trusty-virtio.0", "platform", nullptr},
+        {"/devices/platform/soc/ae00000.mdss/drm/card0", "drm", "/dev/dri/card0"},
+        {"/devices/platform/soc/ae00000.mdss/graphics/fb0", "graphics", "/dev/graphics/fb0"},
+        {"/devices/platform/soc/c440000.qcom,spmi/rtc/rtc0", "rtc", "/dev/rtc0"},
+        {"/devices/platform/soc/a600000.dwc3/usb1/1-1", "usb", "/dev/bus/usb/001/002"},
+        {"/devices/platform/soc/soc:sound/sound/card0/pcmC0D0p", "sound", "/dev/snd/pcmC0D0p"},
+        {"/devices/soc.0/f9924000.i2c/i2c-2/2-0020/input/input0/event0", "input",
+         "/dev/input/event0"},
+        {"/devices/soc.0/f9967000.i2c/i2c-5", "i2c", nullptr},
+        {"/devices/system/cpu/cpu0", "cpu", nullptr},
+        {"/devices/system/cpu/cpu7", "cpu", nullptr},
+        {"/devices/system/cpu/cpufreq", "cpu", nullptr},
+        {"/devices/v4l-touch0", "video4linux", "/dev/v4l-touch0"},
+};
+
+static const std::vector<Permissions> kRecordedDevPermissions = {
+        {"/dev/null", 0666, 0, 0, false},
+        {"/dev/zero", 0666, 0, 0, false},
+        {"/dev/ptmx", 0666, 0, 0, false},
+        {"/dev/ashmem*", 0666, 0, 0, false},
+        {"/dev/binder", 0666, 0, 0, false},
+        {"/dev/dma_heap/system", 0444, 1000, 1000, false},
+        {"/dev/dma_heap/system-uncached", 0444, 1000, 1000, false},
+        {"/dev/dri/*", 0666, 0, 1003, false},
+        {"/dev/uhid", 0660, 3011, 3011, false},
+        {"/dev/rtc0", 0640, 1000, 1000, false},
+        {"/dev/tty0", 0660, 0, 1000, false},
+        {"/dev/graphics/*", 0660, 0, 1003, false},
+        {"/dev/input/*", 0660, 0, 1004, false},
+        {"/dev/v4l-touch*", 0660, 0, 1004, false},
+        {"/dev/snd/*", 0660, 1000, 1005, false},
+        {"/dev/bus/usb/*", 0660, 0, 1018, false},
+        {"/dev/tty*", 0600, 0, 0, false},
+        {"/dev/*/event?", 0640, 0, 1004, false},
+        {"/dev/snd/pcmC[0-9]D*p", 0660, 1000, 1005, false},
+        {"/dev/*", 0600, 1000, 1000, true},
+        {"/dev/input/event0", 0600, 1000, 1004, false},
+};
+
+static const std::vector<SysfsPermissions> kRecordedSysfsPermissions = {
+        {"/sys/devices/platform/trusty.*", "trusty_version", 0440, 0, 1007, false},
+        {"/sys/devices/virtual/input/input*", "enable", 0660, 0, 1004, false},
+        {"/sys/devices/virtual/input/input*", "poll_delay", 0660, 0, 1004, false},
+        {"/sys/devices/virtual/usb_composite/*", "enable", 0664, 0, 1000, false},
+        {"/sys/devices/system/cpu/cpu*", "cpufreq/scaling_max_freq", 0664, 1000, 1000, false},
+        {"/sys/devices/virtual/misc/uhid/*/leds/*", "brightness", 0664, 1000, 1000, false},
+        {"/sys/class/input/event*", "enable", 0660, 0, 1004, false},
+        {"/sys/bus/i2c/devices/i2c-*", "enable", 0660, 0, 1004, false},
+        {"/sys/devices/*/input", "poll_delay", 0660, 0, 1004, true},
+        {"/sys/devices/virtual/tty/tty0", "active", 0440, 0, 0, false},
+};
+
+static std::vector<size_t> CompiledMatches(const PermissionsMatcher& matcher,
+                                           const std::string& path) {
+    std::vector<size_t> matches;
+    matcher.FindMatches(path, &matches);
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+TEST(device_handler, PermissionsMatcherMatchesDevPermissions) {
+    PermissionsMatcher matcher(kRecordedDevPermissions);
+
+    for (const auto& uevent : kRecordedUevents) {
+        if (uevent.device == nullptr) continue;
+
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < kRecordedDevPermissions.size(); ++i) {
+            if (kRecordedDevPermissions[i].Match(uevent.device)) expected.emplace_back(i);
+        }
+        EXPECT_EQ(expected, CompiledMatches(matcher, uevent.device)) << uevent.device;
+    }
+}
+
+// Applies the recorded rules to a fake sysfs tree through the DeviceHandler, and checks that every
+// attribute ends up with the mode of the last rule that MatchWithSubsystem() says applies to it.
+TEST(device_handler, FixupSysPermissionsMatchesSysfsPermissions) {
+    TemporaryDir fake_sys_root;
+    std::set<std::string> attributes;
+    for (const auto& permissions : kRecordedSysfsPermissions) {
+        attributes.emplace(permissions.attribute());
+    }
+
+    DeviceHandler device_handler({}, kRecordedSysfsPermissions, {}, {}, true);
+    for (const auto& uevent : kRecordedUevents) {
+        std::string dir = fake_sys_root.path + std::string(uevent.path);
+        for (const auto& attribute : attributes) {
+            std::string file = dir + "/" + attribute;
+            ASSERT_TRUE(mkdir_recursive(android::base::Dirname(file), 0755)) << file;
+            ASSERT_TRUE(android::base::WriteStringToFile("", file)) << file;
+            ASSERT_EQ(0, chmod(file.c_str(), 0600)) << file;
+        }
+
+        DeviceHandlerTester::FixupSysPermissions(&device_handler, fake_sys_root.path,
+                                                 uevent.path, uevent.subsystem);
+
+        std::string path = "/sys"s + uevent.path;
+        for (const auto& attribute : attributes) {
+            mode_t expected = 0600;
+            for (const auto& permissions : kRecordedSysfsPermissions) {
+                if (permissions.attribute() == attribute &&
+                    permissions.MatchWithSubsystem(path, uevent.subsystem)) {
+                    expected = permissions.perm();
+                }
+            }
+            struct stat st;
+            ASSERT_EQ(0, stat((dir + "/" + attribute).c_str(), &st));
+            EXPECT_EQ(expected, st.st_mode & 07777) << path << "/" << attribute;
+        }
+    }
+}
+
 }  // namespace init
 }  // namespace android
@@ -20,10 +20,13 @@
 #include <sys/mount.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -67,6 +70,7 @@ using android::fs_mgr::ReadDefaultFstab;
 using android::fs_mgr::ReadFstabFromDt;
 using android::fs_mgr::SkipMountingPartitions;
 using android::fs_mgr::TransformFstabForDsu;
+using android::fs_mgr::WriteDefaultFstabCache;
 using android::snapshot::SnapshotManager;
 
 using namespace std::literals;
@@ -93,7 +97,10 @@ class FirstStageMount {
     bool CreateLogicalPartitions();
     bool CreateSnapshotPartitions(android::snapshot::SnapshotManager* sm);
     bool MountPartition(const Fstab::iterator& begin, bool erase_same_mounts,
-                        Fstab::iterator* end = nullptr);
+                        Fstab::iterator* end = nullptr,
+                        std::future<bool>* devices_ready = nullptr);
+    bool SetUpPartitionDevices(FstabEntry* entry);
+    bool InitDmDevice(const std::string& device);
 
     bool MountPartitions();
     bool TrySwitchSystemAsRoot();
@@ -107,6 +114,10 @@ class FirstStageMount {
     // revocation check by DSU installation service.
     void CopyDsuAvbKeys();
 
+    // Called before SetUpDmVerity() runs for several partitions at once. Returns false if it
+    // can't, in which case partitions are set up one at a time.
+    virtual bool PrepareConcurrentDmVerity() { return false; }
+
     // Pure virtual functions.
     virtual bool GetDmVerityDevices(std::set<std::string>* devices) = 0;
     virtual bool SetUpDmVerity(FstabEntry* fstab_entry) = 0;
@@ -120,6 +131,8 @@ class FirstStageMount {
     std::string super_path_;
     std::string super_partition_name_;
     BlockDevInitializer block_dev_init_;
+    // Guards block_dev_init_ while partitions are set up concurrently.
+    std::mutex block_dev_init_lock_;
     // Reads all AVB keys before chroot into /system, as they might be used
     // later when mounting other partitions, e.g., /vendor and /product.
     std::map<std::string, std::vector<std::string>> preload_avb_key_blobs_;
@@ -143,6 +156,7 @@ class FirstStageMountVBootV2 : public FirstStageMount {
     ~FirstStageMountVBootV2() override = default;
 
   protected:
+    bool PrepareConcurrentDmVerity() override;
     bool GetDmVerityDevices(std::set<std::string>* devices) override;
     bool SetUpDmVerity(FstabEntry* fstab_entry) override;
     bool InitAvbHandle();
@@ -379,7 +393,13 @@ bool FirstStageMount::CreateLogicalPartitions() {
     if (!InitDmLinearBackingDevices(*metadata.get())) {
         return false;
     }
-    return android::fs_mgr::CreateLogicalPartitions(*metadata.get(), super_path_);
+
+    Timer t;
+    if (!android::fs_mgr::CreateLogicalPartitions(*metadata.get(), super_path_)) {
+        return false;
+    }
+    LOG(INFO) << "Created device-mapper devices for logical partitions in " << t;
+    return true;
 }
 
 bool FirstStageMount::CreateSnapshotPartitions(SnapshotManager* sm) {
@@ -403,9 +423,11 @@ bool FirstStageMount::CreateSnapshotPartitions(SnapshotManager* sm) {
         }
         return block_dev_init_.InitDevices({device});
     });
+    Timer t;
     if (!sm->CreateLogicalAndSnapshotPartitions(super_path_)) {
         return false;
     }
+    LOG(INFO) << "Created device-mapper devices for logical and snapshot partitions in " << t;
 
     if (use_snapuserd_) {
         CleanupSnapuserdSocket();
@@ -413,8 +435,32 @@ bool FirstStageMount::CreateSnapshotPartitions(SnapshotManager* sm) {
     return true;
 }
 
+bool FirstStageMount::InitDmDevice(const std::string& device) {
+    std::lock_guard lock(block_dev_init_lock_);
+    return block_dev_init_.InitDmDevice(device);
+}
+
+// Sets up the block devices to mount |entry| from: its logical partition, then dm-verity on top.
+bool FirstStageMount::SetUpPartitionDevices(FstabEntry* entry) {
+    if (entry->fs_mgr_flags.logical) {
+        if (!fs_mgr_update_logical_partition(entry)) {
+            return false;
+        }
+        if (!InitDmDevice(entry->blk_device)) {
+            return false;
+        }
+    }
+    if (!SetUpDmVerity(entry)) {
+        PLOG(ERROR) << "Failed to setup verity for '" << entry->mount_point << "'";
+        return false;
+    }
+    return true;
+}
+
+// devices_ready: If set, the pending result of SetUpPartitionDevices() for begin, which then
+//     isn't called again.
 bool FirstStageMount::MountPartition(const Fstab::iterator& begin, bool erase_same_mounts,
-                                     Fstab::iterator* end) {
+                                     Fstab::iterator* end, std::future<bool>* devices_ready) {
     // Sets end to begin + 1, so we can just return on failure below.
     if (end) {
         *end = begin + 1;
@@ -424,16 +470,7 @@ bool FirstStageMount::MountPartition(const Fstab::iterator& begin, bool erase_sa
         return false;
     }
 
-    if (begin->fs_mgr_flags.logical) {
-        if (!fs_mgr_update_logical_partition(&(*begin))) {
-            return false;
-        }
-        if (!block_dev_init_.InitDmDevice(begin->blk_device)) {
-            return false;
-        }
-    }
-    if (!SetUpDmVerity(&(*begin))) {
-        PLOG(ERROR) << "Failed to setup verity for '" << begin->mount_point << "'";
+    if (devices_ready ? !devices_ready->get() : !SetUpPartitionDevices(&(*begin))) {
         return false;
     }
 
@@ -534,34 +571,65 @@ bool FirstStageMount::TrySwitchSystemAsRoot() {
     return true;
 }
 
+// Whether MountPartitions() leaves |entry| alone.
+static bool SkipMountPartitionsEntry(const FstabEntry& entry) {
+    // We've already mounted /system in TrySwitchSystemAsRoot().
+    // Overlayfs entries are handled later.
+    // Raw partition entries such as boot, dtbo, etc. are skipped. Having emmc fstab entries
+    // allows us to probe entry.vbmeta_partition in InitDevices() when they are AVB chained
+    // partitions.
+    return entry.mount_point == "/system" || entry.fs_type == "overlay" ||
+           entry.fs_type == "emmc";
+}
+
 bool FirstStageMount::MountPartitions() {
     if (!TrySwitchSystemAsRoot()) return false;
 
     if (!SkipMountingPartitions(&fstab_, true /* verbose */)) return false;
 
-    for (auto current = fstab_.begin(); current != fstab_.end();) {
-        // We've already mounted /system above.
-        if (current->mount_point == "/system") {
-            ++current;
-            continue;
-        }
-
-        // Handle overlayfs entries later.
-        if (current->fs_type == "overlay") {
-            ++current;
-            continue;
+    // Setting up dm-verity mostly waits on storage, to read vbmeta, and on the kernel, to create
+    // the dm devices, so start it for every partition at once. Partitions are still mounted one
+    // at a time and in fstab order below, each once its own devices are ready. Only the first
+    // entry for a mount point is set up, as in MountPartition().
+    struct PartitionSetUp {
+        std::future<bool> ready;
+        std::chrono::milliseconds took;
+        std::chrono::steady_clock::time_point done;
+    };
+    std::map<const FstabEntry*, PartitionSetUp> set_ups;
+    auto set_up_start = std::chrono::steady_clock::now();
+    if (PrepareConcurrentDmVerity()) {
+        for (auto current = fstab_.begin(); current != fstab_.end();) {
+            if (SkipMountPartitionsEntry(*current)) {
+                ++current;
+                continue;
+            }
+            auto& set_up = set_ups[&(*current)];
+            set_up.ready = std::async(std::launch::async, [this, entry = &(*current), &set_up]() {
+                Timer t;
+                bool ready = SetUpPartitionDevices(entry);
+                set_up.took = t.duration();
+                set_up.done = std::chrono::steady_clock::now();
+                LOG(INFO) << "Set up devices for '" << entry->mount_point << "' in " << t;
+                return ready;
+            });
+            const std::string& mount_point = current->mount_point;
+            current = std::find_if(current, fstab_.end(), [&mount_point](const auto& entry) {
+                return entry.mount_point != mount_point;
+            });
         }
+    }
 
-        // Skip raw partition entries such as boot, dtbo, etc.
-        // Having emmc fstab entries allows us to probe current->vbmeta_partition
-        // in InitDevices() when they are AVB chained partitions.
-        if (current->fs_type == "emmc") {
+    for (auto current = fstab_.begin(); current != fstab_.end();) {
+        if (SkipMountPartitionsEntry(*current)) {
             ++current;
             continue;
         }
 
+        auto set_up = set_ups.find(&(*current));
         Fstab::iterator end;
-        if (!MountPartition(current, false /* erase_same_mounts */, &end)) {
+        if (!MountPartition(current, false /* erase_same_mounts */, &end,
+                            set_up != set_ups.end() ? &set_up->second.ready : nullptr)) {
             if (current->fs_mgr_flags.no_fail) {
                 LOG(INFO) << "Failed to mount " << current->mount_point
                           << ", ignoring mount for no_fail partition";
@@ -576,6 +644,19 @@ bool FirstStageMount::MountPartitions() {
         current = end;
     }
 
+    if (!set_ups.empty()) {
+        auto last_done = set_up_start;
+        std::chrono::milliseconds one_at_a_time = 0ms;
+        for (auto& [entry, set_up] : set_ups) {
+            if (set_up.ready.valid()) set_up.ready.wait();
+            last_done = std::max(last_done, set_up.done);
+            one_at_a_time += set_up.took;
+        }
+        auto took = std::chrono::duration_cast<std::chrono::milliseconds>(last_done - set_up_start);
+        LOG(INFO) << "Set up devices for " << set_ups.size() << " partitions in " << took.count()
+                  << "ms, " << one_at_a_time.count() << "ms one at a time";
+    }
+
     for (const auto& entry : fstab_) {
         if (entry.fs_type == "overlay") {
             fs_mgr_mount_overlayfs_fstab_entry(entry);
@@ -717,7 +798,7 @@ bool FirstStageMountVBootV1::SetUpDmVerity(FstabEntry* fstab_entry) {
                 // The exact block device name (fstab_rec->blk_device) is changed to
                 // "/dev/block/dm-XX". Needs to create it because ueventd isn't started in init
                 // first stage.
-                return block_dev_init_.InitDmDevice(fstab_entry->blk_device);
+                return InitDmDevice(fstab_entry->blk_device);
             default:
                 return false;
         }
@@ -794,6 +875,22 @@ bool FirstStageMountVBootV2::GetDmVerityDevices(std::set<std::string>* devices)
     return true;
 }
 
+bool FirstStageMountVBootV2::PrepareConcurrentDmVerity() {
+    // SetUpDmVerity() would otherwise open avb_handle_ from whichever thread gets there first,
+    // and add missing keys to preload_avb_key_blobs_.
+    bool need_avb_handle = false;
+    for (const auto& entry : fstab_) {
+        if (!entry.avb_keys.empty()) {
+            preload_avb_key_blobs_[entry.avb_keys];
+            need_avb_handle = true;
+        }
+        if (entry.fs_mgr_flags.avb) {
+            need_avb_handle = true;
+        }
+    }
+    return !need_avb_handle || InitAvbHandle();
+}
+
 bool FirstStageMountVBootV2::SetUpDmVerity(FstabEntry* fstab_entry) {
     AvbHashtreeResult hashtree_result;
 
@@ -841,7 +938,7 @@ bool FirstStageMountVBootV2::SetUpDmVerity(FstabEntry* fstab_entry) {
             // The exact block device name (fstab_rec->blk_device) is changed to
             // "/dev/block/dm-XX". Needs to create it because ueventd isn't started in init
             // first stage.
-            return block_dev_init_.InitDmDevice(fstab_entry->blk_device);
+            return InitDmDevice(fstab_entry->blk_device);
         default:
             return false;
     }
@@ -891,7 +988,14 @@ bool DoFirstStageMount(bool create_devices) {
         if (!(*fsm)->DoCreateDevices()) return false;
     }
 
-    return (*fsm)->DoFirstStageMount();
+    if (!(*fsm)->DoFirstStageMount()) return false;
+
+    // The default fstab is reachable now, so parse it once for everything that reads it later
+    // in this boot.
+    if (!WriteDefaultFstabCache()) {
+        LOG(WARNING) << "Failed to write " << android::fs_mgr::kDefaultFstabCachePath;
+    }
+    return true;
 }
 
 void SetInitAvbVersionInRecovery() {
@@ -71,6 +71,7 @@
 #include "mount_namespace.h"
 #include "property_service.h"
 #include "proto_utils.h"
+#include "readahead_profile.h"
 #include "reboot.h"
 #include "reboot_utils.h"
 #include "second_stage_resources.h"
@@ -828,6 +829,9 @@ int SecondStageMain(int argc, char** argv) {
     // Make the time that init stages started available for bootstat to log.
     RecordStageBoottimes(start_time);
 
+    // Page in what the previous boot of this build used, while nothing else needs the disk yet.
+    StartReadaheadReplay();
+
     // Set libavb version for Framework-only OTA match in Treble build.
     if (const char* avb_version = getenv("INIT_AVB_VERSION"); avb_version != nullptr) {
         SetProperty("ro.boot.avb_version", avb_version);
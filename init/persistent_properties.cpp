@@ -18,11 +18,17 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/system_properties.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -33,10 +39,13 @@
 
 using android::base::Dirname;
 using android::base::ReadFdToString;
+using android::base::ReadFileToString;
 using android::base::StartsWith;
 using android::base::unique_fd;
 using android::base::WriteStringToFd;
 
+using namespace std::chrono_literals;
+
 namespace android {
 namespace init {
 
@@ -46,6 +55,15 @@ namespace {
 
 constexpr const char kLegacyPersistentPropertyDir[] = "/data/property";
 
+// Writes that arrive within this window of each other share a single append and fdatasync().
+constexpr auto kJournalCoalesceWindow = 100ms;
+// The journal is folded back into the persistent property file once it grows past this size.
+constexpr off_t kJournalCompactionSize = 64 * 1024;
+
+std::string JournalFilename() {
+    return persistent_property_filename + ".journal";
+}
+
 void AddPersistentProperty(const std::string& name, const std::string& value,
                            PersistentProperties* persistent_properties) {
     auto persistent_property_record = persistent_properties->add_properties();
@@ -155,19 +173,228 @@ Result<std::string> ReadPersistentPropertyFile() {
     return *file_contents;
 }
 
-}  // namespace
+void SetPersistentProperty(const std::string& name, const std::string& value,
+                           PersistentProperties* persistent_properties) {
+    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
+                           persistent_properties->mutable_properties()->end(),
+                           [&name](const auto& record) { return record.name() == name; });
+    if (it != persistent_properties->mutable_properties()->end()) {
+        it->set_name(name);
+        it->set_value(value);
+    } else {
+        AddPersistentProperty(name, value, persistent_properties);
+    }
+}
 
-Result<PersistentProperties> LoadPersistentPropertyFile() {
+// The journal is a sequence of records, each of which is a uint32_t length, a uint32_t checksum
+// and a serialized PersistentPropertyRecord of that length.  A write that was interrupted by a
+// crash leaves a truncated or corrupt record at the end, which ends the replay.
+uint32_t JournalChecksum(const char* data, size_t size) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+void AppendJournalRecord(const std::string& name, const std::string& value, std::string* journal) {
+    PersistentProperties::PersistentPropertyRecord record;
+    record.set_name(name);
+    record.set_value(value);
+    std::string serialized_record = record.SerializeAsString();
+
+    uint32_t header[2] = {static_cast<uint32_t>(serialized_record.size()),
+                          JournalChecksum(serialized_record.data(), serialized_record.size())};
+    journal->append(reinterpret_cast<const char*>(header), sizeof(header));
+    journal->append(serialized_record);
+}
+
+// Applies every complete record of |journal| to |persistent_properties|, and returns the size of
+// the valid part of the journal.
+size_t ReplayJournal(const std::string& journal, PersistentProperties* persistent_properties) {
+    size_t offset = 0;
+    uint32_t header[2];
+    while (journal.size() - offset >= sizeof(header)) {
+        memcpy(header, journal.data() + offset, sizeof(header));
+        auto [length, checksum] = header;
+        if (journal.size() - offset - sizeof(header) < length) break;
+
+        const char* data = journal.data() + offset + sizeof(header);
+        PersistentProperties::PersistentPropertyRecord record;
+        if (JournalChecksum(data, length) != checksum || !record.ParseFromArray(data, length)) {
+            break;
+        }
+        SetPersistentProperty(record.name(), record.value(), persistent_properties);
+        offset += sizeof(header) + length;
+    }
+
+    if (offset != journal.size()) {
+        LOG(WARNING) << "Ignoring " << journal.size() - offset
+                     << " bytes of incomplete persistent property journal";
+    }
+    return offset;
+}
+
+Result<PersistentProperties> LoadPersistentPropertyFileAndJournal() {
     auto file_contents = ReadPersistentPropertyFile();
     if (!file_contents.ok()) return file_contents.error();
 
     PersistentProperties persistent_properties;
-    if (persistent_properties.ParseFromString(*file_contents)) return persistent_properties;
+    if (!persistent_properties.ParseFromString(*file_contents)) {
+        // If the file cannot be parsed in either format, then we don't have any recovery
+        // mechanisms, so we delete it to allow for future writes to take place successfully.
+        unlink(persistent_property_filename.c_str());
+        return Error() << "Unable to parse persistent property file: Could not parse protobuf";
+    }
 
-    // If the file cannot be parsed in either format, then we don't have any recovery
-    // mechanisms, so we delete it to allow for future writes to take place successfully.
-    unlink(persistent_property_filename.c_str());
-    return Error() << "Unable to parse persistent property file: Could not parse protobuf";
+    std::string journal;
+    if (ReadFileToString(JournalFilename(), &journal)) {
+        ReplayJournal(journal, &persistent_properties);
+    }
+    return persistent_properties;
+}
+
+// Persistent properties are written by appending to a journal, rather than by rewriting the whole
+// persistent property file for every update.  Writes are queued and appended by a background
+// thread, so that a burst of updates costs a single fdatasync().  Once the journal grows large
+// enough, it is compacted back into the persistent property file.
+class PersistentPropertyJournal {
+  public:
+    void Write(const std::string& name, const std::string& value) {
+        auto lock = std::lock_guard{mutex_};
+        pending_.insert_or_assign(name, value);
+
+        if (!thread_started_) {
+            thread_started_ = true;
+            std::thread{&PersistentPropertyJournal::ThreadFunction, this}.detach();
+        }
+        cv_.notify_one();
+    }
+
+    void Flush() {
+        auto io_lock = std::lock_guard{io_mutex_};
+
+        std::map<std::string, std::string> records;
+        {
+            auto lock = std::lock_guard{mutex_};
+            records.swap(pending_);
+        }
+        if (records.empty()) return;
+
+        if (auto result = Append(records); !result.ok()) {
+            LOG(ERROR) << "Could not store persistent properties: " << result.error();
+        }
+    }
+
+  private:
+    void ThreadFunction() {
+        auto lock = std::unique_lock{mutex_};
+        while (true) {
+            cv_.wait(lock, [this]() { return !pending_.empty(); });
+
+            lock.unlock();
+            std::this_thread::sleep_for(kJournalCoalesceWindow);
+            Flush();
+            lock.lock();
+        }
+    }
+
+    // Makes sure that the persistent property file is valid and that the journal doesn't end with
+    // a partial record before appending to it for the first time.
+    Result<void> Prepare() {
+        if (prepared_filename_ == persistent_property_filename) return {};
+
+        if (auto persistent_properties = LoadPersistentPropertyFileAndJournal();
+            !persistent_properties.ok()) {
+            LOG(ERROR) << "Recovering persistent properties from memory: "
+                       << persistent_properties.error();
+            if (auto result = WritePersistentPropertyFile(LoadPersistentPropertiesFromMemory());
+                !result.ok()) {
+                return result.error();
+            }
+        } else if (std::string journal; ReadFileToString(JournalFilename(), &journal)) {
+            PersistentProperties unused;
+            if (size_t valid_size = ReplayJournal(journal, &unused); valid_size != journal.size()) {
+                if (truncate(JournalFilename().c_str(), valid_size) != 0) {
+                    return ErrnoError() << "Unable to truncate persistent property journal";
+                }
+            }
+        }
+
+        prepared_filename_ = persistent_property_filename;
+        return {};
+    }
+
+    Result<void> Append(const std::map<std::string, std::string>& records) {
+        if (auto result = Prepare(); !result.ok()) return result.error();
+
+        std::string journal;
+        for (const auto& [name, value] : records) {
+            AppendJournalRecord(name, value, &journal);
+        }
+
+        constexpr int kFlags = O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC;
+        bool created = false;
+        unique_fd fd(TEMP_FAILURE_RETRY(open(JournalFilename().c_str(), kFlags)));
+        if (fd == -1 && errno == ENOENT) {
+            fd.reset(TEMP_FAILURE_RETRY(open(JournalFilename().c_str(), kFlags | O_CREAT, 0600)));
+            created = true;
+        }
+        if (fd == -1) {
+            return ErrnoError() << "Could not open persistent property journal";
+        }
+        if (!WriteStringToFd(journal, fd)) {
+            return ErrnoError() << "Unable to append to persistent property journal";
+        }
+        // The journal is never renamed, so only its size changes and fdatasync() is enough...
+        if (fdatasync(fd) != 0) {
+            return ErrnoError() << "Unable to fdatasync() persistent property journal";
+        }
+        // ... except when it was just created, as its directory entry must reach storage too.
+        // Compaction only truncates the journal, so this happens once.
+        if (created) {
+            auto dir = Dirname(JournalFilename());
+            unique_fd dir_fd(open(dir.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+            if (dir_fd == -1) {
+                return ErrnoError() << "Unable to open persistent properties directory for fsync()";
+            }
+            if (fsync(dir_fd) != 0) {
+                return ErrnoError() << "Unable to fsync() persistent properties directory";
+            }
+        }
+
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && sb.st_size >= kJournalCompactionSize) {
+            fd.reset();
+            return Compact();
+        }
+        return {};
+    }
+
+    Result<void> Compact() {
+        auto persistent_properties = LoadPersistentPropertyFileAndJournal();
+        if (!persistent_properties.ok()) return persistent_properties.error();
+
+        return WritePersistentPropertyFile(*persistent_properties);
+    }
+
+    // Held while the journal is being written, to keep appends in order.
+    std::mutex io_mutex_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<std::string, std::string> pending_;
+    bool thread_started_ = false;
+    std::string prepared_filename_;
+};
+
+PersistentPropertyJournal persistent_property_journal;
+
+}  // namespace
+
+Result<PersistentProperties> LoadPersistentPropertyFile() {
+    persistent_property_journal.Flush();
+    return LoadPersistentPropertyFileAndJournal();
 }
 
 Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties) {
@@ -204,32 +431,22 @@ Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_
     }
     fsync(dir_fd);
 
+    // The file now holds every property, so the journal can be discarded.  Should we crash before
+    // the journal is truncated, replaying it again on top of the new file is harmless, since the
+    // new file already includes its records.
+    if (truncate(JournalFilename().c_str(), 0) != 0 && errno != ENOENT) {
+        return ErrnoError() << "Unable to truncate persistent property journal";
+    }
+
     return {};
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
 void WritePersistentProperty(const std::string& name, const std::string& value) {
-    auto persistent_properties = LoadPersistentPropertyFile();
-
-    if (!persistent_properties.ok()) {
-        LOG(ERROR) << "Recovering persistent properties from memory: "
-                   << persistent_properties.error();
-        persistent_properties = LoadPersistentPropertiesFromMemory();
-    }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        it->set_name(name);
-        it->set_value(value);
-    } else {
-        AddPersistentProperty(name, value, &persistent_properties.value());
-    }
+    persistent_property_journal.Write(name, value);
+}
 
-    if (auto result = WritePersistentPropertyFile(*persistent_properties); !result.ok()) {
-        LOG(ERROR) << "Could not store persistent property: " << result.error();
-    }
+void FlushPersistentProperties() {
+    persistent_property_journal.Flush();
 }
 
 PersistentProperties LoadPersistentProperties() {
@@ -26,7 +26,11 @@ namespace android {
 namespace init {
 
 PersistentProperties LoadPersistentProperties();
+// Queues a write of a persistent property; it reaches storage shortly after, together with any
+// other writes made in the meantime.
 void WritePersistentProperty(const std::string& name, const std::string& value);
+// Synchronously writes any queued persistent properties to storage.
+void FlushPersistentProperties();
 
 // Exposed only for testing
 Result<PersistentProperties> LoadPersistentPropertyFile();
@@ -155,5 +155,53 @@ TEST(persistent_properties, UpdatePropertyBadParse) {
     EXPECT_FALSE(it == read_back_properties.properties().end());
 }
 
+TEST(persistent_properties, JournalReplay) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    std::string journal_filename = tf.path + ".journal"s;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+    auto file_contents = ReadFile(tf.path);
+    ASSERT_RESULT_OK(file_contents);
+
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    WritePersistentProperty("persist.test.journal", "1");
+    WritePersistentProperty("persist.test.journal", "2");
+    FlushPersistentProperties();
+
+    // Updates only go to the journal, until it is compacted.
+    auto new_file_contents = ReadFile(tf.path);
+    ASSERT_RESULT_OK(new_file_contents);
+    EXPECT_EQ(*file_contents, *new_file_contents);
+
+    // A record torn by a crash is ignored.
+    auto journal = ReadFile(journal_filename);
+    ASSERT_RESULT_OK(journal);
+    ASSERT_RESULT_OK(WriteFile(journal_filename, *journal + "\x10\0\0\0abc"s));
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.locale", "pt-BR"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+        {"persist.test.journal", "2"},
+    };
+
+    auto read_back_properties = LoadPersistentProperties();
+    CheckPropertiesEqual(persistent_properties_expected, read_back_properties);
+
+    // Writing the whole file discards the journal.
+    ASSERT_RESULT_OK(WritePersistentPropertyFile(read_back_properties));
+    journal = ReadFile(journal_filename);
+    ASSERT_RESULT_OK(journal);
+    EXPECT_TRUE(journal->empty());
+
+    unlink(journal_filename.c_str());
+}
+
 }  // namespace init
 }  // namespace android
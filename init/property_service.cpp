@@ -56,6 +56,7 @@
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <private/property_service_protocol.h>
 #include <property_info_parser/property_info_parser.h>
 #include <property_info_serializer/property_info_serializer.h>
 #include <selinux/android.h>
@@ -88,9 +89,11 @@ using android::base::Trim;
 using android::base::unique_fd;
 using android::base::WriteStringToFile;
 using android::properties::BuildTrie;
+using android::properties::DigestPropertyContexts;
 using android::properties::ParsePropertyInfoFile;
 using android::properties::PropertyInfoAreaFile;
 using android::properties::PropertyInfoEntry;
+using android::properties::ReadPropertyInfoCache;
 using android::sysprop::InitProperties::is_userspace_reboot_supported;
 
 namespace android {
@@ -504,6 +507,8 @@ uint32_t HandlePropertySet(const std::string& name, const std::string& value,
                   << process_log_string;
         if (!value.empty()) {
             DebugRebootLogging();
+            // Make sure that persistent properties set just before the reboot aren't lost.
+            FlushPersistentProperties();
         }
         if (value == "reboot,userspace" && !is_userspace_reboot_supported().value_or(false)) {
             *error = "Userspace reboot is not supported by this device";
@@ -524,7 +529,155 @@ uint32_t HandlePropertySet(const std::string& name, const std::string& value,
     return PropertySet(name, value, error);
 }
 
-static void handle_property_set_fd() {
+// A connection that has been switched to PROP_MSG_SETPROP_PIPELINED.  The credentials and SELinux
+// context of the peer are resolved once, then requests are handled as soon as they have been
+// fully received, without blocking the property service thread on a slow client.  Control
+// messages are handled as with PROP_MSG_SETPROP: their result is only whether they were queued.
+class PipelinedConnection {
+  public:
+    PipelinedConnection(int socket, const ucred& cred, std::string source_context)
+        : socket_(socket), cred_(cred), source_context_(std::move(source_context)) {}
+
+    // Returns false once the connection should be closed.
+    bool HandleReadable() {
+        char buffer[4096];
+        while (true) {
+            ssize_t n = TEMP_FAILURE_RETRY(recv(socket_, buffer, sizeof(buffer), MSG_DONTWAIT));
+            if (n == 0) {
+                if (!pending_.empty()) {
+                    LOG(ERROR) << "sys_prop: pipelined connection from pid " << cred_.pid
+                               << " closed in the middle of a request";
+                }
+                return false;
+            }
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                PLOG(ERROR) << "sys_prop: recv error on pipelined connection";
+                return false;
+            }
+            pending_.append(buffer, n);
+            if (pending_.size() >= kMaxPendingBytes) break;
+        }
+
+        std::vector<uint32_t> results;
+        size_t offset = 0;
+        std::string name;
+        std::string value;
+        while (true) {
+            auto request_end = ParseRequest(offset, &name, &value);
+            if (!request_end.ok()) {
+                LOG(ERROR) << "sys_prop: invalid pipelined request from pid " << cred_.pid << ": "
+                           << request_end.error();
+                results.emplace_back(PROP_ERROR_READ_DATA);
+                SendResults(results);
+                return false;
+            }
+            if (*request_end == 0) break;
+            offset = *request_end;
+
+            std::string error;
+            uint32_t result =
+                    HandlePropertySet(name, value, source_context_, cred_, nullptr, &error);
+            if (result != PROP_SUCCESS) {
+                LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cred_.uid
+                           << " gid:" << cred_.gid << " pid:" << cred_.pid << ": " << error;
+            }
+            results.emplace_back(result);
+        }
+        pending_.erase(0, offset);
+
+        return SendResults(results);
+    }
+
+  private:
+    // Stop reading once this much data is pending, so that a single client can't hog init.
+    static constexpr size_t kMaxPendingBytes = 64 * 1024;
+
+    // Parses the request at |offset| of pending_, and returns the offset just past it, or 0 if it
+    // has not been fully received yet.
+    Result<size_t> ParseRequest(size_t offset, std::string* name, std::string* value) {
+        for (auto* field : {name, value}) {
+            uint32_t length;
+            if (pending_.size() - offset < sizeof(length)) return 0;
+            memcpy(&length, pending_.data() + offset, sizeof(length));
+            offset += sizeof(length);
+
+            // http://b/35166374: don't allow init to make arbitrarily large allocations.
+            if (length > PROP_PIPELINED_MAX_LENGTH) {
+                return Error() << "string of length " << length << " is too long";
+            }
+            if (pending_.size() - offset < length) return 0;
+            field->assign(pending_, offset, length);
+            offset += length;
+        }
+        return offset;
+    }
+
+    bool SendResults(const std::vector<uint32_t>& results) {
+        if (results.empty()) return true;
+
+        // Clients read results back as they queue more requests, so the socket buffer only ever
+        // needs to hold a window of them.  A client that doesn't read its results is dropped
+        // rather than blocking init.
+        size_t size = results.size() * sizeof(results[0]);
+        ssize_t n = TEMP_FAILURE_RETRY(
+                send(socket_, results.data(), size, MSG_DONTWAIT | MSG_NOSIGNAL));
+        if (n != static_cast<ssize_t>(size)) {
+            PLOG(ERROR) << "sys_prop: unable to send results to pid " << cred_.pid;
+            return false;
+        }
+        return true;
+    }
+
+    unique_fd socket_;
+    ucred cred_;
+    std::string source_context_;
+    std::string pending_;
+};
+
+// Only accessed from the property service thread.
+static std::map<int, std::unique_ptr<PipelinedConnection>> pipelined_connections;
+static constexpr size_t kMaxPipelinedConnections = 32;
+
+static void StartPipelinedConnection(Epoll* epoll, SocketConnection* socket) {
+    const auto& cr = socket->cred();
+    if (pipelined_connections.size() >= kMaxPipelinedConnections) {
+        LOG(ERROR) << "sys_prop: too many pipelined connections, rejecting pid " << cr.pid;
+        socket->SendUint32(PROP_ERROR_SET_FAILED);
+        return;
+    }
+
+    std::string source_context;
+    if (!socket->GetSourceContext(&source_context)) {
+        PLOG(ERROR) << "sys_prop: unable to start pipelined connection: getpeercon() failed";
+        socket->SendUint32(PROP_ERROR_PERMISSION_DENIED);
+        return;
+    }
+
+    if (!socket->SendUint32(PROP_SUCCESS)) {
+        PLOG(ERROR) << "sys_prop: unable to start pipelined connection from pid " << cr.pid;
+        return;
+    }
+
+    int fd = socket->Release();
+    pipelined_connections[fd] = std::make_unique<PipelinedConnection>(fd, cr, source_context);
+
+    auto handler = [epoll, fd]() {
+        auto it = pipelined_connections.find(fd);
+        if (it == pipelined_connections.end() || it->second->HandleReadable()) return;
+
+        if (auto result = epoll->UnregisterHandler(fd); !result.ok()) {
+            LOG(ERROR) << result.error();
+        }
+        pipelined_connections.erase(it);
+    };
+    if (auto result = epoll->RegisterHandler(fd, handler); !result.ok()) {
+        LOG(ERROR) << "sys_prop: " << result.error();
+        pipelined_connections.erase(fd);
+    }
+}
+
+static void handle_property_set_fd(Epoll* epoll) {
     static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
 
     int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
@@ -610,6 +763,10 @@ static void handle_property_set_fd() {
         break;
       }
 
+    case PROP_MSG_SETPROP_PIPELINED:
+        StartPipelinedConnection(epoll, &socket);
+        break;
+
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
@@ -1110,72 +1267,101 @@ void PropertyLoadBootDefaults() {
     update_sys_usb_config();
 }
 
-bool LoadPropertyInfoFromFile(const std::string& filename,
-                              std::vector<PropertyInfoEntry>* property_infos) {
+struct PropertyContextsFile {
+    std::string filename;
+    std::string contents;
+};
+
+static bool ReadPropertyContextsFile(const std::string& filename,
+                                     std::vector<PropertyContextsFile>* files) {
     auto file_contents = std::string();
     if (!ReadFileToString(filename, &file_contents)) {
         PLOG(ERROR) << "Could not read properties from '" << filename << "'";
         return false;
     }
 
+    files->push_back({filename, std::move(file_contents)});
+    return true;
+}
+
+static void ParsePropertyContextsFile(const PropertyContextsFile& file,
+                                      bool require_prefix_or_exact,
+                                      std::vector<PropertyInfoEntry>* property_infos) {
     auto errors = std::vector<std::string>{};
-    bool require_prefix_or_exact = SelinuxGetVendorAndroidVersion() >= __ANDROID_API_R__;
-    ParsePropertyInfoFile(file_contents, require_prefix_or_exact, property_infos, &errors);
-    // Individual parsing errors are reported but do not cause a failed boot, which is what
-    // returning false would do here.
+    ParsePropertyInfoFile(file.contents, require_prefix_or_exact, property_infos, &errors);
+    // Individual parsing errors are reported but do not cause a failed boot.
     for (const auto& error : errors) {
-        LOG(ERROR) << "Could not read line from '" << filename << "': " << error;
+        LOG(ERROR) << "Could not read line from '" << file.filename << "': " << error;
     }
-
-    return true;
 }
 
+// The serialized property contexts, as built from the property_contexts files by
+// property_info_prebuilt.  It is on the verified system partition, so it is trusted, but it is
+// only used while the property_contexts files of every partition match the ones it was built
+// from.  Otherwise, e.g. when only the vendor partition was updated, the trie is built here.
+constexpr static const char kPrebuiltPropertyInfoPath[] = "/system/etc/selinux/plat_property_info";
+
 void CreateSerializedPropertyInfo() {
-    auto property_infos = std::vector<PropertyInfoEntry>();
+    auto files = std::vector<PropertyContextsFile>();
     if (access("/system/etc/selinux/plat_property_contexts", R_OK) != -1) {
-        if (!LoadPropertyInfoFromFile("/system/etc/selinux/plat_property_contexts",
-                                      &property_infos)) {
+        if (!ReadPropertyContextsFile("/system/etc/selinux/plat_property_contexts", &files)) {
             return;
         }
         // Don't check for failure here, since we don't always have all of these partitions.
         // E.g. In case of recovery, the vendor partition will not have mounted and we
         // still need the system / platform properties to function.
         if (access("/system_ext/etc/selinux/system_ext_property_contexts", R_OK) != -1) {
-            LoadPropertyInfoFromFile("/system_ext/etc/selinux/system_ext_property_contexts",
-                                     &property_infos);
+            ReadPropertyContextsFile("/system_ext/etc/selinux/system_ext_property_contexts",
+                                     &files);
         }
-        if (!LoadPropertyInfoFromFile("/vendor/etc/selinux/vendor_property_contexts",
-                                      &property_infos)) {
+        if (!ReadPropertyContextsFile("/vendor/etc/selinux/vendor_property_contexts", &files)) {
             // Fallback to nonplat_* if vendor_* doesn't exist.
-            LoadPropertyInfoFromFile("/vendor/etc/selinux/nonplat_property_contexts",
-                                     &property_infos);
+            ReadPropertyContextsFile("/vendor/etc/selinux/nonplat_property_contexts", &files);
         }
         if (access("/product/etc/selinux/product_property_contexts", R_OK) != -1) {
-            LoadPropertyInfoFromFile("/product/etc/selinux/product_property_contexts",
-                                     &property_infos);
+            ReadPropertyContextsFile("/product/etc/selinux/product_property_contexts", &files);
         }
         if (access("/odm/etc/selinux/odm_property_contexts", R_OK) != -1) {
-            LoadPropertyInfoFromFile("/odm/etc/selinux/odm_property_contexts", &property_infos);
+            ReadPropertyContextsFile("/odm/etc/selinux/odm_property_contexts", &files);
         }
     } else {
-        if (!LoadPropertyInfoFromFile("/plat_property_contexts", &property_infos)) {
+        if (!ReadPropertyContextsFile("/plat_property_contexts", &files)) {
             return;
         }
-        LoadPropertyInfoFromFile("/system_ext_property_contexts", &property_infos);
-        if (!LoadPropertyInfoFromFile("/vendor_property_contexts", &property_infos)) {
+        ReadPropertyContextsFile("/system_ext_property_contexts", &files);
+        if (!ReadPropertyContextsFile("/vendor_property_contexts", &files)) {
             // Fallback to nonplat_* if vendor_* doesn't exist.
-            LoadPropertyInfoFromFile("/nonplat_property_contexts", &property_infos);
+            ReadPropertyContextsFile("/nonplat_property_contexts", &files);
         }
-        LoadPropertyInfoFromFile("/product_property_contexts", &property_infos);
-        LoadPropertyInfoFromFile("/odm_property_contexts", &property_infos);
+        ReadPropertyContextsFile("/product_property_contexts", &files);
+        ReadPropertyContextsFile("/odm_property_contexts", &files);
     }
 
+    bool require_prefix_or_exact = SelinuxGetVendorAndroidVersion() >= __ANDROID_API_R__;
+
     auto serialized_contexts = std::string();
-    auto error = std::string();
-    if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized_contexts,
-                   &error)) {
-        LOG(ERROR) << "Unable to serialize property contexts: " << error;
-        return;
+    auto contents = std::vector<std::string>();
+    for (const auto& file : files) {
+        contents.emplace_back(file.contents);
+    }
+    if (ReadPropertyInfoCache(kPrebuiltPropertyInfoPath,
+                              DigestPropertyContexts(contents, require_prefix_or_exact),
+                              &serialized_contexts)) {
+        LOG(INFO) << "Loaded serialized property contexts from " << kPrebuiltPropertyInfoPath;
+    } else {
+        Timer t;
+        auto property_infos = std::vector<PropertyInfoEntry>();
+        for (const auto& file : files) {
+            ParsePropertyContextsFile(file, require_prefix_or_exact, &property_infos);
+        }
+
+        auto error = std::string();
+        if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string",
+                       &serialized_contexts, &error)) {
+            LOG(ERROR) << "Unable to serialize property contexts: " << error;
+            return;
+        }
+        LOG(INFO) << "Serialized property contexts in " << t;
     }
 
     constexpr static const char kPropertyInfosPath[] = "/dev/__properties__/property_info";
@@ -1315,7 +1501,8 @@ static void PropertyServiceThread() {
         LOG(FATAL) << result.error();
     }
 
-    if (auto result = epoll.RegisterHandler(property_set_fd, handle_property_set_fd);
+    if (auto result = epoll.RegisterHandler(property_set_fd,
+                                            [&epoll]() { handle_property_set_fd(&epoll); });
         !result.ok()) {
         LOG(FATAL) << result.error();
     }
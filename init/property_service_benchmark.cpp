@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <cutils/properties.h>
+
+// Compares setting properties with one connection per set against pipelining them over a single
+// connection.  Both report the number of properties set per second.
+
+static constexpr const char* kBenchmarkProperty = "debug.init.property_service_benchmark";
+
+static void BM_property_set(benchmark::State& state) {
+    int i = 0;
+    for (auto _ : state) {
+        if (property_set(kBenchmarkProperty, std::to_string(i++).c_str()) != 0) {
+            state.SkipWithError("property_set() failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_property_set);
+
+static void BM_property_batch_set(benchmark::State& state) {
+    const int batch_size = state.range(0);
+    int i = 0;
+    for (auto _ : state) {
+        property_batch_t* batch = property_batch_start();
+        for (int j = 0; j < batch_size; ++j) {
+            property_batch_set(batch, kBenchmarkProperty, std::to_string(i++).c_str());
+        }
+        if (property_batch_finish(batch) != 0) {
+            state.SkipWithError("property_batch_finish() reported failures");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(BM_property_batch_set)->Arg(1)->Arg(16)->Arg(256);
+
+BENCHMARK_MAIN();
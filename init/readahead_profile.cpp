@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "readahead_profile.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <android-base/chrono_utils.h>
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <cutils/iosched_policy.h>
+#include <system/thread_defs.h>
+
+using android::base::Dirname;
+using android::base::EndsWith;
+using android::base::GetBoolProperty;
+using android::base::GetProperty;
+using android::base::ParseInt;
+using android::base::ReadFileToString;
+using android::base::SetProperty;
+using android::base::StartsWith;
+using android::base::Timer;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+
+using namespace std::string_literals;
+
+namespace android {
+namespace init {
+
+std::string readahead_profile_filename = "/metadata/readahead/profile";
+
+// The partitions whose files boot pages in. /apex is left out, as APEXes are only mounted by
+// apexd, well after the replay has started.
+std::vector<std::string> readahead_profiled_prefixes = {"/system/", "/system_ext/", "/product/",
+                                                        "/vendor/", "/odm/"};
+
+namespace {
+
+constexpr const char kEnabledProperty[] = "ro.init.readahead_profile";
+
+bool IsProfiledPath(std::string_view path) {
+    if (EndsWith(path, " (deleted)")) return false;
+    return std::any_of(readahead_profiled_prefixes.begin(), readahead_profiled_prefixes.end(),
+                       [&](const std::string& prefix) { return StartsWith(path, prefix); });
+}
+
+// Boot mostly pages files in by mapping them, so the files mapped by the processes running at the
+// end of boot are the ones worth profiling.
+std::set<std::string> GetMappedFiles() {
+    std::set<std::string> files;
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir("/proc"), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Unable to open /proc";
+        return files;
+    }
+    while (auto entry = readdir(dir.get())) {
+        pid_t pid;
+        if (!ParseInt(entry->d_name, &pid)) continue;
+
+        std::string maps;
+        if (!ReadFileToString("/proc/"s + entry->d_name + "/maps", &maps)) continue;
+        std::string_view rest = maps;
+        while (!rest.empty()) {
+            auto eol = rest.find('\n');
+            auto line = rest.substr(0, eol);
+            rest = (eol == std::string_view::npos) ? std::string_view() : rest.substr(eol + 1);
+
+            // The path is the last field, and the only one that contains a '/'.
+            auto slash = line.find('/');
+            if (slash == std::string_view::npos) continue;
+            auto path = line.substr(slash);
+            if (IsProfiledPath(path)) files.emplace(path);
+        }
+    }
+    return files;
+}
+
+void RecordReadaheadProfile(const std::string& fingerprint) {
+    if (auto profile = LoadReadaheadProfile(fingerprint); profile.ok()) {
+        LOG(VERBOSE) << "Readahead profile of this build already recorded";
+        return;
+    }
+
+    Timer t;
+    ReadaheadProfile profile;
+    profile.set_fingerprint(fingerprint);
+    for (const auto& path : GetMappedFiles()) {
+        if (auto result = AddResidentExtents(path, &profile); !result.ok()) {
+            LOG(VERBOSE) << "Unable to profile '" << path << "': " << result.error();
+        }
+    }
+    if (auto result = WriteReadaheadProfile(profile); !result.ok()) {
+        LOG(ERROR) << "Unable to write readahead profile: " << result.error();
+        return;
+    }
+    LOG(INFO) << "Recorded readahead profile of " << profile.files_size() << " files in " << t;
+}
+
+void ReadaheadReplayThread(const std::string& fingerprint) {
+    if (setpriority(PRIO_PROCESS, gettid(), static_cast<int>(ANDROID_PRIORITY_LOWEST)) != 0) {
+        PLOG(WARNING) << "setpriority failed";
+    }
+    if (android_set_ioprio(gettid(), IoSchedClass_IDLE, 7)) {
+        PLOG(WARNING) << "ioprio_set failed";
+    }
+
+    Timer t;
+    auto profile = LoadReadaheadProfile(fingerprint);
+    if (!profile.ok()) {
+        LOG(INFO) << "No readahead profile to replay: " << profile.error();
+        return;
+    }
+    auto bytes = ReplayReadaheadProfile(*profile);
+    LOG(INFO) << "Readahead of " << bytes << " bytes in " << profile->files_size()
+              << " files took " << t;
+    SetProperty("ro.boottime.init.readahead", std::to_string(t.duration().count()));
+}
+
+}  // namespace
+
+Result<void> AddResidentExtents(const std::string& path, ReadaheadProfile* profile) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        return ErrnoError() << "Unable to open";
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        return ErrnoError() << "Unable to stat";
+    }
+    if (!S_ISREG(sb.st_mode) || sb.st_size == 0) {
+        return {};
+    }
+
+    // mincore() only reports what is in the page cache, it does not page anything in.
+    void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return ErrnoError() << "Unable to mmap";
+    }
+    const uint64_t page_size = getpagesize();
+    std::vector<unsigned char> resident((sb.st_size + page_size - 1) / page_size);
+    int rc = mincore(addr, sb.st_size, resident.data());
+    int saved_errno = errno;
+    munmap(addr, sb.st_size);
+    if (rc != 0) {
+        return Error(saved_errno) << "mincore failed";
+    }
+
+    ReadaheadProfile::File* file = nullptr;
+    for (size_t page = 0; page < resident.size();) {
+        if (!(resident[page] & 1)) {
+            page++;
+            continue;
+        }
+        size_t first = page;
+        while (page < resident.size() && (resident[page] & 1)) page++;
+
+        if (!file) {
+            file = profile->add_files();
+            file->set_path(path);
+        }
+        auto extent = file->add_extents();
+        extent->set_offset(first * page_size);
+        extent->set_length(std::min(page * page_size, static_cast<uint64_t>(sb.st_size)) -
+                           first * page_size);
+    }
+    return {};
+}
+
+Result<ReadaheadProfile> LoadReadaheadProfile(const std::string& fingerprint) {
+    std::string contents;
+    if (!ReadFileToString(readahead_profile_filename, &contents)) {
+        return ErrnoError() << "Unable to read " << readahead_profile_filename;
+    }
+    ReadaheadProfile profile;
+    if (!profile.ParseFromString(contents)) {
+        return Error() << "Unable to parse " << readahead_profile_filename;
+    }
+    if (profile.fingerprint() != fingerprint) {
+        return Error() << "Profile is of build '" << profile.fingerprint() << "'";
+    }
+    return profile;
+}
+
+Result<void> WriteReadaheadProfile(const ReadaheadProfile& profile) {
+    const std::string temp_filename = readahead_profile_filename + ".tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC,
+                 0600)));
+    if (fd == -1) {
+        return ErrnoError() << "Could not open temporary profile file";
+    }
+    std::string serialized_string;
+    if (!profile.SerializeToString(&serialized_string)) {
+        return Error() << "Unable to serialize profile";
+    }
+    if (!WriteStringToFd(serialized_string, fd)) {
+        return ErrnoError() << "Unable to write file contents";
+    }
+    fsync(fd);
+    fd.reset();
+
+    if (rename(temp_filename.c_str(), readahead_profile_filename.c_str())) {
+        int saved_errno = errno;
+        unlink(temp_filename.c_str());
+        return Error(saved_errno) << "Unable to rename profile file";
+    }
+
+    auto dir = Dirname(readahead_profile_filename);
+    auto dir_fd = unique_fd{open(dir.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)};
+    if (dir_fd < 0) {
+        return ErrnoError() << "Unable to open profile directory for fsync()";
+    }
+    fsync(dir_fd);
+    return {};
+}
+
+uint64_t ReplayReadaheadProfile(const ReadaheadProfile& profile) {
+    uint64_t bytes = 0;
+    for (const auto& file : profile.files()) {
+        // The profile lives on /metadata, which is writable, so only open what recording could
+        // have put there: regular files on the profiled partitions. O_NONBLOCK keeps a FIFO from
+        // blocking the open.
+        if (!IsProfiledPath(file.path())) continue;
+        unique_fd fd(TEMP_FAILURE_RETRY(
+                open(file.path().c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC)));
+        if (fd == -1) continue;
+        struct stat sb;
+        if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) continue;
+        for (const auto& extent : file.extents()) {
+            if (readahead(fd, extent.offset(), extent.length()) == 0) {
+                bytes += extent.length();
+            }
+        }
+    }
+    return bytes;
+}
+
+void StartReadaheadReplay() {
+    if (!GetBoolProperty(kEnabledProperty, false)) return;
+
+    std::thread(ReadaheadReplayThread, GetProperty("ro.build.fingerprint", "")).detach();
+}
+
+Result<void> do_readahead_profile(const BuiltinArguments& args) {
+    if (args[1] != "record") {
+        return Error() << "Unknown readahead_profile command '" << args[1] << "'";
+    }
+    if (!GetBoolProperty(kEnabledProperty, false)) return {};
+
+    // Walking every mapped file takes a while, so record in a forked process, as the readahead
+    // builtin does.
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (setpriority(PRIO_PROCESS, 0, static_cast<int>(ANDROID_PRIORITY_LOWEST)) != 0) {
+            PLOG(WARNING) << "setpriority failed";
+        }
+        RecordReadaheadProfile(GetProperty("ro.build.fingerprint", ""));
+        _exit(0);
+    } else if (pid < 0) {
+        return ErrnoError() << "Fork failed";
+    }
+    return {};
+}
+
+}  // namespace init
+}  // namespace android
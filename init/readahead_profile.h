@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_READAHEAD_PROFILE_H
+#define _INIT_READAHEAD_PROFILE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "builtin_arguments.h"
+#include "result.h"
+#include "system/core/init/readahead_profile.pb.h"
+
+namespace android {
+namespace init {
+
+// Starts a low priority thread that reads ahead the file extents the previous boot of this build
+// touched, if ro.init.readahead_profile is set. Meant to be called as early in second stage init
+// as properties can be set, and sets ro.boottime.init.readahead once done.
+void StartReadaheadReplay();
+
+// `readahead_profile record`: records the extents of the files that boot has paged in, unless the
+// profile on /metadata is already one of this build.
+Result<void> do_readahead_profile(const BuiltinArguments& args);
+
+// Exposed only for testing
+Result<void> AddResidentExtents(const std::string& path, ReadaheadProfile* profile);
+Result<ReadaheadProfile> LoadReadaheadProfile(const std::string& fingerprint);
+Result<void> WriteReadaheadProfile(const ReadaheadProfile& profile);
+// Returns the number of bytes that readahead was requested for.
+uint64_t ReplayReadaheadProfile(const ReadaheadProfile& profile);
+extern std::string readahead_profile_filename;
+extern std::vector<std::string> readahead_profiled_prefixes;
+
+}  // namespace init
+}  // namespace android
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "readahead_profile.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+using namespace std::literals;
+
+namespace android {
+namespace init {
+
+TEST(readahead_profile, ResidentExtents) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    // Not page aligned, so the last extent is shorter than a page.
+    std::string contents(3 * getpagesize() + 100, 'x');
+    ASSERT_TRUE(android::base::WriteStringToFd(contents, tf.fd));
+
+    ReadaheadProfile profile;
+    ASSERT_RESULT_OK(AddResidentExtents(tf.path, &profile));
+    ASSERT_EQ(1, profile.files_size());
+    EXPECT_EQ(tf.path, profile.files(0).path());
+
+    uint64_t end = 0;
+    for (const auto& extent : profile.files(0).extents()) {
+        EXPECT_GE(extent.offset(), end);
+        end = extent.offset() + extent.length();
+    }
+    EXPECT_EQ(contents.size(), end);
+}
+
+TEST(readahead_profile, EmptyFile) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+
+    ReadaheadProfile profile;
+    ASSERT_RESULT_OK(AddResidentExtents(tf.path, &profile));
+    EXPECT_EQ(0, profile.files_size());
+}
+
+TEST(readahead_profile, WriteLoadReplay) {
+    TemporaryDir td;
+    readahead_profile_filename = td.path + "/profile"s;
+
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd(std::string(8192, 'x'), tf.fd));
+    readahead_profiled_prefixes = {android::base::Dirname(tf.path) + "/"};
+
+    ReadaheadProfile profile;
+    profile.set_fingerprint("build/1");
+    auto file = profile.add_files();
+    file->set_path(tf.path);
+    auto extent = file->add_extents();
+    extent->set_offset(4096);
+    extent->set_length(4096);
+    // Files that are gone, or not mounted yet, are skipped.
+    profile.add_files()->set_path(td.path + "/missing"s);
+    ASSERT_RESULT_OK(WriteReadaheadProfile(profile));
+
+    EXPECT_FALSE(LoadReadaheadProfile("build/2").ok());
+    auto loaded = LoadReadaheadProfile("build/1");
+    ASSERT_RESULT_OK(loaded);
+    ASSERT_EQ(2, loaded->files_size());
+    EXPECT_EQ(4096u, ReplayReadaheadProfile(*loaded));
+}
+
+TEST(readahead_profile, ReplaySkipsUnexpectedFiles) {
+    TemporaryDir td;
+    readahead_profiled_prefixes = {td.path + "/"s};
+    TemporaryFile outside;
+    ASSERT_TRUE(outside.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd(std::string(4096, 'x'), outside.fd));
+
+    const std::string regular = td.path + "/regular"s;
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(4096, 'x'), regular));
+    const std::string link = td.path + "/link"s;
+    ASSERT_EQ(0, symlink(regular.c_str(), link.c_str()));
+    // Opening a FIFO without O_NONBLOCK would block until it has a writer.
+    const std::string fifo = td.path + "/fifo"s;
+    ASSERT_EQ(0, mkfifo(fifo.c_str(), 0600));
+
+    ReadaheadProfile profile;
+    for (const auto& path : {regular, link, fifo, std::string(outside.path)}) {
+        auto file = profile.add_files();
+        file->set_path(path);
+        auto extent = file->add_extents();
+        extent->set_offset(0);
+        extent->set_length(4096);
+    }
+    EXPECT_EQ(4096u, ReplayReadaheadProfile(profile));
+
+    unlink(fifo.c_str());
+    unlink(link.c_str());
+    unlink(regular.c_str());
+}
+
+}  // namespace init
+}  // namespace android
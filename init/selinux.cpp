@@ -569,6 +569,7 @@ void SelinuxRestoreContext() {
     selinux_android_restorecon("/dev/block", SELINUX_ANDROID_RESTORECON_RECURSE);
     selinux_android_restorecon("/dev/dm-user", SELINUX_ANDROID_RESTORECON_RECURSE);
     selinux_android_restorecon("/dev/device-mapper", 0);
+    selinux_android_restorecon(android::fs_mgr::kDefaultFstabCachePath, 0);
 
     selinux_android_restorecon("/apex", 0);
 
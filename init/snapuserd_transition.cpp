@@ -220,6 +220,9 @@ void SnapuserdSelinuxHelper::FinishTransition() {
     selinux_android_restorecon("/dev/urandom", 0);
     selinux_android_restorecon("/dev/kmsg", 0);
     selinux_android_restorecon("/dev/dm-user", SELINUX_ANDROID_RESTORECON_RECURSE);
+    // Labeled by the /dev/snapuserd_metadata(/.*)? entry of the platform file_contexts.
+    selinux_android_restorecon(android::snapshot::kSnapuserdMetadataDir,
+                               SELINUX_ANDROID_RESTORECON_RECURSE);
 
     RelaunchFirstStageSnapuserd();
 
@@ -21,7 +21,11 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <android-base/logging.h>
 #include <cutils/uevent.h>
@@ -29,7 +33,7 @@
 namespace android {
 namespace init {
 
-static void ParseEvent(const char* msg, Uevent* uevent) {
+void ParseUevent(const char* msg, Uevent* uevent) {
     uevent->partition_num = -1;
     uevent->major = -1;
     uevent->minor = -1;
@@ -95,8 +99,7 @@ UeventListener::UeventListener(size_t uevent_socket_rcvbuf_size) {
     fcntl(device_fd_, F_SETFL, O_NONBLOCK);
 }
 
-ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
-    char msg[UEVENT_MSG_LEN + 2];
+ReadUeventResult UeventListener::ReadRawUevent(char* msg, size_t* len) const {
     int n = uevent_kernel_multicast_recv(device_fd_, msg, UEVENT_MSG_LEN);
     if (n <= 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -111,8 +114,18 @@ ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
 
     msg[n] = '\0';
     msg[n + 1] = '\0';
+    *len = n;
+
+    return ReadUeventResult::kSuccess;
+}
+
+ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
+    char msg[UEVENT_MSG_LEN + 2];
+    size_t len;
+    auto result = ReadRawUevent(msg, &len);
+    if (result != ReadUeventResult::kSuccess) return result;
 
-    ParseEvent(msg, uevent);
+    ParseUevent(msg, uevent);
 
     return ReadUeventResult::kSuccess;
 }
@@ -180,6 +193,68 @@ void UeventListener::RegenerateUevents(const ListenerCallback& callback) const {
     }
 }
 
+// TriggerUevents() is the pipelined counterpart of RegenerateUevents().  It only pokes the uevent
+// files and leaves draining the netlink socket to the caller, which lets the /sys walk be split
+// across |num_threads| threads.  Directories are handed out from a shared stack, so threads that
+// land on a shallow subtree pick up more work instead of idling.
+static void TriggerUeventsForPath(const std::string& path, std::vector<std::string>* subdirs) {
+    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(path.c_str()), closedir);
+    if (!d) return;
+
+    int dfd = dirfd(d.get());
+
+    int fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        write(fd, "add\n", 4);
+        close(fd);
+    }
+
+    dirent* de;
+    while ((de = readdir(d.get())) != nullptr) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+        subdirs->emplace_back(path + "/" + de->d_name);
+    }
+}
+
+void UeventListener::TriggerUevents(unsigned int num_threads) const {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<std::string> pending(std::begin(kRegenerationPaths), std::end(kRegenerationPaths));
+    unsigned int busy = 0;
+
+    auto walker = [&]() {
+        std::vector<std::string> subdirs;
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            cv.wait(guard, [&]() { return !pending.empty() || busy == 0; });
+            // Nothing left to hand out and nobody can produce more: the walk is complete.
+            if (pending.empty()) return;
+
+            auto path = std::move(pending.back());
+            pending.pop_back();
+            ++busy;
+            guard.unlock();
+
+            subdirs.clear();
+            TriggerUeventsForPath(path, &subdirs);
+
+            guard.lock();
+            --busy;
+            std::move(subdirs.begin(), subdirs.end(), std::back_inserter(pending));
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(walker);
+    }
+    walker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 void UeventListener::Poll(const ListenerCallback& callback,
                           const std::optional<std::chrono::milliseconds> relative_timeout) const {
     using namespace std::chrono;
@@ -45,6 +45,10 @@ enum class ReadUeventResult {
 
 using ListenerCallback = std::function<ListenerAction(const Uevent&)>;
 
+// Parses a NUL separated uevent message, as read from the netlink socket, into |uevent|.
+// |msg| must be terminated by two NUL bytes.
+void ParseUevent(const char* msg, Uevent* uevent);
+
 class UeventListener {
   public:
     UeventListener(size_t uevent_socket_rcvbuf_size);
@@ -55,6 +59,15 @@ class UeventListener {
     void Poll(const ListenerCallback& callback,
               const std::optional<std::chrono::milliseconds> relative_timeout = {}) const;
 
+    // Writes 'add' to every uevent file under the regeneration paths using |num_threads| threads,
+    // without reading back the generated uevents.  Callers must drain the socket concurrently
+    // with ReadRawUevent() to avoid overrunning its buffer.
+    void TriggerUevents(unsigned int num_threads) const;
+    // Reads one uevent without parsing it.  |msg| must hold at least UEVENT_MSG_LEN + 2 bytes.
+    ReadUeventResult ReadRawUevent(char* msg, size_t* len) const;
+
+    int device_fd() const { return device_fd_.get(); }
+
   private:
     ReadUeventResult ReadUevent(Uevent* uevent) const;
     ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
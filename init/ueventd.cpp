@@ -24,16 +24,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <deque>
 #include <set>
 #include <thread>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/logging.h>
+#include <android-base/macros.h>
 #include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 #include <fstab/fstab.h>
 #include <selinux/android.h>
 #include <selinux/selinux.h>
@@ -102,6 +108,22 @@
 //
 // At this point, ueventd is single threaded, poll()'s and then handles any future uevents.
 
+// Devices may instead enable 'pipelined_coldboot', in which case the handler subprocesses are forked
+// before any uevent has been regenerated, so that device nodes are created while /sys is still
+// being walked:
+// 1) ueventd forks 'n' handler subprocesses, which all block reading from the same end of a
+//    SOCK_SEQPACKET socketpair.  Each read returns exactly one uevent, so whichever subprocess is
+//    idle picks up the next uevent and the work is balanced by the actual cost of handling it
+//    rather than by a static stride.
+//
+// 2) A set of threads in the main ueventd process walk /sys in parallel and write 'add' to the
+//    uevent files, while the main thread drains the netlink socket and forwards each raw uevent
+//    to the handler subprocesses.  Uevents are queued in memory when the subprocesses fall behind,
+//    so that the netlink socket is never left to overrun.
+//
+// 3) Once the walk is complete and every uevent has been forwarded, the main thread closes its end
+//    of the socketpair, which the subprocesses see as EOF, and waits for them as above.
+
 // Lastly, it should be noted that uevents that occur during the coldboot process are handled
 // without issue after the coldboot process completes.  This is because the uevent listener is
 // paused while the uevent handler and restorecon actions take place.  Once coldboot completes,
@@ -115,17 +137,20 @@ class ColdBoot {
   public:
     ColdBoot(UeventListener& uevent_listener,
              std::vector<std::unique_ptr<UeventHandler>>& uevent_handlers,
-             bool enable_parallel_restorecon)
+             bool enable_parallel_restorecon, bool enable_pipelined_coldboot)
         : uevent_listener_(uevent_listener),
           uevent_handlers_(uevent_handlers),
           num_handler_subprocesses_(std::thread::hardware_concurrency() ?: 4),
-          enable_parallel_restorecon_(enable_parallel_restorecon) {}
+          enable_parallel_restorecon_(enable_parallel_restorecon),
+          enable_pipelined_coldboot_(enable_pipelined_coldboot) {}
 
     void Run();
 
   private:
     void UeventHandlerMain(unsigned int process_num, unsigned int total_processes);
+    void PipelinedUeventHandlerMain();
     void RegenerateUevents();
+    void DispatchUevents();
     void ForkSubProcesses();
     void WaitForSubProcesses();
     void RestoreConHandler(unsigned int process_num, unsigned int total_processes);
@@ -136,9 +161,15 @@ class ColdBoot {
 
     unsigned int num_handler_subprocesses_;
     bool enable_parallel_restorecon_;
+    bool enable_pipelined_coldboot_;
 
     std::vector<Uevent> uevent_queue_;
 
+    // Pipelined cold boot only: the main process writes raw uevents to dispatch_fd_ and the
+    // handler subprocesses read them from handler_fd_.
+    android::base::unique_fd dispatch_fd_;
+    android::base::unique_fd handler_fd_;
+
     std::set<pid_t> subprocess_pids_;
 
     std::vector<std::string> restorecon_queue_;
@@ -154,6 +185,28 @@ void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_pr
     }
 }
 
+void ColdBoot::PipelinedUeventHandlerMain() {
+    char msg[UEVENT_MSG_LEN + 2];
+    Uevent uevent;
+
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(recv(handler_fd_, msg, UEVENT_MSG_LEN, 0));
+        // The main process closes its end once every uevent has been dispatched.
+        if (n == 0) return;
+        if (n < 0) {
+            PLOG(FATAL) << "recv() of dispatched uevent failed";
+        }
+
+        msg[n] = '\0';
+        msg[n + 1] = '\0';
+        ParseUevent(msg, &uevent);
+
+        for (auto& uevent_handler : uevent_handlers_) {
+            uevent_handler->HandleUevent(uevent);
+        }
+    }
+}
+
 void ColdBoot::RestoreConHandler(unsigned int process_num, unsigned int total_processes) {
     for (unsigned int i = process_num; i < restorecon_queue_.size(); i += total_processes) {
         auto& dir = restorecon_queue_[i];
@@ -190,6 +243,74 @@ void ColdBoot::RegenerateUevents() {
     });
 }
 
+void ColdBoot::DispatchUevents() {
+    android::base::Timer walk_timer;
+
+    android::base::unique_fd walk_done_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (walk_done_fd == -1) {
+        PLOG(FATAL) << "eventfd() failed";
+    }
+
+    std::thread walker([this, &walk_done_fd]() {
+        uevent_listener_.TriggerUevents(num_handler_subprocesses_);
+        uint64_t done = 1;
+        TEMP_FAILURE_RETRY(write(walk_done_fd, &done, sizeof(done)));
+    });
+
+    std::deque<std::string> pending;
+    bool walk_done = false;
+    size_t num_dispatched = 0;
+    char msg[UEVENT_MSG_LEN + 2];
+
+    while (true) {
+        pollfd fds[3] = {
+                {.fd = uevent_listener_.device_fd(), .events = POLLIN},
+                {.fd = walk_done ? -1 : walk_done_fd.get(), .events = POLLIN},
+                {.fd = pending.empty() ? -1 : dispatch_fd_.get(), .events = POLLOUT},
+        };
+        if (TEMP_FAILURE_RETRY(poll(fds, arraysize(fds), -1)) < 0) {
+            PLOG(ERROR) << "poll() during cold boot dispatch failed, continuing";
+            continue;
+        }
+
+        // The kernel queues a uevent before the write to its uevent file returns, so once the walk
+        // is complete, a single drain below is guaranteed to see every regenerated uevent.
+        if (fds[1].revents & POLLIN) {
+            walk_done = true;
+            LOG(INFO) << "Coldboot /sys walk took " << walk_timer.duration().count() / 1000.0f
+                      << " seconds";
+        }
+
+        size_t len;
+        ReadUeventResult result;
+        while ((result = uevent_listener_.ReadRawUevent(msg, &len)) != ReadUeventResult::kFailed) {
+            if (result == ReadUeventResult::kInvalid) continue;
+            // Keep the two terminating NULs so that the handlers can parse the message in place.
+            pending.emplace_back(msg, len + 2);
+        }
+
+        while (!pending.empty()) {
+            const auto& next = pending.front();
+            ssize_t n = TEMP_FAILURE_RETRY(send(dispatch_fd_, next.data(), next.size() - 2,
+                                                MSG_DONTWAIT | MSG_NOSIGNAL));
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                PLOG(FATAL) << "send() of uevent to handler subprocesses failed";
+            }
+            pending.pop_front();
+            ++num_dispatched;
+        }
+
+        if (walk_done && pending.empty()) break;
+    }
+
+    walker.join();
+    dispatch_fd_.reset();
+
+    LOG(INFO) << "Coldboot dispatched " << num_dispatched << " uevents in "
+              << walk_timer.duration().count() / 1000.0f << " seconds";
+}
+
 void ColdBoot::ForkSubProcesses() {
     for (unsigned int i = 0; i < num_handler_subprocesses_; ++i) {
         auto pid = fork();
@@ -198,7 +319,13 @@ void ColdBoot::ForkSubProcesses() {
         }
 
         if (pid == 0) {
-            UeventHandlerMain(i, num_handler_subprocesses_);
+            if (enable_pipelined_coldboot_) {
+                // Drop our copy of the write end, so that we see EOF once the main process is done.
+                dispatch_fd_.reset();
+                PipelinedUeventHandlerMain();
+            } else {
+                UeventHandlerMain(i, num_handler_subprocesses_);
+            }
             if (enable_parallel_restorecon_) {
                 RestoreConHandler(i, num_handler_subprocesses_);
             }
@@ -245,7 +372,16 @@ void ColdBoot::WaitForSubProcesses() {
 void ColdBoot::Run() {
     android::base::Timer cold_boot_timer;
 
-    RegenerateUevents();
+    if (enable_pipelined_coldboot_) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+            PLOG(FATAL) << "socketpair() failed";
+        }
+        dispatch_fd_.reset(sockets[0]);
+        handler_fd_.reset(sockets[1]);
+    } else {
+        RegenerateUevents();
+    }
 
     if (enable_parallel_restorecon_) {
         selinux_android_restorecon("/sys", 0);
@@ -257,11 +393,36 @@ void ColdBoot::Run() {
 
     ForkSubProcesses();
 
-    if (!enable_parallel_restorecon_) {
+    if (enable_pipelined_coldboot_) {
+        handler_fd_.reset();
+
+        // The main thread is busy dispatching uevents, so do the recursive restorecon on its own
+        // thread.  Only the handler subprocesses change their egid or fscreatecon.
+        std::thread restorecon_thread;
+        if (!enable_parallel_restorecon_) {
+            restorecon_thread = std::thread([]() {
+                android::base::Timer restorecon_timer;
+                selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
+                LOG(INFO) << "Coldboot restorecon of /sys took "
+                          << restorecon_timer.duration().count() / 1000.0f << " seconds";
+            });
+        }
+
+        DispatchUevents();
+
+        if (restorecon_thread.joinable()) {
+            restorecon_thread.join();
+        }
+    } else if (!enable_parallel_restorecon_) {
         selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
     }
 
+    android::base::Timer wait_timer;
     WaitForSubProcesses();
+    if (enable_pipelined_coldboot_) {
+        LOG(INFO) << "Coldboot handlers finished " << wait_timer.duration().count() / 1000.0f
+                  << " seconds after the last uevent was dispatched";
+    }
 
     android::base::SetProperty(kColdBootDoneProp, "true");
     LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds";
@@ -313,7 +474,8 @@ int ueventd_main(int argc, char** argv) {
 
     if (!android::base::GetBoolProperty(kColdBootDoneProp, false)) {
         ColdBoot cold_boot(uevent_listener, uevent_handlers,
-                           ueventd_configuration.enable_parallel_restorecon);
+                           ueventd_configuration.enable_parallel_restorecon,
+                           ueventd_configuration.enable_pipelined_coldboot);
         cold_boot.Run();
     }
 
@@ -340,6 +340,10 @@ parallel_restorecon
 parallel_restorecon enabled enabled
 parallel_restorecon blah
 
+pipelined_coldboot
+pipelined_coldboot enabled enabled
+pipelined_coldboot blah
+
 external_firmware_handler
 external_firmware_handler blah blah
 external_firmware_handler blah blah blah blah
@@ -19,6 +19,14 @@
 #include <sys/eventfd.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 
@@ -85,11 +93,11 @@ bool HandleWrite(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* cal
     return true;
 }
 
-bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
-    if (!buffer->request.Read(fd)) {
-        return false;
-    }
+// Maximum number of requests read ahead of their callbacks when dispatching on a thread pool.
+// Each one holds a FuseBuffer.
+constexpr size_t kMaxPendingRequests = 32;
 
+bool HandleRequest(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
     const uint32_t opcode = buffer->request.header.opcode;
     LOG(VERBOSE) << "Read a fuse packet, opcode=" << opcode;
     switch (opcode) {
@@ -127,13 +135,192 @@ bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCal
     }
 }
 
+bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
+    if (!buffer->request.Read(fd)) {
+        return false;
+    }
+    return HandleRequest(loop, buffer, fd, callback);
+}
+
 } // namespace
 
+// Hands requests to a pool of threads. Requests are queued per inode, and an inode is only
+// picked up by one thread at a time, which keeps them in order.
+class FuseAppLoop::Dispatcher {
+  public:
+    Dispatcher(FuseAppLoop* loop, FuseAppLoopCallback* callback)
+        : loop_(loop), callback_(callback) {
+        {
+            std::lock_guard<std::mutex> lock(loop_->mutex_);
+            loop_->dispatcher_ = this;
+        }
+        for (size_t i = 0; i < loop->threads_; ++i) {
+            threads_.emplace_back([this] { Run(); });
+        }
+    }
+
+    // Finishes the queued requests and joins the threads.
+    ~Dispatcher() {
+        {
+            std::lock_guard<std::mutex> lock(loop_->mutex_);
+            loop_->dispatcher_ = nullptr;
+            stopping_ = true;
+        }
+        work_cond_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Reads a request and queues it for its inode. Waits if kMaxPendingRequests requests are
+    // already pending. Returns false once the loop should end.
+    bool ReadAndDispatch() {
+        std::unique_ptr<FuseBuffer> buffer = GetBuffer();
+        if (!buffer) {
+            return false;
+        }
+        if (!buffer->request.Read(loop_->fd_)) {
+            PutBuffer(std::move(buffer));
+            return false;
+        }
+        if (buffer->request.header.opcode == FUSE_FORGET) {
+            // Do not reply to FUSE_FORGET.
+            PutBuffer(std::move(buffer));
+            return true;
+        }
+
+        const uint64_t inode = buffer->request.header.nodeid;
+        std::lock_guard<std::mutex> lock(loop_->mutex_);
+        auto& queue = inodes_[inode];
+        queue.push_back({std::move(buffer), std::chrono::steady_clock::now()});
+        if (queue.size() == 1) {
+            ready_.push_back(inode);
+            work_cond_.notify_one();
+        }
+        FuseAppLoopStats& stats = loop_->stats_;
+        stats.dispatched_requests++;
+        stats.queue_depth++;
+        stats.max_queue_depth = std::max(stats.max_queue_depth, stats.queue_depth);
+        return true;
+    }
+
+    // Makes ReadAndDispatch() return false from now on, including a call that is waiting for a
+    // buffer to be freed.
+    void BreakLocked() {
+        breaking_ = true;
+        buffer_cond_.notify_all();
+    }
+
+  private:
+    struct Request {
+        std::unique_ptr<FuseBuffer> buffer;
+        std::chrono::steady_clock::time_point read_time;
+    };
+
+    std::unique_ptr<FuseBuffer> GetBuffer() {
+        std::unique_lock<std::mutex> lock(loop_->mutex_);
+        buffer_cond_.wait(lock, [this] {
+            return breaking_ || !free_buffers_.empty() || allocated_buffers_ < kMaxPendingRequests;
+        });
+        if (breaking_) {
+            return nullptr;
+        }
+        if (free_buffers_.empty()) {
+            allocated_buffers_++;
+            return std::make_unique<FuseBuffer>();
+        }
+        std::unique_ptr<FuseBuffer> buffer = std::move(free_buffers_.back());
+        free_buffers_.pop_back();
+        return buffer;
+    }
+
+    void PutBuffer(std::unique_ptr<FuseBuffer> buffer) {
+        std::lock_guard<std::mutex> lock(loop_->mutex_);
+        PutBufferLocked(std::move(buffer));
+    }
+
+    void PutBufferLocked(std::unique_ptr<FuseBuffer> buffer) {
+        free_buffers_.push_back(std::move(buffer));
+        buffer_cond_.notify_one();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(loop_->mutex_);
+        while (true) {
+            work_cond_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+            if (ready_.empty()) return;
+            const uint64_t inode = ready_.front();
+            ready_.pop_front();
+
+            // Only this thread touches the front of the inode's queue until it's popped below.
+            Request& request = inodes_[inode].front();
+            lock.unlock();
+            if (!HandleRequest(loop_, request.buffer.get(), loop_->fd_, callback_)) {
+                // End the loop, as a failure does when the requests are handled serially.
+                LOG(ERROR) << "Failed to handle a request for inode " << inode;
+                loop_->Break();
+            }
+            const uint64_t latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - request.read_time).count();
+            lock.lock();
+
+            FuseAppLoopStats& stats = loop_->stats_;
+            stats.completed_requests++;
+            stats.queue_depth--;
+            stats.total_latency_ns += latency_ns;
+            stats.max_latency_ns = std::max(stats.max_latency_ns, latency_ns);
+
+            auto it = inodes_.find(inode);
+            PutBufferLocked(std::move(it->second.front().buffer));
+            it->second.pop_front();
+            if (it->second.empty()) {
+                inodes_.erase(it);
+            } else {
+                ready_.push_back(inode);
+                work_cond_.notify_one();
+            }
+        }
+    }
+
+    FuseAppLoop* const loop_;
+    FuseAppLoopCallback* const callback_;
+
+    // The members below are guarded by loop_->mutex_.
+    std::unordered_map<uint64_t, std::deque<Request>> inodes_;
+    // Inodes with queued requests that no thread is working on.
+    std::deque<uint64_t> ready_;
+    std::vector<std::unique_ptr<FuseBuffer>> free_buffers_;
+    size_t allocated_buffers_ = 0;
+    bool breaking_ = false;
+    bool stopping_ = false;
+    std::condition_variable work_cond_;
+    std::condition_variable buffer_cond_;
+
+    std::vector<std::thread> threads_;
+
+    DISALLOW_COPY_AND_ASSIGN(Dispatcher);
+};
+
 FuseAppLoopCallback::~FuseAppLoopCallback() = default;
 
-FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : fd_(std::move(fd)) {}
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : FuseAppLoop(std::move(fd), 0) {}
+
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd, size_t threads)
+    : fd_(std::move(fd)), threads_(threads), stats_() {}
+
+FuseAppLoopStats FuseAppLoop::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
 
 void FuseAppLoop::Break() {
+    {
+        // The loop may be waiting for the thread pool rather than for the break event.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dispatcher_ != nullptr) {
+            dispatcher_->BreakLocked();
+        }
+    }
     const int64_t value = 1;
     if (write(break_fd_, &value, sizeof(value)) == -1) {
         PLOG(ERROR) << "Failed to send a break event";
@@ -223,6 +410,11 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
     last_event = 0;
     break_event = 0;
 
+    std::unique_ptr<Dispatcher> dispatcher;
+    if (threads_ > 0) {
+        dispatcher.reset(new Dispatcher(this, callback));
+    }
+
     FuseBuffer buffer;
     while (true) {
         if (!epoll_controller->Wait(1)) {
@@ -236,7 +428,11 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
             break;
         }
 
-        if (!HandleMessage(this, &buffer, fd_, callback)) {
+        if (dispatcher) {
+            if (!dispatcher->ReadAndDispatch()) {
+                break;
+            }
+        } else if (!HandleMessage(this, &buffer, fd_, callback)) {
             break;
         }
     }
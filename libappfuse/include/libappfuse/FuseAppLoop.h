@@ -42,10 +42,29 @@ class FuseAppLoopCallback {
    virtual ~FuseAppLoopCallback();
 };
 
+// Counters for requests dispatched on a FuseAppLoop thread pool.
+struct FuseAppLoopStats {
+    // Requests handed to the pool, and requests whose callback has returned.
+    uint64_t dispatched_requests;
+    uint64_t completed_requests;
+    // Requests queued or running now, and the most there have been at once.
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+    // Time from reading a request to its callback returning.
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+};
+
 class FuseAppLoop final {
   public:
     FuseAppLoop(base::unique_fd&& fd);
 
+    // Runs callbacks on a pool of |threads| threads instead of the thread calling Start(), so
+    // that a slow callback for one inode doesn't hold up the others. Requests for the same
+    // inode are still handled one at a time, in the order they were read. Callbacks, and the
+    // Reply methods they call, then run concurrently and must be thread-safe.
+    FuseAppLoop(base::unique_fd&& fd, size_t threads);
+
     void Start(FuseAppLoopCallback* callback);
     void Break();
 
@@ -56,12 +75,21 @@ class FuseAppLoop final {
     bool ReplyWrite(uint64_t unique, uint32_t size);
     bool ReplyRead(uint64_t unique, uint32_t size, const void* data);
 
+    // Only counts requests handled by the thread pool.
+    FuseAppLoopStats GetStats();
+
   private:
+    class Dispatcher;
+
     base::unique_fd fd_;
     base::unique_fd break_fd_;
+    const size_t threads_;
 
     // Lock for multi-threading.
     std::mutex mutex_;
+    FuseAppLoopStats stats_;
+    // Set while Start() runs callbacks on a thread pool. Guarded by mutex_.
+    Dispatcher* dispatcher_ = nullptr;
 };
 
 bool StartFuseAppLoop(int fd, FuseAppLoopCallback* callback);
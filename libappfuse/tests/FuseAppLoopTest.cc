@@ -16,11 +16,15 @@
 
 #include "libappfuse/FuseAppLoop.h"
 
+#include <signal.h>
 #include <sys/socket.h>
 
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 #include "libappfuse/EpollController.h"
@@ -80,6 +84,43 @@ class Callback : public FuseAppLoopCallback {
   }
 };
 
+// Holds reads of inode 10 until Unblock() is called, and records the reads it has seen.
+class ThreadPoolCallback : public FuseAppLoopCallback {
+ public:
+  FuseAppLoop* loop;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool blocked = true;
+  std::vector<std::pair<uint64_t, uint64_t>> reads;  // inode, offset
+
+  void Unblock() {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocked = false;
+    cond.notify_all();
+  }
+
+  void OnRead(uint64_t seq, uint64_t inode, uint64_t offset,
+              uint32_t size ATTRIBUTE_UNUSED) override {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (inode == 10) {
+        cond.wait(lock, [this] { return !blocked; });
+      }
+      reads.emplace_back(inode, offset);
+    }
+    loop->ReplySimple(seq, 0);
+  }
+
+  void OnLookup(uint64_t seq, uint64_t) override { loop->ReplySimple(seq, -ENOENT); }
+  void OnGetAttr(uint64_t seq, uint64_t) override { loop->ReplySimple(seq, -ENOENT); }
+  void OnFsync(uint64_t seq, uint64_t) override { loop->ReplySimple(seq, 0); }
+  void OnWrite(uint64_t seq, uint64_t, uint64_t, uint32_t, const void*) override {
+    loop->ReplyWrite(seq, 0);
+  }
+  void OnOpen(uint64_t seq, uint64_t inode) override { loop->ReplyOpen(seq, inode); }
+  void OnRelease(uint64_t seq, uint64_t) override { loop->ReplySimple(seq, 0); }
+};
+
 class FuseAppLoopTest : public ::testing::Test {
  protected:
    std::thread thread_;
@@ -295,5 +336,107 @@ TEST_F(FuseAppLoopTest, Break) {
     }
 }
 
+TEST(FuseAppLoopThreadPoolTest, DispatchesInodesConcurrently) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 4);
+  ThreadPoolCallback callback;
+  callback.loop = &loop;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  std::unique_ptr<FuseRequest> request(new FuseRequest);
+  std::unique_ptr<FuseResponse> response(new FuseResponse);
+  auto send_read = [&](uint64_t unique, uint64_t inode, uint64_t offset) {
+    request->Reset(sizeof(fuse_read_in), FUSE_READ, unique);
+    request->header.nodeid = inode;
+    request->read_in.offset = offset;
+    return request->Write(sockets[0]);
+  };
+
+  // A read of inode 11 is answered while the one of inode 10 is held up.
+  ASSERT_TRUE(send_read(1, 10, 0));
+  ASSERT_TRUE(send_read(2, 11, 0));
+  ASSERT_TRUE(response->Read(sockets[0]));
+  EXPECT_EQ(2u, response->header.unique);
+  callback.Unblock();
+  ASSERT_TRUE(response->Read(sockets[0]));
+  EXPECT_EQ(1u, response->header.unique);
+
+  // Reads of one inode are handled in order.
+  for (uint64_t i = 0; i < 8; i++) {
+    ASSERT_TRUE(send_read(3 + i, 12, i * 4096));
+  }
+  for (uint64_t i = 0; i < 8; i++) {
+    ASSERT_TRUE(response->Read(sockets[0]));
+    EXPECT_EQ(3 + i, response->header.unique);
+  }
+
+  loop.Break();
+  thread.join();
+
+  ASSERT_EQ(10u, callback.reads.size());
+  for (uint64_t i = 0; i < 8; i++) {
+    const std::pair<uint64_t, uint64_t> expected(12, i * 4096);
+    EXPECT_EQ(expected, callback.reads[2 + i]);
+  }
+
+  const FuseAppLoopStats stats = loop.GetStats();
+  EXPECT_EQ(10u, stats.dispatched_requests);
+  EXPECT_EQ(10u, stats.completed_requests);
+  EXPECT_EQ(0u, stats.queue_depth);
+  EXPECT_GE(stats.max_queue_depth, 2u);
+  EXPECT_GE(stats.max_latency_ns, stats.total_latency_ns / stats.completed_requests);
+}
+
+TEST(FuseAppLoopThreadPoolTest, BreakWhileWaitingForBuffers) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 1);
+  ThreadPoolCallback callback;
+  callback.loop = &loop;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  // Hold up the pool with reads of inode 10 until the loop has used every buffer and waits for
+  // one to be freed, with more requests left to read.
+  std::unique_ptr<FuseRequest> request(new FuseRequest);
+  for (uint64_t i = 0; i < 40; i++) {
+    request->Reset(sizeof(fuse_read_in), FUSE_READ, i + 1);
+    request->header.nodeid = 10;
+    ASSERT_TRUE(request->Write(sockets[0]));
+  }
+  while (loop.GetStats().dispatched_requests < 32) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // The loop must stop reading even once the pool frees buffers again.
+  loop.Break();
+  callback.Unblock();
+  thread.join();
+  EXPECT_EQ(32u, loop.GetStats().dispatched_requests);
+  EXPECT_EQ(32u, loop.GetStats().completed_requests);
+}
+
+TEST(FuseAppLoopThreadPoolTest, EndsOnRequestFailure) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 2);
+  ThreadPoolCallback callback;
+  callback.loop = &loop;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  // Replies can't be delivered any more, so the loop fails to answer a GETATTR of the root,
+  // which it handles itself, and must end without a Break().
+  sighandler_t old_handler = signal(SIGPIPE, SIG_IGN);
+  ASSERT_EQ(0, shutdown(sockets[0], SHUT_RD));
+  std::unique_ptr<FuseRequest> request(new FuseRequest);
+  request->Reset(sizeof(fuse_getattr_in), FUSE_GETATTR, 1);
+  request->header.nodeid = FUSE_ROOT_ID;
+  ASSERT_TRUE(request->Write(sockets[0]));
+  thread.join();
+  signal(SIGPIPE, old_handler);
+
+  EXPECT_EQ(1u, loop.GetStats().completed_requests);
+}
+
 }  // namespace fuse
 }  // namespace android
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specic language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libappfuse/FuseBridgeLoop.h"
+
+#include <memory>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+namespace android {
+namespace fuse {
+namespace {
+
+// Requests kept in flight by the device side, like the kernel does with readahead. This must stay
+// below net.unix.max_dgram_qlen, or the bridge blocks writing to the proxy socket.
+constexpr int kWindow = 8;
+
+class NullCallback : public FuseBridgeLoopCallback {
+ public:
+  void OnMount(int /* mount_id */) override {}
+  void OnClosed(int /* mount_id */) override {}
+};
+
+// A FuseBridgeLoop between two pairs of message sockets, standing in for /dev/fuse and the app's
+// proxy. The proxy answers every FUSE_READ with |size| bytes of data, and every other request
+// with success.
+class LoopbackBridge {
+ public:
+  explicit LoopbackBridge(size_t size) {
+    CHECK(SetupMessageSockets(&dev_sockets_));
+    CHECK(SetupMessageSockets(&proxy_sockets_));
+    loop_thread_ = std::thread([this] {
+      FuseBridgeLoop loop;
+      loop.AddBridge(1, std::move(dev_sockets_[1]), std::move(proxy_sockets_[0]));
+      loop.Start(&callback_);
+    });
+    proxy_thread_ = std::thread([this, size] {
+      std::unique_ptr<FuseRequest> request(new FuseRequest);
+      std::unique_ptr<FuseResponse> response(new FuseResponse);
+      while (request->Read(proxy_sockets_[1])) {
+        if (request->header.opcode == FUSE_READ) {
+          response->ResetHeader(size, kFuseSuccess, request->header.unique);
+        } else if (request->header.opcode == FUSE_WRITE) {
+          response->Reset(sizeof(fuse_write_out), kFuseSuccess, request->header.unique);
+          response->write_out.size = request->write_in.size;
+        } else {
+          response->Reset(0, kFuseSuccess, request->header.unique);
+        }
+        if (!response->Write(proxy_sockets_[1])) return;
+      }
+    });
+  }
+
+  ~LoopbackBridge() {
+    // The bridge closes once the last open file is released.
+    std::unique_ptr<FuseRequest> request(new FuseRequest);
+    std::unique_ptr<FuseResponse> response(new FuseResponse);
+    for (uint32_t opcode : {FUSE_OPEN, FUSE_RELEASE}) {
+      request->Reset(0, opcode, 1);
+      CHECK(Relay(request.get(), 1, response.get()));
+    }
+    loop_thread_.join();
+    proxy_thread_.join();
+  }
+
+  // Sends |count| requests through the bridge and reads back their replies.
+  bool Relay(FuseRequest* request, int count, FuseResponse* response) {
+    for (int i = 0; i < count; i++) {
+      request->header.unique = i + 1;
+      if (!request->Write(dev_sockets_[0])) return false;
+    }
+    for (int i = 0; i < count; i++) {
+      if (!response->Read(dev_sockets_[0]) || response->header.error != kFuseSuccess) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  base::unique_fd dev_sockets_[2];
+  base::unique_fd proxy_sockets_[2];
+  NullCallback callback_;
+  std::thread loop_thread_;
+  std::thread proxy_thread_;
+};
+
+void BM_BridgeRead(benchmark::State& state) {
+  const size_t size = state.range(0);
+  LoopbackBridge bridge(size);
+  std::unique_ptr<FuseRequest> request(new FuseRequest);
+  std::unique_ptr<FuseResponse> response(new FuseResponse);
+  request->Reset(sizeof(fuse_read_in), FUSE_READ, 1);
+  request->read_in.size = size;
+  for (auto _ : state) {
+    if (!bridge.Relay(request.get(), kWindow, response.get())) {
+      state.SkipWithError("relay failed");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kWindow * size);
+}
+BENCHMARK(BM_BridgeRead)->RangeMultiplier(4)->Range(4096, kFuseMaxRead)->UseRealTime();
+
+void BM_BridgeWrite(benchmark::State& state) {
+  const size_t size = state.range(0);
+  LoopbackBridge bridge(size);
+  std::unique_ptr<FuseRequest> request(new FuseRequest);
+  std::unique_ptr<FuseResponse> response(new FuseResponse);
+  request->Reset(sizeof(fuse_write_in) + size, FUSE_WRITE, 1);
+  request->write_in.size = size;
+  for (auto _ : state) {
+    if (!bridge.Relay(request.get(), kWindow, response.get())) {
+      state.SkipWithError("relay failed");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kWindow * size);
+}
+BENCHMARK(BM_BridgeWrite)->RangeMultiplier(4)->Range(4096, kFuseMaxWrite)->UseRealTime();
+
+}  // namespace
+}  // namespace fuse
+}  // namespace android
+
+BENCHMARK_MAIN();
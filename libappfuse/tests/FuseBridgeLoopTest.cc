@@ -18,7 +18,9 @@
 
 #include <sys/socket.h>
 
+#include <memory>
 #include <sstream>
+#include <string>
 #include <thread>
 
 #include <android-base/logging.h>
@@ -125,6 +127,56 @@ class FuseBridgeLoopTest : public ::testing::Test {
   void TearDown() override {
     Close();
   }
+
+  // Relays a FUSE_READ or FUSE_WRITE request with the largest payload that the bridge
+  // negotiates, and checks that every byte of the payload arrives at the other end.
+  void CheckPayload(uint32_t opcode, uint64_t unique) {
+    SCOPED_TRACE((std::ostringstream() << "opcode: " << opcode).str());
+    const size_t size = opcode == FUSE_READ ? kFuseMaxRead : kFuseMaxWrite;
+    std::string payload(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+      payload[i] = static_cast<char>(i * 7 + unique);
+    }
+
+    std::unique_ptr<FuseRequest> request(new FuseRequest);
+    if (opcode == FUSE_READ) {
+      request->Reset(sizeof(fuse_read_in), FUSE_READ, unique);
+      request->read_in.size = size;
+    } else {
+      request->Reset(sizeof(fuse_write_in) + size, FUSE_WRITE, unique);
+      request->write_in.size = size;
+      memcpy(request->write_data, payload.data(), size);
+    }
+    ASSERT_TRUE(request->Write(dev_sockets_[0]));
+
+    request.reset(new FuseRequest);
+    ASSERT_TRUE(request->Read(proxy_sockets_[1]));
+    EXPECT_EQ(opcode, request->header.opcode);
+    EXPECT_EQ(unique, request->header.unique);
+    std::unique_ptr<FuseResponse> response(new FuseResponse);
+    if (opcode == FUSE_READ) {
+      EXPECT_EQ(size, request->read_in.size);
+      response->ResetHeader(size, kFuseSuccess, unique);
+      memcpy(response->read_data, payload.data(), size);
+    } else {
+      ASSERT_EQ(sizeof(fuse_in_header) + sizeof(fuse_write_in) + size, request->header.len);
+      EXPECT_EQ(payload, std::string(request->write_data, size));
+      response->Reset(sizeof(fuse_write_out), kFuseSuccess, unique);
+      response->write_out.size = size;
+    }
+    ASSERT_TRUE(response->Write(proxy_sockets_[1]));
+
+    response.reset(new FuseResponse);
+    ASSERT_TRUE(response->Read(dev_sockets_[0]));
+    EXPECT_EQ(unique, response->header.unique);
+    EXPECT_EQ(kFuseSuccess, response->header.error);
+    if (opcode == FUSE_READ) {
+      ASSERT_EQ(sizeof(fuse_out_header) + size, response->header.len);
+      EXPECT_EQ(payload, std::string(response->read_data, size));
+    } else {
+      EXPECT_EQ(size, response->write_out.size);
+    }
+  }
 };
 
 } //  namespace
@@ -210,5 +262,11 @@ TEST_F(FuseBridgeLoopTest, Proxy) {
   Close();
 }
 
+TEST_F(FuseBridgeLoopTest, ProxyPayload) {
+  CheckPayload(FUSE_READ, 1u);
+  CheckPayload(FUSE_WRITE, 2u);
+  CheckPayload(FUSE_READ, 3u);
+}
+
 }  // namespace fuse
 }  // namespace android
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIO.h>
+#include <asyncio/AsyncIORing.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define ASYNCIO_HAVE_IO_URING 1
+#endif
+
+namespace {
+
+// An op that has been handed to the kernel. Its index is the io_uring user_data or the
+// aio_data of the iocb, so the caller's user_data can be anything.
+struct Slot {
+    uint64_t user_data;
+    iovec iov;
+    iocb cb;
+    // Kernel aio can't link ops, so the rest of a chain waits here for this op to finish.
+    std::vector<asyncio_op> chain;
+};
+
+}  // namespace
+
+struct asyncio_ring {
+    bool uring = false;
+    std::vector<Slot> slots;
+    std::vector<unsigned> free_slots;
+    std::vector<iovec> buffers;
+    std::vector<int> files;
+    // Slots held back for ops waiting on a link under kernel aio.
+    size_t chained = 0;
+    // Completions that were produced without the kernel, such as cancelled links.
+    std::deque<asyncio_completion> ready;
+
+    aio_context_t aio_ctx = 0;
+
+#ifdef ASYNCIO_HAVE_IO_URING
+    int ring_fd = -1;
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+    // SQEs queued that the kernel hasn't consumed yet.
+    unsigned sq_pending = 0;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+#endif
+};
+
+namespace {
+
+// Returns the fd an op refers to, resolving ASYNCIO_OP_FIXED_FILE for kernel aio.
+int ResolveFd(const asyncio_ring* ring, const asyncio_op& op) {
+    if (!(op.flags & ASYNCIO_OP_FIXED_FILE)) return op.fd;
+    if (op.fd < 0 || static_cast<size_t>(op.fd) >= ring->files.size()) return -1;
+    return ring->files[op.fd];
+}
+
+unsigned AllocSlot(asyncio_ring* ring, const asyncio_op& op) {
+    unsigned index = ring->free_slots.back();
+    ring->free_slots.pop_back();
+    Slot& slot = ring->slots[index];
+    slot.user_data = op.user_data;
+    slot.iov = {op.buf, op.count};
+    slot.chain.clear();
+    return index;
+}
+
+// Ops that have been accepted but not yet returned by asyncio_ring_wait().
+size_t Outstanding(const asyncio_ring* ring) {
+    return ring->slots.size() - ring->free_slots.size() + ring->chained + ring->ready.size();
+}
+
+// Returns the number of ops from the start of |ops| that fit in the ring without splitting a
+// chain.
+unsigned FitOps(const asyncio_ring* ring, const asyncio_op* ops, unsigned nr) {
+    const size_t free = ring->free_slots.size() - ring->chained;
+    if (nr <= free) return nr;
+    unsigned fit = 0;
+    for (unsigned i = 0; i < free; i++) {
+        if (!(ops[i].flags & ASYNCIO_OP_LINK)) fit = i + 1;
+    }
+    return fit;
+}
+
+// --------------------------------------------------------------------------
+// Kernel aio
+// --------------------------------------------------------------------------
+
+// Fails |slot|'s op with |error|, cancels the ops linked after it and frees the slot.
+void AioFail(asyncio_ring* ring, unsigned index, int error) {
+    Slot& slot = ring->slots[index];
+    ring->ready.push_back({slot.user_data, -error});
+    for (const asyncio_op& op : slot.chain) {
+        ring->ready.push_back({op.user_data, -ECANCELED});
+    }
+    ring->chained -= slot.chain.size();
+    slot.chain.clear();
+    ring->free_slots.push_back(index);
+}
+
+// Takes a slot for |ops[0]| and keeps the |nr - 1| ops linked after it with the slot. Returns
+// the slot, with its iocb prepared, or -1 if the op failed already.
+int AioPrepare(asyncio_ring* ring, const asyncio_op* ops, size_t nr) {
+    const asyncio_op& op = ops[0];
+    unsigned index = AllocSlot(ring, op);
+    Slot& slot = ring->slots[index];
+    slot.chain.assign(ops + 1, ops + nr);
+    ring->chained += nr - 1;
+
+    int fd = ResolveFd(ring, op);
+    if (fd == -1) {
+        AioFail(ring, index, EBADF);
+        return -1;
+    }
+    io_prep(&slot.cb, fd, op.buf, op.count, op.offset, op.read);
+    slot.cb.aio_data = index;
+    return index;
+}
+
+int AioSubmit(asyncio_ring* ring, const asyncio_op* ops, unsigned nr) {
+    // Kernel aio has no links, so only the first op of each chain is submitted now. The rest
+    // of the chain waits in its slot and is started from AioWait().
+    std::vector<iocb*> cbs;
+    for (unsigned i = 0; i < nr;) {
+        unsigned end = i + 1;
+        while (end < nr && (ops[end - 1].flags & ASYNCIO_OP_LINK)) end++;
+        int index = AioPrepare(ring, ops + i, end - i);
+        if (index != -1) cbs.push_back(&ring->slots[index].cb);
+        i = end;
+    }
+
+    size_t submitted = 0;
+    while (submitted < cbs.size()) {
+        int rc = io_submit(ring->aio_ctx, cbs.size() - submitted, cbs.data() + submitted);
+        if (rc > 0) {
+            submitted += rc;
+        } else if (rc == -1 && errno == EINTR) {
+            continue;
+        } else {
+            // The first remaining op was rejected; report it and carry on with the rest.
+            AioFail(ring, cbs[submitted]->aio_data, rc == -1 ? errno : EIO);
+            submitted++;
+        }
+    }
+    return nr;
+}
+
+// Frees the slot of an op that completed with |res|, and starts the next op of its chain.
+void AioComplete(asyncio_ring* ring, unsigned index, int32_t res) {
+    Slot& slot = ring->slots[index];
+    std::vector<asyncio_op> chain = std::move(slot.chain);
+    slot.chain.clear();
+    ring->chained -= chain.size();
+    ring->free_slots.push_back(index);
+    if (chain.empty()) return;
+
+    if (res < 0 || static_cast<size_t>(res) != slot.iov.iov_len) {
+        for (const asyncio_op& op : chain) {
+            ring->ready.push_back({op.user_data, -ECANCELED});
+        }
+        return;
+    }
+    int next = AioPrepare(ring, chain.data(), chain.size());
+    if (next == -1) return;
+    iocb* cb = &ring->slots[next].cb;
+    int rc;
+    do {
+        rc = io_submit(ring->aio_ctx, 1, &cb);
+    } while (rc == -1 && errno == EINTR);
+    if (rc != 1) AioFail(ring, next, rc == -1 ? errno : EIO);
+}
+
+int AioWait(asyncio_ring* ring, asyncio_completion* completions, unsigned min_nr,
+            unsigned max_nr) {
+    unsigned count = 0;
+    std::vector<io_event> events(max_nr);
+    while (true) {
+        while (count < max_nr && !ring->ready.empty()) {
+            completions[count++] = ring->ready.front();
+            ring->ready.pop_front();
+        }
+        const size_t in_flight = ring->slots.size() - ring->free_slots.size();
+        if (count >= max_nr || in_flight == 0) break;
+
+        const long wait_nr = count < min_nr ? 1 : 0;
+        int rc = io_getevents(ring->aio_ctx, wait_nr, max_nr - count, events.data(), nullptr);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            return count > 0 ? static_cast<int>(count) : -1;
+        }
+        if (rc == 0) break;
+
+        for (int i = 0; i < rc; i++) {
+            const unsigned index = events[i].data;
+            const int32_t res = events[i].res;
+            completions[count++] = {ring->slots[index].user_data, res};
+            AioComplete(ring, index, res);
+        }
+    }
+    return count;
+}
+
+// --------------------------------------------------------------------------
+// io_uring
+// --------------------------------------------------------------------------
+
+#ifdef ASYNCIO_HAVE_IO_URING
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+unsigned* RingField(void* ring, uint32_t offset) {
+    return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+int UringSetup(asyncio_ring* ring, unsigned entries) {
+    io_uring_params params = {};
+    ring->ring_fd = io_uring_setup(entries, &params);
+    if (ring->ring_fd == -1) return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_size = ring->cq_ring_size =
+                std::max(ring->sq_ring_size, ring->cq_ring_size);
+    }
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) return -1;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) return -1;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqes_size,
+                                                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                 ring->ring_fd, IORING_OFF_SQES));
+    if (ring->sqes == MAP_FAILED) return -1;
+
+    ring->sq_tail = RingField(ring->sq_ring, params.sq_off.tail);
+    ring->sq_mask = RingField(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_array = RingField(ring->sq_ring, params.sq_off.array);
+    ring->cq_head = RingField(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail = RingField(ring->cq_ring, params.cq_off.tail);
+    ring->cq_mask = RingField(ring->cq_ring, params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(ring->cq_ring) +
+                                                 params.cq_off.cqes);
+    return 0;
+}
+
+void UringDestroy(asyncio_ring* ring) {
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->ring_fd != -1) close(ring->ring_fd);
+}
+
+int UringSubmit(asyncio_ring* ring, const asyncio_op* ops, unsigned nr) {
+    // Nothing else writes the tail, and the kernel only reads it, so a plain load is fine.
+    unsigned tail = *ring->sq_tail;
+    const unsigned mask = *ring->sq_mask;
+    for (unsigned i = 0; i < nr; i++) {
+        const asyncio_op& op = ops[i];
+        const unsigned index = AllocSlot(ring, op);
+        Slot& slot = ring->slots[index];
+
+        io_uring_sqe* sqe = &ring->sqes[tail & mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = op.fd;
+        sqe->off = op.offset;
+        sqe->user_data = index;
+        if (op.flags & ASYNCIO_OP_FIXED_BUFFER) {
+            sqe->opcode = op.read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = reinterpret_cast<uint64_t>(op.buf);
+            sqe->len = op.count;
+            sqe->buf_index = op.buf_index;
+        } else {
+            // READV/WRITEV work on every kernel with io_uring; the iovec lives in the slot
+            // until the op completes.
+            sqe->opcode = op.read ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = reinterpret_cast<uint64_t>(&slot.iov);
+            sqe->len = 1;
+        }
+        if (op.flags & ASYNCIO_OP_FIXED_FILE) sqe->flags |= IOSQE_FIXED_FILE;
+        // A link flag on the last op would join the chain to the next submission.
+        if ((op.flags & ASYNCIO_OP_LINK) && i + 1 < nr) sqe->flags |= IOSQE_IO_LINK;
+        ring->sq_array[tail & mask] = tail & mask;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    ring->sq_pending += nr;
+
+    // If the kernel can't take the SQEs right now (EAGAIN, EBUSY), they stay queued and the
+    // next asyncio_ring_wait() submits them.
+    while (ring->sq_pending > 0) {
+        int rc = io_uring_enter(ring->ring_fd, ring->sq_pending, 0, 0);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        ring->sq_pending -= rc;
+    }
+    return nr;
+}
+
+int UringWait(asyncio_ring* ring, asyncio_completion* completions, unsigned min_nr,
+              unsigned max_nr) {
+    unsigned count = 0;
+    while (true) {
+        unsigned head = *ring->cq_head;
+        const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        const unsigned mask = *ring->cq_mask;
+        for (; head != tail && count < max_nr; head++) {
+            const io_uring_cqe& cqe = ring->cqes[head & mask];
+            const unsigned index = cqe.user_data;
+            completions[count++] = {ring->slots[index].user_data, cqe.res};
+            ring->free_slots.push_back(index);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (count >= min_nr || count >= max_nr) break;
+        int rc = io_uring_enter(ring->ring_fd, ring->sq_pending, min_nr - count,
+                                IORING_ENTER_GETEVENTS);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            return count > 0 ? static_cast<int>(count) : -1;
+        }
+        ring->sq_pending -= rc;
+    }
+    return count;
+}
+
+#endif  // ASYNCIO_HAVE_IO_URING
+
+}  // namespace
+
+int asyncio_ring_setup(unsigned entries, unsigned flags, asyncio_ring** result) {
+    if (entries == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    asyncio_ring* ring = new asyncio_ring;
+    ring->slots.resize(entries);
+    for (unsigned i = entries; i > 0; i--) {
+        ring->free_slots.push_back(i - 1);
+    }
+
+#ifdef ASYNCIO_HAVE_IO_URING
+    // io_uring may be missing (ENOSYS) or blocked by policy (EPERM); use aio then.
+    if (!(flags & ASYNCIO_RING_FORCE_AIO)) {
+        if (UringSetup(ring, entries) == 0) {
+            ring->uring = true;
+            *result = ring;
+            return 0;
+        }
+        UringDestroy(ring);
+        ring->ring_fd = -1;
+        ring->sq_ring = ring->cq_ring = MAP_FAILED;
+        ring->sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+#else
+    (void)flags;
+#endif
+
+    if (io_setup(entries, &ring->aio_ctx) == -1) {
+        int saved_errno = errno;
+        delete ring;
+        errno = saved_errno;
+        return -1;
+    }
+    *result = ring;
+    return 0;
+}
+
+void asyncio_ring_destroy(asyncio_ring* ring) {
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ring->uring) {
+        UringDestroy(ring);
+        delete ring;
+        return;
+    }
+#endif
+    io_destroy(ring->aio_ctx);
+    delete ring;
+}
+
+bool asyncio_ring_is_uring(const asyncio_ring* ring) {
+    return ring->uring;
+}
+
+int asyncio_ring_register_buffers(asyncio_ring* ring, const iovec* iovecs, unsigned nr) {
+    if (!ring->buffers.empty()) {
+        errno = EBUSY;
+        return -1;
+    }
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ring->uring && io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, nr)) {
+        return -1;
+    }
+#endif
+    ring->buffers.assign(iovecs, iovecs + nr);
+    return 0;
+}
+
+int asyncio_ring_register_files(asyncio_ring* ring, const int* fds, unsigned nr) {
+    if (!ring->files.empty()) {
+        errno = EBUSY;
+        return -1;
+    }
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ring->uring && io_uring_register(ring->ring_fd, IORING_REGISTER_FILES, fds, nr)) {
+        return -1;
+    }
+#endif
+    ring->files.assign(fds, fds + nr);
+    return 0;
+}
+
+int asyncio_ring_submit(asyncio_ring* ring, const asyncio_op* ops, unsigned nr) {
+    for (unsigned i = 0; i < nr; i++) {
+        if ((ops[i].flags & ASYNCIO_OP_FIXED_BUFFER) && ops[i].buf_index >= ring->buffers.size()) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    nr = FitOps(ring, ops, nr);
+    if (nr == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ring->uring) return UringSubmit(ring, ops, nr);
+#endif
+    return AioSubmit(ring, ops, nr);
+}
+
+int asyncio_ring_wait(asyncio_ring* ring, asyncio_completion* completions, unsigned min_nr,
+                      unsigned max_nr) {
+    // Never wait for more ops than are outstanding.
+    const size_t outstanding = Outstanding(ring);
+    min_nr = std::min<size_t>({min_nr, max_nr, outstanding});
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ring->uring) return UringWait(ring, completions, min_nr, max_nr);
+#endif
+    return AioWait(ring, completions, min_nr, max_nr);
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIORing.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+static constexpr uint32_t kBlockSize = 4096;
+
+// Every test runs against io_uring and against the kernel aio fallback, which emulates links.
+class AsyncIORingTest : public ::testing::TestWithParam<bool> {
+  protected:
+    void SetUp() override { ASSERT_NO_FATAL_FAILURE(Setup(8)); }
+
+    void TearDown() override {
+        if (ring_ != nullptr) asyncio_ring_destroy(ring_);
+    }
+
+    bool force_aio() const { return GetParam(); }
+
+    void Setup(unsigned entries) {
+        if (ring_ != nullptr) asyncio_ring_destroy(ring_);
+        ring_ = nullptr;
+        ASSERT_EQ(0, asyncio_ring_setup(entries, force_aio() ? ASYNCIO_RING_FORCE_AIO : 0, &ring_))
+                << strerror(errno);
+        if (force_aio()) {
+            ASSERT_FALSE(asyncio_ring_is_uring(ring_));
+        } else if (!asyncio_ring_is_uring(ring_)) {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+    }
+
+    // Fills the file with |blocks| blocks, each filled with the letter of its index.
+    void FillFile(size_t blocks) {
+        for (size_t i = 0; i < blocks; i++) {
+            std::string block(kBlockSize, 'a' + i);
+            ASSERT_TRUE(android::base::WriteFully(file_.fd, block.data(), block.size()));
+        }
+    }
+
+    // Collects |nr| completions, keyed by user_data.
+    std::map<uint64_t, int32_t> Wait(unsigned nr) {
+        std::map<uint64_t, int32_t> results;
+        std::vector<asyncio_completion> completions(nr);
+        while (results.size() < nr) {
+            int rc = asyncio_ring_wait(ring_, completions.data(), 1, nr - results.size());
+            EXPECT_GT(rc, 0) << strerror(errno);
+            if (rc <= 0) break;
+            for (int i = 0; i < rc; i++) {
+                EXPECT_EQ(0u, results.count(completions[i].user_data));
+                results[completions[i].user_data] = completions[i].res;
+            }
+        }
+        return results;
+    }
+
+    // Nothing may be left over once a test has collected everything it submitted.
+    void ExpectIdle() {
+        asyncio_completion completion;
+        EXPECT_EQ(0, asyncio_ring_wait(ring_, &completion, 0, 1));
+    }
+
+    asyncio_op Read(uint64_t user_data, void* buf, int64_t offset, uint32_t flags = 0) {
+        return {.read = true, .flags = flags, .fd = file_.fd, .buf = buf, .count = kBlockSize,
+                .offset = offset, .buf_index = 0, .user_data = user_data};
+    }
+
+    asyncio_op Write(uint64_t user_data, void* buf, int64_t offset, uint32_t flags = 0) {
+        asyncio_op op = Read(user_data, buf, offset, flags);
+        op.read = false;
+        return op;
+    }
+
+    asyncio_ring* ring_ = nullptr;
+    TemporaryFile file_;
+};
+
+TEST_P(AsyncIORingTest, ReadWrite) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(2));
+    std::string out(kBlockSize, 'z');
+    std::string in(kBlockSize, '\0');
+    asyncio_op ops[] = {Write(1, out.data(), kBlockSize), Read(2, in.data(), 0)};
+    ASSERT_EQ(2, asyncio_ring_submit(ring_, ops, 2));
+    std::map<uint64_t, int32_t> expected = {{1, kBlockSize}, {2, kBlockSize}};
+    EXPECT_EQ(expected, Wait(2));
+    EXPECT_EQ(std::string(kBlockSize, 'a'), in);
+
+    ASSERT_TRUE(android::base::ReadFullyAtOffset(file_.fd, in.data(), in.size(), kBlockSize));
+    EXPECT_EQ(out, in);
+    ExpectIdle();
+}
+
+// A chain is run in order: the read sees what the write before it put in the file.
+TEST_P(AsyncIORingTest, LinkOrdersOps) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(1));
+    std::string out(kBlockSize, 'y');
+    std::string in(kBlockSize, '\0');
+    asyncio_op ops[] = {Write(1, out.data(), 0, ASYNCIO_OP_LINK), Read(2, in.data(), 0)};
+    ASSERT_EQ(2, asyncio_ring_submit(ring_, ops, 2));
+    std::map<uint64_t, int32_t> expected = {{1, kBlockSize}, {2, kBlockSize}};
+    EXPECT_EQ(expected, Wait(2));
+    EXPECT_EQ(out, in);
+    ExpectIdle();
+}
+
+// An op that fails outright cancels the rest of its chain, but not the ops after the chain.
+TEST_P(AsyncIORingTest, FailedLinkCancelsChain) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(1));
+    std::string buf[4];
+    for (auto& b : buf) b.resize(kBlockSize);
+    asyncio_op ops[] = {
+            Read(1, buf[0].data(), 0, ASYNCIO_OP_LINK),
+            Read(2, buf[1].data(), 0, ASYNCIO_OP_LINK),
+            Read(3, buf[2].data(), 0),
+            Read(4, buf[3].data(), 0),
+    };
+    ops[0].fd = -1;
+    ASSERT_EQ(4, asyncio_ring_submit(ring_, ops, 4));
+    std::map<uint64_t, int32_t> expected = {
+            {1, -EBADF}, {2, -ECANCELED}, {3, -ECANCELED}, {4, kBlockSize}};
+    EXPECT_EQ(expected, Wait(4));
+    ExpectIdle();
+}
+
+// A short transfer in the middle of a chain breaks it too.
+TEST_P(AsyncIORingTest, ShortLinkCancelsChain) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(1));
+    std::string buf[3];
+    for (auto& b : buf) b.resize(kBlockSize);
+    asyncio_op ops[] = {
+            Read(1, buf[0].data(), 0, ASYNCIO_OP_LINK),
+            Read(2, buf[1].data(), kBlockSize / 2, ASYNCIO_OP_LINK),
+            Read(3, buf[2].data(), 0),
+    };
+    ASSERT_EQ(3, asyncio_ring_submit(ring_, ops, 3));
+    std::map<uint64_t, int32_t> expected = {
+            {1, kBlockSize}, {2, kBlockSize / 2}, {3, -ECANCELED}};
+    EXPECT_EQ(expected, Wait(3));
+    ExpectIdle();
+}
+
+// A link flag on the last op of a submission doesn't join it to the next submission.
+TEST_P(AsyncIORingTest, LinkDoesNotSpanSubmissions) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(1));
+    std::string buf[2];
+    for (auto& b : buf) b.resize(kBlockSize);
+    asyncio_op first = Read(1, buf[0].data(), 0, ASYNCIO_OP_LINK);
+    first.fd = -1;
+    ASSERT_EQ(1, asyncio_ring_submit(ring_, &first, 1));
+    asyncio_op second = Read(2, buf[1].data(), 0);
+    ASSERT_EQ(1, asyncio_ring_submit(ring_, &second, 1));
+    std::map<uint64_t, int32_t> expected = {{1, -EBADF}, {2, kBlockSize}};
+    EXPECT_EQ(expected, Wait(2));
+    ExpectIdle();
+}
+
+TEST_P(AsyncIORingTest, FixedFilesAndBuffers) {
+    ASSERT_NO_FATAL_FAILURE(FillFile(2));
+    std::vector<char> buffer(2 * kBlockSize, 'x');
+    iovec iov = {buffer.data(), buffer.size()};
+    ASSERT_EQ(0, asyncio_ring_register_buffers(ring_, &iov, 1)) << strerror(errno);
+    ASSERT_EQ(0, asyncio_ring_register_files(ring_, &file_.fd, 1)) << strerror(errno);
+    EXPECT_EQ(-1, asyncio_ring_register_buffers(ring_, &iov, 1));
+    EXPECT_EQ(EBUSY, errno);
+
+    const uint32_t fixed = ASYNCIO_OP_FIXED_FILE | ASYNCIO_OP_FIXED_BUFFER;
+    asyncio_op ops[] = {
+            Write(1, buffer.data(), kBlockSize, fixed | ASYNCIO_OP_LINK),
+            Read(2, buffer.data() + kBlockSize, kBlockSize, fixed),
+    };
+    ops[0].fd = ops[1].fd = 0;
+    ASSERT_EQ(2, asyncio_ring_submit(ring_, ops, 2));
+    std::map<uint64_t, int32_t> expected = {{1, kBlockSize}, {2, kBlockSize}};
+    EXPECT_EQ(expected, Wait(2));
+    EXPECT_EQ(std::string(2 * kBlockSize, 'x'), std::string(buffer.begin(), buffer.end()));
+
+    // Unregistered indices are rejected: buffers when submitting, files with a completion.
+    asyncio_op bad_buffer = Read(3, buffer.data(), 0, fixed);
+    bad_buffer.fd = 0;
+    bad_buffer.buf_index = 1;
+    EXPECT_EQ(-1, asyncio_ring_submit(ring_, &bad_buffer, 1));
+    EXPECT_EQ(EINVAL, errno);
+
+    asyncio_op bad_file[] = {
+            Read(4, buffer.data(), 0, ASYNCIO_OP_FIXED_FILE | ASYNCIO_OP_LINK),
+            Read(5, buffer.data(), 0),
+    };
+    bad_file[0].fd = 1;
+    ASSERT_EQ(2, asyncio_ring_submit(ring_, bad_file, 2));
+    std::map<uint64_t, int32_t> expected_bad = {{4, -EBADF}, {5, -ECANCELED}};
+    EXPECT_EQ(expected_bad, Wait(2));
+    ExpectIdle();
+}
+
+// Submissions that don't fit are cut short between chains, never inside one.
+TEST_P(AsyncIORingTest, FitOpsKeepsChainsWhole) {
+    ASSERT_NO_FATAL_FAILURE(Setup(4));
+    ASSERT_NO_FATAL_FAILURE(FillFile(1));
+    std::vector<std::string> buf(5, std::string(kBlockSize, '\0'));
+    asyncio_op ops[] = {
+            Read(1, buf[0].data(), 0),
+            Read(2, buf[1].data(), 0, ASYNCIO_OP_LINK),
+            Read(3, buf[2].data(), 0, ASYNCIO_OP_LINK),
+            Read(4, buf[3].data(), 0, ASYNCIO_OP_LINK),
+            Read(5, buf[4].data(), 0),
+    };
+    // Only the first op fits next to a chain of four.
+    ASSERT_EQ(1, asyncio_ring_submit(ring_, ops, 5));
+    // The chain alone fits in the ring once it's empty, but not while the first op is pending.
+    EXPECT_EQ(-1, asyncio_ring_submit(ring_, ops + 1, 4));
+    EXPECT_EQ(EAGAIN, errno);
+    std::map<uint64_t, int32_t> expected = {{1, kBlockSize}};
+    EXPECT_EQ(expected, Wait(1));
+
+    ASSERT_EQ(4, asyncio_ring_submit(ring_, ops + 1, 4));
+    expected = {{2, kBlockSize}, {3, kBlockSize}, {4, kBlockSize}, {5, kBlockSize}};
+    EXPECT_EQ(expected, Wait(4));
+
+    // A chain longer than the ring never fits.
+    asyncio_op long_chain[5];
+    for (int i = 0; i < 5; i++) {
+        long_chain[i] = Read(10 + i, buf[i].data(), 0, i < 4 ? ASYNCIO_OP_LINK : 0);
+    }
+    EXPECT_EQ(-1, asyncio_ring_submit(ring_, long_chain, 5));
+    EXPECT_EQ(EAGAIN, errno);
+    ExpectIdle();
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AsyncIORingTest, ::testing::Values(false, true),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                             return info.param ? "Aio" : "IoUring";
+                         });
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIORing.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+static constexpr size_t kFileSize = 64 * 1024 * 1024;
+static constexpr uint32_t kBlockSize = 4096;
+static constexpr unsigned kQueueDepth = 32;
+
+enum Mode {
+    kAio,
+    kUring,
+    kUringFixed,
+};
+
+// Random 4K reads from a cached file, keeping kQueueDepth reads in flight.
+static void BM_RandomRead(benchmark::State& state) {
+    const Mode mode = static_cast<Mode>(state.range(0));
+
+    TemporaryFile tf;
+    std::vector<char> block(1024 * 1024, 'x');
+    for (size_t written = 0; written < kFileSize; written += block.size()) {
+        if (!android::base::WriteFully(tf.fd, block.data(), block.size())) {
+            state.SkipWithError("failed to fill file");
+            return;
+        }
+    }
+
+    asyncio_ring* ring;
+    if (asyncio_ring_setup(kQueueDepth, mode == kAio ? ASYNCIO_RING_FORCE_AIO : 0, &ring)) {
+        state.SkipWithError("asyncio_ring_setup failed");
+        return;
+    }
+    if (mode != kAio && !asyncio_ring_is_uring(ring)) {
+        asyncio_ring_destroy(ring);
+        state.SkipWithError("io_uring is not available");
+        return;
+    }
+
+    std::vector<char> buffer(kQueueDepth * kBlockSize);
+    uint32_t op_flags = 0;
+    if (mode == kUringFixed) {
+        iovec iov = {buffer.data(), buffer.size()};
+        int fd = tf.fd;
+        if (asyncio_ring_register_buffers(ring, &iov, 1) ||
+            asyncio_ring_register_files(ring, &fd, 1)) {
+            asyncio_ring_destroy(ring);
+            state.SkipWithError("registration failed");
+            return;
+        }
+        op_flags = ASYNCIO_OP_FIXED_BUFFER | ASYNCIO_OP_FIXED_FILE;
+    }
+
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int64_t> block_dist(0, kFileSize / kBlockSize - 1);
+    auto make_op = [&](unsigned slot) {
+        asyncio_op op = {};
+        op.read = true;
+        op.flags = op_flags;
+        op.fd = op_flags & ASYNCIO_OP_FIXED_FILE ? 0 : tf.fd;
+        op.buf = buffer.data() + slot * kBlockSize;
+        op.count = kBlockSize;
+        op.offset = block_dist(rng) * kBlockSize;
+        op.user_data = slot;
+        return op;
+    };
+
+    std::vector<asyncio_op> ops;
+    for (unsigned slot = 0; slot < kQueueDepth; slot++) {
+        ops.push_back(make_op(slot));
+    }
+    asyncio_ring_submit(ring, ops.data(), ops.size());
+
+    std::vector<asyncio_completion> completions(kQueueDepth);
+    int64_t reads = 0;
+    for (auto _ : state) {
+        int n = asyncio_ring_wait(ring, completions.data(), 1, completions.size());
+        if (n <= 0) {
+            state.SkipWithError("asyncio_ring_wait failed");
+            break;
+        }
+        ops.clear();
+        for (int i = 0; i < n; i++) {
+            if (completions[i].res != static_cast<int32_t>(kBlockSize)) {
+                state.SkipWithError("short read");
+            }
+            ops.push_back(make_op(completions[i].user_data));
+        }
+        asyncio_ring_submit(ring, ops.data(), ops.size());
+        reads += n;
+    }
+
+    while (asyncio_ring_wait(ring, completions.data(), kQueueDepth, kQueueDepth) > 0) {
+    }
+    asyncio_ring_destroy(ring);
+
+    state.SetBytesProcessed(reads * kBlockSize);
+    state.counters["IOPS"] = benchmark::Counter(reads, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_RandomRead)->ArgName("mode")->Arg(kAio)->Arg(kUring)->Arg(kUringFixed);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ASYNCIO_RING_H
+#define _ASYNCIO_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A queue of file reads and writes, backed by io_uring where the kernel supports it and
+ * allows it, and by kernel aio (see AsyncIO.h) otherwise. Unlike kernel aio, io_uring is
+ * asynchronous for buffered files too.
+ *
+ * A ring is not thread-safe. All functions return -1 and set errno on failure.
+ */
+struct asyncio_ring;
+
+/* Flags for asyncio_ring_setup(). */
+#define ASYNCIO_RING_FORCE_AIO (1U << 0) /* Use kernel aio even if io_uring is available. */
+
+/* Flags for struct asyncio_op. */
+#define ASYNCIO_OP_FIXED_FILE (1U << 0)   /* |fd| is an index into the registered files. */
+#define ASYNCIO_OP_FIXED_BUFFER (1U << 1) /* |buf| lies within registered buffer |buf_index|. */
+/*
+ * The next op in the same asyncio_ring_submit() call only starts once this one has
+ * transferred all |count| bytes. Otherwise the rest of the chain completes with -ECANCELED.
+ */
+#define ASYNCIO_OP_LINK (1U << 2)
+
+struct asyncio_op {
+    bool read;
+    uint32_t flags;
+    int fd;
+    void* buf;
+    uint32_t count;
+    int64_t offset;
+    uint16_t buf_index;
+    uint64_t user_data;
+};
+
+struct asyncio_completion {
+    uint64_t user_data;
+    int32_t res; /* Bytes transferred, or -errno. */
+};
+
+/* Creates a ring that can have up to |entries| ops in flight. */
+int asyncio_ring_setup(unsigned entries, unsigned flags, struct asyncio_ring** ring);
+void asyncio_ring_destroy(struct asyncio_ring* ring);
+
+/* Whether |ring| is backed by io_uring rather than kernel aio. */
+bool asyncio_ring_is_uring(const struct asyncio_ring* ring);
+
+/*
+ * Registers buffers and files for ASYNCIO_OP_FIXED_BUFFER and ASYNCIO_OP_FIXED_FILE. With
+ * io_uring, this saves mapping them on every op. Each can only be done once per ring.
+ */
+int asyncio_ring_register_buffers(struct asyncio_ring* ring, const struct iovec* iovecs,
+                                  unsigned nr);
+int asyncio_ring_register_files(struct asyncio_ring* ring, const int* fds, unsigned nr);
+
+/*
+ * Submits |nr| ops with a single system call where possible. Returns the number of ops
+ * queued, which is less than |nr| if the ring is full, but never splits a linked chain.
+ * An op that the kernel rejects still produces a completion with the error.
+ */
+int asyncio_ring_submit(struct asyncio_ring* ring, const struct asyncio_op* ops, unsigned nr);
+
+/*
+ * Waits for at least |min_nr| ops to complete and returns up to |max_nr| of them. A
+ * |min_nr| of 0 only collects ops that have already completed.
+ */
+int asyncio_ring_wait(struct asyncio_ring* ring, struct asyncio_completion* completions,
+                      unsigned min_nr, unsigned max_nr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif  // _ASYNCIO_RING_H
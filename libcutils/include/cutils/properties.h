@@ -112,6 +112,23 @@ int property_set(const char *key, const char *value);
 
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
+/* property_batch_*: sets several properties over a single connection to the
+** property service, rather than opening a new connection for every property.
+**
+** property_batch_set() queues a request and only blocks while too many results
+** are outstanding.  Requests are applied in the order in which they are queued.
+** property_batch_finish() waits for all outstanding results, releases the batch
+** and returns 0 if every property was set, or the number of failed requests.
+**
+** If the property service doesn't support batching, the requests fall back to
+** property_set().  property_batch_start() returns NULL on allocation failure.
+*/
+typedef struct property_batch property_batch_t;
+
+property_batch_t* property_batch_start(void);
+int property_batch_set(property_batch_t* batch, const char* key, const char* value);
+int property_batch_finish(property_batch_t* batch);
+
 #if defined(__BIONIC_FORTIFY)
 #define __property_get_err_str "property_get() called with too small of a buffer"
 
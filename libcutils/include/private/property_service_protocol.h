@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Extensions to the property service protocol of <sys/_system_properties.h>, shared between init
+ * and the clients in libcutils.
+ *
+ * PROP_MSG_SETPROP_PIPELINED switches a connection to pipelined mode.  init replies with a single
+ * uint32_t, PROP_SUCCESS if it supports the mode (older versions reply PROP_ERROR_INVALID_CMD).
+ * The client then sends any number of requests, each encoded as for PROP_MSG_SETPROP2:
+ *
+ *     uint32_t name_length, char name[name_length], uint32_t value_length, char value[value_length]
+ *
+ * init sends back one uint32_t result per request, in order, and closes the connection once the
+ * client has shut down its side of the socket.  The credentials and SELinux context of the client
+ * are resolved once, when the connection is switched to pipelined mode.
+ */
+#define PROP_MSG_SETPROP_PIPELINED 0x00030001
+
+/* The maximum length of a name or value in a pipelined request. */
+#define PROP_PIPELINED_MAX_LENGTH 0xffff
@@ -93,6 +93,15 @@ int property_get(const char* key, char* value, const char* default_value) {
 
 #if __has_include(<sys/system_properties.h>)
 
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <new>
+#include <string>
+
+#include <android-base/unique_fd.h>
+#include <private/property_service_protocol.h>
+
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
@@ -115,4 +124,116 @@ int property_list(void (*fn)(const char* name, const char* value, void* cookie),
     return __system_property_foreach(property_list_callback, &data);
 }
 
+// The number of requests that may be outstanding before property_batch_set() reads back results.
+static constexpr size_t kMaxInFlightRequests = 64;
+
+struct property_batch {
+    // Not valid if the property service doesn't support pipelining.
+    android::base::unique_fd fd;
+    size_t in_flight = 0;
+    int failures = 0;
+};
+
+static bool SendFully(int fd, const void* data, size_t size) {
+    auto p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(send(fd, p, size, MSG_NOSIGNAL));
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool RecvUint32(int fd, uint32_t* value) {
+    return TEMP_FAILURE_RETRY(recv(fd, value, sizeof(*value), MSG_WAITALL)) == sizeof(*value);
+}
+
+static android::base::unique_fd ConnectPipelined() {
+    android::base::unique_fd fd(socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd == -1) return {};
+
+    sockaddr_un addr = {.sun_family = AF_LOCAL};
+    strlcpy(addr.sun_path, PROP_SERVICE_NAME, sizeof(addr.sun_path));
+    if (TEMP_FAILURE_RETRY(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) != 0) {
+        return {};
+    }
+
+    uint32_t cmd = PROP_MSG_SETPROP_PIPELINED;
+    uint32_t result;
+    if (!SendFully(fd, &cmd, sizeof(cmd)) || !RecvUint32(fd, &result) || result != PROP_SUCCESS) {
+        return {};
+    }
+    return fd;
+}
+
+static void DropConnection(property_batch_t* batch) {
+    // Results that were never received count as failures.
+    batch->failures += batch->in_flight;
+    batch->in_flight = 0;
+    batch->fd.reset();
+}
+
+static void ReadResult(property_batch_t* batch) {
+    uint32_t result;
+    if (!RecvUint32(batch->fd, &result)) {
+        DropConnection(batch);
+        return;
+    }
+    if (result != PROP_SUCCESS) batch->failures++;
+    batch->in_flight--;
+}
+
+property_batch_t* property_batch_start() {
+    auto batch = new (std::nothrow) property_batch;
+    if (batch != nullptr) batch->fd = ConnectPipelined();
+    return batch;
+}
+
+int property_batch_set(property_batch_t* batch, const char* key, const char* value) {
+    if (!batch->fd.ok()) {
+        int rc = property_set(key, value);
+        if (rc != 0) batch->failures++;
+        return rc;
+    }
+
+    uint32_t key_length = strlen(key);
+    uint32_t value_length = strlen(value);
+    if (key_length > PROP_PIPELINED_MAX_LENGTH || value_length > PROP_PIPELINED_MAX_LENGTH) {
+        batch->failures++;
+        return -1;
+    }
+
+    std::string request;
+    request.reserve(2 * sizeof(uint32_t) + key_length + value_length);
+    request.append(reinterpret_cast<const char*>(&key_length), sizeof(key_length));
+    request.append(key, key_length);
+    request.append(reinterpret_cast<const char*>(&value_length), sizeof(value_length));
+    request.append(value, value_length);
+    if (!SendFully(batch->fd, request.data(), request.size())) {
+        DropConnection(batch);
+        batch->failures++;
+        return -1;
+    }
+
+    batch->in_flight++;
+    while (batch->fd.ok() && batch->in_flight >= kMaxInFlightRequests) {
+        ReadResult(batch);
+    }
+    return 0;
+}
+
+int property_batch_finish(property_batch_t* batch) {
+    if (batch->fd.ok()) {
+        shutdown(batch->fd, SHUT_WR);
+        while (batch->fd.ok() && batch->in_flight > 0) {
+            ReadResult(batch);
+        }
+    }
+
+    int failures = batch->failures;
+    delete batch;
+    return failures;
+}
+
 #endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/stats_event_list.h"
+#include "statsd_writer.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+using android::base::unique_fd;
+
+// Stands in for statsd, reading and discarding events as fast as it can.
+class FakeStatsd {
+  public:
+    FakeStatsd() {
+        path_ = dir_.path + std::string("/statsdw");
+        fd_.reset(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+        sockaddr_un addr = {.sun_family = AF_UNIX};
+        strlcpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path));
+        bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        int rcvbuf = 4 * 1024 * 1024;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        reader_ = std::thread([this] {
+            static constexpr size_t kBatch = 64;
+            static char bufs[kBatch][4096];
+            iovec iovs[kBatch];
+            mmsghdr msgs[kBatch] = {};
+            for (size_t i = 0; i < kBatch; i++) {
+                iovs[i] = {bufs[i], sizeof(bufs[i])};
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            while (recvmmsg(fd_, msgs, kBatch, MSG_WAITFORONE, nullptr) >= 0) {
+            }
+        });
+        reader_.detach();
+    }
+
+    const char* path() const { return path_.c_str(); }
+
+  private:
+    TemporaryDir dir_;
+    std::string path_;
+    unique_fd fd_;
+    std::thread reader_;
+};
+
+// Writes a small atom, as generated statslog code does for a few int fields. Arg 0 is the
+// batch size, with 0 meaning one write per event.
+static void BM_WriteEvent(benchmark::State& state) {
+    static FakeStatsd* statsd = new FakeStatsd;
+    stats_log_close();
+    statsd_writer_set_socket_path(statsd->path());
+    stats_log_enable_batching(state.range(0), 10);
+
+    int32_t tag = 1000;
+    uint8_t payload[24] = {};
+    iovec vec[2] = {{&tag, sizeof(tag)}, {payload, sizeof(payload)}};
+    int64_t written = 0;
+    int64_t dropped = 0;
+    for (auto _ : state) {
+        if (write_to_statsd(vec, 2) > 0) {
+            written++;
+        } else {
+            dropped++;
+        }
+    }
+    stats_log_enable_batching(0, 0);
+    stats_log_close();
+
+    state.counters["events"] = benchmark::Counter(written, benchmark::Counter::kIsRate);
+    state.counters["dropped"] = dropped;
+}
+BENCHMARK(BM_WriteEvent)->Arg(0)->Arg(16)->Arg(64)->UseRealTime();
+
+BENCHMARK_MAIN();
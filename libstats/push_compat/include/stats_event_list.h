@@ -26,6 +26,15 @@ void reset_log_context(android_log_context ctx);
 int write_to_logger(android_log_context context, log_id_t id);
 void note_log_drop(int error, int atom_tag);
 void stats_log_close();
+/*
+ * Batch pushed atoms: queue them in memory and send up to |batch_size| of them with one
+ * system call, at most |flush_delay_ms| after they were written. Writes fail with -EAGAIN
+ * once the queue is full. |flush_delay_ms| must be at least 1. A |batch_size| of 0 turns
+ * batching off again.
+ */
+int stats_log_enable_batching(size_t batch_size, unsigned flush_delay_ms);
+/* Send batched atoms now. */
+int stats_log_flush();
 int android_log_write_char_array(android_log_context ctx, const char* value, size_t len);
 extern int (*write_to_statsd)(struct iovec* vec, size_t nr);
 
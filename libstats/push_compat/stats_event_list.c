@@ -124,7 +124,16 @@ void note_log_drop(int error, int tag) {
     statsdLoggerWrite.noteDrop(error, tag);
 }
 
+int stats_log_enable_batching(size_t batch_size, unsigned flush_delay_ms) {
+    return statsd_writer_enable_batching(batch_size, flush_delay_ms);
+}
+
+int stats_log_flush() {
+    return statsd_writer_flush();
+}
+
 void stats_log_close() {
+    statsd_writer_flush();
     statsd_writer_init_lock();
     write_to_statsd = __write_to_statsd_init;
     if (statsdLoggerWrite.close) {
@@ -26,9 +26,11 @@
 #include <private/android_logger.h>
 #include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -40,6 +42,8 @@ static pthread_mutex_t log_init_lock = PTHREAD_MUTEX_INITIALIZER;
 static atomic_int dropped = 0;
 static atomic_int log_error = 0;
 static atomic_int atom_tag = 0;
+static atomic_uint_fast64_t total_dropped = 0;
+static const char* socket_path = "/dev/socket/statsdw";
 
 void statsd_writer_init_lock() {
     /*
@@ -62,6 +66,7 @@ static int statsdOpen();
 static void statsdClose();
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr);
 static void statsdNoteDrop();
+static int statsdBatchEnqueue(struct timespec* ts, struct iovec* vec, size_t nr);
 
 struct android_log_transport_write statsdLoggerWrite = {
         .name = "statsd",
@@ -98,7 +103,7 @@ static int statsdOpen() {
             struct sockaddr_un un;
             memset(&un, 0, sizeof(struct sockaddr_un));
             un.sun_family = AF_UNIX;
-            strcpy(un.sun_path, "/dev/socket/statsdw");
+            strlcpy(un.sun_path, socket_path, sizeof(un.sun_path));
 
             if (TEMP_FAILURE_RETRY(
                         connect(sock, (struct sockaddr*)&un, sizeof(struct sockaddr_un))) < 0) {
@@ -139,7 +144,7 @@ static void statsdClose() {
 
 static int statsdAvailable() {
     if (atomic_load(&statsdLoggerWrite.sock) < 0) {
-        if (access("/dev/socket/statsdw", W_OK) == 0) {
+        if (access(socket_path, W_OK) == 0) {
             return 0;
         }
         return -EBADF;
@@ -149,10 +154,32 @@ static int statsdAvailable() {
 
 static void statsdNoteDrop(int error, int tag) {
     atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total_dropped, 1, memory_order_relaxed);
     atomic_exchange_explicit(&log_error, error, memory_order_relaxed);
     atomic_exchange_explicit(&atom_tag, tag, memory_order_relaxed);
 }
 
+/*
+ * Fills |buffer| with an event reporting the drops noted since the last report and returns
+ * their number, or returns 0 if there were none. If the report can't be sent, the caller
+ * gives the count back to |dropped|.
+ */
+static int32_t statsdTakeDropReport(android_log_event_long_t* buffer) {
+    int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (snapshot) {
+        // store the last log error in the tag field. This tag field is not used by statsd.
+        buffer->header.tag = atomic_load(&log_error);
+        buffer->payload.type = EVENT_TYPE_LONG;
+        // format:
+        // |atom_tag|dropped_count|
+        int64_t composed_long = atomic_load(&atom_tag);
+        // Send 2 int32's via an int64.
+        composed_long = ((composed_long << 32) | ((int64_t)snapshot));
+        buffer->payload.data = composed_long;
+    }
+    return snapshot;
+}
+
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     ssize_t ret;
     int sock;
@@ -161,6 +188,11 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     android_log_header_t header;
     size_t i, payloadSize;
 
+    ret = statsdBatchEnqueue(ts, vec, nr);
+    if (ret != -ENOTSUP) {
+        return ret;
+    }
+
     sock = atomic_load(&statsdLoggerWrite.sock);
     if (sock < 0) switch (sock) {
             case -ENOTCONN:
@@ -197,20 +229,10 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     // If we dropped events before, try to tell statsd.
     if (sock >= 0) {
-        int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+        android_log_event_long_t buffer;
+        int32_t snapshot = statsdTakeDropReport(&buffer);
         if (snapshot) {
-            android_log_event_long_t buffer;
             header.id = LOG_ID_STATS;
-            // store the last log error in the tag field. This tag field is not used by statsd.
-            buffer.header.tag = atomic_load(&log_error);
-            buffer.payload.type = EVENT_TYPE_LONG;
-            // format:
-            // |atom_tag|dropped_count|
-            int64_t composed_long = atomic_load(&atom_tag);
-            // Send 2 int32's via an int64.
-            composed_long = ((composed_long << 32) | ((int64_t)snapshot));
-            buffer.payload.data = composed_long;
-
             newVec[headerLength].iov_base = &buffer;
             newVec[headerLength].iov_len = sizeof(buffer);
 
@@ -283,3 +305,389 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     return ret;
 }
+
+/*
+ * Batching.
+ *
+ * Once batching is enabled, statsdWrite() copies each event into a bounded lock-free ring
+ * instead of writing it to the socket. Any number of threads can write: a per-slot sequence
+ * number says whether a slot is free for the writer that claimed its position, or holds an
+ * event for the flusher. A flusher thread sends the queued events with sendmmsg() once
+ * batch_size of them are waiting, or flush_delay_ms after the first of them was queued. Each
+ * event is still its own datagram, so statsd sees the same messages as before. While nothing
+ * is queued the flusher sleeps without a timeout, and once batching is turned off again it
+ * sends what is left and exits.
+ *
+ * Writers never block or take a lock, so logging from a signal handler stays safe. If the
+ * ring is full the write fails with -EAGAIN, as it would for a full socket. If statsd is
+ * slow, queued events wait for the socket to drain rather than being dropped.
+ */
+
+#define STATSD_BATCH_SLOTS 256 /* must be a power of two */
+#define STATSD_BATCH_SLOT_PAYLOAD 512
+#define STATSD_BATCH_MAX_SEND 64
+
+struct statsd_batch_slot {
+    atomic_size_t seq;
+    int32_t tag;
+    size_t len;
+    uint8_t data[sizeof(android_log_header_t) + STATSD_BATCH_SLOT_PAYLOAD];
+};
+
+struct statsd_batch {
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos; /* written with flush_lock held */
+    atomic_bool wake_pending;
+    int event_fd;
+    pthread_mutex_t flush_lock;
+    struct statsd_batch_slot slots[STATSD_BATCH_SLOTS];
+};
+
+/* Created once, with log_init_lock held, and never freed. */
+static struct statsd_batch* batch;
+static bool batch_flusher_running;
+static atomic_bool batching = false;
+static atomic_size_t batch_size = 0;
+static atomic_uint flush_delay_ms = 0;
+
+static void statsdBatchReset() {
+    for (size_t i = 0; i < STATSD_BATCH_SLOTS; i++) {
+        atomic_init(&batch->slots[i].seq, i);
+    }
+    atomic_init(&batch->enqueue_pos, 0);
+    atomic_init(&batch->dequeue_pos, 0);
+    atomic_init(&batch->wake_pending, false);
+    pthread_mutex_init(&batch->flush_lock, NULL);
+}
+
+/* The child has no flusher, and must not send what the parent had queued. */
+static void statsdBatchAtforkChild() {
+    atomic_store(&batching, false);
+    batch_flusher_running = false;
+    close(batch->event_fd);
+    batch->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    statsdBatchReset();
+}
+
+static int statsdBatchEnqueue(struct timespec* ts, struct iovec* vec, size_t nr) {
+    if (!atomic_load_explicit(&batching, memory_order_acquire)) {
+        return -ENOTSUP;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < nr; i++) {
+        len += vec[i].iov_len;
+    }
+    if (len > STATSD_BATCH_SLOT_PAYLOAD) {
+        return -ENOTSUP; /* rare; written straight to the socket */
+    }
+
+    struct statsd_batch_slot* slot;
+    size_t pos = atomic_load_explicit(&batch->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        slot = &batch->slots[pos & (STATSD_BATCH_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&batch->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -EAGAIN;
+        } else {
+            pos = atomic_load_explicit(&batch->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    android_log_header_t header;
+    header.id = LOG_ID_STATS;
+    header.tid = gettid();
+    header.realtime.tv_sec = ts->tv_sec;
+    header.realtime.tv_nsec = ts->tv_nsec;
+    memcpy(slot->data, &header, sizeof(header));
+    uint8_t* p = slot->data + sizeof(header);
+    for (size_t i = 0; i < nr; i++) {
+        memcpy(p, vec[i].iov_base, vec[i].iov_len);
+        p += vec[i].iov_len;
+    }
+    slot->len = p - slot->data;
+    slot->tag = 0;
+    if (nr > 0 && vec[0].iov_len >= sizeof(slot->tag)) {
+        memcpy(&slot->tag, vec[0].iov_base, sizeof(slot->tag));
+    }
+    // Sequentially consistent, paired with statsdBatchRelease() and statsdBatchDrainLocked():
+    // either the flusher sees this event, or we see that the ring was empty and wake it.
+    atomic_store(&slot->seq, pos + 1);
+
+    // The first event arms the flush timer, and a full batch is sent right away.
+    size_t queued = pos + 1 - atomic_load(&batch->dequeue_pos);
+    if ((queued == 1 || queued >= atomic_load_explicit(&batch_size, memory_order_relaxed)) &&
+        !atomic_exchange(&batch->wake_pending, true)) {
+        uint64_t one = 1;
+        TEMP_FAILURE_RETRY(write(batch->event_fd, &one, sizeof(one)));
+    }
+    return len;
+}
+
+/* flush_lock assumed. Frees the first |count| queued slots, noting them as dropped if
+ * |error| is set. */
+static void statsdBatchRelease(size_t count, int error) {
+    size_t pos = atomic_load_explicit(&batch->dequeue_pos, memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        struct statsd_batch_slot* slot = &batch->slots[(pos + i) & (STATSD_BATCH_SLOTS - 1)];
+        if (error) {
+            statsdNoteDrop(-error, slot->tag);
+        }
+        atomic_store_explicit(&slot->seq, pos + i + STATSD_BATCH_SLOTS, memory_order_release);
+    }
+    atomic_store(&batch->dequeue_pos, pos + count);
+}
+
+/* Number of events queued, or being queued, that the flusher hasn't sent yet. */
+static size_t statsdBatchQueued() {
+    return atomic_load(&batch->enqueue_pos) - atomic_load(&batch->dequeue_pos);
+}
+
+static int statsdBatchSocket() {
+    int sock = atomic_load(&statsdLoggerWrite.sock);
+    if (sock >= 0) {
+        return sock;
+    }
+    statsd_writer_init_lock();
+    int ret = statsdOpen();
+    statsd_writer_init_unlock();
+    return ret < 0 ? ret : atomic_load(&statsdLoggerWrite.sock);
+}
+
+/* flush_lock assumed. Returns -EAGAIN if the socket filled up with events still queued. */
+static int statsdBatchDrainLocked() {
+    struct mmsghdr msgs[STATSD_BATCH_MAX_SEND + 1];
+    struct iovec iovs[STATSD_BATCH_MAX_SEND + 2];
+    bool reconnected = false;
+
+    for (;;) {
+        size_t start = atomic_load_explicit(&batch->dequeue_pos, memory_order_relaxed);
+        size_t n = 0;
+        while (n < STATSD_BATCH_MAX_SEND) {
+            struct statsd_batch_slot* slot =
+                    &batch->slots[(start + n) & (STATSD_BATCH_SLOTS - 1)];
+            if (atomic_load(&slot->seq) != start + n + 1) {
+                break;
+            }
+            n++;
+        }
+        if (n == 0) {
+            return 0;
+        }
+
+        int sock = statsdBatchSocket();
+        if (sock < 0) {
+            statsdBatchRelease(n, -sock);
+            continue;
+        }
+
+        // If we dropped events before, try to tell statsd first.
+        memset(msgs, 0, sizeof(msgs));
+        size_t m = 0;
+        android_log_header_t report_header;
+        android_log_event_long_t report;
+        int32_t report_count = statsdTakeDropReport(&report);
+        if (report_count) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            report_header.id = LOG_ID_STATS;
+            report_header.tid = gettid();
+            report_header.realtime.tv_sec = ts.tv_sec;
+            report_header.realtime.tv_nsec = ts.tv_nsec;
+            iovs[0].iov_base = &report_header;
+            iovs[0].iov_len = sizeof(report_header);
+            iovs[1].iov_base = &report;
+            iovs[1].iov_len = sizeof(report);
+            msgs[0].msg_hdr.msg_iov = &iovs[0];
+            msgs[0].msg_hdr.msg_iovlen = 2;
+            m = 1;
+        }
+        for (size_t i = 0; i < n; i++, m++) {
+            struct statsd_batch_slot* slot =
+                    &batch->slots[(start + i) & (STATSD_BATCH_SLOTS - 1)];
+            iovs[m + 1].iov_base = slot->data;
+            iovs[m + 1].iov_len = slot->len;
+            msgs[m].msg_hdr.msg_iov = &iovs[m + 1];
+            msgs[m].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = TEMP_FAILURE_RETRY(sendmmsg(sock, msgs, m, 0));
+        int error = sent < 0 ? errno : 0;
+        if (sent < 0) {
+            sent = 0;
+        }
+        if (report_count) {
+            if (sent == 0) {
+                atomic_fetch_add_explicit(&dropped, report_count, memory_order_relaxed);
+            } else {
+                sent--;
+            }
+        }
+        if (sent > 0 || error == 0) {
+            // A partial send reports the error for the next message on the next call.
+            statsdBatchRelease(sent, 0);
+            continue;
+        }
+
+        switch (error) {
+            case EAGAIN:
+                return -EAGAIN;
+            case ENOTCONN:
+            case ECONNREFUSED:
+            case ENOENT:
+                __statsdClose(-error);
+                if (!reconnected) {
+                    reconnected = true;
+                    continue;
+                }
+            /* FALLTHRU */
+            default:
+                statsdBatchRelease(1, error);
+                break;
+        }
+    }
+}
+
+static uint64_t statsdMonotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Called once batching is off and nothing is queued. Returns false if it was turned back on. */
+static bool statsdBatchFlusherExit() {
+    statsd_writer_init_lock();
+    bool exit = !atomic_load(&batching);
+    if (exit) {
+        batch_flusher_running = false;
+    }
+    statsd_writer_init_unlock();
+    return exit;
+}
+
+static void* statsdBatchFlusher(void* arg) {
+    (void)arg;
+    bool socket_full = false;
+    bool armed = false;
+    uint64_t deadline_ms = 0;
+    for (;;) {
+        size_t queued = statsdBatchQueued();
+        if (!atomic_load(&batching) && queued == 0 && statsdBatchFlusherExit()) {
+            return NULL;
+        }
+
+        struct pollfd pfd = {.fd = batch->event_fd, .events = POLLIN};
+        int timeout = -1; /* nothing queued: sleep until the first event wakes us */
+        if (socket_full) {
+            pfd.fd = atomic_load(&statsdLoggerWrite.sock);
+            pfd.events = POLLOUT;
+            timeout = atomic_load(&flush_delay_ms);
+        } else if (queued > 0) {
+            uint64_t now = statsdMonotonicMs();
+            if (!armed) {
+                deadline_ms = now + atomic_load(&flush_delay_ms);
+                armed = true;
+            }
+            timeout = deadline_ms > now ? deadline_ms - now : 0;
+        }
+        poll(&pfd, 1, timeout);
+        if (!socket_full && (pfd.revents & POLLIN)) {
+            uint64_t count;
+            TEMP_FAILURE_RETRY(read(batch->event_fd, &count, sizeof(count)));
+        }
+        atomic_store(&batch->wake_pending, false);
+
+        // Wait for a full batch or the deadline, unless batching was just turned off.
+        if (!socket_full && atomic_load(&batching) &&
+            statsdBatchQueued() < atomic_load(&batch_size) &&
+            (!armed || statsdMonotonicMs() < deadline_ms)) {
+            continue;
+        }
+
+        pthread_mutex_lock(&batch->flush_lock);
+        socket_full = statsdBatchDrainLocked() == -EAGAIN;
+        pthread_mutex_unlock(&batch->flush_lock);
+        armed = false;
+    }
+}
+
+int statsd_writer_enable_batching(size_t max_batch, unsigned max_delay_ms) {
+    if (max_batch == 0) {
+        atomic_store(&batching, false);
+        statsd_writer_flush();
+        // Let the flusher send whatever raced with the flush above, and exit.
+        statsd_writer_init_lock();
+        if (batch_flusher_running) {
+            uint64_t one = 1;
+            TEMP_FAILURE_RETRY(write(batch->event_fd, &one, sizeof(one)));
+        }
+        statsd_writer_init_unlock();
+        return 0;
+    }
+    if (max_delay_ms == 0) {
+        return -EINVAL; /* the flusher would spin */
+    }
+
+    statsd_writer_init_lock();
+    if (!batch) {
+        batch = calloc(1, sizeof(*batch));
+        if (!batch) {
+            statsd_writer_init_unlock();
+            return -ENOMEM;
+        }
+        batch->event_fd = -1;
+        statsdBatchReset();
+        pthread_atfork(NULL, NULL, statsdBatchAtforkChild);
+    }
+    if (batch->event_fd < 0) {
+        batch->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (batch->event_fd < 0) {
+            int ret = -errno;
+            statsd_writer_init_unlock();
+            return ret;
+        }
+    }
+    atomic_store(&batch_size, max_batch < STATSD_BATCH_SLOTS ? max_batch : STATSD_BATCH_SLOTS);
+    atomic_store(&flush_delay_ms, max_delay_ms);
+    if (!batch_flusher_running) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, statsdBatchFlusher, NULL);
+        if (ret) {
+            statsd_writer_init_unlock();
+            return -ret;
+        }
+        pthread_setname_np(thread, "statsd_flusher");
+        pthread_detach(thread);
+        batch_flusher_running = true;
+    }
+    atomic_store_explicit(&batching, true, memory_order_release);
+    statsd_writer_init_unlock();
+    return 0;
+}
+
+int statsd_writer_flush() {
+    statsd_writer_init_lock();
+    struct statsd_batch* b = batch;
+    statsd_writer_init_unlock();
+    if (!b) {
+        return 0;
+    }
+    pthread_mutex_lock(&b->flush_lock);
+    int ret = statsdBatchDrainLocked();
+    pthread_mutex_unlock(&b->flush_lock);
+    return ret;
+}
+
+uint64_t statsd_writer_dropped_count() {
+    return atomic_load_explicit(&total_dropped, memory_order_relaxed);
+}
+
+void statsd_writer_set_socket_path(const char* path) {
+    socket_path = path;
+}
@@ -19,8 +19,14 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Internal lock should not be exposed. This is bad design.
  * TODO: rewrite it in c++ code and encapsulate the functionality in a
@@ -30,6 +36,19 @@ void statsd_writer_init_lock();
 int statsd_writer_init_trylock();
 void statsd_writer_init_unlock();
 
+/*
+ * Queue events and send them with sendmmsg() once |max_batch| are waiting or after
+ * |max_delay_ms|, which must not be 0. A |max_batch| of 0 switches back to one write per
+ * event and stops the flusher thread. Returns 0 or -errno.
+ */
+int statsd_writer_enable_batching(size_t max_batch, unsigned max_delay_ms);
+/* Send queued events now. Returns -EAGAIN if statsd can't take them all yet. */
+int statsd_writer_flush();
+/* Number of events noted as dropped since the process started. */
+uint64_t statsd_writer_dropped_count();
+/* For tests: connect to |path| instead of /dev/socket/statsdw. */
+void statsd_writer_set_socket_path(const char* path);
+
 struct android_log_transport_write {
     const char* name; /* human name to describe the transport */
     atomic_int sock;
@@ -42,4 +61,8 @@ struct android_log_transport_write {
     void (*noteDrop)(int error, int tag);
 };
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // ANDROID_STATS_LOG_STATS_WRITER_H
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/stats_event_list.h"
+#include "statsd_writer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <private/android_logger.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+using android::base::unique_fd;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr int32_t kTag = 1000;
+
+// Stands in for statsd: a datagram socket bound to a temporary path.
+class FakeStatsd {
+  public:
+    FakeStatsd() : path_(dir_.path + std::string("/statsdw")) {
+        fd_.reset(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+        sockaddr_un addr = {.sun_family = AF_UNIX};
+        strlcpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path));
+        bound_ = fd_ != -1 && bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    }
+
+    bool bound() const { return bound_; }
+    const char* path() const { return path_.c_str(); }
+
+    // Returns the next message, or an empty string if none arrives in |timeout_ms|.
+    std::string Receive(int timeout_ms) {
+        pollfd pfd = {.fd = fd_.get(), .events = POLLIN};
+        if (poll(&pfd, 1, timeout_ms) != 1) return "";
+        char buf[LOGGER_ENTRY_MAX_PAYLOAD + sizeof(android_log_header_t)];
+        ssize_t n = TEMP_FAILURE_RETRY(recv(fd_, buf, sizeof(buf), 0));
+        return n > 0 ? std::string(buf, n) : "";
+    }
+
+  private:
+    TemporaryDir dir_;
+    std::string path_;
+    unique_fd fd_;
+    bool bound_;
+};
+
+int WriteEvent(int32_t tag, uint64_t value) {
+    iovec vec[2] = {{&tag, sizeof(tag)}, {&value, sizeof(value)}};
+    return write_to_statsd(vec, 2);
+}
+
+bool IsEvent(const std::string& msg, uint64_t* value) {
+    if (msg.size() != sizeof(android_log_header_t) + sizeof(int32_t) + sizeof(uint64_t)) {
+        return false;
+    }
+    android_log_header_t header;
+    int32_t tag;
+    memcpy(&header, msg.data(), sizeof(header));
+    memcpy(&tag, msg.data() + sizeof(header), sizeof(tag));
+    memcpy(value, msg.data() + sizeof(header) + sizeof(tag), sizeof(*value));
+    return header.id == LOG_ID_STATS && tag == kTag;
+}
+
+// Returns the number of drops a drop report carries, or 0 if |msg| isn't one.
+int32_t DropReportCount(const std::string& msg) {
+    if (msg.size() != sizeof(android_log_header_t) + sizeof(android_log_event_long_t)) {
+        return 0;
+    }
+    android_log_event_long_t report;
+    memcpy(&report, msg.data() + sizeof(android_log_header_t), sizeof(report));
+    if (report.payload.type != EVENT_TYPE_LONG) return 0;
+    EXPECT_EQ(kTag, report.payload.data >> 32);
+    return static_cast<int32_t>(report.payload.data);
+}
+
+std::string ThreadPath(pid_t tid, const char* file) {
+    return "/proc/self/task/" + std::to_string(tid) + "/" + file;
+}
+
+// Returns the batch flusher's thread id, or 0 if there is no flusher.
+pid_t FlusherThread() {
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir("/proc/self/task"), closedir);
+    while (dirent* entry = readdir(dir.get())) {
+        pid_t tid;
+        std::string comm;
+        if (android::base::ParseInt(entry->d_name, &tid) &&
+            android::base::ReadFileToString(ThreadPath(tid, "comm"), &comm) &&
+            android::base::Trim(comm) == "statsd_flusher") {
+            return tid;
+        }
+    }
+    return 0;
+}
+
+// Waits up to a few seconds for the flusher to start or to exit.
+bool WaitForFlusher(bool running) {
+    for (int i = 0; i < 500 && (FlusherThread() != 0) != running; i++) {
+        std::this_thread::sleep_for(10ms);
+    }
+    return (FlusherThread() != 0) == running;
+}
+
+// The number of times |tid| went to sleep.
+uint64_t Wakeups(pid_t tid) {
+    std::string status;
+    android::base::ReadFileToString(ThreadPath(tid, "status"), &status);
+    for (const auto& line : android::base::Split(status, "\n")) {
+        uint64_t switches;
+        if (android::base::StartsWith(line, "voluntary_ctxt_switches:") &&
+            android::base::ParseUint(android::base::Trim(line.substr(line.find(':') + 1)),
+                                     &switches)) {
+            return switches;
+        }
+    }
+    return 0;
+}
+
+class StatsdWriterTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_TRUE(statsd_.bound());
+        stats_log_close();
+        statsd_writer_set_socket_path(statsd_.path());
+    }
+
+    void TearDown() override {
+        stats_log_enable_batching(0, 0);
+        stats_log_close();
+        // The flusher exits, so the next test starts without one.
+        EXPECT_TRUE(WaitForFlusher(false));
+    }
+
+    FakeStatsd statsd_;
+};
+
+}  // namespace
+
+TEST_F(StatsdWriterTest, Unbatched) {
+    ASSERT_EQ(sizeof(uint64_t) + sizeof(int32_t), static_cast<size_t>(WriteEvent(kTag, 42)));
+    uint64_t value;
+    ASSERT_TRUE(IsEvent(statsd_.Receive(0), &value));
+    EXPECT_EQ(42u, value);
+}
+
+TEST_F(StatsdWriterTest, FlushesAfterDelay) {
+    ASSERT_EQ(0, stats_log_enable_batching(64, 20));
+    for (uint64_t i = 0; i < 10; i++) {
+        ASSERT_LT(0, WriteEvent(kTag, i));
+    }
+    // Fewer events than the batch size, so only the delay sends them.
+    for (uint64_t i = 0; i < 10; i++) {
+        uint64_t value;
+        ASSERT_TRUE(IsEvent(statsd_.Receive(5000), &value));
+        EXPECT_EQ(i, value);
+    }
+}
+
+TEST_F(StatsdWriterTest, FlushesFullBatches) {
+    ASSERT_EQ(0, stats_log_enable_batching(8, 60 * 1000));
+    for (uint64_t i = 0; i < 8; i++) {
+        ASSERT_LT(0, WriteEvent(kTag, i));
+    }
+    for (uint64_t i = 0; i < 8; i++) {
+        uint64_t value;
+        ASSERT_TRUE(IsEvent(statsd_.Receive(5000), &value));
+        EXPECT_EQ(i, value);
+    }
+}
+
+TEST_F(StatsdWriterTest, CountsDropsPrecisely) {
+    ASSERT_EQ(0, stats_log_enable_batching(64, 20));
+    const uint64_t dropped_before = statsd_writer_dropped_count();
+
+    // Nobody reads the socket, so the queue fills up once the socket does.
+    int accepted = 0;
+    int rejected = 0;
+    for (uint64_t i = 0; i < 2000; i++) {
+        int ret = WriteEvent(kTag, accepted);
+        if (ret > 0) {
+            accepted++;
+        } else {
+            ASSERT_EQ(-EAGAIN, ret);
+            note_log_drop(ret, kTag);
+            rejected++;
+        }
+    }
+    ASSERT_GT(rejected, 0);
+    EXPECT_EQ(static_cast<uint64_t>(rejected), statsd_writer_dropped_count() - dropped_before);
+
+    // Every accepted event arrives, in order, and the drop reports add up.
+    int received = 0;
+    int reported = 0;
+    while (received < accepted || reported < rejected) {
+        std::string msg = statsd_.Receive(5000);
+        ASSERT_FALSE(msg.empty()) << received << "/" << accepted << " events, " << reported
+                                  << "/" << rejected << " drops";
+        uint64_t value;
+        if (IsEvent(msg, &value)) {
+            EXPECT_EQ(static_cast<uint64_t>(received), value);
+            received++;
+        } else {
+            reported += DropReportCount(msg);
+        }
+        if (received == accepted && reported < rejected) {
+            // Reports go out ahead of the next event.
+            ASSERT_LT(0, WriteEvent(kTag, accepted++));
+        }
+    }
+    EXPECT_EQ(rejected, reported);
+}
+
+TEST_F(StatsdWriterTest, RejectsZeroDelay) {
+    EXPECT_EQ(-EINVAL, stats_log_enable_batching(8, 0));
+    // Still unbatched.
+    ASSERT_LT(0, WriteEvent(kTag, 42));
+    uint64_t value;
+    ASSERT_TRUE(IsEvent(statsd_.Receive(0), &value));
+}
+
+TEST_F(StatsdWriterTest, FlusherSleepsWhileIdle) {
+    ASSERT_EQ(0, stats_log_enable_batching(64, 1));
+    ASSERT_TRUE(WaitForFlusher(true));
+
+    // With nothing queued, a 1ms delay must not turn into a 1ms timer.
+    std::this_thread::sleep_for(50ms);
+    pid_t flusher = FlusherThread();
+    uint64_t before = Wakeups(flusher);
+    std::this_thread::sleep_for(200ms);
+    EXPECT_LE(Wakeups(flusher) - before, 5u);
+
+    // The first event still goes out after the delay.
+    ASSERT_LT(0, WriteEvent(kTag, 7));
+    uint64_t value;
+    ASSERT_TRUE(IsEvent(statsd_.Receive(5000), &value));
+    EXPECT_EQ(7u, value);
+}
+
+TEST_F(StatsdWriterTest, FlusherExitsWhenBatchingIsOff) {
+    ASSERT_EQ(0, stats_log_enable_batching(64, 60 * 1000));
+    ASSERT_TRUE(WaitForFlusher(true));
+    ASSERT_LT(0, WriteEvent(kTag, 1));
+
+    // Turning batching off sends what was queued and stops the flusher.
+    ASSERT_EQ(0, stats_log_enable_batching(0, 0));
+    uint64_t value;
+    ASSERT_TRUE(IsEvent(statsd_.Receive(5000), &value));
+    EXPECT_EQ(1u, value);
+    EXPECT_TRUE(WaitForFlusher(false));
+
+    // And batching can be turned back on.
+    ASSERT_EQ(0, stats_log_enable_batching(1, 60 * 1000));
+    ASSERT_LT(0, WriteEvent(kTag, 2));
+    ASSERT_TRUE(IsEvent(statsd_.Receive(5000), &value));
+    EXPECT_EQ(2u, value);
+}
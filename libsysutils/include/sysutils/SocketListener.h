@@ -43,6 +43,12 @@ public:
     int startListener(int backlog);
     int stopListener();
 
+    // Runs onDataAvailable() on a pool of |threads| threads instead of the listener thread.
+    // Callbacks for the same client are never run concurrently and are run in order, but
+    // callbacks for different clients may be, so onDataAvailable() must be safe to call
+    // from several threads at once. Must be called before startListener().
+    void setDispatchThreads(int threads);
+
     void sendBroadcast(int code, const char *msg, bool addErrno);
 
     void runOnEachSocket(SocketClientCommand *command);
@@ -24,7 +24,8 @@
 
 #include <linux/netlink.h> /* out of order because must follow sys/socket.h */
 
-#include <cutils/uevent.h>
+#include <memory>
+
 #include <log/log.h>
 #include <sysutils/NetlinkEvent.h>
 
@@ -43,37 +44,90 @@ NetlinkListener::NetlinkListener(int socket, int format) :
                             SocketListener(socket, false), mFormat(format) {
 }
 
+// Maximum number of messages read with a single recvmmsg().
+static constexpr unsigned int kMaxBatch = 8;
+
+// Applies the same checks as uevent_kernel_recv() to a message received with recvmmsg().
+static bool isKernelMessage(const struct msghdr& hdr, bool require_group) {
+    const struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        // ignoring netlink message with no sender credentials
+        return false;
+    }
+    const struct sockaddr_nl* addr = static_cast<const struct sockaddr_nl*>(hdr.msg_name);
+    if (addr->nl_pid != 0) {
+        // ignore non-kernel
+        return false;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        // ignore unicast messages when requested
+        return false;
+    }
+    return true;
+}
+
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
-    ssize_t count;
-    uid_t uid = -1;
 
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
     }
 
-    count = TEMP_FAILURE_RETRY(uevent_kernel_recv(socket,
-            mBuffer, sizeof(mBuffer), require_group, &uid));
-    if (count < 0) {
+    // Read everything that's queued, up to kMaxBatch messages, in one go. The first message
+    // goes to mBuffer and the rest to per-thread batch buffers, which live outside the class so
+    // that its layout stays as it is in the VNDK ABI. Those are only touched by the kernel as
+    // far as each message reaches, so they rarely cost more than their address space.
+    static thread_local std::unique_ptr<char[]> batchBuffers;
+    if (!batchBuffers) {
+        batchBuffers.reset(new char[(kMaxBatch - 1) * sizeof(mBuffer)]);
+    }
+    struct mmsghdr msgs[kMaxBatch] = {};
+    struct iovec iovs[kMaxBatch];
+    struct sockaddr_nl addrs[kMaxBatch];
+    char controls[kMaxBatch][CMSG_SPACE(sizeof(struct ucred))];
+    for (unsigned int i = 0; i < kMaxBatch; i++) {
+        iovs[i].iov_base = i == 0 ? mBuffer : &batchBuffers[(i - 1) * sizeof(mBuffer)];
+        iovs[i].iov_len = sizeof(mBuffer);
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    int received = TEMP_FAILURE_RETRY(recvmmsg(socket, msgs, kMaxBatch, MSG_WAITFORONE, nullptr));
+    if (received < 0) {
 #ifdef __ANDROID_RECOVERY__
-        SLOGW("recvmsg failed (%s)", strerror(errno));
+        SLOGW("recvmmsg failed (%s)", strerror(errno));
 #else
-        SLOGE("recvmsg failed (%s)", strerror(errno));
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
 #endif
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
-    } else if (mFormat != NETLINK_FORMAT_BINARY) {
-        // Don't complain if parseBinaryNetlinkMessage returns false. That can
-        // just mean that the buffer contained no messages we're interested in.
-        SLOGE("Error decoding NetlinkEvent");
-    }
+    for (int i = 0; i < received; i++) {
+        char* buffer = static_cast<char*>(iovs[i].iov_base);
+        ssize_t count = msgs[i].msg_len;
+        if (!isKernelMessage(msgs[i].msg_hdr, require_group)) {
+            // clear residual potentially malicious data
+            memset(buffer, 0, count);
+            SLOGE("Ignoring netlink message not from the kernel");
+            continue;
+        }
 
-    delete evt;
+        NetlinkEvent *evt = new NetlinkEvent();
+        if (evt->decode(buffer, count, mFormat)) {
+            onEvent(evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if parseBinaryNetlinkMessage returns false. That can
+            // just mean that the buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
+
+        delete evt;
+    }
     return true;
 }
@@ -19,13 +19,20 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <cutils/sockets.h>
@@ -36,6 +43,104 @@
 #define CtrlPipe_Shutdown 0
 #define CtrlPipe_Wakeup   1
 
+// Maximum number of ready descriptors handled per epoll_wait().
+static constexpr int kMaxEvents = 32;
+
+namespace {
+
+// State that SocketListener can't hold itself without changing its layout, which is part of the
+// VNDK ABI. It is kept in a table keyed by listener instead.
+struct ListenerState {
+    int epollFd = -1;
+    int dispatchThreads = 0;
+};
+
+std::mutex gStatesLock;
+std::unordered_map<const SocketListener*, ListenerState> gStates;
+
+ListenerState getState(const SocketListener* listener) {
+    std::lock_guard<std::mutex> lock(gStatesLock);
+    auto it = gStates.find(listener);
+    return it != gStates.end() ? it->second : ListenerState();
+}
+
+void setEpollFd(const SocketListener* listener, int fd) {
+    std::lock_guard<std::mutex> lock(gStatesLock);
+    gStates[listener].epollFd = fd;
+}
+
+uint32_t clientEvents(int dispatchThreads) {
+    return dispatchThreads > 0 ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+}
+
+bool watch(int epollFd, int fd, int op, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, op, fd, &ev) != 0) {
+        SLOGE("epoll_ctl(%d, fd %d) failed (%s)", op, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Runs onDataAvailable() for ready clients on a fixed set of threads. While a pool is in use,
+// clients are watched with EPOLLONESHOT and only re-armed once their callback has returned,
+// so each client has at most one callback in flight.
+class DispatchPool {
+  public:
+    DispatchPool(int threads, std::function<void(SocketClient*)> dispatch)
+        : mDispatch(std::move(dispatch)) {
+        for (int i = 0; i < threads; ++i) {
+            mThreads.emplace_back([this] { run(); });
+        }
+    }
+
+    // Finishes the queued callbacks and joins the threads.
+    ~DispatchPool() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStopping = true;
+        }
+        mCond.notify_all();
+        for (auto& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    void enqueue(SocketClient* c) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mQueue.push_back(c);
+        }
+        mCond.notify_one();
+    }
+
+  private:
+    void run() {
+        while (true) {
+            SocketClient* c;
+            {
+                std::unique_lock<std::mutex> lock(mLock);
+                mCond.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+                if (mQueue.empty()) return;
+                c = mQueue.front();
+                mQueue.pop_front();
+            }
+            mDispatch(c);
+        }
+    }
+
+    std::function<void(SocketClient*)> mDispatch;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<SocketClient*> mQueue;
+    bool mStopping = false;
+    std::vector<std::thread> mThreads;
+};
+
+}  // namespace
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -64,11 +169,24 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    {
+        std::lock_guard<std::mutex> lock(gStatesLock);
+        auto it = gStates.find(this);
+        if (it != gStates.end()) {
+            if (it->second.epollFd != -1) close(it->second.epollFd);
+            gStates.erase(it);
+        }
+    }
     for (auto pair : mClients) {
         pair.second->decRef();
     }
 }
 
+void SocketListener::setDispatchThreads(int threads) {
+    std::lock_guard<std::mutex> lock(gStatesLock);
+    gStates[this].dispatchThreads = threads;
+}
+
 int SocketListener::startListener() {
     return startListener(4);
 }
@@ -100,6 +218,20 @@ int SocketListener::startListener(int backlog) {
         return -1;
     }
 
+    // The listener thread hasn't started yet, so the interest set can be built without
+    // holding mClientsLock.
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+    setEpollFd(this, epollFd);
+    uint32_t events = clientEvents(getState(this).dispatchThreads);
+    if (!watch(epollFd, mCtrlPipe[0], EPOLL_CTL_ADD, EPOLLIN) ||
+        !watch(epollFd, mSock, EPOLL_CTL_ADD, mListen ? EPOLLIN : events)) {
+        return -1;
+    }
+
     if (pthread_create(&mThread, nullptr, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -123,10 +255,13 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
     mCtrlPipe[1] = -1;
+    close(getState(this).epollFd);
+    setEpollFd(this, -1);
 
     if (mSocketName && mSock > -1) {
         close(mSock);
@@ -149,60 +284,70 @@ void *SocketListener::threadStart(void *obj) {
 }
 
 void SocketListener::runListener() {
-    while (true) {
-        std::vector<pollfd> fds;
-
-        pthread_mutex_lock(&mClientsLock);
-        fds.reserve(2 + mClients.size());
-        fds.push_back({.fd = mCtrlPipe[0], .events = POLLIN});
-        if (mListen) fds.push_back({.fd = mSock, .events = POLLIN});
-        for (auto pair : mClients) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            const int fd = pair.second->getSocket();
-            if (fd != pair.first) SLOGE("fd mismatch: %d != %d", fd, pair.first);
-            fds.push_back({.fd = fd, .events = POLLIN});
+    const ListenerState state = getState(this);
+    const uint32_t clientEventMask = clientEvents(state.dispatchThreads);
+    epoll_event events[kMaxEvents];
+
+    auto dispatch = [&](SocketClient* c) {
+        // Process it, if false is returned, remove from the map
+        SLOGV("processing fd %d", c->getSocket());
+        if (!onDataAvailable(c)) {
+            release(c, false);
         }
-        pthread_mutex_unlock(&mClientsLock);
+        if (state.dispatchThreads > 0) {
+            // Re-arm the one-shot watch, unless the client went away in the meantime.
+            pthread_mutex_lock(&mClientsLock);
+            auto it = mClients.find(c->getSocket());
+            if (it != mClients.end() && it->second == c) {
+                watch(state.epollFd, it->first, EPOLL_CTL_MOD, clientEventMask);
+            }
+            pthread_mutex_unlock(&mClientsLock);
+        }
+        c->decRef();
+    };
+    // The pool only lives as long as this thread, so stopListener() has finished all the
+    // callbacks once it has joined it.
+    std::unique_ptr<DispatchPool> pool;
+    if (state.dispatchThreads > 0) {
+        pool = std::make_unique<DispatchPool>(state.dispatchThreads, dispatch);
+    }
 
+    while (true) {
         SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
-        int rc = TEMP_FAILURE_RETRY(poll(fds.data(), fds.size(), -1));
+        int rc = TEMP_FAILURE_RETRY(epoll_wait(state.epollFd, events, kMaxEvents, -1));
         if (rc < 0) {
-            SLOGE("poll failed (%s) mListen=%d", strerror(errno), mListen);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
         }
 
-        if (fds[0].revents & (POLLIN | POLLERR)) {
+        bool readable_ctrl = false;
+        bool readable_listen = false;
+        for (int i = 0; i < rc; ++i) {
+            if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) continue;
+            if (events[i].data.fd == mCtrlPipe[0]) readable_ctrl = true;
+            if (mListen && events[i].data.fd == mSock) readable_listen = true;
+        }
+
+        if (readable_ctrl) {
             char c = CtrlPipe_Shutdown;
             TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
             if (c == CtrlPipe_Shutdown) {
                 break;
             }
-            continue;
-        }
-        if (mListen && (fds[1].revents & (POLLIN | POLLERR))) {
-            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
-                continue;
-            }
-            pthread_mutex_lock(&mClientsLock);
-            mClients[c] = new SocketClient(c, true, mUseCmdNum);
-            pthread_mutex_unlock(&mClientsLock);
         }
 
         // Add all active clients to the pending list first, so we can release
         // the lock before invoking the callbacks.
         std::vector<SocketClient*> pending;
         pthread_mutex_lock(&mClientsLock);
-        const int size = fds.size();
-        for (int i = mListen ? 2 : 1; i < size; ++i) {
-            const struct pollfd& p = fds[i];
-            if (p.revents & (POLLIN | POLLERR)) {
-                auto it = mClients.find(p.fd);
+        for (int i = 0; i < rc; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0] || (mListen && fd == mSock)) continue;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                auto it = mClients.find(fd);
                 if (it == mClients.end()) {
-                    SLOGE("fd vanished: %d", p.fd);
+                    SLOGE("fd vanished: %d", fd);
                     continue;
                 }
                 SocketClient* c = it->second;
@@ -212,13 +357,27 @@ void SocketListener::runListener() {
         }
         pthread_mutex_unlock(&mClientsLock);
 
+        // Accept after the lookup above, so that a new client can't be mistaken for one that
+        // went away and whose descriptor number was reused.
+        if (readable_listen) {
+            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+            if (c < 0) {
+                SLOGE("accept failed (%s)", strerror(errno));
+                sleep(1);
+            } else {
+                pthread_mutex_lock(&mClientsLock);
+                mClients[c] = new SocketClient(c, true, mUseCmdNum);
+                watch(state.epollFd, c, EPOLL_CTL_ADD, clientEventMask);
+                pthread_mutex_unlock(&mClientsLock);
+            }
+        }
+
         for (SocketClient* c : pending) {
-            // Process it, if false is returned, remove from the map
-            SLOGV("processing fd %d", c->getSocket());
-            if (!onDataAvailable(c)) {
-                release(c, false);
+            if (pool) {
+                pool->enqueue(c);
+            } else {
+                dispatch(c);
             }
-            c->decRef();
         }
     }
 }
@@ -231,6 +390,11 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
         pthread_mutex_lock(&mClientsLock);
         ret = (mClients.erase(c->getSocket()) != 0);
+        if (ret) {
+            // The descriptor stays open until the last reference is dropped, so remove it
+            // from the interest set explicitly.
+            epoll_ctl(getState(this).epollFd, EPOLL_CTL_DEL, c->getSocket(), nullptr);
+        }
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
             ret = c->decRef();
@@ -24,6 +24,8 @@
 
 #include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -118,6 +120,30 @@ class TestListener : public FrameworkListener {
     }
 };
 
+// A listener which echoes back whatever each client sends.
+class EchoListener : public SocketListener {
+  public:
+    EchoListener(int fd) : SocketListener(fd, true) {}
+
+  protected:
+    bool onDataAvailable(SocketClient* c) override {
+        char buf[256];
+        ssize_t len = TEMP_FAILURE_RETRY(read(c->getSocket(), buf, sizeof(buf)));
+        if (len <= 0) return false;
+        return c->sendData(buf, len) == 0;
+    }
+};
+
+std::string recvBytes(int fd, size_t size) {
+    std::string received;
+    while (received.size() < size) {
+        std::string chunk = recvReply(fd);
+        if (chunk.empty()) break;
+        received += chunk;
+    }
+    return received;
+}
+
 }  // unnamed namespace
 
 class FrameworkListenerTest : public testing::Test {
@@ -181,3 +207,51 @@ TEST_F(FrameworkListenerTest, MultipleClients) {
     EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
     EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
 }
+
+TEST_F(FrameworkListenerTest, ManyClients) {
+    // Connect one client at a time so that the listen backlog never fills up.
+    std::vector<unique_fd> clients;
+    for (int i = 0; i < 64; i++) {
+        clients.push_back(clientSocket(mSocketPath));
+        sendCmd(clients.back().get(), "test");
+        EXPECT_EQ(std::string("42 test") + '\0', recvReply(clients.back().get()));
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        sendCmd(clients[i].get(), ("test " + std::to_string(i)).c_str());
+    }
+    for (int i = clients.size() - 1; i >= 0; i--) {
+        EXPECT_EQ("42 test," + std::to_string(i) + '\0', recvReply(clients[i].get()));
+    }
+}
+
+TEST(SocketListenerTest, DispatchThreadsPreserveClientOrder) {
+    std::string path = testSocketPath();
+    unique_fd server = serverSocket(path);
+    EchoListener listener(server.get());
+    listener.setDispatchThreads(4);
+    ASSERT_EQ(0, listener.startListener());
+
+    std::vector<unique_fd> clients;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 8; i++) {
+        clients.push_back(clientSocket(path));
+        ASSERT_TRUE(android::base::WriteFully(clients.back().get(), "hello", 5));
+        EXPECT_EQ("hello", recvBytes(clients.back().get(), 5));
+        expected.push_back("");
+    }
+    // Interleave writes across clients; each client must get its own bytes back in order.
+    for (int n = 0; n < 50; n++) {
+        for (size_t i = 0; i < clients.size(); i++) {
+            std::string msg = std::to_string(i) + ":" + std::to_string(n) + ";";
+            ASSERT_TRUE(android::base::WriteFully(clients[i].get(), msg.data(), msg.size()));
+            expected[i] += msg;
+        }
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        EXPECT_EQ(expected[i], recvBytes(clients[i].get(), expected[i].size()));
+    }
+
+    EXPECT_EQ(0, listener.stopListener());
+    unlink(path.c_str());
+}
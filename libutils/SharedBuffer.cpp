@@ -41,6 +41,7 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
         // The following is OK on Android-supported platforms.
         sb->mRefs.store(1, std::memory_order_relaxed);
         sb->mSize = size;
+        sb->mSlack = 0;
         sb->mClientMetadata = 0;
     }
     return sb;
@@ -78,6 +79,7 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
         buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
         if (buf != nullptr) {
             buf->mSize = newSize;
+            buf->mSlack = 0;
             return buf;
         }
     }
@@ -90,6 +92,35 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
     return sb;    
 }
 
+SharedBuffer* SharedBuffer::editResizeAmortized(size_t newSize) const
+{
+    if (newSize <= mSize) {
+        return editResize(newSize);
+    }
+    if (onlyOwner() && newSize - mSize <= mSlack) {
+        SharedBuffer* buf = const_cast<SharedBuffer*>(this);
+        buf->mSlack -= newSize - buf->mSize;
+        buf->mSize = newSize;
+        return buf;
+    }
+
+    // Grow by at least 50%. The slack has to fit in 32 bits, and we never
+    // over-allocate past what alloc() would accept.
+    size_t capacity;
+    if (__builtin_add_overflow(mSize, mSize / 2, &capacity) || capacity < newSize) {
+        capacity = newSize;
+    }
+    if (capacity - newSize > UINT32_MAX) capacity = newSize + UINT32_MAX;
+    if (capacity >= SIZE_MAX - sizeof(SharedBuffer)) capacity = newSize;
+
+    SharedBuffer* sb = editResize(capacity);
+    if (sb) {
+        sb->mSize = newSize;
+        sb->mSlack = capacity - newSize;
+    }
+    return sb;
+}
+
 SharedBuffer* SharedBuffer::attemptEdit() const
 {
     if (onlyOwner()) {
@@ -74,6 +74,12 @@ public:
     //! edit the buffer, resizing if needed
                     SharedBuffer*           editResize(size_t size) const;
 
+    /*! like editResize(), but when growing, over-allocates so that a
+     * series of small increases is amortized O(1). The extra capacity is
+     * kept across calls and given back by any other resize.
+     */
+                    SharedBuffer*           editResizeAmortized(size_t size) const;
+
     //! like edit() but fails if a copy is required
                     SharedBuffer*           attemptEdit() const;
     
@@ -102,7 +108,8 @@ private:
         // Must be sized to preserve correct alignment.
         mutable std::atomic<int32_t>        mRefs;
                 size_t                      mSize;
-                uint32_t                    mReserved;
+                // Bytes allocated past mSize by editResizeAmortized().
+                uint32_t                    mSlack;
 public:
         // mClientMetadata is reserved for client use.  It is initialized to 0
         // and the clients can do whatever they want with it.  Note that this is
@@ -20,6 +20,7 @@
 
 #include <memory>
 #include <stdint.h>
+#include <string.h>
 
 #include "SharedBuffer.h"
 
@@ -86,3 +87,35 @@ TEST(SharedBufferTest, editResize_zero_size) {
     ASSERT_EQ(0U, buf->size());
     buf->release();
 }
+
+TEST(SharedBufferTest, editResizeAmortized_in_place) {
+    android::SharedBuffer* buf = android::SharedBuffer::alloc(100);
+    buf = buf->editResizeAmortized(101);
+    ASSERT_NE(nullptr, buf);
+    ASSERT_EQ(101U, buf->size());
+    memset(buf->data(), 'x', buf->size());
+
+    // Growing by less than the slack must not move the buffer.
+    android::SharedBuffer* grown = buf->editResizeAmortized(140);
+    ASSERT_EQ(buf, grown);
+    ASSERT_EQ(140U, grown->size());
+    EXPECT_EQ('x', static_cast<char*>(grown->data())[100]);
+
+    // Shrinking gives the slack back.
+    buf = grown->editResizeAmortized(10);
+    ASSERT_EQ(10U, buf->size());
+    buf->release();
+}
+
+TEST(SharedBufferTest, editResizeAmortized_shared) {
+    android::SharedBuffer* buf = android::SharedBuffer::alloc(4);
+    memcpy(buf->data(), "abc", 4);
+    buf->acquire();
+    android::SharedBuffer* copy = buf->editResizeAmortized(8);
+    ASSERT_NE(buf, copy);
+    EXPECT_EQ(8U, copy->size());
+    EXPECT_EQ(4U, buf->size());
+    EXPECT_STREQ("abc", static_cast<char*>(copy->data()));
+    copy->release();
+    buf->release();
+}
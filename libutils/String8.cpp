@@ -317,8 +317,11 @@ status_t String8::appendFormatV(const char* fmt, va_list args)
             oldLength > std::numeric_limits<size_t>::max() - n - 1) {
             return NO_MEMORY;
         }
-        char* buf = lockBuffer(oldLength + n);
-        if (buf) {
+        SharedBuffer* sb =
+                SharedBuffer::bufferFromData(mString)->editResizeAmortized(oldLength + n + 1);
+        if (sb) {
+            char* buf = static_cast<char*>(sb->data());
+            mString = buf;
             vsnprintf(buf + oldLength, n + 1, fmt, args);
         } else {
             result = NO_MEMORY;
@@ -334,7 +337,7 @@ status_t String8::real_append(const char* other, size_t otherLen) {
     size_t newLen;
     if (__builtin_add_overflow(myLen, otherLen, &newLen) ||
         __builtin_add_overflow(newLen, 1, &newLen) ||
-        (buf = SharedBuffer::bufferFromData(mString)->editResize(newLen)) == nullptr) {
+        (buf = SharedBuffer::bufferFromData(mString)->editResizeAmortized(newLen)) == nullptr) {
         return NO_MEMORY;
     }
 
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <benchmark/benchmark.h>
+#include <utils/String8.h>
+#include <string>
+
+void BM_append_android_string8(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String8 s;
+        for (int i = 0; i < state.range(0); ++i) {
+            s.append("0123456789");
+        }
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_append_android_string8)->Range(8, 8 << 10);
+
+void BM_append_std_string(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        std::string s;
+        for (int i = 0; i < state.range(0); ++i) {
+            s.append("0123456789");
+        }
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_append_std_string)->Range(8, 8 << 10);
+
+void BM_appendFormat_android_string8(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String8 s;
+        for (int i = 0; i < state.range(0); ++i) {
+            s.appendFormat("  %s: %d\n", "key", i);
+        }
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_appendFormat_android_string8)->Range(8, 8 << 10);
@@ -22,6 +22,8 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+
 using namespace android;
 
 class String8Test : public testing::Test {
@@ -114,3 +116,22 @@ TEST_F(String8Test, append) {
     EXPECT_EQ(NO_MEMORY, s.append("baz", SIZE_MAX));
     EXPECT_STREQ("foobar", s);
 }
+
+TEST_F(String8Test, appendMany) {
+    String8 s;
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(OK, s.append("ab"));
+        EXPECT_EQ(OK, s.appendFormat("%d,", i));
+        expected += "ab" + std::to_string(i) + ",";
+    }
+    EXPECT_EQ(expected.length(), s.length());
+    EXPECT_STREQ(expected.c_str(), s);
+
+    // Copies made while the buffer has spare capacity must not see later appends.
+    String8 copy(s);
+    EXPECT_EQ(OK, s.append("x"));
+    EXPECT_STREQ(expected.c_str(), copy);
+    EXPECT_EQ(expected.length() + 1, s.length());
+}
+
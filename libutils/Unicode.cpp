@@ -18,10 +18,25 @@
 
 #include <android-base/macros.h>
 #include <limits.h>
+#include <string.h>
 #include <utils/Unicode.h>
 
+#include <algorithm>
+
 #include <log/log.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// AVX2 is used only if the CPU supports it, on top of the SSE2 baseline.
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <immintrin.h>
+#define UNICODE_HAVE_AVX2 1
+#endif
+
 extern "C" {
 
 static const char32_t kByteMask = 0x000000BF;
@@ -52,6 +67,267 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// Vectorized fast paths
+// --------------------------------------------------------------------------
+//
+// Each helper consumes whole blocks from the start of its input for as long
+// as a block is entirely ASCII (or, for utf16_bmp_utf8_length(), contains no
+// surrogates), and returns the number of input units consumed. Whatever is
+// left is handled by the regular one-code-point-at-a-time loops, so invalid
+// input always goes through the same code as before.
+
+#if defined(UNICODE_HAVE_AVX2)
+
+static bool has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+__attribute__((target("avx2")))
+static size_t utf16_ascii_to_utf8_avx2(const char16_t* src, size_t len, char* dst)
+{
+    const __m256i non_ascii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (!_mm256_testz_si256(v, non_ascii)) break;
+        // packus works per 128-bit lane, so gather the two packed halves.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t utf8_ascii_to_utf16_avx2(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvtepu8_epi16(v));
+    }
+    return i;
+}
+
+#endif  // UNICODE_HAVE_AVX2
+
+#if defined(__SSE2__)
+
+static size_t utf16_ascii_to_utf8_blocks(const char16_t* src, size_t len, char* dst)
+{
+    const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, non_ascii), zero)) != 0xFFFF) {
+            break;
+        }
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(v, v));
+    }
+    return i;
+}
+
+static size_t utf8_ascii_to_utf16_blocks(const uint8_t* src, size_t len, char16_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return i;
+}
+
+static size_t utf8_ascii_prefix_blocks(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+    }
+    return i;
+}
+
+static size_t utf16_bmp_utf8_length_blocks(const char16_t* src, size_t len, size_t* utf8_len)
+{
+    const __m128i top5 = _mm_set1_epi16(static_cast<short>(0xF800));
+    const __m128i surrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+    const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t total = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i high = _mm_and_si128(v, top5);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, surrogate)) != 0) break;
+        // One byte per unit, plus one if >= 0x80, plus one more if >= 0x800. The masks
+        // have two bits per unit that is below the threshold.
+        int below_80 = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, non_ascii), zero));
+        int below_800 = _mm_movemask_epi8(_mm_cmpeq_epi16(high, zero));
+        total += 8 + (16 - __builtin_popcount(below_80)) / 2 +
+                 (16 - __builtin_popcount(below_800)) / 2;
+    }
+    *utf8_len = total;
+    return i;
+}
+
+#elif defined(__aarch64__)
+
+static size_t utf16_ascii_to_utf8_blocks(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        if (vmaxvq_u16(v) >= 0x80) break;
+        vst1_u8(reinterpret_cast<uint8_t*>(dst + i), vmovn_u16(v));
+    }
+    return i;
+}
+
+static size_t utf8_ascii_to_utf16_blocks(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        if (vmaxvq_u8(v) >= 0x80) break;
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_high_u8(v));
+    }
+    return i;
+}
+
+static size_t utf8_ascii_prefix_blocks(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(src + i)) >= 0x80) break;
+    }
+    return i;
+}
+
+static size_t utf16_bmp_utf8_length_blocks(const char16_t* src, size_t len, size_t* utf8_len)
+{
+    size_t i = 0;
+    size_t total = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        uint16x8_t high = vandq_u16(v, vdupq_n_u16(0xF800));
+        if (vmaxvq_u16(vceqq_u16(high, vdupq_n_u16(0xD800))) != 0) break;
+        // One byte per unit, plus one if >= 0x80, plus one more if >= 0x800.
+        uint16x8_t extra = vaddq_u16(vshrq_n_u16(vcgeq_u16(v, vdupq_n_u16(0x80)), 15),
+                                     vshrq_n_u16(vcgeq_u16(v, vdupq_n_u16(0x800)), 15));
+        total += 8 + vaddvq_u16(extra);
+    }
+    *utf8_len = total;
+    return i;
+}
+
+#else
+
+// Portable word-at-a-time versions.
+
+static size_t utf16_ascii_to_utf8_blocks(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0xFF80FF80FF80FF80ULL) break;
+        for (size_t j = i; j < i + 4; j++) {
+            dst[j] = static_cast<char>(src[j]);
+        }
+    }
+    return i;
+}
+
+static size_t utf8_ascii_to_utf16_blocks(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) break;
+        for (size_t j = i; j < i + 8; j++) {
+            dst[j] = src[j];
+        }
+    }
+    return i;
+}
+
+static size_t utf8_ascii_prefix_blocks(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) break;
+    }
+    return i;
+}
+
+static size_t utf16_bmp_utf8_length_blocks(const char16_t*, size_t, size_t* utf8_len)
+{
+    *utf8_len = 0;
+    return 0;
+}
+
+#endif
+
+// The wrappers below finish the run one unit at a time once fewer than a block remain (or a
+// block is mixed), so that callers enter them once per run rather than once per character.
+
+static size_t utf16_ascii_to_utf8(const char16_t* src, size_t len, char* dst)
+{
+    size_t done = 0;
+#if defined(UNICODE_HAVE_AVX2)
+    if (has_avx2()) {
+        done = utf16_ascii_to_utf8_avx2(src, len, dst);
+    }
+#endif
+    done += utf16_ascii_to_utf8_blocks(src + done, len - done, dst + done);
+    for (; done < len && src[done] < 0x80; done++) {
+        dst[done] = static_cast<char>(src[done]);
+    }
+    return done;
+}
+
+static size_t utf8_ascii_to_utf16(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t done = 0;
+#if defined(UNICODE_HAVE_AVX2)
+    if (has_avx2()) {
+        done = utf8_ascii_to_utf16_avx2(src, len, dst);
+    }
+#endif
+    done += utf8_ascii_to_utf16_blocks(src + done, len - done, dst + done);
+    for (; done < len && src[done] < 0x80; done++) {
+        dst[done] = src[done];
+    }
+    return done;
+}
+
+static size_t utf8_ascii_prefix(const uint8_t* src, size_t len)
+{
+    size_t done = utf8_ascii_prefix_blocks(src, len);
+    while (done < len && src[done] < 0x80) done++;
+    return done;
+}
+
+static size_t utf16_bmp_utf8_length(const char16_t* src, size_t len, size_t* utf8_len)
+{
+    size_t done = utf16_bmp_utf8_length_blocks(src, len, utf8_len);
+    for (; done < len && (src[done] & 0xF800) != 0xD800; done++) {
+        *utf8_len += src[done] < 0x80 ? 1 : src[done] < 0x800 ? 2 : 3;
+    }
+    return done;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -290,6 +566,18 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80) {
+            // Copy a run of ASCII at once. Never write more than |dst_len|: if the run doesn't
+            // fit, the check below aborts just as it would have one character at a time.
+            size_t n = utf16_ascii_to_utf8(
+                    cur_utf16, std::min<size_t>(end_utf16 - cur_utf16, dst_len), cur);
+            if (n > 0) {
+                cur_utf16 += n;
+                cur += n;
+                dst_len -= n;
+                continue;
+            }
+        }
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -323,6 +611,20 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        if ((*src & 0xF800) != 0xD800) {
+            // Measure a run of BMP characters at once.
+            size_t run_len;
+            size_t n = utf16_bmp_utf8_length(src, end - src, &run_len);
+            if (n > 0) {
+                if (SSIZE_MAX - run_len < ret) {
+                    android_errorWriteLog(0x534e4554, "37723026");
+                    return -1;
+                }
+                ret += run_len;
+                src += n;
+                continue;
+            }
+        }
         size_t char_len;
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*(src + 1) & 0xFC00) == 0xDC00) {
@@ -402,6 +704,15 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len, bool overreadIs
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            // Runs of ASCII map one-to-one.
+            size_t n = utf8_ascii_prefix(u8cur, u8end - u8cur);
+            if (n > 0) {
+                u16measuredLen += n;
+                u8cur += n;
+                continue;
+            }
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         // Malformed utf8, some characters are beyond the end.
@@ -455,6 +766,15 @@ char16_t* utf8_to_utf16_no_null_terminator(
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        if (*u8cur < 0x80) {
+            size_t n = utf8_ascii_to_utf16(
+                    u8cur, std::min<size_t>(u8end - u8cur, u16end - u16cur), u16cur);
+            if (n > 0) {
+                u8cur += n;
+                u16cur += n;
+                continue;
+            }
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
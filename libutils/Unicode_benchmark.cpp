@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Unicode.h>
+#include <string>
+#include <vector>
+
+// Builds a UTF-16 string of |len| units where every |stride|th character is |c|.
+static std::u16string MakeUtf16(size_t len, size_t stride, char16_t c) {
+    std::u16string s;
+    for (size_t i = 0; i < len; i++) {
+        s += (stride != 0 && i % stride == stride - 1) ? c : u'a' + (i % 26);
+    }
+    return s;
+}
+
+static std::string ToUtf8(const std::u16string& s) {
+    std::string out(utf16_to_utf8_length(s.data(), s.size()) + 1, '\0');
+    utf16_to_utf8(s.data(), s.size(), &out[0], out.size());
+    out.pop_back();
+    return out;
+}
+
+static void BM_utf16_to_utf8(benchmark::State& state, size_t stride, char16_t c) {
+    std::u16string src = MakeUtf16(state.range(0), stride, c);
+    std::vector<char> dst(utf16_to_utf8_length(src.data(), src.size()) + 1);
+    while (state.KeepRunning()) {
+        ssize_t len = utf16_to_utf8_length(src.data(), src.size());
+        utf16_to_utf8(src.data(), src.size(), dst.data(), len + 1);
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetBytesProcessed(state.iterations() * src.size() * sizeof(char16_t));
+}
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, ascii, 0, u'a')->Range(16, 64 << 10);
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, latin1, 16, u'é')->Range(16, 64 << 10);
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, cjk, 1, u'中')->Range(16, 64 << 10);
+
+static void BM_utf8_to_utf16(benchmark::State& state, size_t stride, char16_t c) {
+    std::string src = ToUtf8(MakeUtf16(state.range(0), stride, c));
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(src.data());
+    std::vector<char16_t> dst(utf8_to_utf16_length(u8, src.size()) + 1);
+    while (state.KeepRunning()) {
+        ssize_t len = utf8_to_utf16_length(u8, src.size());
+        utf8_to_utf16(u8, src.size(), dst.data(), len + 1);
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetBytesProcessed(state.iterations() * src.size());
+}
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, ascii, 0, u'a')->Range(16, 64 << 10);
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, latin1, 16, u'é')->Range(16, 64 << 10);
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, cjk, 1, u'中')->Range(16, 64 << 10);
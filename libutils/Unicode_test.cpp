@@ -19,6 +19,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <log/log.h>
 #include <utils/Unicode.h>
 
@@ -187,4 +189,70 @@ TEST_F(UnicodeTest, InvalidUtf8OverreadDetected) {
             true /* overreadIsFatal */), "" /* regex for ASSERT_DEATH */);
 }
 
+// The conversions take a faster path over long runs of ASCII (and BMP characters, when
+// measuring UTF-16). Check that a single non-ASCII character is handled the same wherever
+// it falls relative to those runs.
+TEST_F(UnicodeTest, UTF16toUTF8LongRuns) {
+    struct {
+        std::u16string utf16;
+        std::string utf8;
+    } const kInserts[] = {
+        {u"é", "\xc3\xa9"},
+        {u"中", "\xe4\xb8\xad"},
+        {u"\U0001f600", "\xf0\x9f\x98\x80"},
+        {std::u16string(1, 0xd800), ""},  // unpaired surrogates are dropped
+        {std::u16string(1, 0xdc00), ""},
+    };
+    for (const auto& insert : kInserts) {
+        for (size_t pos = 0; pos <= 40; pos++) {
+            std::u16string utf16 = std::u16string(pos, u'a') + insert.utf16 +
+                                   std::u16string(40 - pos, u'b');
+            std::string expected = std::string(pos, 'a') + insert.utf8 +
+                                   std::string(40 - pos, 'b');
+
+            ASSERT_EQ(static_cast<ssize_t>(expected.size()),
+                      utf16_to_utf8_length(utf16.data(), utf16.size())) << pos;
+            std::string utf8(expected.size() + 1, '\xff');
+            utf16_to_utf8(utf16.data(), utf16.size(), &utf8[0], utf8.size());
+            EXPECT_EQ(expected + '\0', utf8) << pos;
+        }
+    }
+
+    // A long run of two- and three-byte characters.
+    std::u16string utf16;
+    for (int i = 0; i < 40; i++) utf16 += (i % 2) ? u"é" : u"中";
+    EXPECT_EQ(100, utf16_to_utf8_length(utf16.data(), utf16.size()));
+}
+
+TEST_F(UnicodeTest, UTF8toUTF16LongRuns) {
+    struct {
+        std::string utf8;
+        std::u16string utf16;
+    } const kInserts[] = {
+        {"\xc3\xa9", u"é"},
+        {"\xe4\xb8\xad", u"中"},
+        {"\xf0\x9f\x98\x80", u"\U0001f600"},
+    };
+    for (const auto& insert : kInserts) {
+        for (size_t pos = 0; pos <= 40; pos++) {
+            std::string utf8 = std::string(pos, 'a') + insert.utf8 + std::string(40 - pos, 'b');
+            std::u16string expected = std::u16string(pos, u'a') + insert.utf16 +
+                                      std::u16string(40 - pos, u'b');
+            const uint8_t* u8 = reinterpret_cast<const uint8_t*>(utf8.data());
+
+            ASSERT_EQ(static_cast<ssize_t>(expected.size()), utf8_to_utf16_length(u8, utf8.size()))
+                    << pos;
+            std::u16string utf16(expected.size() + 1, 0xffff);
+            utf8_to_utf16(u8, utf8.size(), &utf16[0], utf16.size());
+            EXPECT_EQ(expected + u'\0', utf16) << pos;
+
+            // A truncated sequence after the ASCII run is still rejected.
+            std::string truncated = std::string(pos, 'a') + insert.utf8.substr(0, 1);
+            EXPECT_EQ(-1, utf8_to_utf16_length(reinterpret_cast<const uint8_t*>(truncated.data()),
+                                               truncated.size()))
+                    << pos;
+        }
+    }
+}
+
 }
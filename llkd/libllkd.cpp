@@ -15,6 +15,7 @@
  */
 
 #include "llkd.h"
+#include "llkd_proc.h"
 
 #include <ctype.h>
 #include <dirent.h>  // opendir() and readdir()
@@ -53,8 +54,6 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
-#define TASK_COMM_LEN 16  // internal kernel, not uapi, from .../linux/include/linux/sched.h
-
 using namespace std::chrono_literals;
 using namespace std::chrono;
 using namespace std::literals;
@@ -177,6 +176,8 @@ class dir {
 
     operator bool() const { return fd >= 0; }
 
+    int getFd(void) const { return fd; }
+
     void reset(void) {
         if (fd >= 0) {
             ::close(fd);
@@ -213,6 +214,10 @@ class dir {
 
 dirent dir::buff[dir::numLevels][dir::buffEntries];
 
+// Shared by /proc/<tid>/stat and /proc/<tid>/cgroup reads, which are parsed
+// before the next read.
+char llkReadBuffer[4096];
+
 // helper functions
 
 bool llkIsMissingExeLink(pid_t tid) {
@@ -306,12 +311,13 @@ struct proc {
     bool updated;                  // cleared before monitoring pass.
     bool killed;                   // sent a kill to this thread, next panic...
     bool frozen;                   // process is in frozen cgroup.
+    bool frozenValid;              // frozen has been read this pass
+    llkProcFile statFile;          // /proc/<tid>/stat, reread every pass
+    llkProcFile cgroupFile;        // /proc/<tid>/cgroup, read for frozen
 
     void setComm(const char* _comm) { strncpy(comm + 1, _comm, sizeof(comm) - 2); }
 
-    void setFrozen(bool _frozen) { frozen = _frozen; }
-
-    proc(pid_t tid, pid_t pid, pid_t ppid, const char* _comm, int time, char state, bool frozen)
+    proc(pid_t tid, pid_t pid, pid_t ppid, const char* _comm, int time, char state)
         : tid(tid),
           schedUpdate(0),
           nrSwitches(0),
@@ -332,7 +338,8 @@ struct proc {
           cmdlineValid(false),
           updated(true),
           killed(!llkTestWithKill),
-          frozen(frozen) {
+          frozen(false),
+          frozenValid(false) {
         memset(comm, '\0', sizeof(comm));
         setComm(_comm);
     }
@@ -378,7 +385,17 @@ struct proc {
         return uid;
     }
 
-    bool isFrozen() { return frozen; }
+    // Only threads that survive the cheaper filters in llkCheck() get this
+    // far, so the cgroup is not read for the thousands that are not stuck.
+    bool isFrozen() {
+        if (!frozenValid) {
+            frozen = (cgroupFile.read(llkTopDirectory.getFd(), tid, "/cgroup", llkReadBuffer,
+                                      sizeof(llkReadBuffer)) > 0) &&
+                     (strstr(llkReadBuffer, ":freezer:/frozen") != nullptr);
+            frozenValid = true;
+        }
+        return frozen;
+    }
 
     void reset(void) {  // reset cache, if we detected pid rollover
         uid = -1;
@@ -391,6 +408,7 @@ struct proc {
         comm[0] = '\0';
         exeMissingValid = false;
         cmdlineValid = false;
+        frozenValid = false;
     }
 };
 
@@ -599,9 +617,8 @@ void llkTidRemove(pid_t tid) {
     tids.erase(tid);
 }
 
-proc* llkTidAlloc(pid_t tid, pid_t pid, pid_t ppid, const char* comm, int time, char state,
-                  bool frozen) {
-    auto it = tids.emplace(std::make_pair(tid, proc(tid, pid, ppid, comm, time, state, frozen)));
+proc* llkTidAlloc(pid_t tid, pid_t pid, pid_t ppid, const char* comm, int time, char state) {
+    auto it = tids.emplace(std::make_pair(tid, proc(tid, pid, ppid, comm, time, state)));
     return &it.first->second;
 }
 
@@ -777,6 +794,18 @@ bool getValidTidDir(dirent* dp, std::string* piddir) {
     return true;
 }
 
+// Same as getValidTidDir(), without building the path when not needed.
+bool isValidTidDir(dirent* dp) {
+    if (!::isdigit(dp->d_name[0])) {
+        return false;
+    }
+    if (__predict_true(dp->d_type == DT_DIR)) {
+        return true;
+    }
+    std::string piddir;
+    return getValidTidDir(dp, &piddir);
+}
+
 bool llkIsMonitorState(char state) {
     return (state == 'Z') || (state == 'D');
 }
@@ -1016,63 +1045,58 @@ milliseconds llkCheck(bool checkRunning) {
         }
         for (auto tp = taskDirectory.read(dir::task, dp); tp != nullptr;
              tp = taskDirectory.read(dir::task)) {
-            if (!getValidTidDir(tp, &piddir)) {
+            if (!isValidTidDir(tp)) {
                 continue;
             }
-
-            // Get the process stat
-            std::string stat = ReadFile(piddir + "/stat");
-            if (stat.empty()) {
+            pid_t tid;
+            if (!android::base::ParseInt(tp->d_name, &tid)) {
                 continue;
             }
-            unsigned tid = -1;
-            char pdir[TASK_COMM_LEN + 1];
-            char state = '?';
-            unsigned ppid = -1;
-            unsigned utime = -1;
-            unsigned stime = -1;
-            int dummy;
-            pdir[0] = '\0';
-            // tid should not change value
-            auto match = ::sscanf(
-                stat.c_str(),
-                "%u (%" ___STRING(
-                    TASK_COMM_LEN) "[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d",
-                &tid, pdir, &state, &ppid, &utime, &stime, &dummy);
             if (pid == -1) {
                 pid = tid;
             }
-            LOG(VERBOSE) << "match " << match << ' ' << tid << " (" << pdir << ") " << state << ' '
-                         << ppid << " ... " << utime << ' ' << stime << ' ' << dummy;
-            if (match != 7) {
+
+            // Get the process stat, rereading the file descriptor kept open
+            // since the last pass.
+            auto procp = llkTidLookup(tid);
+            llkProcFile newStatFile;
+            auto& statFile = (procp != nullptr) ? procp->statFile : newStatFile;
+            if (statFile.read(llkTopDirectory.getFd(), tid, "/stat", llkReadBuffer,
+                              sizeof(llkReadBuffer)) <= 0) {
+                continue;
+            }
+            llkStat stat = {};
+            auto match = llkParseStat(llkReadBuffer, &stat);
+            LOG(VERBOSE) << "match " << match << ' ' << tid << " (" << stat.comm << ") "
+                         << stat.state << ' ' << stat.ppid << " ... " << stat.utime << ' '
+                         << stat.stime;
+            if (!match) {
                 continue;
             }
+            const char state = stat.state;
+            const pid_t ppid = stat.ppid;
 
-            // Get the process cgroup
-            auto cgroup = ReadFile(piddir + "/cgroup");
-            auto frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
-
-            auto procp = llkTidLookup(tid);
             if (procp == nullptr) {
-                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, frozen);
+                procp = llkTidAlloc(tid, pid, ppid, stat.comm, stat.utime + stat.stime, state);
+                procp->statFile = std::move(newStatFile);
             } else {
                 // comm can change ...
-                procp->setComm(pdir);
-                // frozen can change, too...
-                procp->setFrozen(frozen);
+                procp->setComm(stat.comm);
+                // frozen can change, too, reread if needed.
+                procp->frozenValid = false;
                 procp->updated = true;
                 // pid/ppid/tid wrap?
                 if (((procp->update != prevUpdate) && (procp->update != llkUpdate)) ||
                     (procp->ppid != ppid) || (procp->pid != pid)) {
                     procp->reset();
-                } else if (procp->time != (utime + stime)) {  // secondary ABA.
+                } else if (procp->time != (stat.utime + stat.stime)) {  // secondary ABA.
                     // watching utime+stime granularity jiffy
                     procp->state = '?';
                 }
                 procp->update = llkUpdate;
                 procp->pid = pid;
                 procp->ppid = ppid;
-                procp->time = utime + stime;
+                procp->time = stat.utime + stat.stime;
                 if (procp->state != state) {
                     procp->count = 0ms;
                     procp->killed = !llkTestWithKill;
@@ -1119,7 +1143,7 @@ milliseconds llkCheck(bool checkRunning) {
 
             auto pprocp = llkTidLookup(ppid);
             if (pprocp == nullptr) {
-                pprocp = llkTidAlloc(ppid, ppid, 0, "", 0, '?', false);
+                pprocp = llkTidAlloc(ppid, ppid, 0, "", 0, '?');
             }
             if (pprocp) {
                 if (llkSkipPproc(pprocp, procp)) break;
@@ -1133,6 +1157,7 @@ milliseconds llkCheck(bool checkRunning) {
             }
 
             // ABA mitigation watching last time schedule activity happened
+            piddir = procdir + std::to_string(tid);
             llkCheckSchedUpdate(procp, piddir);
 
 #ifdef __PTRACE_ENABLED__
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include "llkd_proc.h"
+
+// A /proc-like tree of <tid>/stat and <tid>/cgroup files, for the same
+// number of threads as a busy device.
+class SyntheticProc {
+  public:
+    explicit SyntheticProc(int threads) {
+        for (int i = 0; i < threads; ++i) {
+            pid_t tid = 1000 + i;
+            auto dir = std::string(tmp_.path) + "/" + std::to_string(tid);
+            mkdir(dir.c_str(), 0755);
+            auto stat = std::to_string(tid) + " (Binder:" + std::to_string(tid) +
+                        "_2) S 1 1000 0 0 -1 1077952832 1234 0 0 0 " + std::to_string(i) +
+                        " 56 0 0 20 0 24 0 1234 123456789 4321 18446744073709551615 1 1 0 0 "
+                        "0 0 4608 1 1073775864 0 0 0 17 3 0 0 0 0 0 0 0 0 0 0 0 0 0\n";
+            android::base::WriteStringToFile(stat, dir + "/stat");
+            android::base::WriteStringToFile(
+                    "5:freezer:/\n4:memory:/\n3:cpuset:/foreground\n2:cpu:/\n1:blkio:/\n"
+                    "0::/uid_10123/pid_" + std::to_string(tid) + "\n",
+                    dir + "/cgroup");
+            tids_.push_back(tid);
+        }
+        fd_.reset(open(tmp_.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    }
+
+    const char* path() const { return tmp_.path; }
+    int fd() const { return fd_; }
+    const std::vector<pid_t>& tids() const { return tids_; }
+
+  private:
+    TemporaryDir tmp_;
+    android::base::unique_fd fd_;
+    std::vector<pid_t> tids_;
+};
+
+// What llkCheck() used to do for every thread: build paths, read stat and
+// cgroup with ReadFileToString(), and parse with sscanf().
+static void BM_ScanReadFile(benchmark::State& state) {
+    SyntheticProc proc(state.range(0));
+    unsigned frozen = 0;
+    for (auto _ : state) {
+        for (auto tid : proc.tids()) {
+            auto piddir = std::string(proc.path()) + "/" + std::to_string(tid);
+            std::string stat;
+            if (!android::base::ReadFileToString(piddir + "/stat", &stat)) {
+                state.SkipWithError("read failed");
+                return;
+            }
+            unsigned ptid, ppid, utime, stime;
+            char comm[TASK_COMM_LEN + 1];
+            char pstate;
+            int dummy;
+            if (sscanf(stat.c_str(),
+                       "%u (%16[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d", &ptid,
+                       comm, &pstate, &ppid, &utime, &stime, &dummy) != 7) {
+                state.SkipWithError("parse failed");
+                return;
+            }
+            std::string cgroup;
+            android::base::ReadFileToString(piddir + "/cgroup", &cgroup);
+            frozen += cgroup.find(":freezer:/frozen") != std::string::npos;
+        }
+    }
+    benchmark::DoNotOptimize(frozen);
+    state.SetItemsProcessed(state.iterations() * proc.tids().size());
+}
+BENCHMARK(BM_ScanReadFile)->Arg(1000)->Arg(4000)->Unit(benchmark::kMicrosecond);
+
+// What llkCheck() does now: pread() the cached stat file descriptors into a
+// reused buffer and parse them with llkParseStat(), leaving cgroup alone.
+static void BM_ScanCached(benchmark::State& state) {
+    SyntheticProc proc(state.range(0));
+    std::vector<llkProcFile> files(proc.tids().size());
+    char buffer[4096];
+    for (auto _ : state) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (files[i].read(proc.fd(), proc.tids()[i], "/stat", buffer, sizeof(buffer)) <= 0) {
+                state.SkipWithError("read failed");
+                return;
+            }
+            llkStat stat;
+            if (!llkParseStat(buffer, &stat) || (stat.tid != proc.tids()[i])) {
+                state.SkipWithError("parse failed");
+                return;
+            }
+            benchmark::DoNotOptimize(stat);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * proc.tids().size());
+}
+BENCHMARK(BM_ScanCached)->Arg(1000)->Arg(4000)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
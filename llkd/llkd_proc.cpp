@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "llkd_proc.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+// A cached file descriptor per thread adds up, so leave half of RLIMIT_NOFILE
+// for everything else. Past that, nodes are opened again for every read.
+size_t llkMaxCachedFds(void) {
+    static const size_t max = []() -> size_t {
+        rlimit rl;
+        return (getrlimit(RLIMIT_NOFILE, &rl) == 0) ? rl.rlim_cur / 2 : 512;
+    }();
+    return max;
+}
+
+size_t llkCachedFds;
+
+const char* llkSkipField(const char* cp) {
+    while ((*cp != ' ') && (*cp != '\0')) ++cp;
+    while (*cp == ' ') ++cp;
+    return cp;
+}
+
+// Returns nullptr unless cp points at a decimal number.
+const char* llkParseUnsigned(const char* cp, unsigned* val) {
+    if (!isdigit(*cp)) return nullptr;
+    unsigned ret = 0;
+    do {
+        ret = ret * 10 + (*cp++ - '0');
+    } while (isdigit(*cp));
+    *val = ret;
+    return cp;
+}
+
+}  // namespace
+
+bool llkParseStat(const char* content, llkStat* stat) {
+    unsigned val;
+    auto cp = llkParseUnsigned(content, &val);
+    if ((cp == nullptr) || (cp[0] != ' ') || (cp[1] != '(')) return false;
+    stat->tid = val;
+
+    // comm can contain anything, including ") ", so look for the last ')'.
+    auto comm = cp + 2;
+    auto end = strrchr(comm, ')');
+    if ((end == nullptr) || (end[1] != ' ')) return false;
+    size_t len = std::min(static_cast<size_t>(end - comm), sizeof(stat->comm) - 1);
+    memcpy(stat->comm, comm, len);
+    stat->comm[len] = '\0';
+
+    cp = end + 2;
+    if ((cp[0] == '\0') || (cp[1] != ' ')) return false;
+    stat->state = cp[0];
+    cp += 2;
+
+    if ((cp = llkParseUnsigned(cp, &val)) == nullptr) return false;
+    stat->ppid = val;
+
+    // Skip fields 5 (pgrp) through 13 (cmajflt)
+    cp = llkSkipField(cp);
+    for (int field = 5; field <= 13; ++field) {
+        if (*cp == '\0') return false;
+        cp = llkSkipField(cp);
+    }
+
+    if ((cp = llkParseUnsigned(cp, &stat->utime)) == nullptr) return false;
+    if ((cp = llkParseUnsigned(llkSkipField(cp), &stat->stime)) == nullptr) return false;
+    // and field 16 (cutime) must follow, as it did for the sscanf() format.
+    cp = llkSkipField(cp);
+    return (*cp == '-') || isdigit(*cp);
+}
+
+llkProcFile::~llkProcFile() {
+    close();
+}
+
+void llkProcFile::close(void) {
+    if (fd != -1) {
+        fd.reset();
+        --llkCachedFds;
+    }
+}
+
+ssize_t llkProcFile::read(int dirfd, pid_t tid, const char* node, char* buf, size_t size) {
+    if (fd != -1) {
+        auto ret = TEMP_FAILURE_RETRY(::pread(fd, buf, size - 1, 0));
+        if (ret > 0) {
+            buf[ret] = '\0';
+            return ret;
+        }
+        close();
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "%d%s", tid, node);
+    android::base::unique_fd newFd(
+            TEMP_FAILURE_RETRY(::openat(dirfd, path, O_RDONLY | O_CLOEXEC)));
+    if (newFd == -1) return -1;
+    auto ret = TEMP_FAILURE_RETRY(::pread(newFd, buf, size - 1, 0));
+    if (ret < 0) return -1;
+    buf[ret] = '\0';
+    if (llkCachedFds < llkMaxCachedFds()) {
+        fd = std::move(newFd);
+        ++llkCachedFds;
+    }
+    return ret;
+}
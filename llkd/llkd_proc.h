@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LLKD_PROC_H_
+#define _LLKD_PROC_H_
+
+#include <sys/types.h>
+
+#include <utility>
+
+#include <android-base/unique_fd.h>
+
+#define TASK_COMM_LEN 16  // internal kernel, not uapi, from .../linux/include/linux/sched.h
+
+// The /proc/<tid>/stat fields that llkd monitors.
+struct llkStat {
+    pid_t tid;                     // field 1
+    char comm[TASK_COMM_LEN + 1];  // field 2, without the parentheses
+    char state;                    // field 3
+    pid_t ppid;                    // field 4
+    unsigned utime;                // field 14
+    unsigned stime;                // field 15
+};
+
+// Parses the nul terminated content of /proc/<tid>/stat, which unlike
+// sscanf() copes with a ')' in comm. Returns false if it is malformed.
+bool llkParseStat(const char* content, llkStat* stat);
+
+// A /proc/<tid> node that is reread every cycle through a cached file
+// descriptor, saving the path building and open() that ReadFile() costs.
+class llkProcFile {
+  public:
+    llkProcFile() = default;
+    llkProcFile(llkProcFile&& c) = default;
+    ~llkProcFile();
+
+    llkProcFile& operator=(llkProcFile&& c) {
+        close();
+        fd = std::move(c.fd);
+        return *this;
+    }
+
+    // Reads up to size - 1 bytes of <dirfd>/<tid><node> into buf and nul
+    // terminates them. The node is reopened if the cached file descriptor no
+    // longer reads, which is the case once the thread is reaped, so a reused
+    // tid is followed. Returns the number of bytes read, or -1 on error.
+    ssize_t read(int dirfd, pid_t tid, const char* node, char* buf, size_t size);
+
+    void close(void);
+
+  private:
+    android::base::unique_fd fd;
+};
+
+#endif  // _LLKD_PROC_H_
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../llkd_proc.h"
+
+namespace {
+
+// Fields 3 onwards of a /proc/<tid>/stat line, up to and including field 17.
+// utime (field 14) is 140 and stime (field 15) is 150.
+const std::string kTail = " S 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17";
+
+std::string StatLine(const std::string& comm) {
+    return "1234 (" + comm + ")" + kTail;
+}
+
+}  // namespace
+
+TEST(llkd_proc, ParseStat) {
+    llkStat stat;
+    ASSERT_TRUE(llkParseStat(StatLine("init").c_str(), &stat));
+    EXPECT_EQ(1234, stat.tid);
+    EXPECT_STREQ("init", stat.comm);
+    EXPECT_EQ('S', stat.state);
+    EXPECT_EQ(3, stat.ppid);
+    EXPECT_EQ(140u, stat.utime);
+    EXPECT_EQ(150u, stat.stime);
+}
+
+TEST(llkd_proc, ParseStatCommWithParenthesesAndSpaces) {
+    // A comm can be set to anything, including text that looks like the fields after it.
+    for (const std::string comm : {"a) b", "a b c", ") R 99 (", "))", "(x)", " ", ""}) {
+        llkStat stat;
+        ASSERT_TRUE(llkParseStat(StatLine(comm).c_str(), &stat)) << comm;
+        EXPECT_EQ(comm, stat.comm);
+        EXPECT_EQ('S', stat.state) << comm;
+        EXPECT_EQ(3, stat.ppid) << comm;
+        EXPECT_EQ(140u, stat.utime) << comm;
+        EXPECT_EQ(150u, stat.stime) << comm;
+    }
+}
+
+TEST(llkd_proc, ParseStatCommLength) {
+    // The kernel reports at most TASK_COMM_LEN - 1 characters, which always fit.
+    const std::string longest(TASK_COMM_LEN - 1, 'x');
+    llkStat stat;
+    ASSERT_TRUE(llkParseStat(StatLine(longest).c_str(), &stat));
+    EXPECT_EQ(longest, stat.comm);
+
+    // llkStat has room for TASK_COMM_LEN characters,
+    const std::string full(TASK_COMM_LEN, 'y');
+    ASSERT_TRUE(llkParseStat(StatLine(full).c_str(), &stat));
+    EXPECT_EQ(full, stat.comm);
+
+    // and anything longer is truncated to that, without losing the fields after it.
+    ASSERT_TRUE(llkParseStat(StatLine(full + ") z").c_str(), &stat));
+    EXPECT_EQ(full, stat.comm);
+    EXPECT_EQ('S', stat.state);
+    EXPECT_EQ(150u, stat.stime);
+}
+
+TEST(llkd_proc, ParseStatTruncated) {
+    // Every prefix of a line that stops before field 16 (cutime) is rejected, like a read that
+    // came up short.
+    const std::string line = StatLine("a) b");
+    const size_t complete = line.find(" -16") + 2;
+    llkStat stat;
+    for (size_t len = 0; len < complete; ++len) {
+        EXPECT_FALSE(llkParseStat(line.substr(0, len).c_str(), &stat)) << line.substr(0, len);
+    }
+    EXPECT_TRUE(llkParseStat(line.substr(0, complete).c_str(), &stat));
+}
+
+TEST(llkd_proc, ParseStatMalformed) {
+    llkStat stat;
+    for (const char* line : {
+                 // tid isn't a number
+                 "x (a) S 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // comm isn't in parentheses
+                 "1234 a S 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // comm isn't closed
+                 "1234 (a S 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // no space after comm
+                 "1234 (a)S 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // state isn't one character
+                 "1234 (a) SS 3 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // ppid isn't a number
+                 "1234 (a) S x 5 6 7 -1 9 10 11 12 13 140 150 -16 17",
+                 // utime isn't a number
+                 "1234 (a) S 3 5 6 7 -1 9 10 11 12 13 x 150 -16 17",
+                 // stime isn't a number
+                 "1234 (a) S 3 5 6 7 -1 9 10 11 12 13 140 -150 -16 17",
+                 // a field is missing
+                 "1234 (a) S 3 5 6 7 -1 9 10 11 12 140 150 -16 17",
+         }) {
+        EXPECT_FALSE(llkParseStat(line, &stat)) << line;
+    }
+}
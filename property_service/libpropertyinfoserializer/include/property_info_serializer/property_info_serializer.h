@@ -44,5 +44,24 @@ void ParsePropertyInfoFile(const std::string& file_contents, bool require_prefix
                            std::vector<PropertyInfoEntry>* property_infos,
                            std::vector<std::string>* errors);
 
+// A serialized trie only depends on the property_contexts files that it is built from, so it can
+// be built ahead of time.  The cache is keyed on a digest of those inputs, computed by
+// DigestPropertyInfoInputs(), and ReadPropertyInfoCache() only returns a trie whose digest
+// matches and whose contents are intact.  Neither the digest nor the checksum authenticates the
+// cache: whoever can write it controls the property contexts that it returns, so it must only be
+// kept where no one but its writer can modify it, such as a verified partition.
+std::string DigestPropertyInfoInputs(const std::vector<std::string>& inputs);
+
+// The digest of the trie that ParsePropertyInfoFile() and BuildTrie() make from the contents of
+// these property_contexts files, in this order.
+std::string DigestPropertyContexts(const std::vector<std::string>& file_contents,
+                                   bool require_prefix_or_exact);
+
+bool WritePropertyInfoCache(const std::string& path, const std::string& digest,
+                            const std::string& serialized_trie, std::string* error);
+
+bool ReadPropertyInfoCache(const std::string& path, const std::string& digest,
+                           std::string* serialized_trie);
+
 }  // namespace properties
 }  // namespace android
@@ -0,0 +1,141 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "property_info_serializer/property_info_serializer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+
+using android::base::ReadFileToString;
+using android::base::StringPrintf;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
+
+namespace android {
+namespace properties {
+
+namespace {
+
+// The cache file is the magic line, the digest of the inputs and a checksum of the serialized
+// trie, each on a line of their own, followed by the serialized trie itself.
+constexpr char kCacheMagic[] = "property_info cache v1";
+
+uint64_t Fnv1a64(uint64_t hash, const void* data, size_t size) {
+  auto bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::string TrieChecksum(const std::string& serialized_trie) {
+  return StringPrintf("%016" PRIx64,
+                      Fnv1a64(0xcbf29ce484222325ULL, serialized_trie.data(), serialized_trie.size()));
+}
+
+}  // namespace
+
+std::string DigestPropertyInfoInputs(const std::vector<std::string>& inputs) {
+  // Two FNV-1a hashes with different offset bases, so that the digest is 128 bits wide.
+  uint64_t hashes[2] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL};
+  for (auto& hash : hashes) {
+    for (const auto& input : inputs) {
+      // Hash the size too, so that moving data from one input to the next changes the digest.
+      uint64_t size = input.size();
+      hash = Fnv1a64(hash, &size, sizeof(size));
+      hash = Fnv1a64(hash, input.data(), input.size());
+    }
+  }
+  return StringPrintf("%016" PRIx64 "%016" PRIx64, hashes[0], hashes[1]);
+}
+
+std::string DigestPropertyContexts(const std::vector<std::string>& file_contents,
+                                   bool require_prefix_or_exact) {
+  auto inputs = std::vector<std::string>{require_prefix_or_exact ? "1" : "0"};
+  inputs.insert(inputs.end(), file_contents.begin(), file_contents.end());
+  return DigestPropertyInfoInputs(inputs);
+}
+
+bool WritePropertyInfoCache(const std::string& path, const std::string& digest,
+                            const std::string& serialized_trie, std::string* error) {
+  auto contents = std::string(kCacheMagic) + "\n" + digest + "\n" +
+                  TrieChecksum(serialized_trie) + "\n" + serialized_trie;
+
+  auto temp_path = path + ".tmp";
+  unique_fd fd(TEMP_FAILURE_RETRY(
+      open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600)));
+  if (fd == -1) {
+    *error = "Could not open '" + temp_path + "': " + strerror(errno);
+    return false;
+  }
+  if (!WriteStringToFd(contents, fd) || fsync(fd) != 0) {
+    *error = "Could not write '" + temp_path + "': " + strerror(errno);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  fd.reset();
+
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    *error = "Could not rename '" + temp_path + "': " + strerror(errno);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ReadPropertyInfoCache(const std::string& path, const std::string& digest,
+                           std::string* serialized_trie) {
+  std::string contents;
+  if (!ReadFileToString(path, &contents)) {
+    return false;
+  }
+
+  size_t offset = 0;
+  std::string header[3];
+  for (auto& line : header) {
+    auto end = contents.find('\n', offset);
+    if (end == std::string::npos) {
+      return false;
+    }
+    line = contents.substr(offset, end - offset);
+    offset = end + 1;
+  }
+
+  auto& [magic, cached_digest, checksum] = header;
+  if (magic != kCacheMagic || cached_digest != digest) {
+    return false;
+  }
+
+  contents.erase(0, offset);
+  // A corrupt trie would take down every process that reads properties, so verify it as well.
+  if (TrieChecksum(contents) != checksum) {
+    return false;
+  }
+
+  *serialized_trie = std::move(contents);
+  return true;
+}
+
+}  // namespace properties
+}  // namespace android
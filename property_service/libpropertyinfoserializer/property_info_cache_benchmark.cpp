@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "property_info_serializer/property_info_serializer.h"
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+// Compares building the property info trie from the property_contexts files of the device, as
+// init does when the inputs changed, against loading it as prebuilt by property_info_prebuilt.
+// Both include reading the inputs.
+
+namespace android {
+namespace properties {
+
+static const char* const kPropertyContextsFiles[] = {
+    "/system/etc/selinux/plat_property_contexts",
+    "/system_ext/etc/selinux/system_ext_property_contexts",
+    "/vendor/etc/selinux/vendor_property_contexts",
+    "/product/etc/selinux/product_property_contexts",
+    "/odm/etc/selinux/odm_property_contexts",
+};
+
+static std::vector<std::string> ReadPropertyContextsFiles() {
+  std::vector<std::string> contents;
+  for (const auto& file : kPropertyContextsFiles) {
+    std::string file_contents;
+    if (android::base::ReadFileToString(file, &file_contents)) {
+      contents.emplace_back(std::move(file_contents));
+    }
+  }
+  return contents;
+}
+
+static void BM_BuildTrie(benchmark::State& state) {
+  for (auto _ : state) {
+    auto property_infos = std::vector<PropertyInfoEntry>();
+    auto errors = std::vector<std::string>();
+    for (const auto& contents : ReadPropertyContextsFiles()) {
+      ParsePropertyInfoFile(contents, true, &property_infos, &errors);
+    }
+
+    auto serialized_trie = std::string();
+    auto error = std::string();
+    if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized_trie,
+                   &error)) {
+      state.SkipWithError(error.c_str());
+      return;
+    }
+    benchmark::DoNotOptimize(serialized_trie);
+  }
+}
+BENCHMARK(BM_BuildTrie);
+
+static void BM_ReadPropertyInfoCache(benchmark::State& state) {
+  auto contents = ReadPropertyContextsFiles();
+  if (contents.empty()) {
+    state.SkipWithError("No property_contexts files found");
+    return;
+  }
+
+  auto property_infos = std::vector<PropertyInfoEntry>();
+  auto errors = std::vector<std::string>();
+  for (const auto& file_contents : contents) {
+    ParsePropertyInfoFile(file_contents, true, &property_infos, &errors);
+  }
+  auto serialized_trie = std::string();
+  auto error = std::string();
+  if (!BuildTrie(property_infos, "u:object_r:default_prop:s0", "string", &serialized_trie,
+                 &error)) {
+    state.SkipWithError(error.c_str());
+    return;
+  }
+
+  TemporaryDir dir;
+  auto cache_path = std::string(dir.path) + "/property_info";
+  if (!WritePropertyInfoCache(cache_path, DigestPropertyContexts(contents, true), serialized_trie,
+                              &error)) {
+    state.SkipWithError(error.c_str());
+    return;
+  }
+
+  for (auto _ : state) {
+    auto cached_trie = std::string();
+    auto digest = DigestPropertyContexts(ReadPropertyContextsFiles(), true);
+    if (!ReadPropertyInfoCache(cache_path, digest, &cached_trie)) {
+      state.SkipWithError("Cache miss");
+      return;
+    }
+    benchmark::DoNotOptimize(cached_trie);
+  }
+}
+BENCHMARK(BM_ReadPropertyInfoCache);
+
+}  // namespace properties
+}  // namespace android
+
+BENCHMARK_MAIN();
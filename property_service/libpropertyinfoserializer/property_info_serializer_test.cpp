@@ -18,6 +18,8 @@
 
 #include "property_info_parser/property_info_parser.h"
 
+#include <android-base/file.h>
+
 #include <gtest/gtest.h>
 
 namespace android {
@@ -889,5 +891,52 @@ TEST(propertyinfoserializer, GetPropertyInfo_empty_context_and_type) {
   EXPECT_STREQ("5th", type);
 }
 
+TEST(propertyinfoserializer, CacheRoundTrip) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"test.", "1st", "1st", false},
+      {"test.test", "2nd", "2nd", false},
+  };
+
+  auto serialized_trie = std::string();
+  auto error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &error)) << error;
+
+  TemporaryDir dir;
+  auto cache_path = std::string(dir.path) + "/property_info";
+  auto digest = DigestPropertyInfoInputs({"test. 1st\n", "test.test 2nd\n"});
+  ASSERT_TRUE(WritePropertyInfoCache(cache_path, digest, serialized_trie, &error)) << error;
+
+  auto cached_trie = std::string();
+  ASSERT_TRUE(ReadPropertyInfoCache(cache_path, digest, &cached_trie));
+  EXPECT_EQ(serialized_trie, cached_trie);
+
+  // Any change to the inputs, including moving data between them, invalidates the cache.
+  EXPECT_FALSE(ReadPropertyInfoCache(
+      cache_path, DigestPropertyInfoInputs({"test. 1st\ntest.test 2nd\n"}), &cached_trie));
+  EXPECT_FALSE(ReadPropertyInfoCache(
+      cache_path, DigestPropertyInfoInputs({"test. 1st\n", "test.test 3rd\n"}), &cached_trie));
+
+  // So does corruption of the cached trie.
+  auto contents = std::string();
+  ASSERT_TRUE(android::base::ReadFileToString(cache_path, &contents));
+  contents.back() ^= 1;
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, cache_path));
+  EXPECT_FALSE(ReadPropertyInfoCache(cache_path, digest, &cached_trie));
+}
+
+TEST(propertyinfoserializer, DigestPropertyContexts) {
+  auto files = std::vector<std::string>{
+      "test. u:object_r:1st:s0\n",
+      "test.test u:object_r:2nd:s0\n",
+  };
+  auto digest = DigestPropertyContexts(files, true);
+  EXPECT_EQ(digest, DigestPropertyContexts(files, true));
+
+  // The parsing mode changes the trie that the same files make, so it changes the digest too.
+  EXPECT_NE(digest, DigestPropertyContexts(files, false));
+  EXPECT_NE(digest, DigestPropertyContexts({files[1], files[0]}, true));
+  EXPECT_NE(digest, DigestPropertyContexts({files[0]}, true));
+}
+
 }  // namespace properties
 }  // namespace android
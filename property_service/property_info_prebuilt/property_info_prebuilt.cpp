@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Builds the serialized property contexts that init loads from
+// /system/etc/selinux/plat_property_info instead of building them at boot.  The property_contexts
+// files must be given in the order init reads them: plat, system_ext, vendor, product and odm.
+
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <property_info_serializer/property_info_serializer.h>
+
+using android::base::ReadFileToString;
+using android::properties::BuildTrie;
+using android::properties::DigestPropertyContexts;
+using android::properties::ParsePropertyInfoFile;
+using android::properties::PropertyInfoEntry;
+using android::properties::WritePropertyInfoCache;
+
+int main(int argc, char** argv) {
+  // init only requires a prefix or exact match type for vendors from Android R onwards.
+  bool require_prefix_or_exact = false;
+  int first_arg = 1;
+  if (argc > 1 && strcmp(argv[1], "--require_prefix_or_exact") == 0) {
+    require_prefix_or_exact = true;
+    first_arg++;
+  }
+  if (argc - first_arg < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " [--require_prefix_or_exact] OUTPUT PROPERTY_INFO_FILE [PROPERTY_INFO_FILE]..."
+              << std::endl;
+    return -1;
+  }
+
+  auto file_contents = std::vector<std::string>{};
+  auto property_info_entries = std::vector<PropertyInfoEntry>{};
+  for (int i = first_arg + 1; i < argc; ++i) {
+    auto filename = argv[i];
+    auto& contents = file_contents.emplace_back();
+    if (!ReadFileToString(filename, &contents)) {
+      std::cerr << "Could not read properties from '" << filename << "'" << std::endl;
+      return -1;
+    }
+
+    auto errors = std::vector<std::string>{};
+    ParsePropertyInfoFile(contents, require_prefix_or_exact, &property_info_entries, &errors);
+    if (!errors.empty()) {
+      for (const auto& error : errors) {
+        std::cerr << "Could not read line from '" << filename << "': " << error << std::endl;
+      }
+      return -1;
+    }
+  }
+
+  auto serialized_contexts = std::string{};
+  auto error = std::string{};
+  if (!BuildTrie(property_info_entries, "u:object_r:default_prop:s0", "string",
+                 &serialized_contexts, &error)) {
+    std::cerr << "Unable to serialize property contexts: " << error << std::endl;
+    return -1;
+  }
+
+  auto digest = DigestPropertyContexts(file_contents, require_prefix_or_exact);
+  if (!WritePropertyInfoCache(argv[first_arg], digest, serialized_contexts, &error)) {
+    std::cerr << error << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -32,13 +32,19 @@
 
 #define FD_TBL_SIZE 64
 #define MAX_READ_SIZE 4096
+#define MAX_CLOSE_PENDING 16
 
 #define ALTERNATE_DATA_DIR "alternate/"
 
+/*
+ * SS_DIRTY_DATA: only file content was written, which fdatasync() covers.
+ * SS_DIRTY:      the file was truncated or resized, which needs fsync().
+ */
 enum sync_state {
     SS_UNUSED = -1,
     SS_CLEAN =  0,
-    SS_DIRTY =  1,
+    SS_DIRTY_DATA = 1,
+    SS_DIRTY =  2,
 };
 
 static int ssdir_fd = -1;
@@ -48,6 +54,14 @@ static enum sync_state fs_state;
 static enum sync_state dir_state;
 static enum sync_state fd_state[FD_TBL_SIZE];
 
+/*
+ * Dirty files closed by the server are kept open until the next
+ * storage_sync_checkpoint(), which syncs all of them in one go instead of
+ * one fsync() per close.
+ */
+static bool fd_close_pending[FD_TBL_SIZE];
+static uint close_pending_cnt;
+
 static bool alternate_mode;
 
 static struct {
@@ -77,24 +91,27 @@ static uint32_t insert_fd(int open_flags, int fd)
     return handle;
 }
 
-static int lookup_fd(uint32_t handle, bool dirty)
+static int lookup_fd(uint32_t handle, enum sync_state dirty)
 {
-    if (dirty) {
-        if (handle < FD_TBL_SIZE) {
-            fd_state[handle] = SS_DIRTY;
-        } else {
-            fs_state = SS_DIRTY;
+    if (handle < FD_TBL_SIZE) {
+        if (fd_close_pending[handle]) {
+            return -1; /* already closed by the server */
         }
+        if (fd_state[handle] < dirty) {
+            fd_state[handle] = dirty;
+        }
+    } else if (dirty != SS_CLEAN) {
+        fs_state = SS_DIRTY;
     }
     return handle;
 }
 
-static int remove_fd(uint32_t handle)
+static int sync_fd(int fd, enum sync_state state)
 {
-    if (handle < FD_TBL_SIZE) {
-        fd_state[handle] = SS_UNUSED; /* set to uninstalled */
+    if (state == SS_DIRTY_DATA) {
+        return fdatasync(fd);
     }
-    return handle;
+    return fsync(fd);
 }
 
 static enum storage_err translate_errno(int error)
@@ -340,6 +357,8 @@ int storage_file_close(struct storage_msg *msg,
                        const void *r, size_t req_len)
 {
     const struct storage_file_close_req *req = r;
+    enum sync_state state = SS_DIRTY;
+    int rc;
 
     if (req_len != sizeof(*req)) {
         ALOGE("%s: invalid request length (%zd != %zd)\n",
@@ -348,16 +367,36 @@ int storage_file_close(struct storage_msg *msg,
         goto err_response;
     }
 
-    int fd = remove_fd(req->handle);
+    int fd = req->handle;
     ALOGV("%s: handle = %u: fd = %u\n", __func__, req->handle, fd);
 
-    int rc = fsync(fd);
-    if (rc < 0) {
-        rc = errno;
-        ALOGE("%s: fsync failed for fd=%u: %s\n",
-              __func__, fd, strerror(errno));
-        msg->result = translate_errno(rc);
-        goto err_response;
+    if (req->handle < FD_TBL_SIZE) {
+        if (fd_close_pending[fd]) {
+            ALOGE("%s: handle %u is already closed\n", __func__, req->handle);
+            msg->result = translate_errno(EBADF);
+            goto err_response;
+        }
+
+        state = fd_state[fd];
+        if (state > SS_CLEAN && close_pending_cnt < MAX_CLOSE_PENDING) {
+            /* leave the sync and close to the next checkpoint */
+            fd_close_pending[fd] = true;
+            close_pending_cnt++;
+            msg->result = STORAGE_NO_ERROR;
+            goto err_response;
+        }
+        fd_state[fd] = SS_UNUSED; /* set to uninstalled */
+    }
+
+    if (state > SS_CLEAN) {
+        rc = sync_fd(fd, state);
+        if (rc < 0) {
+            rc = errno;
+            ALOGE("%s: fsync failed for fd=%u: %s\n",
+                  __func__, fd, strerror(errno));
+            msg->result = translate_errno(rc);
+            goto err_response;
+        }
     }
 
     rc = close(fd);
@@ -389,7 +428,7 @@ int storage_file_write(struct storage_msg *msg,
         goto err_response;
     }
 
-    int fd = lookup_fd(req->handle, true);
+    int fd = lookup_fd(req->handle, SS_DIRTY_DATA);
     if (write_with_retry(fd, &req->data[0], req_len - sizeof(*req),
                          req->offset) < 0) {
         rc = errno;
@@ -426,7 +465,7 @@ int storage_file_read(struct storage_msg *msg,
         goto err_response;
     }
 
-    int fd = lookup_fd(req->handle, false);
+    int fd = lookup_fd(req->handle, SS_CLEAN);
     ssize_t read_res = read_with_retry(fd, read_rsp.hdr.data, req->size,
                                        (off_t)req->offset);
     if (read_res < 0) {
@@ -459,7 +498,7 @@ int storage_file_get_size(struct storage_msg *msg,
     }
 
     struct stat stat;
-    int fd = lookup_fd(req->handle, false);
+    int fd = lookup_fd(req->handle, SS_CLEAN);
     int rc = fstat(fd, &stat);
     if (rc < 0) {
         rc = errno;
@@ -490,7 +529,7 @@ int storage_file_set_size(struct storage_msg *msg,
         goto err_response;
     }
 
-    int fd = lookup_fd(req->handle, true);
+    int fd = lookup_fd(req->handle, SS_DIRTY);
     int rc = TEMP_FAILURE_RETRY(ftruncate(fd, req->size));
     if (rc < 0) {
         rc = errno;
@@ -515,7 +554,9 @@ int storage_init(const char *dirname)
     dir_state = SS_CLEAN;
     for (uint i = 0; i < FD_TBL_SIZE; i++) {
         fd_state[i] = SS_UNUSED;  /* uninstalled */
+        fd_close_pending[i] = false;
     }
+    close_pending_cnt = 0;
 
     ssdir_fd = open(dirname, O_RDONLY);
     if (ssdir_fd < 0) {
@@ -530,12 +571,24 @@ int storage_sync_checkpoint(void)
 {
     int rc;
 
+    /*
+     * Start writeback for every dirty fd before waiting on any of them, so
+     * the filesystem can commit them together rather than one at a time.
+     */
+    if (fs_state == SS_CLEAN) {
+        for (uint fd = 0; fd < FD_TBL_SIZE; fd++) {
+            if (fd_state[fd] > SS_CLEAN) {
+                sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            }
+        }
+    }
+
     /* sync fd table and reset it to clean state first */
     for (uint fd = 0; fd < FD_TBL_SIZE; fd++) {
-         if (fd_state[fd] == SS_DIRTY) {
+         if (fd_state[fd] > SS_CLEAN) {
              if (fs_state == SS_CLEAN) {
                  /* need to sync individual fd */
-                 rc = fsync(fd);
+                 rc = sync_fd(fd, fd_state[fd]);
                  if (rc < 0) {
                      ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
                      return rc;
@@ -567,6 +620,18 @@ int storage_sync_checkpoint(void)
         fs_state = SS_CLEAN;
     }
 
+    /* everything is on disk now, so finish the closes left to us */
+    for (uint fd = 0; fd < FD_TBL_SIZE && close_pending_cnt; fd++) {
+        if (fd_close_pending[fd]) {
+            if (close(fd) < 0) {
+                ALOGE("close for fd=%d failed: %s\n", fd, strerror(errno));
+            }
+            fd_close_pending[fd] = false;
+            fd_state[fd] = SS_UNUSED;
+            close_pending_cnt--;
+        }
+    }
+
     return 0;
 }
 
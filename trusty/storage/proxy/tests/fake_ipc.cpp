@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fake_ipc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+extern "C" {
+#include "../ipc.h"
+#include "../storage.h"
+}
+
+static FakeStorageChannel* channel;
+
+FakeStorageChannel::FakeStorageChannel() {
+    assert(channel == nullptr);
+    channel = this;
+}
+
+FakeStorageChannel::~FakeStorageChannel() {
+    channel = nullptr;
+}
+
+void FakeStorageChannel::Respond(const struct storage_msg* msg, const void* out, size_t out_size) {
+    assert(!responded_);
+    responded_ = true;
+    cmd_ = msg->cmd;
+    result_ = msg->result;
+    const uint8_t* data = static_cast<const uint8_t*>(out);
+    response_.assign(data, data + (out ? out_size : 0));
+}
+
+int32_t FakeStorageChannel::Send(uint32_t cmd, uint32_t flags, const void* req, size_t req_len) {
+    struct storage_msg msg = {
+            .cmd = cmd,
+            .flags = flags,
+            .size = static_cast<uint32_t>(sizeof(msg) + req_len),
+    };
+    responded_ = false;
+    response_.clear();
+
+    /* the same pre-commit handling and dispatch as handle_req() in proxy.c */
+    if ((flags & STORAGE_MSG_FLAG_PRE_COMMIT) && storage_sync_checkpoint() < 0) {
+        return STORAGE_ERR_GENERIC;
+    }
+
+    int rc;
+    switch (cmd) {
+        case STORAGE_FILE_DELETE:
+            rc = storage_file_delete(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_OPEN:
+            rc = storage_file_open(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_CLOSE:
+            rc = storage_file_close(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_WRITE:
+            rc = storage_file_write(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_READ:
+            rc = storage_file_read(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_GET_SIZE:
+            rc = storage_file_get_size(&msg, req, req_len);
+            break;
+        case STORAGE_FILE_SET_SIZE:
+            rc = storage_file_set_size(&msg, req, req_len);
+            break;
+        default:
+            return STORAGE_ERR_UNIMPLEMENTED;
+    }
+    if (rc < 0 || !responded_ || cmd_ != (cmd | STORAGE_RESP_BIT)) {
+        return STORAGE_ERR_GENERIC;
+    }
+    return result_;
+}
+
+int32_t FakeStorageChannel::Open(const std::string& name, uint32_t open_flags,
+                                 uint32_t* handle) {
+    /* the proxy zero terminates requests, so the name is sent without one */
+    std::vector<uint8_t> buf(sizeof(storage_file_open_req) + name.size() + 1);
+    auto req = reinterpret_cast<storage_file_open_req*>(buf.data());
+    req->flags = open_flags;
+    memcpy(req->name, name.c_str(), name.size() + 1);
+
+    int32_t result = Send(STORAGE_FILE_OPEN, 0, req, buf.size() - 1);
+    if (result == STORAGE_NO_ERROR) {
+        *handle = reinterpret_cast<const storage_file_open_resp*>(response_.data())->handle;
+    }
+    return result;
+}
+
+int32_t FakeStorageChannel::Close(uint32_t handle) {
+    struct storage_file_close_req req = {.handle = handle};
+    return Send(STORAGE_FILE_CLOSE, 0, &req, sizeof(req));
+}
+
+int32_t FakeStorageChannel::Write(uint32_t handle, uint64_t offset, const void* data, size_t size,
+                                  uint32_t flags) {
+    std::vector<uint8_t> buf(sizeof(storage_file_write_req) + size);
+    auto req = reinterpret_cast<storage_file_write_req*>(buf.data());
+    req->offset = offset;
+    req->handle = handle;
+    memcpy(req->data, data, size);
+    return Send(STORAGE_FILE_WRITE, flags, req, buf.size());
+}
+
+int32_t FakeStorageChannel::Read(uint32_t handle, uint64_t offset, uint32_t size,
+                                 std::string* data) {
+    struct storage_file_read_req req = {.handle = handle, .size = size, .offset = offset};
+    int32_t result = Send(STORAGE_FILE_READ, 0, &req, sizeof(req));
+    if (result == STORAGE_NO_ERROR) {
+        data->assign(response_.begin(), response_.end());
+    }
+    return result;
+}
+
+int32_t FakeStorageChannel::SetSize(uint32_t handle, uint64_t size) {
+    struct storage_file_set_size_req req = {.size = size, .handle = handle};
+    return Send(STORAGE_FILE_SET_SIZE, 0, &req, sizeof(req));
+}
+
+int ipc_connect(const char*, const char*) {
+    return 0;
+}
+
+void ipc_disconnect(void) {}
+
+ssize_t ipc_get_msg(struct storage_msg*, void*, size_t) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+int ipc_respond(struct storage_msg* msg, void* out, size_t out_size) {
+    assert(channel != nullptr);
+    msg->cmd |= STORAGE_RESP_BIT;
+    channel->Respond(msg, out, out_size);
+    return 0;
+}
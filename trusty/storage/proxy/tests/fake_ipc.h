@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <trusty/interface/storage.h>
+
+/*
+ * A stand-in for the TIPC channel to the secure storage server, so the file
+ * side of storageproxyd can be driven without Trusty. Requests go straight to
+ * the storage.c handlers, as proxy.c would dispatch them, and their responses
+ * are captured instead of being written to the channel.
+ */
+class FakeStorageChannel {
+  public:
+    FakeStorageChannel();
+    ~FakeStorageChannel();
+
+    /* Sends one request and returns the result of its response. */
+    int32_t Send(uint32_t cmd, uint32_t flags, const void* req, size_t req_len);
+
+    /* Payload of the last response. */
+    const std::vector<uint8_t>& response() const { return response_; }
+
+    int32_t Open(const std::string& name, uint32_t open_flags, uint32_t* handle);
+    int32_t Close(uint32_t handle);
+    int32_t Write(uint32_t handle, uint64_t offset, const void* data, size_t size,
+                  uint32_t flags = 0);
+    int32_t Read(uint32_t handle, uint64_t offset, uint32_t size, std::string* data);
+    int32_t SetSize(uint32_t handle, uint64_t size);
+
+    /* Called by the fake ipc_respond(). */
+    void Respond(const struct storage_msg* msg, const void* out, size_t out_size);
+
+  private:
+    uint32_t cmd_ = 0;
+    int32_t result_ = -1;
+    bool responded_ = false;
+    std::vector<uint8_t> response_;
+};
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+#include "fake_ipc.h"
+
+extern "C" {
+#include "../storage.h"
+}
+
+/*
+ * A transaction as the secure storage server issues it: blocks written to a
+ * number of files, the files closed, then a commit. Measures how many of
+ * them storageproxyd gets through against the data partition.
+ */
+static void BM_Transaction(benchmark::State& state) {
+    TemporaryDir dir;
+    storage_init(dir.path);
+    FakeStorageChannel channel;
+
+    const int files = state.range(0);
+    std::vector<uint8_t> block(state.range(1), 0xa5);
+    std::vector<uint32_t> handles(files);
+    for (auto _ : state) {
+        for (int i = 0; i < files; i++) {
+            channel.Open("file" + std::to_string(i), STORAGE_FILE_OPEN_CREATE, &handles[i]);
+            channel.Write(handles[i], 0, block.data(), block.size());
+        }
+        for (auto handle : handles) {
+            channel.Close(handle);
+        }
+        if (storage_sync_checkpoint() < 0) {
+            state.SkipWithError("commit failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * files * block.size());
+}
+BENCHMARK(BM_Transaction)->Args({1, 4096})->Args({4, 4096})->Args({8, 4096})->UseRealTime();
+
+BENCHMARK_MAIN();
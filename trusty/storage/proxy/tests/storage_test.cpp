@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "fake_ipc.h"
+
+extern "C" {
+#include "../storage.h"
+}
+
+static bool IsOpen(uint32_t handle) {
+    return fcntl(handle, F_GETFD) != -1;
+}
+
+class StorageProxyTest : public ::testing::Test {
+  protected:
+    void SetUp() override { ASSERT_EQ(0, storage_init(dir_.path)); }
+
+    void TearDown() override { EXPECT_EQ(0, storage_sync_checkpoint()); }
+
+    uint32_t CreateFile(const std::string& name) {
+        uint32_t handle = 0;
+        EXPECT_EQ(STORAGE_NO_ERROR, channel_.Open(name, STORAGE_FILE_OPEN_CREATE, &handle));
+        return handle;
+    }
+
+    TemporaryDir dir_;
+    FakeStorageChannel channel_;
+};
+
+TEST_F(StorageProxyTest, WriteRead) {
+    uint32_t handle = CreateFile("file");
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(handle, 0, "hello", 5));
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(handle, 5, " world", 6));
+
+    std::string data;
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Read(handle, 0, 64, &data));
+    EXPECT_EQ("hello world", data);
+    EXPECT_EQ(STORAGE_NO_ERROR, channel_.Close(handle));
+}
+
+TEST_F(StorageProxyTest, DirtyCloseIsDeferredToCommit) {
+    uint32_t handle = CreateFile("file");
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(handle, 0, "data", 4));
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Close(handle));
+    EXPECT_TRUE(IsOpen(handle));
+
+    /* the handle is closed as far as the server is concerned */
+    EXPECT_EQ(STORAGE_ERR_NOT_VALID, channel_.Write(handle, 0, "more", 4));
+    EXPECT_EQ(STORAGE_ERR_NOT_VALID, channel_.Close(handle));
+
+    ASSERT_EQ(0, storage_sync_checkpoint());
+    EXPECT_FALSE(IsOpen(handle));
+
+    std::string content;
+    ASSERT_TRUE(android::base::ReadFileToString(std::string(dir_.path) + "/file", &content));
+    EXPECT_EQ("data", content);
+}
+
+TEST_F(StorageProxyTest, CleanCloseIsImmediate) {
+    uint32_t handle = CreateFile("file");
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(handle, 0, "data", 4));
+    ASSERT_EQ(0, storage_sync_checkpoint());
+
+    std::string data;
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Read(handle, 0, 4, &data));
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Close(handle));
+    EXPECT_FALSE(IsOpen(handle));
+}
+
+TEST_F(StorageProxyTest, PreCommitFlagFinishesPendingCloses) {
+    uint32_t first = CreateFile("first");
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.SetSize(first, 128));
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Close(first));
+    EXPECT_TRUE(IsOpen(first));
+
+    uint32_t second = CreateFile("second");
+    ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(second, 0, "data", 4, STORAGE_MSG_FLAG_PRE_COMMIT));
+    EXPECT_FALSE(IsOpen(first));
+    EXPECT_EQ(STORAGE_NO_ERROR, channel_.Close(second));
+}
+
+TEST_F(StorageProxyTest, PendingClosesAreBounded) {
+    std::vector<uint32_t> handles;
+    for (int i = 0; i < 32; i++) {
+        uint32_t handle = CreateFile("file" + std::to_string(i));
+        ASSERT_EQ(STORAGE_NO_ERROR, channel_.Write(handle, 0, "data", 4));
+        handles.push_back(handle);
+    }
+    for (auto handle : handles) {
+        ASSERT_EQ(STORAGE_NO_ERROR, channel_.Close(handle));
+    }
+
+    size_t still_open = 0;
+    for (auto handle : handles) {
+        still_open += IsOpen(handle);
+    }
+    EXPECT_GT(still_open, 0u);
+    EXPECT_LT(still_open, handles.size());
+
+    ASSERT_EQ(0, storage_sync_checkpoint());
+    for (auto handle : handles) {
+        EXPECT_FALSE(IsOpen(handle));
+    }
+}